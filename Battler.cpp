@@ -4,6 +4,9 @@
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <ctime>
+#include <filesystem>
+#include <stdexcept>
 
 #include "Parser.h"
 #include "expression.h"
@@ -13,10 +16,32 @@
 
 using namespace Battler;
 
-std::string GetErrorString(std::string errorTypeString, std::string reason, Token t, vector<string> lines) {
+// the text of line l of source, counted from 1
+static std::string_view GetLine(std::string_view source, int l) {
+    size_t start = 0;
+    for (int i = 1; i < l && start != std::string_view::npos; i++) {
+        start = source.find('\n', start);
+        if (start != std::string_view::npos) {
+            start++;
+        }
+    }
+    if (start == std::string_view::npos || start > source.size()) {
+        return std::string_view();
+    }
+    return source.substr(start, source.find('\n', start) - start);
+}
+
+std::string GetErrorString(std::string errorTypeString, std::string reason, Token t, std::string_view source) {
     std::stringstream ss;
+    if (t.l < 1) {
+        // not caused by any one token
+        ss << "Error: " << errorTypeString << std::endl;
+        ss << "Reason: " << reason << std::endl;
+        return ss.str();
+    }
+
     ss << "Error: " << errorTypeString << " on line " << t.l << std::endl;
-    ss << lines[t.l-1] << std::endl;
+    ss << GetLine(source, t.l) << std::endl;
     for(int i=0; i<t.c; i++) {
 
         ss << "_";
@@ -27,37 +52,84 @@ std::string GetErrorString(std::string errorTypeString, std::string reason, Toke
     return ss.str();
 }
 
-int main(int argc, char* argv[]) {
-
-    srand(time(NULL));
+static bool IsBytecodeFile(const std::string& path) {
+    const std::string extension = ".bbc";
+    return path.size() >= extension.size() && path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+}
 
-    if (argc < 2) {
+int main(int argc, char* argv[]) {
 
-        std::cout<< "Please call like this: \"battler.exe path/to/main/game/file.battler\"" << std::endl;
-        return 1;
+    const char* path = nullptr;
+    const char* bytecodePath = nullptr;
+    const char* cachePath = nullptr;
+    uint64_t seed = (uint64_t) time(NULL);
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--seed" && i + 1 < argc) {
+            try {
+                seed = std::stoull(argv[++i]);
+            } catch (std::logic_error&) {
+                std::cout << "--seed needs a number, not " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--compile" && i + 1 < argc) {
+            bytecodePath = argv[++i];
+        }
+        else if (arg == "--cache" && i + 1 < argc) {
+            cachePath = argv[++i];
+        }
+        else {
+            path = argv[i];
+        }
     }
 
-    std::ifstream is;
-    is.open(argv[1]);
-
-    if (!is.is_open()) {
+    if (path == nullptr) {
 
-        std::cout << "Could not find file " << argv[1] << std::endl;
+        std::cout<< "Please call like this: \"battler.exe [--seed N] path/to/main/game/file.battler\"" << std::endl;
+        std::cout<< "or to run compiled bytecode: \"battler.exe [--seed N] path/to/game.bbc\"" << std::endl;
+        std::cout<< "or to compile a game to bytecode: \"battler.exe --compile path/to/game.bbc path/to/main/game/file.battler\"" << std::endl;
+        std::cout<< "included modules are cached in .battler_cache next to the main game file, or in --cache path/to/dir" << std::endl;
         return 1;
     }
 
-    std::vector<std::string> lines;
+    bool bytecode = IsBytecodeFile(path);
 
-    std::string line;
-    while (std::getline(is, line))
-    {
-        lines.push_back(line);
+    if (!bytecode && !std::ifstream(path).is_open()) {
+        std::cout << "Could not find file " << path << std::endl;
+        return 1;
     }
 
     Program program;
     try {
-        std::cout << "Compiling game file" << std::endl;
-        program.Compile(lines);
+        if (bytecode) {
+            std::cout << "Loading bytecode" << std::endl;
+            program.Load(path);
+        }
+        else {
+            std::cout << "Compiling game file" << std::endl;
+            if (cachePath != nullptr) {
+                program.SetModuleCache(cachePath);
+            }
+            else {
+                program.SetModuleCache((std::filesystem::path(path).parent_path() / ".battler_cache").string());
+            }
+            program.CompileFile(path);
+        }
+
+        if (bytecodePath != nullptr) {
+            // the image holds the loaded game, so running it skips loading too. Anything random
+            // drawn while loading is drawn now, from the seed the game is compiled with
+            program.Seed(seed);
+            program.Run(true);
+            program.Save(bytecodePath);
+            std::cout << "Saved bytecode to " << bytecodePath << std::endl;
+            return 0;
+        }
+
+        program.Seed(seed);
+        std::cout << "Random seed " << seed << std::endl;
 
         std::cout << "Loading Compiled Game" << std::endl;
         program.Run(true);
@@ -76,8 +148,11 @@ int main(int argc, char* argv[]) {
     } catch (VMError e) {
         std::cout << "VM Error" << e.reason << endl;
         return 1;
+    } catch (BytecodeError e) {
+        std::cout << "Bytecode Error: " << e.reason << endl;
+        return 1;
     } catch (UnexpectedTokenException e) {
-        std::cout << GetErrorString("unexpected token", e.reason, e.t, lines) << endl;
+        std::cout << GetErrorString("unexpected token", e.reason, e.t, program.Source()) << endl;
         return 1;
     } catch (NameRedeclaredException e) {
         std::cout << "Error: redeclaration of name: " << e.name << std::endl;
@@ -90,7 +165,7 @@ int main(int argc, char* argv[]) {
         return 1;
     }
     catch (CompileError e) {
-        std::cout << GetErrorString("compiler error", e.reason, e.t, lines) << endl;
+        std::cout << GetErrorString("compiler error", e.reason, e.t, program.Source()) << endl;
     }
 
     return 0;
@@ -5,9 +5,15 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <bitset>
 #include <unordered_map>
 #include <tuple>
+#include <array>
+#include <cstdint>
+#include <cassert>
+#include <memory>
+#include <type_traits>
 
 #include "vm/game.h"
 
@@ -23,6 +29,15 @@ const int RUN_ERROR = -1;
 const int RUN_FINISHED = 0;
 const int RUN_WAITING_FOR_INTERACTION_RETURN = 1;
 
+// the slot of a name that is looked up in the locale stack at runtime
+const int NO_SLOT = -1;
+
+// the card ID of a name that doesn't name a card
+const int NO_CARD = -1;
+
+// the most values an expression may hold on the VM's value stack at once
+const int VALUE_STACK_SIZE = 64;
+
 enum class StackTransferType
 {
     MOVE,
@@ -60,6 +75,8 @@ enum class OpcodeType
     COMPARE,
     COMPARE_GREATERTHAN,
     COMPARE_LESSTHAN,
+    // closes a postfix expression
+    EXPRESSION_END,
     
     // Stack operations
     STACK_SOURCE_RANDOM_CARD_TYPE,
@@ -88,7 +105,6 @@ enum class OpcodeType
     STACK_FROM_CONSTRAINT,
     STACK_FROM_NO_CONSTRAINT,
 
-    DYNAMIC_IDENTIFIER_RESOLUTION_START,
     DYNAMIC_IDENTIFIER_RESOLTION_NAMES,
     DYNAMIC_IDENTIFIER_RESOLUTION_END,
 
@@ -134,8 +150,13 @@ enum class OpcodeType
     
     // just in case we need it
     NO_OP,
+
+    // not an opcode, the number of opcode types
+    OPCODE_TYPE_COUNT,
 };
 
+const size_t OPCODE_TYPE_COUNT = (size_t) OpcodeType::OPCODE_TYPE_COUNT;
+
 enum class PROC_MODE
 {
     GAME,
@@ -152,6 +173,7 @@ enum class PROC_MODE
 #define OPCODE_CONV_T uint64_t
 
 #define TYPE_CODE_T_MASK uint16_t(0xFF)
+#define DATA_IX_T_MASK (OPCODE_CONV_T(0xFFFFFFFF) << 32)
 
 // data type codes
 const TYPE_CODE_T STRING_TC = 0x01;
@@ -183,13 +205,114 @@ typedef void(stack_move_callback_fun)(
 class Opcode
 {
     public:
-        Opcode() : data(0), blk_size(0) {};
-        Opcode(OpcodeType t) : type(t) {};
+        Opcode() : type(OpcodeType::NO_OP), jump_index(-1), end_index(-1), slot(NO_SLOT), data(0) {};
+        Opcode(OpcodeType t) : type(t), jump_index(-1), end_index(-1), slot(NO_SLOT), data(0) {};
         OpcodeType type;
-        int blk_size;
+        // block headers: the next elseif / else header of the same if, or the end of the block
+        // block ends: the header of the block
+        // do: the header of the phase
+        int jump_index;
+        union
+        {
+            // block headers: the end of the block, for an elseif / else the end of the whole if
+            int end_index;
+            // names: the ID of the card the first name of a reference names, or NO_CARD
+            int card;
+        };
+        // names: the global slot the first name of a reference is bound to
+        // card block headers: the ID of the card they declare
+        int slot;
         uint64_t data;
 };
 
+// what resolve_names bound the first name of a reference to
+struct NameBinding
+{
+    int slot{NO_SLOT};
+    int card{NO_CARD};
+};
+
+// bytecode images hold opcodes exactly as they are in memory
+static_assert(std::is_trivially_copyable<Opcode>::value && sizeof(Opcode) == 24, "Opcode is stored in bytecode images as is");
+
+// A program's opcodes. The compiler appends to its own copy of them, a loaded program reads them
+// in place from its bytecode image, which every copy of the program shares.
+class Bytecode
+{
+public:
+    Bytecode() {}
+    Bytecode(const Bytecode& other) {*this = other;}
+    Bytecode(Bytecode&& other) noexcept {*this = std::move(other);}
+
+    Bytecode& operator=(const Bytecode& other)
+    {
+        m_owned = other.m_owned;
+        m_image = other.m_image;
+        m_code = m_image ? other.m_code : m_owned.data();
+        m_size = other.m_size;
+        return *this;
+    }
+
+    Bytecode& operator=(Bytecode&& other) noexcept
+    {
+        m_owned = std::move(other.m_owned);
+        m_image = std::move(other.m_image);
+        m_code = m_image ? other.m_code : m_owned.data();
+        m_size = other.m_size;
+        return *this;
+    }
+
+    const Opcode& operator[](size_t i) const {return m_code[i];}
+    size_t size() const {return m_size;}
+    const Opcode* begin() const {return m_code;}
+    const Opcode* end() const {return m_code + m_size;}
+
+    void push_back(const Opcode& code)
+    {
+        assert(!m_image);
+        m_owned.push_back(code);
+        m_code = m_owned.data();
+        m_size = m_owned.size();
+    }
+
+    void append(const Opcode* first, const Opcode* last)
+    {
+        assert(!m_image);
+        m_owned.insert(m_owned.end(), first, last);
+        m_code = m_owned.data();
+        m_size = m_owned.size();
+    }
+
+    void reserve(size_t size)
+    {
+        assert(!m_image);
+        m_owned.reserve(size);
+        m_code = m_owned.data();
+    }
+
+    // for the compiler's passes over the opcodes it has emitted
+    Opcode& Edit(size_t i)
+    {
+        assert(!m_image);
+        return m_owned[i];
+    }
+
+    // reads size opcodes at code, which image keeps alive
+    void Adopt(std::shared_ptr<const void> image, const Opcode* code, size_t size)
+    {
+        m_owned.clear();
+        m_image = std::move(image);
+        m_code = code;
+        m_size = size;
+    }
+
+private:
+    vector<Opcode> m_owned;
+    std::shared_ptr<const void> m_image;
+    const Opcode* m_code{nullptr};
+    size_t m_size{0};
+};
+
 enum class InputOperationType {
     MOVE,
     CUT,
@@ -202,21 +325,22 @@ enum class InputOperationType {
 class StackTransferStateTracker
 {
 public:
-    StackTransferType transferType;
+    StackTransferType transferType{StackTransferType::MOVE};
     bool randomSource{false};
     bool specificCardGeneration{false};
-    std::string specificCardName;
+    int specificCardID{-1};
 
-    std::string randomSourceParentCard;
+    int randomSourceClassID{-1};
     int srcStackID{0};
     int dstStackID{0};
     int nExpected{0};
-    bool dstTop;
-    bool srcTop;
-    InputOperationType type;
+    bool dstTop{false};
+    bool srcTop{false};
+    InputOperationType type{InputOperationType::MOVE};
     bool fixedDest{true};
     bool fixedSrc{true};
-    std::vector<Card> cardsToMove;
+    std::vector<CardInstance> cardsToMove;
+    bool takenFromEnd{false}; // cardsToMove are the top or bottom of the source stack, not chosen
     std::vector<int> sourceStackSelectionPool;
     std::vector<int> destinationStackSelectionPool;
     bool complete{false};
@@ -228,8 +352,22 @@ class Program
 public:
     Program() : m_depth(0), m_current_opcode_index(0), m_stack_move_callback(nullptr) {};
     void _Parse(vector<string>);
-    void CompileExpression(Expression);
+    void CompileExpression(const Expression&);
     void Compile(vector<string>);
+    // compiles a whole game held in one buffer. Tokens point into it, so the program keeps it
+    void CompileSource(string source);
+    // compiles the game file at path, mapped rather than read into lines
+    void CompileFile(const string& path);
+    std::string_view Source() const {return m_source;}
+    // recompiles the setup, turn, phase and card blocks that differ from this program's and patches
+    // them in, without touching the running game. The rest of the game block can't change. Cards
+    // that changed, and the cards that inherit from them, are redeclared if the game is loaded.
+    // Only call it between turns
+    void Reload(vector<string> lines);
+    // the number of threads that compile a game block's expressions, 0 for one per core
+    void SetCompileThreads(unsigned threads) {m_compile_threads = threads;}
+    // where included modules are cached once they're compiled, nowhere if it's empty
+    void SetModuleCache(const string& dir) {m_module_cache = dir;}
     int Run(bool load = false);
     int RunSetup();
     int RunTurn(bool resume=false);
@@ -238,70 +376,175 @@ public:
     StackTransferStateTracker m_stackTransferStateTracker;
 
     void SetStackMoveCallbackFun(stack_move_callback_fun* fun, void* data);
-    bool AddCardToWaitingInput(Card c);
+    bool AddCardToWaitingInput(CardInstance c);
 
     vector<Opcode> opcodes();
+
+    // writes the compiled program to a versioned bytecode image, see vm/Bytecode.cpp. Once the
+    // program has been loaded with Run(true), the image holds the loaded game too
+    void Save(const string& path) const;
+    // replaces this program with the one in a bytecode image. The image is mapped and its opcodes
+    // are run in place. If it holds a loaded game, Run(true) has nothing left to do
+    void Load(const string& path);
+    bool Loaded() const {return m_loaded;}
+
     Game& game();
+    // reseeds the game's random generator, so runs with the same seed play out the same
+    void Seed(uint64_t seed) {m_game.random.Seed(seed);}
+    uint64_t executed_opcodes() const {return m_executed_opcodes;}
+    size_t constant_pool_size() const {return m_game.symbols.size() + m_ints.size() + m_bools.size();}
     inline vector<Token> _Tokens() {return m_tokens;}
     inline Expression _GetRootExpression() {return m_rootExpression;}
 
 
 private:
     //compiled data
-    vector<Opcode> m_opcodes;
+    Bytecode m_opcodes;
+    std::shared_ptr<const void> m_source_buffer; // keeps m_source alive for the tokens
+    std::string_view m_source;
     vector<Token> m_tokens;
 
+    std::shared_ptr<ExpressionArena> m_expressions; // shared by copies, m_rootExpression points into it
     Expression m_rootExpression;
 
-    vector<string> m_strings;
+    // strings live in m_game.symbols, so a string's pool index is its symbol
     vector<int> m_ints;
     vector<bool> m_bools;
+    unordered_map<int, DATA_IX_T> m_int_indexes;
 
-    int m_setup_index;
-    int m_turn_index;
+    int m_setup_index{-1};
+    int m_turn_index{-1};
     int m_depth;
     int m_depth_store;
-    unordered_map<string, int> m_phase_indexes;
+    unordered_map<Symbol, int> m_phase_indexes;
+    unordered_map<Symbol, int> m_global_slots;
+    unordered_map<Symbol, int> m_card_ids; // card name -> the ID it's declared with
 
     //runtime data
+    bool m_loaded{false}; // Run(true) has finished
     Game m_game;
     int m_current_opcode_index;
+    uint64_t m_executed_opcodes{0};
     vector<AttrCont> m_locale_stack;
+    vector<Attr> m_globals;
+    std::array<Attr, VALUE_STACK_SIZE> m_value_stack;
+    // card sequence literals, one entry per CARD_SEQUENCE_START, compiled the first time they're
+    // evaluated with all their cards declared. A CARD_SEQUENCE value is an index into this table
+    vector<CardSequence> m_card_sequences;
+    int m_value_stack_size{0};
+    vector<Symbol> m_expression_names;
+    vector<Symbol> m_lvalue_names; // an assignment's target, kept to reuse its capacity
     vector<PROC_MODE> m_proc_mode_stack;
     vector<string> m_block_name_stack;
 
     stack_move_callback_fun* m_stack_move_callback;
     void* m_stack_callback_data;
 
-    void factor_expression(Expression);
-    void compile_name(vector<Token>, bool lvalue);
-
-    int run(Opcode code, bool load = false);
+    void factor_expression(const Expression&);
+    void factor_postfix(const Expression&);
+    void compile_name(ArenaSpan<Token>, bool lvalue);
+
+    typedef int (Program::*opcode_handler)(const Opcode& code, bool load);
+    typedef std::array<opcode_handler, OPCODE_TYPE_COUNT> OpcodeHandlerTable;
+
+    static const OpcodeHandlerTable s_opcode_handlers;
+    static constexpr OpcodeHandlerTable make_opcode_handler_table();
+    int execute(bool load, int stopDepth);
+
+    // instruction handlers, dispatched by execute()
+    int op_game_blk_header(const Opcode& code, bool load);
+    int op_blk_end(const Opcode& code, bool load);
+    int op_if_blk_header(const Opcode& code, bool load);
+    int op_else_blk_header(const Opcode& code, bool load);
+    int op_foreachplayer_blk_header(const Opcode& code, bool load);
+    int op_foreachplayer_blk_end(const Opcode& code, bool load);
+    int op_setup_blk_header(const Opcode& code, bool load);
+    int op_phase_blk_header(const Opcode& code, bool load);
+    int op_turn_blk_header(const Opcode& code, bool load);
+    int op_card_blk_header(const Opcode& code, bool load);
+    int op_do_decl(const Opcode& code, bool load);
+    int op_stack_transfer(const Opcode& code, bool load);
+    int op_stack_source_location(const Opcode& code, bool load);
+    int op_destination_stack(const Opcode& code, bool load);
+    int op_stack_destination_location(const Opcode& code, bool load);
+    int op_attr_decl(const Opcode& code, bool load);
+    int op_players_l_value(const Opcode& code, bool load);
+    int op_assignment(const Opcode& code, bool load);
+    int op_winner_decl(const Opcode& code, bool load);
+    int op_looser_decl(const Opcode& code, bool load);
+    int op_unknown(const Opcode& code, bool load);
 
     static AttributeType s_type_code_to_attribute_type(TYPE_CODE_T);
 
+    // an expression of the game block and the opcodes it compiled to, recorded for Reload
+    struct CompiledBlock
+    {
+        ExpressionType type;
+        Symbol name; // of a phase or card
+        int begin; // its opcodes are [begin, end)
+        int end;
+        bool compiled; // rather than copied from the previous program by Reload
+        // of an include: every module it linked, with the hash of the content it was compiled from
+        vector<std::pair<string, uint64_t>> modules;
+    };
+    vector<CompiledBlock> m_blocks;
+    unsigned m_compile_threads{0};
+    // a unit is compiled to be linked into another program, which links the modules it includes
+    bool m_unit{false};
+    string m_source_dir; // included modules are found relative to it
+    string m_module_cache;
+    vector<string> m_include_stack;
+    vector<std::pair<string, uint64_t>> m_linked_modules; // every module include_module linked
+
+    void compile_top_level(const Expression& expr);
+    void compile_game_body(ArenaSpan<Expression> body);
+    void link(const Program& unit, bool record);
+    void include_module(const string& dir, const string& path);
+
+    // lexes m_source into m_tokens, then compiles them
+    void tokenize();
+    void compile_source();
+    void resolve_jump_targets();
+    void resolve_names();
     void ignore_block();
-    bool is_block_start();
-    bool is_block_end();
+    static bool s_is_block_start(OpcodeType type);
+    static bool s_is_block_end(OpcodeType type);
 
+    DATA_IX_T intern_string(std::string_view s);
+    DATA_IX_T intern_int(int i);
+    DATA_IX_T intern_bool(bool b);
+    void compile_constant(const Attr& constant);
     void compile_factor_from_number(int number);
 
     //copied from run.h
-    AttrCont* GetObjectAttrContPtrFromIdentifier(vector<string>::iterator namesBegin, vector<string>::iterator namesEnd);
-    AttrCont* GetGlobalObjectAttrContPtr(AttrCont& cont, string name);
+    AttrCont* GetObjectAttrContPtrFromIdentifier(vector<Symbol>::iterator namesBegin, vector<Symbol>::iterator namesEnd, NameBinding binding = {});
+    AttrCont* GetGlobalObjectAttrContPtr(AttrCont& cont, Symbol name);
+    AttrCont* GetObjectAttrContPtr(const Attr& object);
+    const Attr& evaluate_expression();
+    // the next free slot on the value stack
+    Attr& push_value();
+    void push_value(const Attr& value);
     int resolve_number_expression();
     bool resolve_bool_expression();
-    string resolve_string_expression();
+    Symbol resolve_string_expression();
     float resolve_float_expression();
     Attr resolve_expression_to_attr();
 
-    void read_name(vector<string>& names, OpcodeType nameType);
-    Attr* get_attr_ptr(vector<string>& names);
-    Attr get_attr_rvalue(vector<string>& names);
-    Attr get_attr_rvalue_from_base_attr(Attr base, vector<string>& names);
-    string get_card_parent_name(string nameSequence);
-    string get_card_name(string nameSequence);
-    Stack* get_stack_ptr(vector<string>& names);
+    NameBinding read_name(vector<Symbol>& names, OpcodeType nameType);
+    Attr& get_global(int slot);
+    // the card a name was bound to, or NO_CARD if it isn't declared yet
+    int bound_card(const NameBinding& binding) const;
+    Attr* get_attr_ptr(vector<Symbol>& names, NameBinding binding = {});
+    Attr get_attr_rvalue(vector<Symbol>& names, NameBinding binding = {});
+    Attr get_attr_rvalue_from_base_attr(Attr base, vector<Symbol>& names);
+    // resolves a name or dot chain to the attribute it refers to, without copying anything on the
+    // way. Positions and sizes aren't stored anywhere, so those are written to computed
+    Attr* get_attr_path(vector<Symbol>& names, NameBinding binding, Attr& computed, bool lvalue);
+    // follows [name, end) from current. Returns nullptr if the last name isn't there
+    Attr* walk_attr_path(Attr current, vector<Symbol>::const_iterator name, vector<Symbol>::const_iterator end, Attr& computed, bool lvalue);
+    Symbol get_card_parent_name(const string& nameSequence);
+    Symbol get_card_name(const string& nameSequence);
+    Stack* get_stack_ptr(vector<Symbol>& names, NameBinding binding = {});
     bool compare_attrs(Attr a, Attr b);
     bool compare_lessthan_attrs(Attr a, Attr b);
     bool compare_greatherthan_attrs(Attr a, Attr b);
@@ -309,9 +552,13 @@ private:
     Attr add_attrs(Attr a, Attr b);
     Attr multiply_attrs(Attr a, Attr b);
     Attr divide_attrs(Attr a, Attr b);
-    bool CompleteStackTransfer(StackTransferStateTracker);
+    bool CompleteStackTransfer(const StackTransferStateTracker&);
 
     void call_stack_move_callback(int from, int to, bool fromTop, bool toTop, const int* cardIds, int nCards);
+
+    // the loaded game in a bytecode image, see vm/Bytecode.cpp
+    void save_game(string& image) const;
+    void load_game(class ImageReader& reader);
 };
 
 class CompileError {
@@ -327,6 +574,16 @@ public:
     VMError(string reason) : reason{ reason } {}
 };
 
+class BytecodeError {
+public:
+    string reason;
+    BytecodeError(string reason) : reason{ reason } {}
+};
+
+// maps the file at path read only, for as long as the returned pointer lives. Returns nullptr if
+// it can't be opened. See vm/Bytecode.cpp
+std::shared_ptr<const void> map_file(const string& path, size_t& size);
+
 }
 
 #endif // !COMPILER_H
@@ -1,7 +1,28 @@
 #include "expression.h"
 
+#include <algorithm>
+#include <cstdint>
+
 namespace Battler {
 
+    void* ExpressionArena::allocate(size_t bytes, size_t alignment) {
+        size_t padding = (alignment - reinterpret_cast<uintptr_t>(next) % alignment) % alignment;
+        if (next == nullptr || padding + bytes > left) {
+            // lists bigger than a block get a block of their own
+            size_t size = std::max(BLOCK_SIZE, bytes + alignment);
+            blocks.emplace_back(new char[size]);
+            next = blocks.back().get();
+            left = size;
+            padding = (alignment - reinterpret_cast<uintptr_t>(next) % alignment) % alignment;
+        }
+
+        void* p = next + padding;
+        next += padding + bytes;
+        left -= padding + bytes;
+        used += bytes;
+        return p;
+    }
+
     ExpressionType GetExpressionTypeFromOperatorTokenType(TokenType type) {
         switch (type) {
         case TokenType::plus: return ExpressionType::ADDITION;
@@ -61,7 +82,7 @@ namespace Battler {
         throw UnexpectedTokenException(*(current - 1), "Unexpected end to token stream");
     }
 
-    std::vector<Expression> GetBlock(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
+    std::vector<Expression> GetBlock(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
         std::vector<Expression> expressions;
 
         while (current != end) {
@@ -69,7 +90,7 @@ namespace Battler {
                 return expressions;
             }
 
-            expressions.push_back(GetExpression(current, end));
+            expressions.push_back(GetExpression(arena, current, end));
 
             current++;
         }
@@ -77,48 +98,44 @@ namespace Battler {
         return expressions;
     }
 
-    Expression GetGameDelcarationExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
+    Expression GetGameDelcarationExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
         Token t = *current;
         ensureNoEOF(++current, end);
         ensureTokenType(TokenType::name, *current, "Expected game name declaration here");
-        Expression gameNameDeclaration = Expression(ExpressionType::GAME_NAME_DECLARATION, { *current });
+        Expression gameNameDeclaration = Expression(ExpressionType::GAME_NAME_DECLARATION, arena.Tokens({ *current }));
 
         ensureNoEOF(++current, end);
         ensureTokenTypeAndText(TokenType::name, "start", *current, "Expected a 'start' here");
         ensureNoEOF(++current, end);
 
-        Expression gameExpr;
-        gameExpr.tokens.push_back(t);
-        gameExpr.type = ExpressionType::GAME_DECLARATION;
-        gameExpr.children = GetBlock(current, end);
-        gameExpr.children.push_back(std::move(gameNameDeclaration));
+        Expression gameExpr(ExpressionType::GAME_DECLARATION, arena.Tokens({ t }));
+        std::vector<Expression> children = GetBlock(arena, current, end);
+        children.push_back(gameNameDeclaration);
+        gameExpr.children = arena.Children(children);
 
         return gameExpr;
     }
 
-    Expression GetAttrDeclarationExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
+    Expression GetAttrDeclarationExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
         ensureNoEOF(current + 1, end);
 
-        Expression attrDeclaration;
-        attrDeclaration.type = ExpressionType::ATTR_DECLARATION;
-        attrDeclaration.tokens.push_back(*current);
+        Expression attrDeclaration(ExpressionType::ATTR_DECLARATION, arena.Tokens({ *current }));
 
         ensureTokenType(TokenType::name, *current, "Expected an attribute type specifier here EG 'int', 'bool, 'string'");
 
-        auto typeSpecifierExpression = Expression(ExpressionType::ATTR_TYPE_SPECIFIER, { *current });
+        auto typeSpecifierExpression = Expression(ExpressionType::ATTR_TYPE_SPECIFIER, arena.Tokens({ *current }));
 
         ensureNoEOF(++current, end);
         ensureTokenType(TokenType::name, *current, "Expected an attribute name here EG 'x', 'HP', 'myAttributeName'. This is not a valid name");
         auto nameDeclarationExpression = Expression(ExpressionType::ATTR_NAME_DECLARATION, {});
-        nameDeclarationExpression.tokens = GetIdentifierTokens(current, end);
+        nameDeclarationExpression.tokens = arena.Tokens(GetIdentifierTokens(current, end));
 
-        attrDeclaration.children.push_back(std::move(typeSpecifierExpression));
-        attrDeclaration.children.push_back(std::move(nameDeclarationExpression));
+        attrDeclaration.children = arena.Children({ typeSpecifierExpression, nameDeclarationExpression });
 
         return attrDeclaration;
     }
 
-    Expression GetFactorExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
+    Expression GetFactorExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
 
         Expression expression;
 
@@ -139,15 +156,15 @@ namespace Battler {
 
             auto brackedtedExpressionCurrent = current + 1;
             auto bracketedExpressionEnd = i;
-            Expression brackedtedExpression = GetFactorExpression(brackedtedExpressionCurrent, bracketedExpressionEnd);
+            Expression brackedtedExpression = GetFactorExpression(arena, brackedtedExpressionCurrent, bracketedExpressionEnd);
             current = bracketedExpressionEnd;
 
             if (current + 1 != end && (current + 1)->type == dot) {
                 current += 2;
                 std::vector<Token> identifierTokens = GetIdentifierTokens(current, end);
                 leftFactor.type = ExpressionType::RESOLVED_IDENTIFIER_ATTRIBUTE_ACCESS;
-                leftFactor.children.push_back(brackedtedExpression);
-                leftFactor.tokens = identifierTokens;
+                leftFactor.children = arena.Children({ brackedtedExpression });
+                leftFactor.tokens = arena.Tokens(identifierTokens);
             }
             else {
                 leftFactor = brackedtedExpression;
@@ -162,12 +179,13 @@ namespace Battler {
             else {
                 identifierTokens = { *current };
             }
-            leftFactor = Expression(ExpressionType::FACTOR, identifierTokens);
+            leftFactor = Expression(ExpressionType::FACTOR, arena.Tokens(identifierTokens));
 
         } else if (current->type == TokenType::open_sq_br) {
             // expect card sequence here
 
-            leftFactor = Expression(ExpressionType::CARD_SEQUENCE, {*current});
+            leftFactor = Expression(ExpressionType::CARD_SEQUENCE, arena.Tokens({ *current }));
+            std::vector<Expression> matchers;
 
             ensureNoEOF(++current, end);
 
@@ -186,21 +204,22 @@ namespace Battler {
 
                 if (current->type == TokenType::underscore)
                 {
-                    leftFactor.children.push_back(Expression(ExpressionType::CARD_SEQUENCE_MATCH_ANYCARD, {}));
+                    matchers.push_back(Expression(ExpressionType::CARD_SEQUENCE_MATCH_ANYCARD, {}));
                 }
                 else if (current->type == TokenType::colon)
                 {
-                    leftFactor.children.push_back(Expression(ExpressionType::CARD_SEQUENCE_MATCH_REST, {}));
+                    matchers.push_back(Expression(ExpressionType::CARD_SEQUENCE_MATCH_REST, {}));
                 }
                 else
                 {
                     auto cardIdentifierTokens = GetIdentifierTokens(current, end);
-                    leftFactor.children.push_back(Expression(ExpressionType::FACTOR, cardIdentifierTokens));
+                    matchers.push_back(Expression(ExpressionType::FACTOR, arena.Tokens(cardIdentifierTokens)));
                 }
                 current ++;
             }
 
             ensureTokenType(TokenType::close_sq_br, *current, "Expected an end to to the sequence ']' here");
+            leftFactor.children = arena.Children(matchers);
         }
         else {
             throw UnexpectedTokenException(*current, "expected a value, var name or a bracketed expression here");
@@ -215,14 +234,13 @@ namespace Battler {
             }
 
             expression.type = expressionType;
-            expression.tokens.push_back(*current);
+            expression.tokens = arena.Tokens({ *current });
 
             ensureNoEOF(++current, end);
 
-            auto rightFactor = GetFactorExpression(current, end);
+            auto rightFactor = GetFactorExpression(arena, current, end);
 
-            expression.children.push_back(std::move(leftFactor));
-            expression.children.push_back(std::move(rightFactor));
+            expression.children = arena.Children({ leftFactor, rightFactor });
 
         }
         else {
@@ -232,16 +250,14 @@ namespace Battler {
         return expression;
     }
 
-    Expression GetAssignmentExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end, std::vector<Token>::iterator& leftAccumulationStart) {
+    Expression GetAssignmentExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end, std::vector<Token>::iterator& leftAccumulationStart) {
 
-        Expression expression;
-        expression.type = ExpressionType::ATTR_ASSIGNMENT;
-        expression.tokens.push_back(*current);
+        Expression expression(ExpressionType::ATTR_ASSIGNMENT, arena.Tokens({ *current }));
 
         Expression assignmentTarget;
         assignmentTarget.type = ExpressionType::ASSIGNMENT_TARGET;
         ensureTokenType(TokenType::name, *leftAccumulationStart, "Expected a name here as the target of an assignment");
-        assignmentTarget.tokens = GetIdentifierTokens(leftAccumulationStart, end);
+        assignmentTarget.tokens = arena.Tokens(GetIdentifierTokens(leftAccumulationStart, end));
         leftAccumulationStart++;
 
         if (leftAccumulationStart != current) {
@@ -251,42 +267,41 @@ namespace Battler {
         ensureNoEOF(current + 1, end);
         current++;
 
-        auto rightHandSide = GetFactorExpression(current, end);
+        auto rightHandSide = GetFactorExpression(arena, current, end);
 
-        expression.children.push_back(std::move(assignmentTarget));
-        expression.children.push_back(std::move(rightHandSide));
+        expression.children = arena.Children({ assignmentTarget, rightHandSide });
         return expression;
     }
 
-    Expression GetCardDeclarationExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
-        Expression cardExpr;
-        cardExpr.tokens.push_back(*current);
+    Expression GetCardDeclarationExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
+        Expression cardExpr(ExpressionType::CARD_DECLARATION, arena.Tokens({ *current }));
 
         ensureNoEOF(++current, end);
         ensureTokenType(TokenType::name, *current, "Expected name of Card declared here");
-        Expression cardNameDeclaration = Expression(ExpressionType::CARD_NAME_DECLARATION, { *current });
+        // the card's name, then its parent's if it has one
+        std::vector<Token> names = { *current };
         ensureNoEOF(++current, end);
 
         if (current->text != "start") {
             ensureTokenType(TokenType::name, *current, "Expected start or card parent name here");
-            cardNameDeclaration.tokens.push_back(*current);
+            names.push_back(*current);
             ensureNoEOF(++current, end);
         }
+        Expression cardNameDeclaration(ExpressionType::CARD_NAME_DECLARATION, arena.Tokens(names));
 
         ensureTokenTypeAndText(TokenType::name, "start", *current, "Expected a 'start' here");
         ensureNoEOF(++current, end);
 
 
-        cardExpr.type = ExpressionType::CARD_DECLARATION;
-        cardExpr.children = GetBlock(current, end);
-        cardExpr.children.push_back(std::move(cardNameDeclaration));
+        std::vector<Expression> children = GetBlock(arena, current, end);
+        children.push_back(cardNameDeclaration);
+        cardExpr.children = arena.Children(children);
 
         return cardExpr;
     }
 
-    Expression GetSetupExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
-        Expression expr;
-        expr.tokens.push_back(*current);
+    Expression GetSetupExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
+        Expression expr(ExpressionType::SETUP_DECLARATION, arena.Tokens({ *current }));
 
         ensureTokenTypeAndText(TokenType::name, "setup", *current, "you can't start a setup expression with this");
         ensureNoEOF(++current, end);
@@ -294,34 +309,34 @@ namespace Battler {
         ensureNoEOF(++current, end);
 
 
-        expr.type = ExpressionType::SETUP_DECLARATION;
-        expr.children = GetBlock(current, end);
+        expr.children = arena.Children(GetBlock(arena, current, end));
 
         return expr;
     }
 
-    Expression GetForEachPlayerExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
+    Expression GetForEachPlayerExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
         ensureTokenTypeAndText(TokenType::name, "foreachplayer", *current, "foreachplayer expected for this kind of loop");
 
-        Expression expr(ExpressionType::FOREACHPLAYER_DECLARATION, { *current });
+        Expression expr(ExpressionType::FOREACHPLAYER_DECLARATION, arena.Tokens({ *current }));
 
         ensureNoEOF(++current, end);
         ensureTokenType(TokenType::name, *current, "expected each player identifier here");
 
-        Expression identExpr(ExpressionType::FOREACHPLAYER_IDENTIFIER_DECLARATION, { *current });
+        Expression identExpr(ExpressionType::FOREACHPLAYER_IDENTIFIER_DECLARATION, arena.Tokens({ *current }));
 
         ensureNoEOF(++current, end);
         ensureTokenTypeAndText(TokenType::name, "start", *current, "expected 'start' here");
         ensureNoEOF(++current, end);
 
 
-        expr.children = GetBlock(current, end);
-        expr.children.push_back(identExpr);
+        std::vector<Expression> children = GetBlock(arena, current, end);
+        children.push_back(identExpr);
+        expr.children = arena.Children(children);
 
         return expr;
     }
 
-    Expression GetStackMoveSourceExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
+    Expression GetStackMoveSourceExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
         ensureTokenType(TokenType::name, *current, "this is not a valid left side move expression");
 
         Expression expr;
@@ -377,12 +392,12 @@ namespace Battler {
             }
         }
 
-        expr.tokens = sourceIdentifers;
+        expr.tokens = arena.Tokens(sourceIdentifers);
 
         return expr;
     }
 
-    Expression GetStackMoveTargetExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end, bool requirePosition/*=true*/, bool requireAmount/*=true*/) {
+    Expression GetStackMoveTargetExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end, bool requirePosition/*=true*/, bool requireAmount/*=true*/) {
         ensureTokenType(TokenType::name, *current, "this is not a valid left side move expression");
 
         Expression expr;
@@ -400,7 +415,7 @@ namespace Battler {
                 break;
             }
         }
-        Expression stackIdentifierExpr(ExpressionType::IDENTIFIER, std::move(targetIdentifierTokens));
+        Expression stackIdentifierExpr(ExpressionType::IDENTIFIER, arena.Tokens(targetIdentifierTokens));
 
         if (requirePosition)
         {
@@ -416,7 +431,7 @@ namespace Battler {
             else {
                 throw UnexpectedTokenException(*current, "Expected one of 'top' or 'bottom' here");
             }
-            expr.tokens.push_back(*current);
+            expr.tokens = arena.Tokens({ *current });
         }
         else {
             expr.type = ExpressionType::STACK_SOURCE_TOP;
@@ -434,20 +449,21 @@ namespace Battler {
             }
         }
 
-        expr.children.push_back(std::move(stackIdentifierExpr));
-
-
         if (requireAmount)
         {
             ensureNoEOF(++current, end);
-            auto factorExpression = GetFactorExpression(current, end);
-            expr.children.push_back(std::move(factorExpression));
+            auto factorExpression = GetFactorExpression(arena, current, end);
+            expr.children = arena.Children({ stackIdentifierExpr, factorExpression });
+        }
+        else
+        {
+            expr.children = arena.Children({ stackIdentifierExpr });
         }
 
         return expr;
     }
 
-    Expression GetTransferExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end, std::vector<Token>::iterator& leftAccumulationStart) {
+    Expression GetTransferExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end, std::vector<Token>::iterator& leftAccumulationStart) {
         if (current->type != TokenType::move
             && current->type != TokenType::move_under
             && current->type != TokenType::cut
@@ -460,7 +476,7 @@ namespace Battler {
         expr.type = ExpressionType::STACK_TRANSFER;
         Expression sourceStackExpr, operationExpr, targetStackExpr;
 
-        sourceStackExpr = GetStackMoveSourceExpression(leftAccumulationStart, end);
+        sourceStackExpr = GetStackMoveSourceExpression(arena, leftAccumulationStart, end);
         ensureNoEOF(++leftAccumulationStart, end);
         if (leftAccumulationStart != current) {
             throw UnexpectedTokenException(*leftAccumulationStart, "You can't have more than one expression on the left hand side of a move");
@@ -501,11 +517,7 @@ namespace Battler {
             requirePosition = false;
         }
 
-        targetStackExpr = GetStackMoveTargetExpression(current, end, requirePosition, requireAmount);
-
-        expr.children.push_back(sourceStackExpr);
-        expr.children.push_back(operationExpr);
-        expr.children.push_back(targetStackExpr);
+        targetStackExpr = GetStackMoveTargetExpression(arena, current, end, requirePosition, requireAmount);
 
         // ensureNoEOF(++current, end);
 
@@ -529,7 +541,7 @@ namespace Battler {
                 {
                     ensureTokenType(TokenType::open_brace, *(++current), "Expectated a '{' here");
                     ensureNoEOF(++current, end);
-                    fromExpr = GetFactorExpression(current, end);
+                    fromExpr = GetFactorExpression(arena, current, end);
                     foundFromClause = true;
                     ensureTokenType(TokenType::close_brace, *(++current), "Expected a '}' here");
                     if (foundToClause || (current+1)->type != TokenType::comma)
@@ -545,7 +557,7 @@ namespace Battler {
                 {
                     ensureTokenType(TokenType::open_brace, *(++current), "Expectated a '{' here");
                     ensureNoEOF(++current, end);
-                    toExpr = GetFactorExpression(current, end);
+                    toExpr = GetFactorExpression(arena, current, end);
                     foundToClause = true;
                     ensureTokenType(TokenType::close_brace, *(++current), "Expected a '}' here");
                     if (foundFromClause || (current+1)->type != TokenType::comma)
@@ -566,82 +578,68 @@ namespace Battler {
             Expression none;
             none.type = ExpressionType::NONE;
 
-            if (foundFromClause)
-            {
-                fromExprParent.children.push_back(fromExpr);
-            }
-            else
-            {
-                fromExprParent.children.push_back(none);
-            }
-            if (foundToClause)
-            {
-                toExprParent.children.push_back(toExpr);
-            }
-            else
-            {
-                toExprParent.children.push_back(none);
-            }
+            fromExprParent.children = arena.Children({ foundFromClause ? fromExpr : none });
+            toExprParent.children = arena.Children({ foundToClause ? toExpr : none });
         }
         else
         {
             Expression none;
             none.type = ExpressionType::NONE;
-            toExprParent.children.push_back(none);
-            fromExprParent.children.push_back(none);
+            toExprParent.children = arena.Children({ none });
+            fromExprParent.children = arena.Children({ none });
         }
-        expr.children.push_back(fromExprParent);
-        expr.children.push_back(toExprParent);
+        expr.children = arena.Children({ sourceStackExpr, operationExpr, targetStackExpr, fromExprParent, toExprParent });
 
 
 
         return expr;
     }
 
-    Expression GetPhaseDeclarationExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
+    Expression GetPhaseDeclarationExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
         ensureNoEOF(++current, end);
         ensureTokenType(TokenType::name, *current, "Expected name of phase declared here");
 
-        Expression expr(ExpressionType::PHASE_DECLARATION, { *current });
+        Expression expr(ExpressionType::PHASE_DECLARATION, arena.Tokens({ *current }));
         ensureNoEOF(++current, end);
 
         ensureTokenTypeAndText(TokenType::name, "start", *current, "Expected 'start' here");
         ensureNoEOF(++current, end);
 
-        expr.children = GetBlock(current, end);
+        expr.children = arena.Children(GetBlock(arena, current, end));
 
         return expr;
     }
 
-    Expression GetOnPlaceExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
-        Expression expr(ExpressionType::ONPLACE_DECLARATION, { *current });
+    Expression GetOnPlaceExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
+        Expression expr(ExpressionType::ONPLACE_DECLARATION, arena.Tokens({ *current }));
 
         ensureNoEOF(++current, end);
         ensureTokenType(TokenType::name, *current, "Expected name of target stack here");
 
         auto stackIdentifierTokens = GetIdentifierTokens(current, end);
 
-        auto stackNameDeclaration = Expression(ExpressionType::ONPLACE_STACK_DECLARATION, stackIdentifierTokens);
+        auto stackNameDeclaration = Expression(ExpressionType::ONPLACE_STACK_DECLARATION, arena.Tokens(stackIdentifierTokens));
 
         ensureNoEOF(++current, end);
         ensureTokenType(TokenType::name, *current, "Expected name of card identifier here");
 
-        auto cardIdentifier = Expression(ExpressionType::ONPLACE_IDENTIFIER_DECLARATION, { *current });
+        auto cardIdentifier = Expression(ExpressionType::ONPLACE_IDENTIFIER_DECLARATION, arena.Tokens({ *current }));
 
         ensureNoEOF(++current, end);
         ensureTokenTypeAndText(TokenType::name, "start", *current, "Expected 'start' here");
 
         ensureNoEOF(++current, end);
-        expr.children = GetBlock(current, end);
-        expr.children.push_back(std::move(stackNameDeclaration));
-        expr.children.push_back(std::move(cardIdentifier));
+        std::vector<Expression> children = GetBlock(arena, current, end);
+        children.push_back(stackNameDeclaration);
+        children.push_back(cardIdentifier);
+        expr.children = arena.Children(children);
 
         return expr;
     }
 
-    Expression GetIfExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
+    Expression GetIfExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
 
-        Expression expr(ExpressionType::IF_DECLARATION, { *current });
+        Expression expr(ExpressionType::IF_DECLARATION, arena.Tokens({ *current }));
 
         ensureNoEOF(++current, end);
 
@@ -649,96 +647,117 @@ namespace Battler {
             throw UnexpectedTokenException(*current, "expected boolean expression here");
         }
 
-        auto booleanExpression = GetFactorExpression(current, end);
+        auto booleanExpression = GetFactorExpression(arena, current, end);
         ensureNoEOF(++current, end);
         ensureTokenTypeAndText(TokenType::name, "start", *current, "Expected 'start' here");
 
         ensureNoEOF(++current, end);
-        expr.children.push_back(booleanExpression);
-        auto blockExprs = GetBlock(current, end);
-        expr.children.insert(expr.children.end(), blockExprs.begin(), blockExprs.end());
+        std::vector<Expression> children = { booleanExpression };
+        auto blockExprs = GetBlock(arena, current, end);
+        children.insert(children.end(), blockExprs.begin(), blockExprs.end());
 
         while (current->text == "elseif") {
-            Expression elseIfExpr(ExpressionType::ELSEIF_DECLARATION, {*current});
+            Expression elseIfExpr(ExpressionType::ELSEIF_DECLARATION, arena.Tokens({ *current }));
             ensureNoEOF(++current, end);
-            auto elseIfGuard = GetFactorExpression(current, end);
+            auto elseIfGuard = GetFactorExpression(arena, current, end);
             ensureNoEOF(++current, end);
             ensureTokenTypeAndText(TokenType::name, "then", *current, "Expected 'then' here");
             ensureNoEOF(++current, end);
-            auto elseIfBlockExprs = GetBlock(current, end);
-            elseIfExpr.children.push_back(elseIfGuard);
-            elseIfExpr.children.insert(elseIfExpr.children.end(), elseIfBlockExprs.begin(), elseIfBlockExprs.end());
-            expr.children.push_back(elseIfExpr);
+            auto elseIfBlockExprs = GetBlock(arena, current, end);
+            elseIfBlockExprs.insert(elseIfBlockExprs.begin(), elseIfGuard);
+            elseIfExpr.children = arena.Children(elseIfBlockExprs);
+            children.push_back(elseIfExpr);
         }
 
         if (current->text == "else") {
-            Expression elseExpr(ExpressionType::ELSE_DECLARATION, {*current});
+            Expression elseExpr(ExpressionType::ELSE_DECLARATION, arena.Tokens({ *current }));
             ensureNoEOF(++current, end);
-            auto elseBlockExprs = GetBlock(current, end);
-            elseExpr.children = elseBlockExprs;
-            expr.children.push_back(elseExpr);
+            auto elseBlockExprs = GetBlock(arena, current, end);
+            elseExpr.children = arena.Children(elseBlockExprs);
+            children.push_back(elseExpr);
         }
+        expr.children = arena.Children(children);
 
         return expr;
     }
 
-    Expression GetWinnerIsExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
+    Expression GetWinnerIsExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
 
-        Expression expr(ExpressionType::WINNER_DECLARATION, { *current });
+        Expression expr(ExpressionType::WINNER_DECLARATION, arena.Tokens({ *current }));
         ensureNoEOF(++current, end);
 
-        expr.tokens = GetIdentifierTokens(current, end);
+        expr.tokens = arena.Tokens(GetIdentifierTokens(current, end));
 
         return expr;
     }
 
-    Expression GetLooserIsExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
-        Expression expr(ExpressionType::LOOSER_DECLARATION, { *current });
+    Expression GetLooserIsExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
+        Expression expr(ExpressionType::LOOSER_DECLARATION, arena.Tokens({ *current }));
         ensureNoEOF(++current, end);
 
-        expr.tokens = GetIdentifierTokens(current, end);
+        expr.tokens = arena.Tokens(GetIdentifierTokens(current, end));
 
         return expr;
     }
 
-    Expression GetTurnExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
-        Expression expr(ExpressionType::TURN_DECLARATION, { *current });
+    Expression GetTurnExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
+        Expression expr(ExpressionType::TURN_DECLARATION, arena.Tokens({ *current }));
 
         ensureNoEOF(++current, end);
         ensureTokenTypeAndText(TokenType::name, "start", *current, "Expected 'start' here");
 
         ensureNoEOF(++current, end);
-        expr.children = GetBlock(current, end);
+        expr.children = arena.Children(GetBlock(arena, current, end));
 
         return expr;
     }
 
-    Expression GetDoExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
-        Expression expr(ExpressionType::DO_DECLARATION, { *current });
+    Expression GetDoExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
+        auto doToken = current;
 
         ensureNoEOF(++current, end);
         ensureTokenType(TokenType::name, *current, "Expected phase name here");
 
-        expr.tokens.push_back(*current);
+        Expression expr(ExpressionType::DO_DECLARATION, arena.Tokens({ *doToken, *current }));
 
         return expr;
     }
 
-    Expression GetPlayersExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
-        Expression expr(ExpressionType::PLAYERS_DECLARATION, {*current});
+    // the path isn't lexed as one token, so its token is the source between the quotes
+    Expression GetIncludeExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
+        auto includeToken = current;
 
         ensureNoEOF(++current, end);
+        ensureTokenType(TokenType::dquote, *current, "Expected a quoted path here EG \"cards/ships.battler\"");
+        Token path = *current;
 
-        expr.children.push_back(GetFactorExpression(current, end));
+        do {
+            ensureNoEOF(++current, end);
+        } while (current->type != TokenType::dquote);
+        if (current->l != path.l) {
+            throw UnexpectedTokenException(path, "Expected the path to end on this line");
+        }
 
-        return expr;
+        const char* pathStart = path.text.data() + 1;
+        path.type = TokenType::name;
+        path.text = std::string_view(pathStart, current->text.data() - pathStart);
+
+        return Expression(ExpressionType::INCLUDE_DECLARATION, arena.Tokens({ *includeToken, path }));
     }
 
-    Expression GetExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
+    Expression GetPlayersExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
+        Expression expr(ExpressionType::PLAYERS_DECLARATION, arena.Tokens({ *current }));
 
-        Expression expression;
+        ensureNoEOF(++current, end);
+
+        expr.children = arena.Children({ GetFactorExpression(arena, current, end) });
+
+        return expr;
+    }
 
-        expression.tokens.push_back(*current);
+    Expression GetExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end) {
+
+        Expression expression(ExpressionType::NONE, arena.Tokens({ *current }));
 
         // sometimes we want to process the left hand side expression later EG `my.draw_stack -> my.hand`
         auto leftAccumulationStart = current;
@@ -746,40 +765,43 @@ namespace Battler {
         while (current != end) {
             if (current->type == TokenType::name) {
                 if (current->text == "game") {
-                    return GetGameDelcarationExpression(current, end);
+                    return GetGameDelcarationExpression(arena, current, end);
                 }
                 else if (current->text == "card") {
-                    return GetCardDeclarationExpression(current, end);
+                    return GetCardDeclarationExpression(arena, current, end);
                 }
                 else if (current->text == "setup") {
-                    return GetSetupExpression(current, end);
+                    return GetSetupExpression(arena, current, end);
                 }
                 else if (current->text == "phase") {
-                    return GetPhaseDeclarationExpression(current, end);
+                    return GetPhaseDeclarationExpression(arena, current, end);
                 }
                 else if (current->text == "foreachplayer") {
-                    return GetForEachPlayerExpression(current, end);
+                    return GetForEachPlayerExpression(arena, current, end);
                 }
                 else if (current->text == "onplace") {
-                    return GetOnPlaceExpression(current, end);
+                    return GetOnPlaceExpression(arena, current, end);
                 }
                 else if (current->text == "if") {
-                    return GetIfExpression(current, end);
+                    return GetIfExpression(arena, current, end);
                 }
                 else if (current->text == "winneris") {
-                    return GetWinnerIsExpression(current, end);
+                    return GetWinnerIsExpression(arena, current, end);
                 }
                 else if (current->text == "looseris") {
-                    return GetLooserIsExpression(current, end);
+                    return GetLooserIsExpression(arena, current, end);
                 }
                 else if (current->text == "turn") {
-                    return GetTurnExpression(current, end);
+                    return GetTurnExpression(arena, current, end);
                 }
                 else if (current->text == "do") {
-                    return GetDoExpression(current, end);
+                    return GetDoExpression(arena, current, end);
                 }
                 else if (current->text == "players") {
-                    return GetPlayersExpression(current, end);
+                    return GetPlayersExpression(arena, current, end);
+                }
+                else if (current->text == "include") {
+                    return GetIncludeExpression(arena, current, end);
                 }
                 // these keywords are part of larger expressions and should be accumulated before evaluation
                 // (this allows them not to be immediately evauated as an attribute declaration, even if `random StacName ...` looks like one)
@@ -787,24 +809,24 @@ namespace Battler {
                 else if (current->text == "choose") {}
                 else if (current->text == "place") {}
                 else if ((current + 1) != end && (current + 1)->type == TokenType::name) {
-                    return GetAttrDeclarationExpression(current, end);
+                    return GetAttrDeclarationExpression(arena, current, end);
                 }
             }
 
             else if (current->type == TokenType::assignment) {
-                return GetAssignmentExpression(current, end, leftAccumulationStart);
+                return GetAssignmentExpression(arena, current, end, leftAccumulationStart);
             }
             else if (current->type == TokenType::move) {
-                return GetTransferExpression(current, end, leftAccumulationStart);
+                return GetTransferExpression(arena, current, end, leftAccumulationStart);
             }
             else if (current->type == TokenType::move_under) {
-                return GetTransferExpression(current, end, leftAccumulationStart);
+                return GetTransferExpression(arena, current, end, leftAccumulationStart);
             }
             else if (current->type == TokenType::cut) {
-                return GetTransferExpression(current, end, leftAccumulationStart);
+                return GetTransferExpression(arena, current, end, leftAccumulationStart);
             }
             else if (current->type == TokenType::cut_under) {
-                return GetTransferExpression(current, end, leftAccumulationStart);
+                return GetTransferExpression(arena, current, end, leftAccumulationStart);
             }
 
             ensureNoEOF(++current, end);
@@ -1,7 +1,19 @@
 #include "Parser.h"
 
+#include <cstring>
+
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#include <emmintrin.h>
+#define BATTLER_SSE2
+#endif
+
 namespace Battler {
 
+	static std::pair<Token, const char*> token(Token& t, const char* begin, const char* end) {
+		t.text = std::string_view(begin, end - begin);
+		return std::make_pair(t, end);
+	}
+
 	bool IsOperatorType(TokenType type) {
 		return
 			type == TokenType::divide
@@ -14,169 +26,236 @@ namespace Battler {
 	}
 
 
-	std::pair<Token, std::string::iterator> getNextToken(
-		std::string::iterator begin,
-		std::string::iterator end
+	// What a byte can start. Operators that are a single byte all share one class and take their
+	// token type from s_single_tokens, the rest need a look at what follows them.
+	enum CharClass : unsigned char {
+		UNKNOWN_CHAR,
+		SINGLE_CHAR,
+		SPACE_CHAR,
+		NEWLINE_CHAR,
+		COMMENT_CHAR,
+		DIGIT_CHAR,
+		LETTER_CHAR,
+		EQUALS_CHAR,
+		MINUS_CHAR,
+		SLASH_CHAR
+	};
+
+	struct CharTables {
+		CharClass classes[256];
+		TokenType single_tokens[256];
+		bool name_chars[256]; // what a name carries on with after its first letter
+	};
+
+	static constexpr CharTables make_char_tables() {
+		CharTables tables{};
+		for (int c = 0; c < 256; c++) {
+			tables.classes[c] = UNKNOWN_CHAR;
+			tables.single_tokens[c] = TokenType::unknown;
+			tables.name_chars[c] = false;
+		}
+		for (int c = '0'; c <= '9'; c++) {
+			tables.classes[c] = DIGIT_CHAR;
+			tables.name_chars[c] = true;
+		}
+		for (int c = 'a'; c <= 'z'; c++) {
+			tables.classes[c] = LETTER_CHAR;
+			tables.classes[c - 'a' + 'A'] = LETTER_CHAR;
+			tables.name_chars[c] = true;
+			tables.name_chars[c - 'a' + 'A'] = true;
+		}
+		tables.name_chars[(unsigned char) '_'] = true;
+
+		tables.classes[(unsigned char) ' '] = SPACE_CHAR;
+		tables.classes[(unsigned char) '\n'] = NEWLINE_CHAR;
+		tables.classes[(unsigned char) '\r'] = NEWLINE_CHAR;
+		tables.classes[(unsigned char) '#'] = COMMENT_CHAR;
+		tables.classes[(unsigned char) '='] = EQUALS_CHAR;
+		tables.classes[(unsigned char) '-'] = MINUS_CHAR;
+		tables.classes[(unsigned char) '/'] = SLASH_CHAR;
+
+		const std::pair<char, TokenType> singles[] = {
+			{'+', TokenType::plus},
+			{'*', TokenType::times},
+			{'<', TokenType::lessthan},
+			{'>', TokenType::greaterthan},
+			{'(', TokenType::openbr},
+			{')', TokenType::closebr},
+			{'"', TokenType::dquote},
+			{',', TokenType::comma},
+			{'.', TokenType::dot},
+			{'[', TokenType::open_sq_br},
+			{']', TokenType::close_sq_br},
+			{'_', TokenType::underscore},
+			{':', TokenType::colon},
+			{'{', TokenType::open_brace},
+			{'}', TokenType::close_brace}
+		};
+		for (auto& single : singles) {
+			tables.classes[(unsigned char) single.first] = SINGLE_CHAR;
+			tables.single_tokens[(unsigned char) single.first] = single.second;
+		}
+		return tables;
+	}
+
+	static constexpr CharTables s_chars = make_char_tables();
+
+	static CharClass char_class(char c) {
+		return s_chars.classes[(unsigned char) c];
+	}
+
+#ifdef BATTLER_SSE2
+	// the first byte of a 16 byte block whose bit is clear in mask, or 16
+	static int first_clear(int mask) {
+		unsigned missing = ~(unsigned) mask & 0xFFFFu;
+		return missing ? __builtin_ctz(missing) : 16;
+	}
+
+	// a byte mask of the chunk's bytes in [lo, lo + n), done as a signed compare after moving
+	// lo to -128, since SSE2 has no unsigned byte compare
+	static __m128i in_range(__m128i chunk, char lo, int n) {
+		__m128i shifted = _mm_sub_epi8(chunk, _mm_set1_epi8((char) (lo + 128)));
+		return _mm_cmplt_epi8(shifted, _mm_set1_epi8((char) (n - 128)));
+	}
+#endif
+
+	// Runs of spaces (mostly indentation) and of name characters are where a game's bytes are,
+	// so both are skipped 16 bytes at a time where SSE2 is there to do it.
+	static const char* skip_spaces(const char* begin, const char* end) {
+#ifdef BATTLER_SSE2
+		const __m128i spaces = _mm_set1_epi8(' ');
+		while (end - begin >= 16) {
+			__m128i chunk = _mm_loadu_si128((const __m128i*) begin);
+			int skipped = first_clear(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, spaces)));
+			begin += skipped;
+			if (skipped != 16) {
+				return begin;
+			}
+		}
+#endif
+		while (begin != end && *begin == ' ') {
+			begin++;
+		}
+		return begin;
+	}
+
+	static const char* skip_name(const char* begin, const char* end) {
+#ifdef BATTLER_SSE2
+		const __m128i lower = _mm_set1_epi8(0x20);
+		const __m128i underscores = _mm_set1_epi8('_');
+		while (end - begin >= 16) {
+			__m128i chunk = _mm_loadu_si128((const __m128i*) begin);
+			__m128i letters = in_range(_mm_or_si128(chunk, lower), 'a', 26);
+			__m128i digits = in_range(chunk, '0', 10);
+			__m128i name = _mm_or_si128(_mm_or_si128(letters, digits), _mm_cmpeq_epi8(chunk, underscores));
+			int skipped = first_clear(_mm_movemask_epi8(name));
+			begin += skipped;
+			if (skipped != 16) {
+				return begin;
+			}
+		}
+#endif
+		while (begin != end && s_chars.name_chars[(unsigned char) *begin]) {
+			begin++;
+		}
+		return begin;
+	}
+
+	static const char* skip_digits(const char* begin, const char* end) {
+		while (begin != end && char_class(*begin) == DIGIT_CHAR) {
+			begin++;
+		}
+		return begin;
+	}
+
+	// a comment runs to the end of its line, memchr finds that faster than a loop would
+	static const char* skip_line(const char* begin, const char* end) {
+		const void* newline = std::memchr(begin, '\n', end - begin);
+		return newline ? (const char*) newline : end;
+	}
+
+	std::pair<Token, const char*> getNextToken(
+		const char* begin,
+		const char* end
 	) {
 
 		assert(begin != end);
 
 		Token t;
+		const char* start = begin;
 
-		if (*begin == ' ') {
+		switch (char_class(*begin)) {
+		case SINGLE_CHAR:
+			t.type = s_chars.single_tokens[(unsigned char) *begin];
+			return token(t, start, begin + 1);
+		case SPACE_CHAR:
 			t.type = TokenType::space;
-			for (; begin != end && *begin == ' '; begin++) {
-				t.text.push_back(*begin);
-			}
-			return make_pair(t, begin);
-		}
-		else if (*begin == '#') {
+			return token(t, start, skip_spaces(begin, end));
+		case COMMENT_CHAR:
 			t.type = TokenType::comment;
-			t.text = '#';
-			return make_pair(t, begin);
-		}
-		else if (*begin == '=') {
-			t.text.push_back('=');
+			return token(t, start, begin + 1);
+		case DIGIT_CHAR:
+			t.type = TokenType::number;
+			return token(t, start, skip_digits(begin, end));
+		case LETTER_CHAR:
+			t.type = TokenType::name;
+			return token(t, start, skip_name(begin, end));
+		case EQUALS_CHAR:
 			if (begin + 1 != end && *(begin + 1) == '=') {
-				t.text.push_back('=');
 				t.type = TokenType::equality;
-				return make_pair(t, begin + 2);
+				return token(t, start, begin + 2);
 			}
 			t.type = TokenType::assignment;
-			return make_pair(t, begin + 1);
-		}
-		else if (*begin == '+') {
-			t.text.push_back('+');
-			t.type = TokenType::plus;
-			return make_pair(t, begin + 1);
-		}
-		else if (*begin == '-') {
-			t.text.push_back('-');
-
+			return token(t, start, begin + 1);
+		case MINUS_CHAR:
+		case SLASH_CHAR: {
+			bool minus = char_class(*begin) == MINUS_CHAR;
 			if (begin + 1 != end && *(begin + 1) == '>') {
-				t.text.push_back('>');
-
 				if (begin + 2 != end && *(begin + 2) == '_') {
-					t.text.push_back('_');
-					t.type = TokenType::move_under;
-					return make_pair(t, begin + 3);
+					t.type = minus ? TokenType::move_under : TokenType::cut_under;
+					return token(t, start, begin + 3);
 				}
-
-				t.type = TokenType::move;
-				return make_pair(t, begin + 2);
+				t.type = minus ? TokenType::move : TokenType::cut;
+				return token(t, start, begin + 2);
 			}
-			t.type = TokenType::minus;
-			return make_pair(t, begin + 1);
-		}
-		else if (*begin == '*') {
-			t.text.push_back('*');
-			t.type = TokenType::times;
-			return make_pair(t, begin + 1);
+			t.type = minus ? TokenType::minus : TokenType::divide;
+			return token(t, start, begin + 1);
 		}
-		else if (*begin == '/') {
-            t.text.push_back('/');
-
-            if (begin + 1 != end && *(begin + 1) == '>') {
-                t.text.push_back('>');
-
-                if (begin + 2 != end && *(begin + 2) == '_') {
-                    t.text.push_back('_');
-                    t.type = TokenType::cut_under;
-                    return make_pair(t, begin + 3);
-                }
-                
-                t.type = TokenType::cut;
-                return make_pair(t, begin + 2);
-            }
-			t.type = TokenType::divide;
-			return make_pair(t, begin + 1);
-		}
-		else if (*begin == '<') {
-			t.text.push_back('<');
-			t.type = TokenType::lessthan;
-			return make_pair(t, begin + 1);
-		}
-		else if (*begin == '>') {
-			t.text.push_back('>');
-			t.type = TokenType::greaterthan;
-			return make_pair(t, begin + 1);
-		}
-		else if (*begin == '(') {
-			t.text.push_back('(');
-			t.type = TokenType::openbr;
-			return make_pair(t, begin + 1);
-		}
-		else if (*begin == ')') {
-			t.text.push_back(')');
-			t.type = TokenType::closebr;
-			return make_pair(t, begin + 1);
-		}
-		else if (*begin == '"') {
-			t.text.push_back('"');
-			t.type = TokenType::dquote;
-			return make_pair(t, begin + 1);
-		}
-		else if (*begin == ',') {
-			t.text.push_back(',');
-			t.type = TokenType::comma;
-			return make_pair(t, begin + 1);
-		}
-		else if (*begin == '.') {
-			t.text.push_back('.');
-			t.type = TokenType::dot;
-			return make_pair(t, begin + 1);
-		}
-		else if (*begin == '[') {
-			t.text.push_back('[');
-			t.type = TokenType::open_sq_br;
-			return make_pair(t, begin + 1);
-		}
-		else if (*begin == ']') {
-			t.text.push_back(']');
-			t.type = TokenType::close_sq_br;
-			return make_pair(t, begin + 1);
-		}
-        else if (*begin == '_') {
-            t.text.push_back('_');
-            t.type = TokenType::underscore;
-            return make_pair(t, begin + 1);
-        }
-        else if (*begin == ':') {
-            t.text.push_back(':');
-            t.type = TokenType::colon;
-            return make_pair(t, begin + 1);
-        }
-        else if (*begin == '{') {
-            t.text.push_back('{');
-            t.type = TokenType::open_brace;
-            return make_pair(t, begin + 1);
-        }
-        else if (*begin == '}') {
-            t.text.push_back('}');
-            t.type = TokenType::close_brace;
-            return make_pair(t, begin + 1);
-        }
-		// the catch all unknown chars case
-		else if (!std::isalnum(*begin)) {
-			t.text.push_back(*begin);
+		default:
+			// the catch all unknown chars case, newlines included when they are asked for directly
 			t.type = TokenType::unknown;
-			return make_pair(t, begin + 1);
+			return token(t, start, begin + 1);
 		}
+	}
 
-		if (std::isdigit(*begin)) {
-			t.type = TokenType::number;
-			for (; begin != end && std::isdigit(*begin); begin++) {
-				t.text.push_back(*begin);
+	bool Lexer::Next(Token& t) {
+		while (current != end) {
+			switch (char_class(*current)) {
+			case NEWLINE_CHAR:
+				if (*current == '\n') {
+					line++;
+					lineStart = current + 1;
+				}
+				current++;
+				continue;
+			case SPACE_CHAR:
+				current = skip_spaces(current, end);
+				continue;
+			case COMMENT_CHAR:
+				current = skip_line(current, end);
+				continue;
+			default:
+				break;
 			}
-			return make_pair(t, begin);
-		}
 
-		t.type = TokenType::name;
-		for (; begin != end && (std::isalnum(*begin) || *begin == '_'); begin++) {
-			t.text.push_back(*begin);
+			auto resPair = getNextToken(current, end);
+			t = resPair.first;
+			t.l = line;
+			t.c = (int) (current - lineStart);
+			current = resPair.second;
+			return true;
 		}
-
-		return make_pair(t, begin);
+		return false;
 	}
 
 }
@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <cctype>
 #include <cassert>
@@ -41,15 +42,31 @@ namespace Battler {
 
 	struct Token {
 		TokenType type;
-		int l;
-		int c;
-		std::string text;
+		int l; // counted from 1
+		int c; // counted from 0
+		std::string_view text; // points into the source, which outlives the tokens
 	};
 
 	bool IsOperatorType(TokenType type);
-	std::pair<Token, std::string::iterator> getNextToken(
-		std::string::iterator begin,
-		std::string::iterator end
+	std::pair<Token, const char*> getNextToken(
+		const char* begin,
+		const char* end
 	);
 
+	// Splits a source buffer into tokens one at a time, without copying their text. Spaces and
+	// comments are skipped, and every token knows the line and column it starts at.
+	class Lexer {
+	public:
+		explicit Lexer(std::string_view source) : current(source.data()), end(source.data() + source.size()), lineStart(current) {}
+
+		// false once the source has run out
+		bool Next(Token& t);
+
+	private:
+		const char* current;
+		const char* end;
+		const char* lineStart;
+		int line{1};
+	};
+
 }
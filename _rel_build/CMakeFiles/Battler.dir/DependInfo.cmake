@@ -0,0 +1,25 @@
+
+# Consider dependencies only in project.
+set(CMAKE_DEPENDS_IN_PROJECT_ONLY OFF)
+
+# The set of languages for which implicit dependencies are needed:
+set(CMAKE_DEPENDS_LANGUAGES
+  )
+
+# The set of dependency files which are needed:
+set(CMAKE_DEPENDS_DEPENDENCY_FILES
+  "/root/repo/Battler.cpp" "CMakeFiles/Battler.dir/Battler.cpp.o" "gcc" "CMakeFiles/Battler.dir/Battler.cpp.o.d"
+  "/root/repo/Expression.cpp" "CMakeFiles/Battler.dir/Expression.cpp.o" "gcc" "CMakeFiles/Battler.dir/Expression.cpp.o.d"
+  "/root/repo/InterpreterErrors.cpp" "CMakeFiles/Battler.dir/InterpreterErrors.cpp.o" "gcc" "CMakeFiles/Battler.dir/InterpreterErrors.cpp.o.d"
+  "/root/repo/Parser.cpp" "CMakeFiles/Battler.dir/Parser.cpp.o" "gcc" "CMakeFiles/Battler.dir/Parser.cpp.o.d"
+  "/root/repo/vm/Bytecode.cpp" "CMakeFiles/Battler.dir/vm/Bytecode.cpp.o" "gcc" "CMakeFiles/Battler.dir/vm/Bytecode.cpp.o.d"
+  "/root/repo/vm/Compiler.cpp" "CMakeFiles/Battler.dir/vm/Compiler.cpp.o" "gcc" "CMakeFiles/Battler.dir/vm/Compiler.cpp.o.d"
+  "/root/repo/vm/game.cpp" "CMakeFiles/Battler.dir/vm/game.cpp.o" "gcc" "CMakeFiles/Battler.dir/vm/game.cpp.o.d"
+  )
+
+# Targets to which this target links.
+set(CMAKE_TARGET_LINKED_INFO_FILES
+  )
+
+# Fortran module output directory.
+set(CMAKE_Fortran_TARGET_MODULE_DIR "")
@@ -0,0 +1,23 @@
+file(REMOVE_RECURSE
+  "Battler"
+  "Battler.pdb"
+  "CMakeFiles/Battler.dir/Battler.cpp.o"
+  "CMakeFiles/Battler.dir/Battler.cpp.o.d"
+  "CMakeFiles/Battler.dir/Expression.cpp.o"
+  "CMakeFiles/Battler.dir/Expression.cpp.o.d"
+  "CMakeFiles/Battler.dir/InterpreterErrors.cpp.o"
+  "CMakeFiles/Battler.dir/InterpreterErrors.cpp.o.d"
+  "CMakeFiles/Battler.dir/Parser.cpp.o"
+  "CMakeFiles/Battler.dir/Parser.cpp.o.d"
+  "CMakeFiles/Battler.dir/vm/Bytecode.cpp.o"
+  "CMakeFiles/Battler.dir/vm/Bytecode.cpp.o.d"
+  "CMakeFiles/Battler.dir/vm/Compiler.cpp.o"
+  "CMakeFiles/Battler.dir/vm/Compiler.cpp.o.d"
+  "CMakeFiles/Battler.dir/vm/game.cpp.o"
+  "CMakeFiles/Battler.dir/vm/game.cpp.o.d"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/Battler.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,27 @@
+
+# Consider dependencies only in project.
+set(CMAKE_DEPENDS_IN_PROJECT_ONLY OFF)
+
+# The set of languages for which implicit dependencies are needed:
+set(CMAKE_DEPENDS_LANGUAGES
+  )
+
+# The set of dependency files which are needed:
+set(CMAKE_DEPENDS_DEPENDENCY_FILES
+  "/root/repo/Expression.cpp" "CMakeFiles/BattlerTester.dir/Expression.cpp.o" "gcc" "CMakeFiles/BattlerTester.dir/Expression.cpp.o.d"
+  "/root/repo/InterpreterErrors.cpp" "CMakeFiles/BattlerTester.dir/InterpreterErrors.cpp.o" "gcc" "CMakeFiles/BattlerTester.dir/InterpreterErrors.cpp.o.d"
+  "/root/repo/Parser.cpp" "CMakeFiles/BattlerTester.dir/Parser.cpp.o" "gcc" "CMakeFiles/BattlerTester.dir/Parser.cpp.o.d"
+  "/root/repo/tests/tests.cpp" "CMakeFiles/BattlerTester.dir/tests/tests.cpp.o" "gcc" "CMakeFiles/BattlerTester.dir/tests/tests.cpp.o.d"
+  "/root/repo/vm/Bytecode.cpp" "CMakeFiles/BattlerTester.dir/vm/Bytecode.cpp.o" "gcc" "CMakeFiles/BattlerTester.dir/vm/Bytecode.cpp.o.d"
+  "/root/repo/vm/Compiler.cpp" "CMakeFiles/BattlerTester.dir/vm/Compiler.cpp.o" "gcc" "CMakeFiles/BattlerTester.dir/vm/Compiler.cpp.o.d"
+  "/root/repo/vm/game.cpp" "CMakeFiles/BattlerTester.dir/vm/game.cpp.o" "gcc" "CMakeFiles/BattlerTester.dir/vm/game.cpp.o.d"
+  )
+
+# Targets to which this target links.
+set(CMAKE_TARGET_LINKED_INFO_FILES
+  "/root/repo/_rel_build/_deps/googletest-build/googletest/CMakeFiles/gtest_main.dir/DependInfo.cmake"
+  "/root/repo/_rel_build/_deps/googletest-build/googletest/CMakeFiles/gtest.dir/DependInfo.cmake"
+  )
+
+# Fortran module output directory.
+set(CMAKE_Fortran_TARGET_MODULE_DIR "")
@@ -0,0 +1,23 @@
+file(REMOVE_RECURSE
+  "BattlerTester"
+  "BattlerTester.pdb"
+  "CMakeFiles/BattlerTester.dir/Expression.cpp.o"
+  "CMakeFiles/BattlerTester.dir/Expression.cpp.o.d"
+  "CMakeFiles/BattlerTester.dir/InterpreterErrors.cpp.o"
+  "CMakeFiles/BattlerTester.dir/InterpreterErrors.cpp.o.d"
+  "CMakeFiles/BattlerTester.dir/Parser.cpp.o"
+  "CMakeFiles/BattlerTester.dir/Parser.cpp.o.d"
+  "CMakeFiles/BattlerTester.dir/tests/tests.cpp.o"
+  "CMakeFiles/BattlerTester.dir/tests/tests.cpp.o.d"
+  "CMakeFiles/BattlerTester.dir/vm/Bytecode.cpp.o"
+  "CMakeFiles/BattlerTester.dir/vm/Bytecode.cpp.o.d"
+  "CMakeFiles/BattlerTester.dir/vm/Compiler.cpp.o"
+  "CMakeFiles/BattlerTester.dir/vm/Compiler.cpp.o.d"
+  "CMakeFiles/BattlerTester.dir/vm/game.cpp.o"
+  "CMakeFiles/BattlerTester.dir/vm/game.cpp.o.d"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/BattlerTester.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
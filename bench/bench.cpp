@@ -0,0 +1,1080 @@
+/**
+ * bench.cpp
+ *
+ * Benchmarks for the battler compiler and VM.
+ * Build with -DBENCHMARKS=ON, then run `BattlerBench` to run every benchmark
+ * or `BattlerBench name...` to run just the named ones.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "../Compiler.h"
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds_since(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static std::vector<std::string> read_lines(const std::string& path)
+{
+    std::ifstream is(path);
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(is, line))
+    {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+// A game that never finishes on its own: every turn runs each phase, and every phase
+// shuffles cards between two stacks through a few if / elseif / else chains.
+static std::vector<std::string> synthetic_game(int nPhases)
+{
+    std::vector<std::string> lines = {
+        "game Synthetic start",
+            "players 2",
+            "card C start",
+                "int power",
+            "end",
+            "card One C start",
+                "power = 1",
+            "end",
+            "card Two C start",
+                "power = 2",
+            "end",
+            "visiblestack a",
+            "visiblestack b",
+            "int counter",
+            "place One -> a 50",
+            "place Two -> b 50",
+            "setup start end",
+    };
+
+    for (int i = 0; i < nPhases; i++)
+    {
+        std::vector<std::string> phase = {
+            "phase P" + std::to_string(i) + " start",
+                "if a.size > b.size start",
+                    "a -> b top 1",
+                "elseif b.size > a.size then",
+                    "b -> a top 1",
+                "else",
+                    "a -> b top 1",
+                "end",
+                "if a.top == One start",
+                    "counter = counter + 1",
+                "elseif a.top.power > 1 then",
+                    "counter = counter + 2",
+                "end",
+                "foreachplayer p start",
+                    "if b.top.power < 2 start",
+                        "b -> a top 1",
+                    "end",
+                "end",
+            "end",
+        };
+        lines.insert(lines.end(), phase.begin(), phase.end());
+    }
+
+    lines.push_back("turn start");
+    for (int i = 0; i < nPhases; i++)
+    {
+        lines.push_back("do P" + std::to_string(i));
+    }
+    lines.push_back("end");
+    lines.push_back("end");
+
+    return lines;
+}
+
+static void report(const std::string& name, double secs, uint64_t ops)
+{
+    std::cout << "  " << name << ": " << secs * 1000.0 << " ms";
+    if (ops > 0)
+    {
+        std::cout << ", " << ops << " opcodes, " << (ops / secs) / 1e6 << " M opcodes/s";
+    }
+    std::cout << std::endl;
+}
+
+static void bench_dispatch()
+{
+    std::cout << "dispatch" << std::endl;
+
+    {
+        Battler::Program compiled;
+        compiled.Compile(read_lines(BATTLER_SOURCE_DIR "/game_file.txt"));
+
+        const int reps = 2000;
+        uint64_t ops = 0;
+        double secs = 0;
+        for (int i = 0; i < reps; i++)
+        {
+            Battler::Program p = compiled;
+            p.Seed(i);
+            auto start = Clock::now();
+            p.Run(true);
+            p.RunSetup();
+            while (p.game().winner == -1)
+            {
+                p.RunTurn();
+            }
+            secs += seconds_since(start);
+            ops += p.executed_opcodes();
+        }
+        report("game_file.txt x" + std::to_string(reps), secs, ops);
+    }
+
+    {
+        Battler::Program p;
+        p.Compile(synthetic_game(20));
+        p.Seed(1);
+        p.Run(true);
+        p.RunSetup();
+        uint64_t setupOps = p.executed_opcodes();
+
+        const int turns = 2000;
+        auto start = Clock::now();
+        for (int i = 0; i < turns; i++)
+        {
+            p.RunTurn();
+        }
+        report("synthetic 20 phases x" + std::to_string(turns) + " turns", seconds_since(start), p.executed_opcodes());
+        // a turn that gives up early runs fewer opcodes, and looks faster for it. Compare this
+        // between builds before comparing their speed
+        std::cout << "  " << (p.executed_opcodes() - setupOps) / turns << " opcodes/turn" << std::endl;
+    }
+}
+
+// A turn that does nothing but read and write attributes: a global counter, a stack's size
+// and a phase local, from inside a foreachplayer loop so the lookups go through a few frames.
+static std::vector<std::string> attribute_access_game(int nStatements)
+{
+    std::vector<std::string> lines = {
+        "game Access start",
+            "players 2",
+            "visiblestack a",
+            "int counter",
+            "int limit",
+            "limit = 1000000",
+            "setup start end",
+            "phase P start",
+                "int local",
+                "foreachplayer p start",
+    };
+
+    for (int i = 0; i < nStatements; i++)
+    {
+        lines.push_back("counter = counter + a.size");
+        lines.push_back("local = local + counter");
+        lines.push_back("if counter > limit start counter = 0 end");
+    }
+
+    std::vector<std::string> tail = {
+                "end",
+            "end",
+            "turn start",
+                "do P",
+            "end",
+        "end",
+    };
+    lines.insert(lines.end(), tail.begin(), tail.end());
+
+    return lines;
+}
+
+static void bench_attribute_access()
+{
+    std::cout << "attribute access" << std::endl;
+
+    const int statements = 50;
+    Battler::Program p;
+    p.Compile(attribute_access_game(statements));
+    p.Run(true);
+    p.RunSetup();
+
+    // per statement block: counter, counter, a.size, local, local, counter, counter, limit
+    // and the counter written back on overflow, which never happens here
+    const int accessesPerStatement = 8;
+    const int turns = 2000;
+    auto start = Clock::now();
+    for (int i = 0; i < turns; i++)
+    {
+        p.RunTurn();
+    }
+    double secs = seconds_since(start);
+
+    uint64_t accesses = (uint64_t) turns * p.game().players.size() * statements * accessesPerStatement;
+    report(std::to_string(statements * 3) + " statements x" + std::to_string(turns) + " turns", secs, p.executed_opcodes());
+    std::cout << "  " << accesses << " attribute accesses, " << (secs * 1e9) / accesses << " ns/access" << std::endl;
+}
+
+// A turn made of if / elseif chains whose guards do arithmetic on attributes and stack sizes,
+// and compare stack positions to cards. The first operator of an expression is its root, so
+// every comparison comes first.
+static std::vector<std::string> conditions_game(int nChains)
+{
+    std::vector<std::string> lines = {
+        "game Conditions start",
+            "players 2",
+            "card C start",
+                "int power",
+            "end",
+            "card One C start",
+                "power = 1",
+            "end",
+            "visiblestack a",
+            "visiblestack b",
+            "int counter",
+            "int limit",
+            "limit = 1000000",
+            "place One -> a 10",
+            "place One -> b 20",
+            "setup start end",
+            "turn start",
+    };
+
+    for (int i = 0; i < nChains; i++)
+    {
+        std::vector<std::string> chain = {
+                "if limit < counter * 2 + a.size start",
+                    "counter = 0",
+                "elseif a.top.power > b.size - a.size then",
+                    "counter = counter + 1",
+                "elseif b.size < a.size * 2 + 1 then",
+                    "counter = counter + 2",
+                "elseif a.top == One then",
+                    "counter = counter + 3",
+                "end",
+        };
+        lines.insert(lines.end(), chain.begin(), chain.end());
+    }
+
+    lines.push_back("end");
+    lines.push_back("end");
+
+    return lines;
+}
+
+static void bench_conditions()
+{
+    std::cout << "conditions" << std::endl;
+
+    const int chains = 50;
+    Battler::Program p;
+    p.Compile(conditions_game(chains));
+    p.Run(true);
+    p.RunSetup();
+
+    const int turns = 2000;
+    auto start = Clock::now();
+    for (int i = 0; i < turns; i++)
+    {
+        p.RunTurn();
+    }
+    double secs = seconds_since(start);
+
+    report(std::to_string(chains) + " if chains x" + std::to_string(turns) + " turns", secs, p.executed_opcodes());
+    std::cout << "  " << (secs * 1e6) / turns << " us/turn" << std::endl;
+}
+
+static void bench_bytecode()
+{
+    std::cout << "bytecode" << std::endl;
+
+    std::vector<std::pair<std::string, std::vector<std::string>>> games = {
+        {"game_file.txt", read_lines(BATTLER_SOURCE_DIR "/game_file.txt")},
+        {"synthetic 20 phases", synthetic_game(20)},
+        {"50 if chains", conditions_game(50)},
+    };
+
+    for (auto& game : games)
+    {
+        Battler::Program p;
+        p.Compile(game.second);
+        std::cout << "  " << game.first << ": " << p.opcodes().size() << " opcodes, "
+            << p.constant_pool_size() << " constants" << std::endl;
+    }
+}
+
+// A game that defines nCards cards, each overriding one of four attributes it inherits.
+static std::vector<std::string> many_cards_game(int nCards)
+{
+    std::vector<std::string> lines = {
+        "game Cards start",
+            "card Base start",
+                "int power",
+                "int health",
+                "int cost",
+                "int rarity",
+            "end",
+    };
+
+    for (int i = 0; i < nCards; i++)
+    {
+        lines.push_back("card C" + std::to_string(i) + " Base start");
+        lines.push_back("power = " + std::to_string(i % 100));
+        lines.push_back("end");
+    }
+
+    lines.push_back("setup start end");
+    lines.push_back("turn start end");
+    lines.push_back("end");
+
+    return lines;
+}
+
+// The layout Attr had before it became a tagged value, to compare against
+struct LegacyAttr {
+    Battler::AttributeType type;
+    std::string s;
+    int stackRef;
+    std::tuple<int, int> stackPositionRef;
+    std::string cardRef;
+    std::string phaseRef;
+    std::vector<Battler::CardMatcher> cardSquence;
+    union {
+        int i{0};
+        bool b;
+        float f;
+        int playerRef;
+    };
+};
+
+static void bench_attr()
+{
+    std::cout << "attr" << std::endl;
+
+    const int nCards = 10000;
+    Battler::Program p;
+    p.Compile(many_cards_game(nCards));
+    auto start = Clock::now();
+    p.Run(true);
+    report(std::to_string(nCards) + " cards, load", seconds_since(start), p.executed_opcodes());
+
+    std::vector<Battler::AttrCont> attrs;
+    std::vector<std::unordered_map<Battler::Symbol, Battler::Attr>> hashedAttrs;
+    std::vector<std::unordered_map<Battler::Symbol, LegacyAttr>> legacyAttrs;
+    std::set<const Battler::Shape*> shapes;
+    size_t values = 0;
+    for (auto& card : p.game().cards)
+    {
+        Battler::AttrCont& cont = card.attributes;
+        attrs.push_back(cont);
+        shapes.insert(cont.GetShape());
+
+        std::unordered_map<Battler::Symbol, Battler::Attr> hashed;
+        std::unordered_map<Battler::Symbol, LegacyAttr> legacy;
+        for (size_t slot = 0; slot < cont.Values().size(); slot++)
+        {
+            Battler::Symbol name = cont.GetShape()->Names()[slot];
+            hashed[name] = cont.Values()[slot];
+            legacy[name].type = cont.Values()[slot].type;
+            legacy[name].i = cont.Values()[slot].i;
+        }
+        hashedAttrs.push_back(hashed);
+        legacyAttrs.push_back(legacy);
+        values += cont.Values().size();
+    }
+
+    std::cout << "  " << values << " attribute values in " << shapes.size() << " shapes: " << sizeof(Battler::Attr)
+        << " bytes each, " << values * sizeof(Battler::Attr) / 1024 << " KiB (was " << sizeof(LegacyAttr)
+        << " bytes each, " << values * sizeof(LegacyAttr) / 1024 << " KiB)" << std::endl;
+
+    // copying a card's attributes is what generating an instance of it costs
+    const int reps = 20;
+    long checksum = 0;
+    start = Clock::now();
+    for (int r = 0; r < reps; r++)
+    {
+        for (auto& a : attrs)
+        {
+            auto copy = a;
+            checksum += copy.Values().size();
+        }
+    }
+    report("copy card attributes x" + std::to_string(reps), seconds_since(start), 0);
+
+    start = Clock::now();
+    for (int r = 0; r < reps; r++)
+    {
+        for (auto& a : hashedAttrs)
+        {
+            auto copy = a;
+            checksum += copy.size();
+        }
+    }
+    report("copy card attributes as hash maps x" + std::to_string(reps), seconds_since(start), 0);
+
+    start = Clock::now();
+    for (int r = 0; r < reps; r++)
+    {
+        for (auto& a : legacyAttrs)
+        {
+            auto copy = a;
+            checksum += copy.size();
+        }
+    }
+    report("copy legacy card attributes x" + std::to_string(reps), seconds_since(start), 0);
+
+    if (checksum != 3L * reps * values)
+    {
+        std::cout << "  unexpected checksum " << checksum << std::endl;
+    }
+
+    const int nInstances = 1000000;
+    std::vector<Battler::CardInstance> deck;
+    deck.reserve(nInstances);
+    int card = p.game().FindCard(p.game().symbols.Find("C0"));
+    start = Clock::now();
+    for (int i = 0; i < nInstances; i++)
+    {
+        deck.push_back(p.game().GenerateCard(card));
+    }
+    report("generate " + std::to_string(nInstances) + " card instances", seconds_since(start), 0);
+    std::cout << "  " << sizeof(Battler::CardInstance) << " bytes per instance until it's written to, "
+        << nInstances * sizeof(Battler::CardInstance) / (1024 * 1024) << " MiB in all" << std::endl;
+}
+
+// Two big stacks that pass cards back and forth at their bottoms, so every move inserts or
+// removes at the front of a stack.
+static std::vector<std::string> bottom_moves_game(int nCards, int nMoves)
+{
+    std::vector<std::string> lines = {
+        "game Bottoms start",
+            "card C start end",
+            "visiblestack a",
+            "visiblestack b",
+            "place C -> a " + std::to_string(nCards),
+            "place C -> b " + std::to_string(nCards),
+            "setup start end",
+            "turn start",
+    };
+
+    for (int i = 0; i < nMoves; i++)
+    {
+        lines.push_back("a ->_ b bottom 1");
+        lines.push_back("b ->_ a bottom 1");
+    }
+
+    lines.push_back("end");
+    lines.push_back("end");
+
+    return lines;
+}
+
+static void bench_stacks()
+{
+    std::cout << "stacks" << std::endl;
+
+    const int cards = 50000;
+    const int moves = 10;
+    Battler::Program p;
+    p.Compile(bottom_moves_game(cards, moves));
+    p.Run(true);
+    p.RunSetup();
+
+    const int turns = 1000;
+    auto start = Clock::now();
+    for (int i = 0; i < turns; i++)
+    {
+        p.RunTurn();
+    }
+    double secs = seconds_since(start);
+
+    report(std::to_string(2 * moves) + " bottom moves between " + std::to_string(cards) + " card stacks x"
+        + std::to_string(turns) + " turns", secs, p.executed_opcodes());
+    std::cout << "  " << (secs * 1e9) / (2 * moves * turns) << " ns/move" << std::endl;
+}
+
+// Every turn a player picks cards from anywhere in a big pool, and they're put back on top.
+static std::vector<std::string> pick_game(int nCards, int nPicks)
+{
+    return {
+        "game Picks start",
+            "card C start end",
+            "visiblestack pool",
+            "visiblestack hand",
+            "place C -> pool " + std::to_string(nCards),
+            "setup start end",
+            "turn start",
+                "choose pool -> hand " + std::to_string(nPicks),
+                "hand -> pool top " + std::to_string(nPicks),
+            "end",
+        "end",
+    };
+}
+
+static void bench_picks()
+{
+    std::cout << "picks" << std::endl;
+
+    const int cards = 50000;
+    const int picks = 100;
+    Battler::Program p;
+    p.Compile(pick_game(cards, picks));
+    p.Run(true);
+    p.RunSetup();
+
+    // the picked cards go back on the pool, so its cards stay the same. Reading them every turn
+    // would close the gaps the picks leave, which isn't what's measured here
+    const std::deque<Battler::CardInstance> pool = p.game().stacks[0].Cards();
+
+    const int turns = 200;
+    double secs = 0;
+    for (int i = 0; i < turns; i++)
+    {
+        p.RunTurn();
+        // spread the picks over the whole pool
+        std::vector<Battler::CardInstance> picked;
+        for (int j = 0; j < picks; j++)
+        {
+            picked.push_back(pool[(j * 7919 + i) % pool.size()]);
+        }
+
+        auto start = Clock::now();
+        for (auto& card : picked)
+        {
+            p.AddCardToWaitingInput(card);
+        }
+        p.RunTurn(true);
+        secs += seconds_since(start);
+    }
+
+    report(std::to_string(picks) + " picks from " + std::to_string(cards) + " cards x" + std::to_string(turns)
+        + " turns", secs, 0);
+    std::cout << "  " << (secs * 1e6) / turns << " us/pick of " << picks << std::endl;
+}
+
+// nFamilies card families under one root card, each with nPerFamily concrete cards. Every turn
+// draws random cards of the whole class and of one family.
+static std::vector<std::string> random_game(int nFamilies, int nPerFamily, int nDraws)
+{
+    std::vector<std::string> lines = {
+        "game Random start",
+            "card Root start",
+                "int health",
+            "end",
+    };
+    for (int f = 0; f < nFamilies; f++)
+    {
+        lines.push_back("card F" + std::to_string(f) + " Root start end");
+        for (int c = 0; c < nPerFamily; c++)
+        {
+            lines.push_back("card C" + std::to_string(f) + "_" + std::to_string(c) + " F" + std::to_string(f)
+                + " start end");
+        }
+    }
+    lines.insert(lines.end(), {
+            "visiblestack deck",
+            "setup start end",
+            "turn start",
+                "random Root -> deck " + std::to_string(nDraws),
+                "random F0 -> deck " + std::to_string(nDraws),
+            "end",
+        "end",
+    });
+    return lines;
+}
+
+static void bench_random()
+{
+    std::cout << "random" << std::endl;
+
+    const int families = 40;
+    const int perFamily = 50;
+    const int draws = 10;
+    Battler::Program p;
+    p.Compile(random_game(families, perFamily, draws));
+    p.Run(true);
+    p.RunSetup();
+
+    const int turns = 2000;
+    auto start = Clock::now();
+    for (int i = 0; i < turns; i++)
+    {
+        p.RunTurn();
+    }
+    double secs = seconds_since(start);
+    report(std::to_string(2 * draws) + " random cards from " + std::to_string(p.game().cards.size())
+        + " card classes x" + std::to_string(turns) + " turns", secs, p.executed_opcodes());
+    std::cout << "  " << (secs * 1e6) / turns << " us/turn" << std::endl;
+}
+
+// Every turn compares and moves cards at the top of a stack of nCards cards, so none of it should
+// cost more as the stack grows.
+static std::vector<std::string> stack_size_game(int nCards)
+{
+    return {
+        "game StackSize start",
+            "card C start",
+                "int power",
+            "end",
+            "card D C start end",
+            "visiblestack InPlay",
+            "visiblestack Other",
+            "int matches",
+            "place C -> InPlay " + std::to_string(nCards),
+            "place D -> Other 1",
+            "setup start end",
+            "turn start",
+                "if InPlay.top == InPlay.top - 1 start",
+                    "matches = matches + InPlay.top.power + InPlay.size",
+                "end",
+                "if InPlay.bottom == Other.top start",
+                    "matches = matches - 1",
+                "end",
+                "Other -> InPlay top 1",
+                "InPlay -> Other top 1",
+            "end",
+        "end",
+    };
+}
+
+static void bench_stack_size()
+{
+    std::cout << "stack size" << std::endl;
+
+    const int turns = 20000;
+    for (int cards : {10, 100, 1000, 10000, 100000})
+    {
+        Battler::Program p;
+        p.Compile(stack_size_game(cards));
+        p.Run(true);
+        p.RunSetup();
+
+        auto start = Clock::now();
+        for (int i = 0; i < turns; i++)
+        {
+            p.RunTurn();
+        }
+        double secs = seconds_since(start);
+
+        std::cout << "  " << cards << " cards: " << (secs * 1e9) / turns << " ns/turn" << std::endl;
+    }
+}
+
+// A deck of nCards cards, with the cards the sequences look for near its top.
+static std::vector<std::string> sequence_game(int nCards, int nChecks)
+{
+    std::vector<std::string> lines = {
+        "game Sequences start",
+            "card A start end",
+            "card B start end",
+            "card C start end",
+            "visiblestack deck",
+            "int matches",
+            "place C -> deck " + std::to_string(nCards),
+            "place A -> deck 1",
+            "place C -> deck 1",
+            "place B -> deck 1",
+            "place C -> deck 2",
+            "setup start end",
+            "turn start",
+    };
+    for (int i = 0; i < nChecks; i++)
+    {
+        lines.insert(lines.end(), {
+                "if deck == [: B _ A :] start",
+                    "matches = matches + 1",
+                "end",
+                "if deck == [C C B] start",
+                    "matches = matches + 1",
+                "end",
+        });
+    }
+    lines.insert(lines.end(), {
+            "end",
+        "end",
+    });
+    return lines;
+}
+
+static void bench_sequences()
+{
+    std::cout << "sequences" << std::endl;
+
+    const int checks = 10;
+    const int turns = 2000;
+    for (int cards : {10, 1000, 100000})
+    {
+        Battler::Program p;
+        p.Compile(sequence_game(cards, checks));
+        p.Run(true);
+        p.RunSetup();
+
+        auto start = Clock::now();
+        for (int i = 0; i < turns; i++)
+        {
+            p.RunTurn();
+        }
+        double secs = seconds_since(start);
+
+        std::cout << "  " << 2 * checks << " sequence checks on " << cards << " cards: " << (secs * 1e6) / turns
+            << " us/turn" << std::endl;
+    }
+}
+
+// Time from an empty Program to the first turn, compiling the source each time or loading the
+// bytecode image compiled from it.
+static void bench_startup()
+{
+    std::cout << "startup" << std::endl;
+
+    std::string dir = std::filesystem::temp_directory_path().string();
+    std::vector<std::pair<std::string, std::vector<std::string>>> games = {
+        {"game_file.txt", read_lines(BATTLER_SOURCE_DIR "/game_file.txt")},
+        {"synthetic 500 phases", synthetic_game(500)},
+        {"2000 cards", many_cards_game(2000)},
+    };
+
+    const int reps = 50;
+    for (size_t g = 0; g < games.size(); g++)
+    {
+        std::string source = dir + "/battler_bench_" + std::to_string(g) + ".txt";
+        std::string image = dir + "/battler_bench_" + std::to_string(g) + ".bbc";
+        std::string loadedImage = dir + "/battler_bench_" + std::to_string(g) + "_loaded.bbc";
+        {
+            std::ofstream out(source);
+            for (auto& line : games[g].second)
+            {
+                out << line << "\n";
+            }
+        }
+        {
+            Battler::Program p;
+            p.Compile(games[g].second);
+            p.Save(image);
+            p.Run(true);
+            p.Save(loadedImage);
+        }
+
+        auto start = Clock::now();
+        for (int i = 0; i < reps; i++)
+        {
+            Battler::Program p;
+            p.Compile(read_lines(source));
+            p.Run(true);
+            p.RunSetup();
+        }
+        double compiled = seconds_since(start) / reps;
+
+        start = Clock::now();
+        for (int i = 0; i < reps; i++)
+        {
+            Battler::Program p;
+            p.Load(image);
+            p.Run(true);
+            p.RunSetup();
+        }
+        double loaded = seconds_since(start) / reps;
+
+        // Run(true) does nothing for an image saved after loading
+        start = Clock::now();
+        for (int i = 0; i < reps; i++)
+        {
+            Battler::Program p;
+            p.Load(loadedImage);
+            p.Run(true);
+            p.RunSetup();
+        }
+        double preloaded = seconds_since(start) / reps;
+
+        std::cout << "  " << games[g].first << ": " << compiled * 1e6 << " us from source, " << loaded * 1e6
+            << " us from bytecode, " << preloaded * 1e6 << " us from a loaded image" << std::endl;
+
+        std::remove(source.c_str());
+        std::remove(image.c_str());
+        std::remove(loadedImage.c_str());
+    }
+}
+
+// lexing and compiling a ~500k line game, from lines and straight from its file
+static void bench_lexer()
+{
+    std::cout << "lexer" << std::endl;
+
+    std::vector<std::string> lines = synthetic_game(26000);
+    std::string path = std::filesystem::temp_directory_path().string() + "/battler_bench_lexer.txt";
+    {
+        std::ofstream out(path);
+        for (auto& line : lines)
+        {
+            out << line << "\n";
+        }
+    }
+    std::cout << "  " << lines.size() << " lines" << std::endl;
+
+    auto start = Clock::now();
+    Battler::Program parsed;
+    parsed._Parse(lines);
+    double secs = seconds_since(start);
+    size_t nTokens = parsed._Tokens().size();
+    std::cout << "  lex: " << secs * 1000.0 << " ms, " << secs * 1e9 / nTokens << " ns/token" << std::endl;
+
+    // just the lexer over an indented copy of the game, the way games are written, without
+    // storing the tokens: best of a few passes
+    std::string source;
+    auto ends_with = [](const std::string& line, const std::string& word) {
+        return line.size() >= word.size() && line.compare(line.size() - word.size(), word.size(), word) == 0;
+    };
+    int depth = 0;
+    for (auto& line : lines)
+    {
+        bool closes = line == "end" || line.rfind("else", 0) == 0;
+        bool opens = ends_with(line, "start") || ends_with(line, "then") || line == "else";
+        if (closes && depth > 0)
+        {
+            depth--;
+        }
+        source.append(4 * depth, ' ');
+        source += line;
+        source += '\n';
+        if (opens)
+        {
+            depth++;
+        }
+    }
+    double best = 1e9;
+    size_t nScanned = 0;
+    for (int pass = 0; pass < 5; pass++)
+    {
+        start = Clock::now();
+        Battler::Lexer lexer(source);
+        Battler::Token t;
+        nScanned = 0;
+        while (lexer.Next(t))
+        {
+            nScanned++;
+        }
+        best = std::min(best, seconds_since(start));
+    }
+    std::cout << "  scan: " << source.size() / 1048576.0 << " MB, " << nScanned / best / 1e6 << " M tokens/s, "
+        << best * 1e9 / nScanned << " ns/token" << std::endl;
+
+    start = Clock::now();
+    {
+        Battler::Program p;
+        p.Compile(read_lines(path));
+    }
+    report("compile from lines", seconds_since(start), 0);
+
+    start = Clock::now();
+    {
+        Battler::Program p;
+        p.CompileFile(path);
+    }
+    report("compile from file", seconds_since(start), 0);
+
+    std::remove(path.c_str());
+}
+
+// the most memory this process has had resident, in KB
+static long peak_rss_kb()
+{
+#ifdef _WIN32
+    return -1;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+#endif
+}
+
+// compiling a big game: 20k cards and 2k phases. Peak RSS is the process's, run this on its own
+static void bench_ast()
+{
+    std::cout << "ast" << std::endl;
+
+    std::vector<std::string> lines = synthetic_game(2000);
+    std::vector<std::string> cards = many_cards_game(20000);
+    // the cards, without many_cards_game's game, setup, turn and end lines
+    lines.insert(lines.begin() + 1, cards.begin() + 1, cards.end() - 3);
+    std::cout << "  " << lines.size() << " lines" << std::endl;
+
+    long before = peak_rss_kb();
+    auto start = Clock::now();
+    {
+        Battler::Program p;
+        p.Compile(lines);
+    }
+    report("compile", seconds_since(start), 0);
+    std::cout << "  peak RSS: " << peak_rss_kb() / 1024 << " MB (" << before / 1024 << " MB before compiling)" << std::endl;
+}
+
+// The ast benchmark's game, compiled with its game block's expressions spread over more threads.
+static void bench_parallel_compile()
+{
+    std::cout << "parallel" << std::endl;
+
+    std::vector<std::string> lines = synthetic_game(2000);
+    std::vector<std::string> cards = many_cards_game(20000);
+    lines.insert(lines.begin() + 1, cards.begin() + 1, cards.end() - 3);
+    std::cout << "  " << lines.size() << " lines, " << std::thread::hardware_concurrency() << " cores" << std::endl;
+
+    for (unsigned threads : {1, 2, 4, 8})
+    {
+        Battler::Program p;
+        p.SetCompileThreads(threads);
+        auto start = Clock::now();
+        p.Compile(lines);
+        report("compile on " + std::to_string(threads) + " threads", seconds_since(start), 0);
+    }
+}
+
+// A game whose 20000 cards are in a catalogue module of their own, compiled with the module
+// pasted in, with an empty module cache and with the catalogue cached.
+static void bench_modules()
+{
+    std::cout << "modules" << std::endl;
+
+    namespace fs = std::filesystem;
+    fs::path dir = fs::temp_directory_path() / "battler_bench_modules";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+
+    std::vector<std::string> game = synthetic_game(200);
+    std::vector<std::string> cards = many_cards_game(20000);
+    // the cards, without many_cards_game's game, setup, turn and end lines
+    std::vector<std::string> catalogue(cards.begin() + 1, cards.end() - 3);
+    std::vector<std::string> pasted = game;
+    pasted.insert(pasted.begin() + 1, catalogue.begin(), catalogue.end());
+    game.insert(game.begin() + 1, "include \"cards.battler\"");
+
+    auto write = [](const fs::path& path, const std::vector<std::string>& lines) {
+        std::ofstream out(path);
+        for (auto& line : lines)
+        {
+            out << line << "\n";
+        }
+    };
+    write(dir / "pasted.battler", pasted);
+    write(dir / "game.battler", game);
+    write(dir / "cards.battler", catalogue);
+
+    auto compile = [&](const fs::path& path) {
+        auto start = Clock::now();
+        Battler::Program p;
+        p.SetModuleCache((dir / "cache").string());
+        p.CompileFile(path.string());
+        return seconds_since(start);
+    };
+
+    report("pasted into the game file", compile(dir / "pasted.battler"), 0);
+    report("included, not cached", compile(dir / "game.battler"), 0);
+    report("included, cached", compile(dir / "game.battler"), 0);
+
+    fs::remove_all(dir);
+}
+
+// Changing one phase of a large game, by reloading it into the running program and by compiling
+// and loading it from scratch.
+static void bench_reload()
+{
+    std::cout << "reload" << std::endl;
+
+    std::vector<std::string> lines = synthetic_game(2000);
+    std::vector<std::string> cards = many_cards_game(20000);
+    lines.insert(lines.begin() + 1, cards.begin() + 1, cards.end() - 3);
+    std::cout << "  " << lines.size() << " lines" << std::endl;
+
+    Battler::Program p;
+    p.Compile(lines);
+    p.Seed(1);
+    p.Run(true);
+    p.RunSetup();
+    p.RunTurn();
+
+    auto phase = std::find(lines.begin(), lines.end(), "phase P1000 start");
+    *(phase + 2) = "a -> b top 2";
+
+    auto start = Clock::now();
+    p.Reload(lines);
+    report("reload one phase", seconds_since(start), 0);
+
+    start = Clock::now();
+    {
+        Battler::Program fresh;
+        fresh.Compile(lines);
+        fresh.Seed(1);
+        fresh.Run(true);
+    }
+    report("compile and load", seconds_since(start), 0);
+}
+
+int main(int argc, char* argv[])
+{
+    std::map<std::string, std::function<void()>> benchmarks = {
+        {"dispatch", bench_dispatch},
+        {"access", bench_attribute_access},
+        {"conditions", bench_conditions},
+        {"bytecode", bench_bytecode},
+        {"attr", bench_attr},
+        {"stacks", bench_stacks},
+        {"picks", bench_picks},
+        {"random", bench_random},
+        {"size", bench_stack_size},
+        {"sequences", bench_sequences},
+        {"startup", bench_startup},
+        {"lexer", bench_lexer},
+        {"ast", bench_ast},
+        {"reload", bench_reload},
+        {"parallel", bench_parallel_compile},
+        {"modules", bench_modules},
+    };
+
+    try {
+        if (argc < 2)
+        {
+            for (auto& b : benchmarks)
+            {
+                b.second();
+            }
+            return 0;
+        }
+
+        for (int i = 1; i < argc; i++)
+        {
+            auto b = benchmarks.find(argv[i]);
+            if (b == benchmarks.end())
+            {
+                std::cout << "unknown benchmark " << argv[i] << std::endl;
+                return 1;
+            }
+            b->second();
+        }
+    } catch (Battler::VMError e) {
+        std::cout << "VM Error " << e.reason << std::endl;
+        return 1;
+    } catch (Battler::CompileError e) {
+        std::cout << "Compile Error " << e.reason << std::endl;
+        return 1;
+    } catch (Battler::BytecodeError e) {
+        std::cout << "Bytecode Error " << e.reason << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
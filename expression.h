@@ -5,6 +5,9 @@
 
 #include <vector>
 #include <string>
+#include <cstring>
+#include <initializer_list>
+#include <type_traits>
 #include <utility>
 #include <cctype>
 #include <cassert>
@@ -82,6 +85,7 @@ namespace Battler {
         WINNER_DECLARATION,
         LOOSER_DECLARATION,
         DO_DECLARATION,
+        INCLUDE_DECLARATION, // include "cards/ships.battler"
         PLAYERS_DECLARATION,
         WHERE_FROM_TRANSFER_CONTRAINT,
         WHERE_TO_TRANSFER_CONTRAINT,
@@ -92,35 +96,97 @@ namespace Battler {
     using std::cout;
     using std::endl;
 
+    // A run of tokens or expressions that lives in an ExpressionArena. Copying it copies two words
+    template <class T>
+    class ArenaSpan {
+    public:
+        ArenaSpan() {}
+        ArenaSpan(const T* data, size_t size) : m_data(data), m_size(size) {}
+
+        const T* begin() const { return m_data; }
+        const T* end() const { return m_data + m_size; }
+        size_t size() const { return m_size; }
+        bool empty() const { return m_size == 0; }
+        const T& operator[](size_t i) const { return m_data[i]; }
+        const T& back() const { return m_data[m_size - 1]; }
+
+        // the elements in [from, to)
+        ArenaSpan Slice(size_t from, size_t to) const { return ArenaSpan(m_data + from, to - from); }
+        // every element but the last n
+        ArenaSpan DropBack(size_t n = 1) const { return ArenaSpan(m_data, m_size - n); }
+
+    private:
+        const T* m_data{nullptr};
+        size_t m_size{0};
+    };
+
+    // A node of the syntax tree. Its tokens and children are spans of the arena it was parsed into,
+    // so nodes are passed around by value or reference without copying their subtrees.
     class Expression {
     public:
-        ExpressionType type;
-        std::vector<Token> tokens;
-        std::vector<Expression> children;
+        ExpressionType type{ExpressionType::NONE};
+        ArenaSpan<Token> tokens;
+        ArenaSpan<Expression> children;
         Expression() {}
-        Expression(ExpressionType type_in, std::vector<Token> tokens_in) : type( type_in ), tokens(tokens_in) {}
+        Expression(ExpressionType type_in, ArenaSpan<Token> tokens_in) : type( type_in ), tokens(tokens_in) {}
+    };
+
+    // Holds every token list and child list of a parsed game, in a few large blocks. The parser
+    // builds each list in a scratch vector and copies it in once the list is complete.
+    class ExpressionArena {
+    public:
+        ArenaSpan<Token> Tokens(const std::vector<Token>& tokens) { return copy(tokens.data(), tokens.size()); }
+        ArenaSpan<Token> Tokens(std::initializer_list<Token> tokens) { return copy(tokens.begin(), tokens.size()); }
+        ArenaSpan<Expression> Children(const std::vector<Expression>& children) { return copy(children.data(), children.size()); }
+        ArenaSpan<Expression> Children(std::initializer_list<Expression> children) { return copy(children.begin(), children.size()); }
+
+        // bytes handed out so far
+        size_t Used() const { return used; }
+
+    private:
+        static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+        std::vector<std::unique_ptr<char[]>> blocks;
+        char* next{nullptr};
+        size_t left{0};
+        size_t used{0};
+
+        void* allocate(size_t bytes, size_t alignment);
+
+        template <class T>
+        ArenaSpan<T> copy(const T* items, size_t n) {
+            // blocks are freed without running destructors
+            static_assert(std::is_trivially_copyable<T>::value && std::is_trivially_destructible<T>::value, "arena elements must be plain values");
+            if (n == 0) {
+                return ArenaSpan<T>();
+            }
+            T* data = static_cast<T*>(allocate(n * sizeof(T), alignof(T)));
+            std::memcpy(static_cast<void*>(data), items, n * sizeof(T));
+            return ArenaSpan<T>(data, n);
+        }
     };
 
     ExpressionType GetExpressionTypeFromOperatorTokenType(TokenType type);
     std::vector<Token> GetIdentifierTokens(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
-    std::vector<Expression> GetBlock(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
-    Expression GetGameDelcarationExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
-    Expression GetAttrDeclarationExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
-    Expression GetFactorExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
-    Expression GetAssignmentExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end, std::vector<Token>::iterator& leftAccumulationStart);
-    Expression GetCardDeclarationExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
-    Expression GetSetupExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
-    Expression GetForEachPlayerExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
-    Expression GetStackMoveSourceExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
-    Expression GetStackMoveTargetExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end, bool requirePosition=true, bool requireAmount=true);
-    Expression GetPhaseDeclarationExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
-    Expression GetOnPlaceExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
-    Expression GetIfExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
-    Expression GetWinnerIsExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
-    Expression GetTurnExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
-    Expression GetDoExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
-    Expression GetPlayersExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
-    Expression GetExpression(std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
+    std::vector<Expression> GetBlock(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
+    Expression GetGameDelcarationExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
+    Expression GetAttrDeclarationExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
+    Expression GetFactorExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
+    Expression GetAssignmentExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end, std::vector<Token>::iterator& leftAccumulationStart);
+    Expression GetCardDeclarationExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
+    Expression GetSetupExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
+    Expression GetForEachPlayerExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
+    Expression GetStackMoveSourceExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
+    Expression GetStackMoveTargetExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end, bool requirePosition=true, bool requireAmount=true);
+    Expression GetPhaseDeclarationExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
+    Expression GetOnPlaceExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
+    Expression GetIfExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
+    Expression GetWinnerIsExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
+    Expression GetTurnExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
+    Expression GetDoExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
+    Expression GetPlayersExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
+    Expression GetIncludeExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
+    Expression GetExpression(ExpressionArena& arena, std::vector<Token>::iterator& current, const std::vector<Token>::iterator end);
 
 
 }
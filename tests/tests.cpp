@@ -2,12 +2,45 @@
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <set>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <cstdlib>
+#include <memory>
+#include <new>
 
 #include "../Compiler.h"
 #include "../expression.h"
 #include "../vm/game.h"
 #include "../interpreter_errors.h"
 
+// every heap allocation in the tester goes through here, so tests can pin hot paths at none
+static std::atomic<size_t> g_allocations{0};
+
+void* operator new(std::size_t size)
+{
+    g_allocations++;
+    if (void* p = std::malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
 TEST(EndToEndTests, BasicGame)
 {
     auto lines = std::vector<std::string>() = {
@@ -43,48 +76,49 @@ TEST(EndToEndTests, BasicGame)
     
     EXPECT_EQ(p.game().cards.size(), 2);
     EXPECT_EQ(p.game().name, "Test");
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 0);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 0);
     
     auto cards = p.game().cards;
+    auto& symbols = p.game().symbols;
     
-    auto parentCardIt = cards.find("Parent");
-    EXPECT_NE(parentCardIt, cards.end());
+    int parentID = p.game().FindCard(symbols.Find("Parent"));
+    EXPECT_NE(parentID, -1);
     
-    auto childCardIt = cards.find("Child");
-    EXPECT_NE(childCardIt, cards.end());
+    int childID = p.game().FindCard(symbols.Find("Child"));
+    EXPECT_NE(childID, -1);
     
-    Battler::Card parent = parentCardIt->second;
-    Battler::Card child = childCardIt->second;
+    Battler::Card parent = cards[parentID];
+    Battler::Card child = cards[childID];
     
-    EXPECT_EQ(parent.name, "Parent");
-    EXPECT_TRUE(parent.attributes.Contains("health"));
-    EXPECT_TRUE(parent.attributes.Contains("attack"));
-    EXPECT_FALSE(parent.attributes.Contains("defence"));
-    EXPECT_EQ(parent.attributes.Get("health").i, 0);
-    EXPECT_EQ(parent.attributes.Get("attack").i, 0);
+    EXPECT_EQ(parent.name, symbols.Find("Parent"));
+    EXPECT_TRUE(parent.attributes.Contains(symbols.Find("health")));
+    EXPECT_TRUE(parent.attributes.Contains(symbols.Find("attack")));
+    EXPECT_FALSE(parent.attributes.Contains(symbols.Find("defence")));
+    EXPECT_EQ(parent.attributes.Get(symbols.Find("health")).i, 0);
+    EXPECT_EQ(parent.attributes.Get(symbols.Find("attack")).i, 0);
     EXPECT_EQ(parent.ID, 0);
     EXPECT_EQ(parent.UUID, -1);
     
-    EXPECT_EQ(child.name, "Child");
-    EXPECT_TRUE(child.attributes.Contains("health"));
-    EXPECT_TRUE(child.attributes.Contains("attack"));
-    EXPECT_TRUE(child.attributes.Contains("defence"));
-    EXPECT_EQ(child.attributes.Get("health").i, 90); // this is going to be wrong until we get operator presidence working
-    EXPECT_EQ(child.attributes.Get("attack").i, 0);
-    EXPECT_EQ(child.attributes.Get("defence").i, 0);
+    EXPECT_EQ(child.name, symbols.Find("Child"));
+    EXPECT_TRUE(child.attributes.Contains(symbols.Find("health")));
+    EXPECT_TRUE(child.attributes.Contains(symbols.Find("attack")));
+    EXPECT_TRUE(child.attributes.Contains(symbols.Find("defence")));
+    EXPECT_EQ(child.attributes.Get(symbols.Find("health")).i, 90); // this is going to be wrong until we get operator presidence working
+    EXPECT_EQ(child.attributes.Get(symbols.Find("attack")).i, 0);
+    EXPECT_EQ(child.attributes.Get(symbols.Find("defence")).i, 0);
     EXPECT_EQ(child.ID, 1);
     EXPECT_EQ(parent.UUID, -1);
     
     p.RunSetup();
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 1);
-    EXPECT_EQ(p.game().stacks[0].cards[0].UUID, 1);
-    EXPECT_EQ(p.game().stacks[1].cards.size(), 0);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 1);
+    EXPECT_EQ(p.game().stacks[0].Cards()[0].UUID, 1);
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 0);
     
     p.RunTurn();
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 0);
-    EXPECT_EQ(p.game().stacks[1].cards.size(), 2);
-    EXPECT_EQ(p.game().stacks[1].cards[1].UUID, 1);
-    EXPECT_EQ(p.game().stacks[1].cards[0].UUID, 2);    
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 0);
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 2);
+    EXPECT_EQ(p.game().stacks[1].Cards()[1].UUID, 1);
+    EXPECT_EQ(p.game().stacks[1].Cards()[0].UUID, 2);    
 }
 
 
@@ -124,21 +158,21 @@ TEST(EndToEndTests, ChooseMoveInstr)
     p.RunTurn();
     
     EXPECT_TRUE(p.m_waitingForUserInteraction);
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 1);
-    EXPECT_EQ(p.game().stacks[1].cards.size(), 0);
-    EXPECT_FALSE(p.AddCardToWaitingInput(p.game().stacks[0].cards[0]));
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 1);
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 0);
+    EXPECT_FALSE(p.AddCardToWaitingInput(p.game().stacks[0].Cards()[0]));
     
     EXPECT_FALSE(p.m_waitingForUserInteraction);
     p.RunTurn(true);
     
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 0);
-    EXPECT_EQ(p.game().stacks[1].cards.size(), 1);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 0);
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 1);
     
     p.RunTurn();
     // the source stack should be empty, so we should not expect any more user input
     EXPECT_FALSE(p.m_waitingForUserInteraction);
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 0);
-    EXPECT_EQ(p.game().stacks[1].cards.size(), 1);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 0);
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 1);
 }
 
 TEST(EndToEndTests, CutTest)
@@ -174,13 +208,13 @@ TEST(EndToEndTests, CutTest)
     p.Run(true);
     p.RunSetup();
     
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 20);
-    EXPECT_EQ(p.game().stacks[1].cards.size(), 0);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 20);
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 0);
     
     p.RunTurn();
     
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 10);
-    EXPECT_EQ(p.game().stacks[1].cards.size(), 10);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 10);
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 10);
 }
 
 TEST(ParserTest, CutTest)
@@ -199,6 +233,90 @@ TEST(ParserTest, CutTest)
     EXPECT_EQ(tokens[4].type, Battler::TokenType::number);
 }
 
+TEST(ParserTest, TokensPointIntoTheSource)
+{
+    std::string source = "game g start\n    int x # a comment -> with tokens\n\n  x = 10 /> y\r\nend";
+    Battler::Lexer lexer(source);
+
+    std::vector<Battler::Token> tokens;
+    tokens.reserve(16);
+    Battler::Token t;
+    size_t before = g_allocations;
+    while (lexer.Next(t))
+    {
+        tokens.push_back(t);
+    }
+    EXPECT_EQ(g_allocations - before, 0);
+
+    ASSERT_EQ(tokens.size(), 11);
+    EXPECT_EQ(tokens[3].text, "int");
+    EXPECT_EQ(tokens[3].l, 2);
+    EXPECT_EQ(tokens[3].c, 4);
+    EXPECT_EQ(tokens[5].text, "x");
+    EXPECT_EQ(tokens[5].l, 4);
+    EXPECT_EQ(tokens[5].c, 2);
+    EXPECT_EQ(tokens[7].type, Battler::TokenType::number);
+    EXPECT_EQ(tokens[7].text, "10");
+    EXPECT_EQ(tokens[8].type, Battler::TokenType::cut);
+    EXPECT_EQ(tokens[8].c, 9);
+    EXPECT_EQ(tokens[10].text, "end");
+    EXPECT_EQ(tokens[10].l, 5);
+    EXPECT_EQ(tokens[10].c, 0);
+
+    for (auto& token : tokens)
+    {
+        EXPECT_GE(token.text.data(), source.data());
+        EXPECT_LE(token.text.data() + token.text.size(), source.data() + source.size());
+    }
+}
+
+TEST(ParserTest, LongRunsSplitWhereTheyEnd)
+{
+    // runs longer than the 16 bytes the lexer skips at a time, ending both inside a block and at the end
+    std::string indent(37, ' ');
+    std::string source = indent + "a_very_long_card_name_Number42x->_ 1234567890123456789 ==/>_\xe9"
+        + indent + "# comment ending without a newline";
+    Battler::Lexer lexer(source);
+
+    std::vector<Battler::Token> tokens;
+    Battler::Token t;
+    while (lexer.Next(t))
+    {
+        tokens.push_back(t);
+    }
+
+    ASSERT_EQ(tokens.size(), 6);
+    EXPECT_EQ(tokens[0].type, Battler::TokenType::name);
+    EXPECT_EQ(tokens[0].text, "a_very_long_card_name_Number42x");
+    EXPECT_EQ(tokens[0].c, 37);
+    EXPECT_EQ(tokens[1].type, Battler::TokenType::move_under);
+    EXPECT_EQ(tokens[2].type, Battler::TokenType::number);
+    EXPECT_EQ(tokens[2].text, "1234567890123456789");
+    EXPECT_EQ(tokens[3].type, Battler::TokenType::equality);
+    EXPECT_EQ(tokens[4].type, Battler::TokenType::cut_under);
+    EXPECT_EQ(tokens[5].type, Battler::TokenType::unknown);
+    EXPECT_EQ(tokens[5].text, "\xe9");
+}
+
+TEST(ParserTest, ExpressionTreesOutliveTheirProgram)
+{
+    std::unique_ptr<Battler::Program> original = std::make_unique<Battler::Program>();
+    original->Compile({"game g start", "int x", "x = 1 + 2", "card A start end", "end"});
+    Battler::Program copy = *original;
+    original.reset();
+
+    Battler::Expression root = copy._GetRootExpression();
+    EXPECT_EQ(root.type, Battler::ExpressionType::GAME_DECLARATION);
+    ASSERT_EQ(root.children.size(), 4);
+    EXPECT_EQ(root.children[0].type, Battler::ExpressionType::ATTR_DECLARATION);
+    EXPECT_EQ(root.children[1].type, Battler::ExpressionType::ATTR_ASSIGNMENT);
+    EXPECT_EQ(root.children[1].children[1].type, Battler::ExpressionType::ADDITION);
+    EXPECT_EQ(root.children[1].children[1].children[1].tokens[0].text, "2");
+    EXPECT_EQ(root.children[2].type, Battler::ExpressionType::CARD_DECLARATION);
+    EXPECT_EQ(root.children.back().type, Battler::ExpressionType::GAME_NAME_DECLARATION);
+    EXPECT_EQ(root.children.back().tokens[0].text, "g");
+}
+
 TEST(CompilerTest, CutTest)
 {
     std::string line = "a /> b top 5";
@@ -241,8 +359,8 @@ TEST(EndToEndTests, ChooseCutTest)
     p.Run(true);
     p.RunSetup();
     
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 20);
-    EXPECT_EQ(p.game().stacks[1].cards.size(), 0);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 20);
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 0);
     
     p.RunTurn();
     
@@ -259,8 +377,8 @@ TEST(EndToEndTests, ChooseCutTest)
     p.m_stackTransferStateTracker.cutPoint = 10;
     p.RunTurn(true);
     
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 10);
-    EXPECT_EQ(p.game().stacks[1].cards.size(), 10);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 10);
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 10);
 }
 
 TEST(ParserTest, CutTestChoose)
@@ -334,15 +452,15 @@ TEST(EndToEndTests, MoveFromSelection)
     p.m_stackTransferStateTracker.srcStackID = 1;
     p.m_waitingForUserInteraction = false;
 
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 20);
-    EXPECT_EQ(p.game().stacks[1].cards.size(), 20);
-    EXPECT_EQ(p.game().stacks[2].cards.size(), 1);
-    Battler::Card cardToMove = *(p.game().stacks[1].cards.end()-1);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 20);
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 20);
+    EXPECT_EQ(p.game().stacks[2].Cards().size(), 1);
+    Battler::CardInstance cardToMove = *(p.game().stacks[1].Cards().end()-1);
     p.RunTurn(true);
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 20);
-    EXPECT_EQ(p.game().stacks[1].cards.size(), 19);
-    EXPECT_EQ(p.game().stacks[2].cards.size(), 2);
-    EXPECT_EQ((p.game().stacks[2].cards.end()-1)->UUID, cardToMove.UUID);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 20);
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 19);
+    EXPECT_EQ(p.game().stacks[2].Cards().size(), 2);
+    EXPECT_EQ((p.game().stacks[2].Cards().end()-1)->UUID, cardToMove.UUID);
 
     EXPECT_TRUE(p.m_waitingForUserInteraction);
     EXPECT_FALSE(p.m_stackTransferStateTracker.srcTop);
@@ -351,12 +469,12 @@ TEST(EndToEndTests, MoveFromSelection)
     EXPECT_EQ(p.m_stackTransferStateTracker.sourceStackSelectionPool[0], 0);
     EXPECT_EQ(p.m_stackTransferStateTracker.sourceStackSelectionPool[1], 1);
     p.m_stackTransferStateTracker.srcStackID = 0;
-    Battler::Card newCardToBeOnTheBottom = p.game().stacks[0].cards[1];
+    Battler::CardInstance newCardToBeOnTheBottom = p.game().stacks[0].Cards()[1];
     p.RunTurn(true);
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 18);
-    EXPECT_EQ(p.game().stacks[1].cards.size(), 19);
-    EXPECT_EQ(p.game().stacks[2].cards.size(), 4);
-    EXPECT_EQ(p.game().stacks[2].cards.begin()->UUID, newCardToBeOnTheBottom.UUID);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 18);
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 19);
+    EXPECT_EQ(p.game().stacks[2].Cards().size(), 4);
+    EXPECT_EQ(p.game().stacks[2].Cards().begin()->UUID, newCardToBeOnTheBottom.UUID);
 }
 
 TEST(EndToEndTests, MoveToSelection)
@@ -402,15 +520,15 @@ TEST(EndToEndTests, MoveToSelection)
     p.m_stackTransferStateTracker.dstStackID = 1;
     p.m_waitingForUserInteraction = false;
 
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 20);
-    EXPECT_EQ(p.game().stacks[1].cards.size(), 0);
-    EXPECT_EQ(p.game().stacks[2].cards.size(), 0);
-    Battler::Card cardToMove = *(p.game().stacks[0].cards.end()-1);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 20);
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 0);
+    EXPECT_EQ(p.game().stacks[2].Cards().size(), 0);
+    Battler::CardInstance cardToMove = *(p.game().stacks[0].Cards().end()-1);
     p.RunTurn(true);
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 19);
-    EXPECT_EQ(p.game().stacks[1].cards.size(), 1);
-    EXPECT_EQ(p.game().stacks[2].cards.size(), 0);
-    EXPECT_EQ((p.game().stacks[1].cards.end()-1)->UUID, cardToMove.UUID);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 19);
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 1);
+    EXPECT_EQ(p.game().stacks[2].Cards().size(), 0);
+    EXPECT_EQ((p.game().stacks[1].Cards().end()-1)->UUID, cardToMove.UUID);
 
     EXPECT_TRUE(p.m_waitingForUserInteraction);
     EXPECT_EQ(p.m_stackTransferStateTracker.type, Battler::InputOperationType::CHOOSE_DESTINATION);
@@ -418,12 +536,12 @@ TEST(EndToEndTests, MoveToSelection)
     EXPECT_EQ(p.m_stackTransferStateTracker.destinationStackSelectionPool[0], 2);
     EXPECT_EQ(p.m_stackTransferStateTracker.destinationStackSelectionPool[1], 1);
     p.m_stackTransferStateTracker.dstStackID = 2;
-    Battler::Card newCardToBeOnTheBottom = p.game().stacks[0].cards[0];
+    Battler::CardInstance newCardToBeOnTheBottom = p.game().stacks[0].Cards()[0];
     p.RunTurn(true);
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 18);
-    EXPECT_EQ(p.game().stacks[1].cards.size(), 1);
-    EXPECT_EQ(p.game().stacks[2].cards.size(), 1);
-    EXPECT_EQ(p.game().stacks[2].cards.begin()->UUID, newCardToBeOnTheBottom.UUID);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 18);
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 1);
+    EXPECT_EQ(p.game().stacks[2].Cards().size(), 1);
+    EXPECT_EQ(p.game().stacks[2].Cards().begin()->UUID, newCardToBeOnTheBottom.UUID);
     EXPECT_FALSE(p.m_waitingForUserInteraction);
 }
 
@@ -470,10 +588,10 @@ TEST(EndToEndTests, MoveFromAndToSelection)
     p.m_stackTransferStateTracker.srcStackID = 0;
     p.m_waitingForUserInteraction = false;
 
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 20);
-    EXPECT_EQ(p.game().stacks[1].cards.size(), 0);
-    EXPECT_EQ(p.game().stacks[2].cards.size(), 0);
-    Battler::Card cardToMove = *(p.game().stacks[0].cards.end()-1);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 20);
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 0);
+    EXPECT_EQ(p.game().stacks[2].Cards().size(), 0);
+    Battler::CardInstance cardToMove = *(p.game().stacks[0].Cards().end()-1);
     p.RunTurn(true);
 
 
@@ -487,10 +605,10 @@ TEST(EndToEndTests, MoveFromAndToSelection)
 
     p.RunTurn(true);
 
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 19);
-    EXPECT_EQ(p.game().stacks[1].cards.size(), 0);
-    EXPECT_EQ(p.game().stacks[2].cards.size(), 1);
-    EXPECT_EQ((p.game().stacks[2].cards.end()-1)->UUID, cardToMove.UUID);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 19);
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 0);
+    EXPECT_EQ(p.game().stacks[2].Cards().size(), 1);
+    EXPECT_EQ((p.game().stacks[2].Cards().end()-1)->UUID, cardToMove.UUID);
     EXPECT_FALSE(p.m_waitingForUserInteraction);
 }
 
@@ -514,7 +632,7 @@ TEST(VMTtest, Compare_stackPosref_Card)
     Battler::Program p;
     p.Compile(lines);
     p.Run();
-    EXPECT_EQ(p.game().stacks.begin()->second.cards.size(), 40);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 40);
 }
 
 TEST(VMTtest, ResolveCardAttributesFromStackPosition)
@@ -541,7 +659,7 @@ TEST(VMTtest, ResolveCardAttributesFromStackPosition)
     Battler::Program p;
     p.Compile(lines);
     p.Run();
-    EXPECT_EQ(p.game().stacks.begin()->second.cards.size(), 40);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 40);
 }
 
 TEST(VMTtest, LessThan)
@@ -568,7 +686,7 @@ TEST(VMTtest, LessThan)
     Battler::Program p;
     p.Compile(lines);
     p.Run();
-    EXPECT_EQ(p.game().stacks.begin()->second.cards.size(), 40);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 40);
 }
 
 TEST(VMTtest, greatherThan)
@@ -595,7 +713,7 @@ TEST(VMTtest, greatherThan)
     Battler::Program p;
     p.Compile(lines);
     p.Run();
-    EXPECT_EQ(p.game().stacks.begin()->second.cards.size(), 40);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 40);
 }
 
 TEST(VMTtest, DeclareLooser)
@@ -649,7 +767,7 @@ TEST(VMTtest, BracketExpression)
     Battler::Program p;
     p.Compile(lines);
     p.Run();
-    EXPECT_EQ(p.game().stacks.begin()->second.cards.size(), 12);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 12);
 }
 
 TEST(VMTtest, TransferNamedCard)
@@ -666,8 +784,8 @@ TEST(VMTtest, TransferNamedCard)
     Battler::Program p;
     p.Compile(lines);
     p.Run();
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 10);
-    EXPECT_EQ(p.game().stacks[0].cards[0].ID, 0);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 10);
+    EXPECT_EQ(p.game().stacks[0].Cards()[0].ID, 0);
 }
 
 TEST(VMTtest, if_ifelse)
@@ -690,8 +808,8 @@ TEST(VMTtest, if_ifelse)
     Battler::Program p;
     p.Compile(lines);
     p.Run();
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 10);
-    EXPECT_EQ(p.game().stacks[0].cards[0].ID, 0);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 10);
+    EXPECT_EQ(p.game().stacks[0].Cards()[0].ID, 0);
 }
 
 TEST(VMTtest, if_ifelse_else)
@@ -718,8 +836,8 @@ TEST(VMTtest, if_ifelse_else)
     Battler::Program p;
     p.Compile(lines);
     p.Run();
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 10);
-    EXPECT_EQ(p.game().stacks[0].cards[0].ID, 2);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 10);
+    EXPECT_EQ(p.game().stacks[0].Cards()[0].ID, 2);
 }
 
 TEST(VMTtest, if_ifelse_NoMatchingBlock)
@@ -745,8 +863,8 @@ TEST(VMTtest, if_ifelse_NoMatchingBlock)
     Battler::Program p;
     p.Compile(lines);
     p.Run();
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 2);
-    EXPECT_EQ(p.game().stacks[0].cards[0].ID, 2);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 2);
+    EXPECT_EQ(p.game().stacks[0].Cards()[0].ID, 2);
 }
 
 TEST(VMTest, if_else)
@@ -769,8 +887,8 @@ TEST(VMTest, if_else)
     Battler::Program p;
     p.Compile(lines);
     p.Run();
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 20);
-    EXPECT_EQ(p.game().stacks[0].cards[0].ID, 1);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 20);
+    EXPECT_EQ(p.game().stacks[0].Cards()[0].ID, 1);
 }
 
 TEST(VMTtest, test_ifelseblock_insideTurn)
@@ -802,8 +920,8 @@ TEST(VMTtest, test_ifelseblock_insideTurn)
     p.RunSetup();
     p.RunTurn();
 
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 20);
-    EXPECT_EQ(p.game().stacks[0].cards[0].ID, 1);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 20);
+    EXPECT_EQ(p.game().stacks[0].Cards()[0].ID, 1);
 }
 
 TEST(VMTtest, transferFromEmptyStack)
@@ -821,8 +939,8 @@ TEST(VMTtest, transferFromEmptyStack)
     Battler::Program p;
     p.Compile(lines);
     p.Run();
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 0);
-    EXPECT_EQ(p.game().stacks[1].cards.size(), 0);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 0);
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 0);
 }
 
 TEST(VMTtest, testCardFromEmptyStack)
@@ -841,8 +959,8 @@ TEST(VMTtest, testCardFromEmptyStack)
     Battler::Program p;
     p.Compile(lines);
     p.Run();
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 0);
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 0);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 0);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 0);
 }
 
 TEST(VMTtest, compareTwoStackPositionReferences)
@@ -863,7 +981,7 @@ TEST(VMTtest, compareTwoStackPositionReferences)
     Battler::Program p;
     p.Compile(lines);
     p.Run();
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 5);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 5);
 }
 
 TEST(VMTest, nesetedIfElseInIfElse)
@@ -902,7 +1020,7 @@ TEST(VMTest, nesetedIfElseInIfElse)
     p.Compile(lines);
     p.Run(true);
     EXPECT_EQ(p.RunTurn(), 0);
-    EXPECT_EQ(p.game().stacks[1].cards.size(), 6);
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 6);
 }
 
 TEST(VMTtest, TestExactSequence)
@@ -930,7 +1048,7 @@ TEST(VMTtest, TestExactSequence)
     Battler::Program p;
     p.Compile(lines);
     p.Run();
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 6);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 6);
 }
 
 TEST(VMTtest, testStartSequence)
@@ -958,7 +1076,7 @@ TEST(VMTtest, testStartSequence)
     Battler::Program p;
     p.Compile(lines);
     p.Run();
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 10);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 10);
 }
 
 TEST(VMTtest, testWildcardSequence)
@@ -986,37 +1104,28 @@ TEST(VMTtest, testWildcardSequence)
     Battler::Program p;
     p.Compile(lines);
     p.Run();
-    EXPECT_EQ(p.game().stacks[0].cards.size(), 10);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 10);
 }
 
 TEST(GameTest, MatchesSequence)
 {
     Battler::Stack s;
-    Battler::Card c1;
-    c1.ID = 1;
-
-    Battler::Card c2;
-    c2.ID = 2;
+    Battler::CardInstance c1(1, 1);
 
-    Battler::Card c3;
-    c3.ID = 3;
+    Battler::CardInstance c2(2, 2);
 
-    Battler::Card c4;
-    c4.ID = 4;
+    Battler::CardInstance c3(3, 3);
 
-    Battler::Card c5;
-    c5.ID = 5;
+    Battler::CardInstance c4(4, 4);
 
-    Battler::Card c6;
-    c6.ID = 6;
+    Battler::CardInstance c5(5, 5);
 
-    Battler::Card c7;
-    c7.ID = 7;
+    Battler::CardInstance c6(6, 6);
 
-    s.cards = {c1, c2, c3, c4, c5, c6, c7};
+    Battler::CardInstance c7(7, 7);
 
     // we want C1 to be at the top of the deck, which is the end of the vector
-    std::reverse(s.cards.begin(), s.cards.end());
+    s.Insert(true, {c7, c6, c5, c4, c3, c2, c1});
 
     // matches awkward sequence [: 1 2 3 : 6 _]
     std::vector<Battler::CardMatcher> sequence1 = {
@@ -1073,6 +1182,35 @@ TEST(GameTest, MatchesSequence)
 
 }
 
+TEST(GameTest, SequencesAfterARestTryEveryCard)
+{
+    Battler::Stack s;
+    int uuid = 0;
+    for (int id : {4, 2, 1, 3, 1})
+    {
+        s.Insert(true, {Battler::CardInstance(uuid++, id)});
+    }
+
+    using Battler::CardMatcherType;
+
+    // from the top the stack reads 1 3 1 2 4. The first 1 isn't followed by a 2, the second is
+    Battler::CardSequence oneThenTwo({{CardMatcherType::REST, 0}, {CardMatcherType::ID, 1}, {CardMatcherType::ID, 2}});
+    EXPECT_TRUE(s.MatchesSequence(oneThenTwo));
+    EXPECT_FALSE(s.MatchesSequence(oneThenTwo, true));
+
+    // two RESTs in a row are one gap
+    Battler::CardSequence gaps({{CardMatcherType::REST, 0}, {CardMatcherType::REST, 0}, {CardMatcherType::ID, 4}});
+    EXPECT_TRUE(s.MatchesSequence(gaps));
+
+    // bottom up the stack reads 4 2 1 3 1
+    Battler::CardSequence fourAnyOne({{CardMatcherType::ID, 4}, {CardMatcherType::ANY, 0}, {CardMatcherType::ID, 1}});
+    EXPECT_TRUE(s.MatchesSequence(fourAnyOne, true));
+    EXPECT_FALSE(s.MatchesSequence(fourAnyOne));
+
+    EXPECT_TRUE(oneThenTwo.Resolved());
+    EXPECT_FALSE(Battler::CardSequence({{CardMatcherType::ID, -1}}).Resolved());
+}
+
 TEST(VMTtest, testStackTransferWhereClause)
 {
     auto lines = std::vector<std::string>() =
@@ -1118,7 +1256,1618 @@ TEST(VMTtest, testStackTransferWhereClause)
     p.m_waitingForUserInteraction = false;
     EXPECT_EQ(p.RunTurn(true), 0);
 
-    EXPECT_EQ(p.game().stacks[3].cards.size(), 4);
+    EXPECT_EQ(p.game().stacks[3].Cards().size(), 4);
+
+}
+
+
+TEST(VMTest, executedBranchPopsItsLocale)
+{
+    auto lines = std::vector<std::string>() =
+    {
+        "game test start",
+            "visiblestack a",
+            "card A start end",
+            "place A -> a 1",
+            "if a.top == A start",
+                "place A -> a 1",
+            "elseif a.top == A then",
+                "place A -> a 2",
+            "else",
+                "place A -> a 3",
+            "end",
+        "end"
+    };
+
+    Battler::Program p;
+    p.Compile(lines);
+    p.Run();
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 2);
+    // only the game's own locale should be left once the if block is done
+    EXPECT_EQ(p.locale_stack().size(), 1);
+}
+
+TEST(VMTest, manyStringConstants)
+{
+    // enough names to push the string constant indexes well past one byte
+    std::vector<std::string> lines = {"game test start", "visiblestack a", "card A start end", "setup start end"};
+    for (int i = 0; i < 300; i++)
+    {
+        lines.push_back("phase P" + std::to_string(i) + " start");
+        lines.push_back("place A -> a 1");
+        lines.push_back("end");
+    }
+    lines.push_back("turn start");
+    lines.push_back("do P299");
+    lines.push_back("end");
+    lines.push_back("end");
+
+    Battler::Program p;
+    p.Compile(lines);
+    p.Run(true);
+    p.RunSetup();
+    EXPECT_EQ(p.RunTurn(), 0);
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 1);
+    EXPECT_GT(p.executed_opcodes(), 0);
+}
+
+TEST(CompilerTest, ifChainJumpTargets)
+{
+    auto lines = std::vector<std::string>() =
+    {
+        "game test start",
+            "visiblestack a",
+            "if a.size > 1 start",
+                "if a.size > 2 start end",
+            "elseif a.size > 3 then",
+            "else",
+            "end",
+        "end"
+    };
+
+    Battler::Program p;
+    p.Compile(lines);
+    auto opcodes = p.opcodes();
+
+    std::vector<int> headers;
+    for (int i = 0; i < opcodes.size(); i++)
+    {
+        auto t = opcodes[i].type;
+        if (t == Battler::OpcodeType::IF_BLK_HEADER || t == Battler::OpcodeType::ELSE_IF_BLK_HEADER || t == Battler::OpcodeType::ELSE_BLK_HEADER)
+        {
+            headers.push_back(i);
+        }
+    }
+
+    // outer if, nested if, elseif, else
+    ASSERT_EQ(headers.size(), 4);
+    int outerIf = headers[0], innerIf = headers[1], elseIf = headers[2], elseHeader = headers[3];
+    int outerEnd = opcodes[outerIf].end_index;
+
+    EXPECT_EQ(opcodes[outerEnd].type, Battler::OpcodeType::BLK_END);
+    EXPECT_EQ(opcodes[outerEnd].jump_index, outerIf);
+    EXPECT_EQ(opcodes[outerIf].jump_index, elseIf);
+    EXPECT_EQ(opcodes[elseIf].jump_index, elseHeader);
+    EXPECT_EQ(opcodes[elseHeader].jump_index, outerEnd);
+    EXPECT_EQ(opcodes[elseIf].end_index, outerEnd);
+    EXPECT_EQ(opcodes[elseHeader].end_index, outerEnd);
+
+    EXPECT_EQ(opcodes[opcodes[innerIf].end_index].type, Battler::OpcodeType::BLK_END);
+    EXPECT_LT(opcodes[innerIf].end_index, elseIf);
+    EXPECT_EQ(opcodes[innerIf].jump_index, opcodes[innerIf].end_index);
+
+    // the game block ends on the last opcode
+    EXPECT_EQ(opcodes[0].end_index, opcodes.size() - 1);
+}
+
+TEST(VMTest, foreachPlayerLoopsOverEveryPlayer)
+{
+    auto lines = std::vector<std::string>() =
+    {
+        "game test start",
+            "players 3",
+            "visiblestack a",
+            "card A start end",
+            "foreachplayer p start",
+                "if a.size < 100 start",
+                    "place A -> a 2",
+                "end",
+            "end",
+            "place A -> a 1",
+        "end"
+    };
+
+    Battler::Program p;
+    p.Compile(lines);
+    p.Run();
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 2 * p.game().players.size() + 1);
+    EXPECT_EQ(p.locale_stack().size(), 1);
+}
+
+TEST(CompilerTest, gameAttributesAreBoundToSlots)
+{
+    auto lines = std::vector<std::string>() =
+    {
+        "game test start",
+            "visiblestack a",
+            "int counter",
+            "int shadowed",
+            "card A start end",
+            "setup start",
+                "int shadowed",
+            "end",
+            "turn start",
+                "counter = counter + 1",
+                "shadowed = 2",
+                "a.ownerID = currentPlayer",
+                "place A -> a 1",
+            "end",
+        "end"
+    };
+
+    Battler::Program p;
+    p.Compile(lines);
+    auto opcodes = p.opcodes();
+
+    int boundCounters = 0;
+    for (auto& code : opcodes)
+    {
+        if (code.type == Battler::OpcodeType::L_VALUE || code.type == Battler::OpcodeType::R_VALUE_REF)
+        {
+            if (code.slot != Battler::NO_SLOT)
+            {
+                boundCounters++;
+            }
+        }
+    }
+
+    // 'int counter' and both uses of counter, the stack a twice, and nothing else:
+    // shadowed is declared in setup too, A is a card and currentPlayer is a local
+    EXPECT_EQ(boundCounters, 5);
+}
+
+TEST(CompilerTest, cardNamesAreBoundToIDs)
+{
+    auto lines = std::vector<std::string>() =
+    {
+        "game test start",
+            "visiblestack a",
+            "card A start",
+                "int power",
+                "power = 2",
+            "end",
+            "card B A start",
+                "power = 5",
+            "end",
+            "int x",
+            "place B -> a 1",
+            "x = B.power + a.top.power",
+            "if x == 10 start",
+                "place A -> a 1",
+            "end",
+            "card D start end",
+        "end"
+    };
+
+    Battler::Program p;
+    p.Compile(lines);
+
+    // the card source, and the start of B.power, name B before the game has declared it
+    int boundToB = 0;
+    for (auto& code : p.opcodes())
+    {
+        if (code.type == Battler::OpcodeType::CARD_BLK_HEADER)
+        {
+            EXPECT_NE(code.slot, Battler::NO_CARD);
+        }
+        else if ((code.type == Battler::OpcodeType::L_VALUE || code.type == Battler::OpcodeType::R_VALUE_DOT_SEPERATED_REF_CHAIN)
+            && code.card == 1)
+        {
+            boundToB++;
+        }
+    }
+    EXPECT_EQ(boundToB, 2);
+
+    p.Run(true);
+    auto& game = p.game();
+    EXPECT_EQ(game.FindCard(game.symbols.Find("A")), 0);
+    EXPECT_EQ(game.FindCard(game.symbols.Find("B")), 1);
+    ASSERT_EQ(game.stacks[0].Cards().size(), 2);
+    EXPECT_EQ(game.stacks[0].Cards()[0].ID, 1);
+    EXPECT_EQ(game.stacks[0].Cards()[1].ID, 0);
+
+    // values that refer to a card by ID are still printed with its name
+    Battler::Attr ref(Battler::AttributeType::CARD_REF);
+    ref.cardRef = 1;
+    EXPECT_EQ(ref.ToString(game), "B");
+
+    // images keep the IDs, of which there are more than global slots
+    std::string path = testing::TempDir() + "cardNamesAreBoundToIDs.bbc";
+    p.Save(path);
+    Battler::Program loaded;
+    loaded.Load(path);
+    EXPECT_EQ(loaded.game().FindCard(loaded.game().symbols.Find("B")), 1);
+    std::remove(path.c_str());
+
+    // a card added by a reload gets the next ID, wherever it's declared
+    lines.insert(lines.begin() + 6, {"card C A start", "end"});
+    p.Reload(lines);
+    EXPECT_EQ(game.FindCard(game.symbols.Find("B")), 1);
+    EXPECT_EQ(game.FindCard(game.symbols.Find("C")), 3);
+    EXPECT_EQ(game.cards.size(), 4);
+}
+
+TEST(VMTest, boundAndShadowedAttributes)
+{
+    // a plain name finds the game's attribute before a local of the same name,
+    // which still holds when only the unshadowed counter is bound to a slot
+    auto lines = std::vector<std::string>() =
+    {
+        "game test start",
+            "visiblestack a",
+            "visiblestack b",
+            "int counter",
+            "int shadowed",
+            "card A start end",
+            "counter = 2",
+            "shadowed = 5",
+            "setup start",
+                "int shadowed",
+                "shadowed = 1",
+                "counter = counter + shadowed",
+            "end",
+            "turn start",
+                "if counter == 3 start",
+                    "place A -> a 1",
+                "end",
+                "if shadowed == 1 start",
+                    "place A -> b 1",
+                "end",
+            "end",
+        "end"
+    };
+
+    Battler::Program p;
+    p.Compile(lines);
+    p.Run(true);
+    p.RunSetup();
+    p.RunTurn();
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 1);
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 1);
+}
+
+TEST(CompilerTest, expressionsArePostfix)
+{
+    auto lines = std::vector<std::string>() =
+    {
+        "game test start",
+            "int x",
+            "x = x + 2 * x",
+        "end"
+    };
+
+    Battler::Program p;
+    p.Compile(lines);
+    auto opcodes = p.opcodes();
+
+    auto isLValue = [](const Battler::Opcode& code) {
+        return code.type == Battler::OpcodeType::L_VALUE;
+    };
+    // the first lvalue is the declaration's, the second one the assignment's
+    auto assignment = std::find_if(opcodes.begin(), opcodes.end(), isLValue);
+    assignment = std::find_if(assignment + 1, opcodes.end(), isLValue);
+    ASSERT_NE(assignment, opcodes.end());
+
+    std::vector<Battler::OpcodeType> expected = {
+        Battler::OpcodeType::R_VALUE_REF,
+        Battler::OpcodeType::R_VALUE,
+        Battler::OpcodeType::R_VALUE_REF,
+        Battler::OpcodeType::MULTIPLY,
+        Battler::OpcodeType::ADD,
+        Battler::OpcodeType::EXPRESSION_END,
+    };
+    for (int i = 0; i < expected.size(); i++)
+    {
+        EXPECT_EQ((assignment + 1 + i)->type, expected[i]);
+    }
+}
+
+TEST(VMTest, valueStackEvaluation)
+{
+    auto lines = std::vector<std::string>() =
+    {
+        "game test start",
+            "visiblestack a",
+            "card A start",
+                "int power",
+                "power = 4",
+            "end",
+            "int x",
+            "place A -> a 3",
+            "x = a.size * 2 - a.top.power / 2",
+            "if x == 4 start",
+                "place A -> a x - a.size",
+            "end",
+            "if x < a.size * 2 + 1 start",
+                "place A -> a 10",
+            "end",
+        "end"
+    };
+
+    Battler::Program p;
+    p.Compile(lines);
+    p.Run();
+    // x = 3 * (2 - (4 / 2)) = 0, the first guard fails and the second one passes
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 13);
+}
+
+TEST(VMTest, failedExpressionsReleaseTheValueStack)
+{
+    auto lines = std::vector<std::string>() =
+    {
+        "game test start",
+            "players 1",
+            "visiblestack a",
+            "int x",
+            "setup start end",
+            "turn start",
+                "x = 1 + 2 * a.top.power",
+            "end",
+        "end"
+    };
+
+    Battler::Program p;
+    p.Compile(lines);
+    p.Run(true);
+    p.RunSetup();
+
+    // each failure throws with operands still on the stack, far more times than it has slots
+    for (int i = 0; i < 200; i++)
+    {
+        EXPECT_THROW(p.RunTurn(), Battler::VMError);
+    }
+}
+
+TEST(CompilerTest, literalExpressionsAreFolded)
+{
+    auto lines = std::vector<std::string>() =
+    {
+        "game test start",
+            "visiblestack a",
+            "card A start end",
+            "int x",
+            "x = 50 + 60 * 6 - 5 / 4",
+            "if 2 > 1 start",
+                "place A -> a 1",
+            "end",
+            "if 1 == 1 / 0 start",
+                "place A -> a 1",
+            "end",
+        "end"
+    };
+
+    Battler::Program p;
+    p.Compile(lines);
+    auto opcodes = p.opcodes();
+
+    int operators = 0;
+    for (auto& code : opcodes)
+    {
+        if (code.type == Battler::OpcodeType::ADD || code.type == Battler::OpcodeType::SUBTRACT
+            || code.type == Battler::OpcodeType::MULTIPLY || code.type == Battler::OpcodeType::COMPARE_GREATERTHAN)
+        {
+            operators++;
+        }
+    }
+    // only the guard that divides by zero is left to the VM
+    EXPECT_EQ(operators, 0);
+
+    // names: test, a, A, x; ints: 50 + 60 * (6 - 5 / 4) = 350, 1, 0; bools: true, on top of the
+    // symbols every program starts with
+    EXPECT_EQ(p.constant_pool_size(), Battler::Program().constant_pool_size() + 8);
+}
+
+TEST(CompilerTest, overflowingLiteralsAreLeftToTheVM)
+{
+    Battler::Program p;
+    p.Compile({"game test start", "int x", "x = 2147483647 + 1", "x = 65536 * 65536", "x = 0 - 2147483647", "end"});
+
+    std::vector<Battler::OpcodeType> operators;
+    for (auto& code : p.opcodes())
+    {
+        if (code.type >= Battler::OpcodeType::ADD && code.type <= Battler::OpcodeType::DIVIDE)
+        {
+            operators.push_back(code.type);
+        }
+    }
+    EXPECT_EQ(operators, (std::vector<Battler::OpcodeType>{Battler::OpcodeType::ADD, Battler::OpcodeType::MULTIPLY}));
+
+    // which divides by zero, or the one division that overflows, when it runs
+    for (std::string division : {"x = 1 / 0", "x = m / (0 - 1)"})
+    {
+        Battler::Program vm;
+        vm.Compile({"game test start", "int x", "int m", "m = (0 - 2147483647) - 1", division, "end"});
+        EXPECT_THROW(vm.Run(true), Battler::VMError);
+    }
+}
+
+TEST(CompilerTest, namesAreInternedOnce)
+{
+    auto lines = std::vector<std::string>() =
+    {
+        "game test start",
+            "card A start",
+                "int health",
+            "end",
+            "card B A start",
+                "health = 3",
+            "end",
+            "int health",
+            "health = A.health",
+        "end"
+    };
+
+    Battler::Program p;
+    p.Compile(lines);
+    p.Run(true);
 
+    auto& symbols = p.game().symbols;
+    Battler::Symbol health = symbols.Find("health");
+    EXPECT_NE(health, Battler::NO_SYMBOL);
+    EXPECT_EQ(symbols.Name(health), "health");
+    EXPECT_EQ(symbols.Find("currentPlayer"), Battler::CURRENT_PLAYER_SYMBOL);
+
+    // every reference to a name carries the same symbol the game model is keyed by
+    for (auto& code : p.opcodes())
+    {
+        if (code.type == Battler::OpcodeType::L_VALUE_DOT_SEPERATED_REF_CHAIN
+            || code.type == Battler::OpcodeType::R_VALUE_DOT_SEPERATED_REF_CHAIN)
+        {
+            Battler::Symbol symbol = (Battler::Symbol) ((code.data & DATA_IX_T_MASK) >> 32);
+            EXPECT_TRUE(symbol == symbols.Find("A") || symbol == health);
+        }
+    }
+
+    Battler::Card b = p.game().cards[p.game().FindCard(symbols.Find("B"))];
+    EXPECT_EQ(b.name, symbols.Find("B"));
+    EXPECT_EQ(b.parentName, symbols.Find("A"));
+    EXPECT_EQ(b.attributes.Get(health).i, 3);
 }
 
+TEST(CompilerTest, parallelCompilationLinksTheSameOpcodes)
+{
+    std::vector<std::string> lines = {
+        "game test start",
+            "players 2",
+            "visiblestack deck",
+            "int counter",
+            "bool dealt",
+    };
+    for (int i = 0; i < 200; i++)
+    {
+        std::string n = std::to_string(i);
+        lines.insert(lines.end(), {
+            "card C" + n + " start",
+                "int power" + n,
+                "power" + n + " = " + n,
+            "end",
+            "phase P" + n + " start",
+                "if deck == [: C" + n + " _ :] start",
+                    "counter = counter + " + std::to_string(i % 7),
+                    "dealt = true",
+                "end",
+            "end",
+        });
+    }
+    lines.insert(lines.end(), {
+            "place C3 -> deck 5",
+            "setup start end",
+            "turn start",
+                "do P3",
+                "do P199",
+            "end",
+        "end",
+    });
+
+    Battler::Program sequential;
+    sequential.SetCompileThreads(1);
+    sequential.Compile(lines);
+    Battler::Program parallel;
+    parallel.SetCompileThreads(4);
+    parallel.Compile(lines);
+
+    auto expected = sequential.opcodes();
+    auto actual = parallel.opcodes();
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); i++)
+    {
+        EXPECT_EQ(actual[i].type, expected[i].type) << i;
+        EXPECT_EQ(actual[i].data, expected[i].data) << i;
+        EXPECT_EQ(actual[i].jump_index, expected[i].jump_index) << i;
+        EXPECT_EQ(actual[i].end_index, expected[i].end_index) << i;
+        EXPECT_EQ(actual[i].slot, expected[i].slot) << i;
+    }
+    EXPECT_EQ(parallel.game().symbols.size(), sequential.game().symbols.size());
+
+    for (Battler::Program* p : {&sequential, &parallel})
+    {
+        p->Run(true);
+        p->RunSetup();
+        p->RunTurn();
+        EXPECT_EQ(p->game().cards.size(), 200);
+        EXPECT_EQ(p->game().stacks[0].Cards().size(), 5);
+    }
+
+    // errors are reported from the first expression that has one, whichever thread compiled it
+    std::string tooDeep = "counter = counter";
+    for (int i = 0; i < 100; i++)
+    {
+        tooDeep += " + counter";
+    }
+    lines[111] = tooDeep;
+    lines[1511] = tooDeep;
+    Battler::Program broken;
+    broken.SetCompileThreads(4);
+    try
+    {
+        broken.Compile(lines);
+        FAIL();
+    }
+    catch (Battler::CompileError e)
+    {
+        EXPECT_EQ(e.t.l, 112);
+    }
+}
+
+TEST(VMTest, attributeLookupsDoNotAllocate)
+{
+    auto game = [](int nStatements) {
+        std::vector<std::string> lines = {
+            "game test start",
+                "players 1",
+                "card C start",
+                    "int attack",
+                "end",
+                "visiblestack Hand",
+                "int Hand.n",
+                "int Hand.h",
+                "privatestack Hand.inner",
+                "int Hand.inner.depth",
+                "int x",
+                "place C -> Hand 3",
+                "setup start end",
+                "turn start",
+        };
+        for (int i = 0; i < nStatements; i++)
+        {
+            lines.push_back("x = Hand.top.attack + Hand.n + Hand.size + Hand.inner.depth");
+            lines.push_back("Hand.inner.depth = Hand.bottom.attack");
+        }
+        lines.insert(lines.end(), {
+                "end",
+            "end",
+        });
+        return lines;
+    };
+
+    // a turn allocates the same whether it looks attributes up once or forty times
+    auto allocationsPerTurn = [&](int nStatements) {
+        Battler::Program p;
+        p.Compile(game(nStatements));
+        p.Run(true);
+        p.RunSetup();
+        p.RunTurn();
+
+        size_t before = g_allocations;
+        p.RunTurn();
+        return g_allocations - before;
+    };
+
+    EXPECT_EQ(allocationsPerTurn(40), allocationsPerTurn(1));
+}
+
+TEST(VMTest, stackPositionsReferToTheirInstance)
+{
+    auto lines = std::vector<std::string>() =
+    {
+        "game test start",
+            "card C start",
+                "int attack",
+            "end",
+            "visiblestack Hand",
+            "int x",
+            "place C -> Hand 2",
+            "Hand.top.attack = 7",
+            "x = Hand.top.attack + Hand.bottom.attack",
+        "end"
+    };
+
+    Battler::Program p;
+    p.Compile(lines);
+    p.Run(true);
+
+    // writing through a position gives that instance its own attributes, the card's are untouched
+    auto& game = p.game();
+    auto& hand = game.stacks[0].Cards();
+    EXPECT_EQ(game.Attributes(hand.back()).Get(game.symbols.Find("attack")).i, 7);
+    EXPECT_EQ(game.Attributes(hand.front()).Get(game.symbols.Find("attack")).i, 0);
+    EXPECT_EQ(game.cards[0].attributes.Get(game.symbols.Find("attack")).i, 0);
+}
+
+TEST(VMTest, positionsOffTheStackMatchNothing)
+{
+    auto lines = std::vector<std::string>() =
+    {
+        "game test start",
+            "card C start end",
+            "visiblestack InPlay",
+            "visiblestack Empty",
+            "visiblestack Matches",
+            "place C -> InPlay 1",
+            "if InPlay.top == InPlay.top - 1 start",
+                "place C -> Matches 1",
+            "end",
+            "if Empty.top == InPlay.top start",
+                "place C -> Matches 10",
+            "end",
+            "if InPlay.top == InPlay.bottom start",
+                "place C -> Matches 100",
+            "end",
+        "end"
+    };
+
+    Battler::Program p;
+    p.Compile(lines);
+    p.Run(true);
+
+    // only the last comparison is between two cards
+    EXPECT_EQ(p.game().stacks[2].Cards().size(), 100);
+}
+
+TEST(VMTest, bytecodeImagesRunLikeTheirSource)
+{
+    auto lines = std::vector<std::string>() =
+    {
+        "game test start",
+            "players 2",
+            "card Ship start",
+                "int health",
+            "end",
+            "card Rifter Ship start",
+                "health = 3",
+            "end",
+            "card Atron Ship start",
+                "health = 4",
+            "end",
+            "visiblestack deck",
+            "visiblestack discard",
+            "bool dealt",
+            "int total",
+            "dealt = true",
+            "setup start",
+                "random Ship -> deck 20",
+            "end",
+            "turn start",
+                "if deck.size > 0 start",
+                    "total = total + deck.top.health",
+                    "deck -> discard top 1",
+                "end",
+            "end",
+        "end"
+    };
+
+    Battler::Program compiled;
+    compiled.Compile(lines);
+    std::string path = testing::TempDir() + "bytecodeImagesRunLikeTheirSource.bbc";
+    compiled.Save(path);
+
+    Battler::Program loaded;
+    loaded.Load(path);
+
+    auto expected = compiled.opcodes();
+    auto actual = loaded.opcodes();
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); i++)
+    {
+        EXPECT_EQ(actual[i].type, expected[i].type);
+        EXPECT_EQ(actual[i].data, expected[i].data);
+        EXPECT_EQ(actual[i].jump_index, expected[i].jump_index);
+        EXPECT_EQ(actual[i].end_index, expected[i].end_index);
+        EXPECT_EQ(actual[i].slot, expected[i].slot);
+    }
+    EXPECT_EQ(loaded.constant_pool_size(), compiled.constant_pool_size());
+
+    // copies share the loaded image, and play the same game as the compiled program
+    Battler::Program copy = loaded;
+    for (Battler::Program* p : {&compiled, &copy})
+    {
+        p->Seed(5);
+        p->Run(true);
+        p->RunSetup();
+        for (int i = 0; i < 10; i++)
+        {
+            p->RunTurn();
+        }
+    }
+    ASSERT_EQ(copy.game().stacks[1].Cards().size(), 10);
+    for (int i = 0; i < 10; i++)
+    {
+        EXPECT_EQ(copy.game().stacks[1].Cards()[i].ID, compiled.game().stacks[1].Cards()[i].ID);
+    }
+
+    std::remove(path.c_str());
+}
+
+TEST(VMTest, corruptBytecodeImagesAreRejected)
+{
+    Battler::Program compiled;
+    compiled.Compile({"game test start", "int x", "x = 3", "end"});
+    std::string path = testing::TempDir() + "corruptBytecodeImagesAreRejected.bbc";
+    compiled.Save(path);
+
+    std::string image;
+    {
+        std::ifstream in(path, std::ios::binary);
+        image.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    auto write = [&](const std::string& contents) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << contents;
+    };
+
+    Battler::Program p;
+    write(image.substr(0, image.size() / 2));
+    EXPECT_THROW(p.Load(path), Battler::BytecodeError);
+    write("game test start\nend\n");
+    EXPECT_THROW(p.Load(path), Battler::BytecodeError);
+    EXPECT_THROW(p.Load(path + ".missing"), Battler::BytecodeError);
+
+    // opcodes are stored as they are in memory, so an opcode's bytes find it in the image
+    auto withData = [&](Battler::OpcodeType type, TYPE_CODE_T typeCode, uint64_t index) {
+        for (auto& code : compiled.opcodes())
+        {
+            if (code.type == type && (code.data & TYPE_CODE_T_MASK) == typeCode)
+            {
+                std::string original(reinterpret_cast<const char*>(&code), sizeof(code));
+                Battler::Opcode corrupt = code;
+                corrupt.data = (corrupt.data & ~DATA_IX_T_MASK) | (index << 32);
+                std::string corrupted = image;
+                corrupted.replace(image.find(original), sizeof(code), reinterpret_cast<const char*>(&corrupt), sizeof(corrupt));
+                return corrupted;
+            }
+        }
+        ADD_FAILURE() << "no such opcode";
+        return image;
+    };
+    write(withData(Battler::OpcodeType::R_VALUE, Battler::INT_TC, 1000));
+    EXPECT_THROW(p.Load(path), Battler::BytecodeError);
+    write(withData(Battler::OpcodeType::L_VALUE, Battler::STRING_TC, 1000));
+    EXPECT_THROW(p.Load(path), Battler::BytecodeError);
+
+    write(image);
+    p.Load(path);
+    EXPECT_EQ(p.opcodes().size(), compiled.opcodes().size());
+
+    // expressions are evaluated as they are in the image, so one that leaves too many or too few
+    // values on the value stack is an error when it runs. Sums are right associative, so each y
+    // waits on the stack until the last one
+    std::string nested = "y";
+    for (int i = 1; i < Battler::VALUE_STACK_SIZE; i++)
+    {
+        nested = "y + " + nested;
+    }
+    Battler::Program deep;
+    deep.Compile({"game test start", "int y", "int x", "x = " + nested, "end"});
+    deep.Save(path);
+    {
+        std::ifstream in(path, std::ios::binary);
+        image.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    auto replaced = [&](Battler::OpcodeType type, const Battler::Opcode& with) {
+        for (auto& code : deep.opcodes())
+        {
+            if (code.type == type)
+            {
+                std::string corrupted = image;
+                std::string original(reinterpret_cast<const char*>(&code), sizeof(code));
+                corrupted.replace(image.find(original), sizeof(code), reinterpret_cast<const char*>(&with), sizeof(with));
+                return corrupted;
+            }
+        }
+        ADD_FAILURE() << "no such opcode";
+        return image;
+    };
+    const Battler::Opcode* y = nullptr;
+    for (auto& code : deep.opcodes())
+    {
+        if (code.type == Battler::OpcodeType::R_VALUE_REF)
+        {
+            y = &code;
+            break;
+        }
+    }
+    ASSERT_NE(y, nullptr);
+    write(image);
+    p.Load(path);
+    EXPECT_NO_THROW(p.Run(true));
+    // the first ADD turned into one more y is a 65th value
+    write(replaced(Battler::OpcodeType::ADD, *y));
+    p.Load(path);
+    EXPECT_THROW(p.Run(true), Battler::VMError);
+    // the first y turned into an ADD has nothing to add
+    write(replaced(Battler::OpcodeType::R_VALUE_REF, Battler::Opcode(Battler::OpcodeType::ADD)));
+    p.Load(path);
+    EXPECT_THROW(p.Run(true), Battler::VMError);
+
+    // a loaded game's values are checked too. x's value is the last thing like it in the image,
+    // and turned into a card reference it names a card that isn't there
+    Battler::Program loaded;
+    loaded.Compile({"game test start", "int x", "x = 123456789", "end"});
+    loaded.Run(true);
+    loaded.Save(path);
+    {
+        std::ifstream in(path, std::ios::binary);
+        image.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    Battler::Attr x(Battler::AttributeType::INT);
+    x.i = 123456789;
+    size_t at = image.rfind(std::string(reinterpret_cast<const char*>(&x), sizeof(x)));
+    ASSERT_NE(at, std::string::npos);
+    x.type = Battler::AttributeType::CARD_REF;
+    write(image.replace(at, sizeof(x), reinterpret_cast<const char*>(&x), sizeof(x)));
+    EXPECT_THROW(p.Load(path), Battler::BytecodeError);
+
+    // and so are the players and stacks it refers to by index
+    auto savedWith = [&](std::function<void(Battler::Game&)> corrupt) {
+        Battler::Program game;
+        game.Compile({"game test start", "players 2", "visiblestack deck", "end"});
+        game.Run(true);
+        corrupt(game.game());
+        game.Save(path);
+    };
+    savedWith([](Battler::Game& game) {game.currentPlayerIndex = (int) game.players.size();});
+    EXPECT_THROW(p.Load(path), Battler::BytecodeError);
+    savedWith([](Battler::Game& game) {game.players.clear(); game.currentPlayerIndex = 0;});
+    EXPECT_THROW(p.Load(path), Battler::BytecodeError);
+    savedWith([](Battler::Game& game) {game.stacks[0].t = (Battler::StackType) 42;});
+    EXPECT_THROW(p.Load(path), Battler::BytecodeError);
+    savedWith([](Battler::Game& game) {game.playerBindings["p"] = (int) game.players.size();});
+    EXPECT_THROW(p.Load(path), Battler::BytecodeError);
+    savedWith([](Battler::Game& game) {game.currentPlayerIndex = 1;});
+    p.Load(path);
+    EXPECT_EQ(p.game().currentPlayerIndex, 1);
+
+    std::remove(path.c_str());
+}
+
+TEST(VMTest, loadedGamesSaveTheirState)
+{
+    auto lines = std::vector<std::string>() =
+    {
+        "game test start",
+            "players 2",
+            "card Ship start",
+                "int health",
+            "end",
+            "card Rifter Ship start",
+                "health = 3",
+            "end",
+            "card Atron Ship start",
+                "health = 4",
+            "end",
+            "visiblestack deck",
+            "visiblestack discard",
+            "int total",
+            "setup start",
+                "random Ship -> deck 20",
+            "end",
+            "turn start",
+                "if deck.size > 0 start",
+                    "deck.top.health = deck.top.health + 10",
+                    "total = total + deck.top.health",
+                    "deck -> discard top 1",
+                "end",
+            "end",
+        "end"
+    };
+
+    Battler::Program original;
+    original.Compile(lines);
+    original.Seed(9);
+    original.Run(true);
+    std::string path = testing::TempDir() + "loadedGamesSaveTheirState.bbc";
+    original.Save(path);
+
+    // a game saved after loading doesn't load again
+    Battler::Program loaded;
+    loaded.Load(path);
+    EXPECT_TRUE(loaded.Loaded());
+    loaded.Run(true);
+    ASSERT_EQ(loaded.game().cards.size(), original.game().cards.size());
+    for (size_t i = 0; i < original.game().cards.size(); i++)
+    {
+        EXPECT_EQ(loaded.game().cards[i].name, original.game().cards[i].name);
+        EXPECT_EQ(loaded.game().cards[i].parentID, original.game().cards[i].parentID);
+    }
+    EXPECT_EQ(loaded.game().stacks.size(), original.game().stacks.size());
+
+    // and one saved in the middle of the game carries on where it left off
+    original.RunSetup();
+    for (int i = 0; i < 5; i++)
+    {
+        original.RunTurn();
+    }
+    original.Save(path);
+    loaded.Load(path);
+    EXPECT_TRUE(loaded.Loaded());
+    for (Battler::Program* p : {&original, &loaded})
+    {
+        for (int i = 0; i < 5; i++)
+        {
+            p->RunTurn();
+        }
+    }
+    for (int stack = 0; stack < 2; stack++)
+    {
+        auto& expected = original.game().stacks[stack].Cards();
+        auto& actual = loaded.game().stacks[stack].Cards();
+        ASSERT_EQ(actual.size(), expected.size());
+        for (size_t i = 0; i < expected.size(); i++)
+        {
+            EXPECT_EQ(actual[i].UUID, expected[i].UUID);
+            EXPECT_EQ(actual[i].ID, expected[i].ID);
+            EXPECT_EQ(actual[i].overrides != nullptr, expected[i].overrides != nullptr);
+        }
+    }
+    EXPECT_EQ(loaded.game().stacks[1].Cards().size(), 10);
+    EXPECT_EQ(loaded.game().stacks[0].PositionOf(loaded.game().stacks[0].Cards().back().UUID), 9);
+
+    // images saved before loading still load
+    Battler::Program compiled;
+    compiled.Compile(lines);
+    compiled.Save(path);
+    loaded.Load(path);
+    EXPECT_FALSE(loaded.Loaded());
+
+    std::remove(path.c_str());
+}
+
+TEST(VMTest, reloadPatchesBlocksIntoARunningGame)
+{
+    auto lines = std::vector<std::string>() =
+    {
+        "game test start",
+            "card Ship start",
+                "int health",
+            "end",
+            "card Rifter Ship start",
+                "health = 3",
+            "end",
+            "visiblestack deck",
+            "visiblestack discard",
+            "setup start",
+                "random Ship -> deck 20",
+            "end",
+            "phase draw start",
+                "deck -> discard top 1",
+            "end",
+            "turn start",
+                "do draw",
+            "end",
+        "end"
+    };
+
+    Battler::Program p;
+    p.Compile(lines);
+    p.Run(true);
+    p.RunSetup();
+    for (int i = 0; i < 3; i++)
+    {
+        p.RunTurn();
+    }
+    ASSERT_EQ(p.game().stacks[1].Cards().size(), 3);
+    size_t unchanged = p.opcodes().size();
+
+    // reloading the same rules changes nothing
+    p.Reload(lines);
+    EXPECT_EQ(p.opcodes().size(), unchanged);
+    EXPECT_EQ(p.game().cards.size(), 2);
+
+    lines[2] = "int shield";
+    lines[5] = "shield = 3";
+    lines[13] = "deck -> discard top 2";
+    p.Reload(lines);
+
+    // the game carries on with the new rules where it left off
+    auto& symbols = p.game().symbols;
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 17);
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 3);
+    p.RunTurn();
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 5);
+
+    // a card inherits its parent's new attributes, and keeps its ID
+    ASSERT_EQ(p.game().cards.size(), 2);
+    const Battler::Card& rifter = p.game().cards[p.game().FindCard(symbols.Find("Rifter"))];
+    EXPECT_EQ(rifter.ID, 1);
+    EXPECT_TRUE(rifter.attributes.Contains(symbols.Find("shield")));
+    EXPECT_FALSE(rifter.attributes.Contains(symbols.Find("health")));
+    EXPECT_EQ(p.game().stacks[1].Cards()[0].ID, rifter.ID);
+
+    // everything outside the blocks has already run, so it can't change
+    lines[8] = "visiblestack hand";
+    EXPECT_THROW(p.Reload(lines), Battler::CompileError);
+    p.RunTurn();
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 7);
+}
+
+TEST(CompilerTest, includedModulesAreCachedByContent)
+{
+    namespace fs = std::filesystem;
+    fs::path dir = fs::path(testing::TempDir()) / "includedModulesAreCachedByContent";
+    fs::path cache = dir / "cache";
+    fs::remove_all(dir);
+    fs::create_directories(dir / "cards");
+    auto write = [](fs::path path, std::vector<std::string> lines) {
+        std::ofstream out(path);
+        for (auto& line : lines)
+        {
+            out << line << "\n";
+        }
+    };
+
+    write(dir / "game.battler", {
+        "game test start",
+            "include \"cards/ships.battler\"",
+            "visiblestack deck",
+            "visiblestack discard",
+            "include \"phases.battler\"",
+            "turn start",
+                "do draw",
+            "end",
+        "end",
+    });
+    write(dir / "cards" / "ships.battler", {
+        "card Ship start",
+            "int health",
+        "end",
+        "include \"rifter.battler\"",
+    });
+    write(dir / "cards" / "rifter.battler", {
+        "card Rifter Ship start",
+            "health = 3",
+        "end",
+    });
+    write(dir / "phases.battler", {
+        "setup start",
+            "random Ship -> deck 10",
+        "end",
+        "phase draw start",
+            "deck -> discard top 1",
+        "end",
+    });
+
+    auto compile = [&]() {
+        auto p = std::make_unique<Battler::Program>();
+        p->SetModuleCache(cache.string());
+        p->CompileFile((dir / "game.battler").string());
+        return p;
+    };
+    auto cached = [&]() {
+        return std::distance(fs::directory_iterator(cache), fs::directory_iterator());
+    };
+
+    auto first = compile();
+    EXPECT_EQ(cached(), 3);
+    // a module that doesn't load is silently compiled again, so make sure they all do
+    for (auto& entry : fs::directory_iterator(cache))
+    {
+        Battler::Program unit;
+        EXPECT_NO_THROW(unit.Load(entry.path().string())) << entry.path();
+    }
+    first->Run(true);
+    first->RunSetup();
+    first->RunTurn();
+    auto& symbols = first->game().symbols;
+    ASSERT_EQ(first->game().cards.size(), 2);
+    Battler::Card rifter = first->game().cards[first->game().FindCard(symbols.Find("Rifter"))];
+    EXPECT_EQ(rifter.attributes.Get(symbols.Find("health")).i, 3);
+    EXPECT_EQ(first->game().stacks[0].Cards().size(), 9);
+    EXPECT_EQ(first->game().stacks[1].Cards().size(), 1);
+
+    // unchanged modules are linked from the cache, giving the same program
+    auto second = compile();
+    EXPECT_EQ(cached(), 3);
+    auto expected = first->opcodes();
+    auto actual = second->opcodes();
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); i++)
+    {
+        EXPECT_EQ(actual[i].type, expected[i].type) << i;
+        EXPECT_EQ(actual[i].data, expected[i].data) << i;
+        EXPECT_EQ(actual[i].jump_index, expected[i].jump_index) << i;
+    }
+
+    // and only the module that changed is compiled again
+    write(dir / "phases.battler", {
+        "setup start",
+            "random Ship -> deck 10",
+        "end",
+        "phase draw start",
+            "deck -> discard top 2",
+        "end",
+    });
+    auto third = compile();
+    EXPECT_EQ(cached(), 4);
+    third->Run(true);
+    third->RunSetup();
+    third->RunTurn();
+    EXPECT_EQ(third->game().stacks[1].Cards().size(), 2);
+
+    // a cached module whose hash and size collide with another's isn't linked in its place
+    fs::path drawOne, drawTwo;
+    for (auto& entry : fs::directory_iterator(cache))
+    {
+        Battler::Program unit;
+        unit.Load(entry.path().string());
+        if (unit.Source().find("top 1") != std::string_view::npos)
+        {
+            drawOne = entry.path();
+        }
+        else if (unit.Source().find("top 2") != std::string_view::npos)
+        {
+            drawTwo = entry.path();
+        }
+    }
+    ASSERT_FALSE(drawOne.empty());
+    ASSERT_FALSE(drawTwo.empty());
+    fs::copy_file(drawOne, drawTwo, fs::copy_options::overwrite_existing);
+    auto collided = compile();
+    collided->Run(true);
+    collided->RunSetup();
+    collided->RunTurn();
+    EXPECT_EQ(collided->game().stacks[1].Cards().size(), 2);
+
+    // errors name the module they're in
+    write(dir / "cards" / "rifter.battler", {
+        "card Rifter Ship start",
+            "health = 3",
+        "end",
+        "end",
+    });
+    try
+    {
+        compile();
+        FAIL();
+    }
+    catch (Battler::CompileError e)
+    {
+        EXPECT_NE(e.reason.find("rifter.battler line 4"), std::string::npos) << e.reason;
+    }
+
+    write(dir / "cards" / "rifter.battler", {
+        "include \"ships.battler\"",
+    });
+    EXPECT_THROW(compile(), Battler::CompileError);
+
+    fs::remove_all(dir);
+}
+
+TEST(VMTest, reloadKeepsModuleEntryPoints)
+{
+    namespace fs = std::filesystem;
+    fs::path dir = fs::path(testing::TempDir()) / "reloadKeepsModuleEntryPoints";
+    fs::remove_all(dir);
+    fs::create_directories(dir / "mods");
+    auto write = [](fs::path path, std::vector<std::string> lines) {
+        std::ofstream out(path);
+        for (auto& line : lines)
+        {
+            out << line << "\n";
+        }
+    };
+
+    write(dir / "mods" / "phases.battler", {
+        "card C start end",
+        "setup start",
+            "place C -> deck 10",
+        "end",
+        "phase P start",
+            "deck -> discard top 1",
+        "end",
+    });
+    auto lines = std::vector<std::string>() =
+    {
+        "game test start",
+            "visiblestack deck",
+            "visiblestack discard",
+            "include \"mods/phases.battler\"",
+            "turn start",
+                "do P",
+            "end",
+        "end"
+    };
+    write(dir / "game.battler", lines);
+
+    Battler::Program p;
+    p.CompileFile((dir / "game.battler").string());
+    p.Run(true);
+    p.RunSetup();
+    p.RunTurn();
+    ASSERT_EQ(p.game().stacks[1].Cards().size(), 1);
+
+    // only the turn changes, the module's setup and phase are still there
+    lines[5] = "do P do P";
+    p.Reload(lines);
+    p.RunTurn();
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 3);
+    p.RunSetup();
+    EXPECT_EQ(p.game().stacks[0].Cards().size(), 17);
+
+    // an edited module isn't kept stale, reloading it is an error and the game carries on as it was
+    write(dir / "mods" / "phases.battler", {
+        "card C start end",
+        "setup start",
+            "place C -> deck 10",
+        "end",
+        "phase P start",
+            "deck -> discard top 5",
+        "end",
+    });
+    EXPECT_THROW(p.Reload(lines), Battler::CompileError);
+    p.RunTurn();
+    EXPECT_EQ(p.game().stacks[1].Cards().size(), 5);
+
+    fs::remove_all(dir);
+}
+
+TEST(VMTest, seededGamesReplay)
+{
+    auto lines = std::vector<std::string>() =
+    {
+        "game test start",
+            "card Ship start end",
+            "card Rifter Ship start end",
+            "card Atron Ship start end",
+            "card Comet Ship start end",
+            "visiblestack deck",
+            "setup start",
+                "random Ship -> deck 200",
+            "end",
+        "end"
+    };
+
+    auto deal = [&](uint64_t seed) {
+        Battler::Program p;
+        p.Seed(seed);
+        p.Compile(lines);
+        p.Run(true);
+        p.RunSetup();
+        std::vector<int> ids;
+        for (auto& card : p.game().stacks[0].Cards())
+        {
+            ids.push_back(card.ID);
+        }
+        return ids;
+    };
+
+    EXPECT_EQ(deal(42), deal(42));
+    EXPECT_NE(deal(42), deal(43));
+
+    // draws are bounded and spread over the whole range
+    Battler::Random random(7);
+    std::vector<int> counts(3);
+    for (int i = 0; i < 30000; i++)
+    {
+        uint32_t n = random.Below(3);
+        ASSERT_LT(n, 3);
+        counts[n]++;
+    }
+    for (int count : counts)
+    {
+        EXPECT_NEAR(count, 10000, 500);
+    }
+}
+
+TEST(VMTest, cardsAndStacksAreIndexedByID)
+{
+    auto lines = std::vector<std::string>() =
+    {
+        "game test start",
+            "card A start",
+                "int health",
+            "end",
+            "card B A start",
+            "end",
+            "card C B start",
+            "end",
+            "visiblestack deck",
+            "visiblestack discard",
+        "end"
+    };
+
+    Battler::Program p;
+    p.Compile(lines);
+    p.Run(true);
+
+    auto& game = p.game();
+    ASSERT_EQ(game.cards.size(), 3);
+    ASSERT_EQ(game.stacks.size(), 2);
+    for (int i = 0; i < (int) game.cards.size(); i++)
+    {
+        EXPECT_EQ(game.cards[i].ID, i);
+        EXPECT_EQ(game.FindCard(game.cards[i].name), i);
+    }
+    for (int i = 0; i < (int) game.stacks.size(); i++)
+    {
+        EXPECT_EQ(game.stacks[i].ID, i);
+    }
+
+    Battler::Card& c = game.cards[game.FindCard(game.symbols.Find("C"))];
+    EXPECT_EQ(game.cards[c.parentID].name, game.symbols.Find("B"));
+    EXPECT_EQ(game.FindCard(game.symbols.Intern("Missing")), -1);
+}
+
+TEST(VMTest, randomCardsComeFromEveryLevelOfTheClass)
+{
+    auto lines = std::vector<std::string>() =
+    {
+        "game test start",
+            "card Ship start",
+                "int health",
+            "end",
+            "card Frigate Ship start",
+            "end",
+            "card Rifter Frigate start",
+            "end",
+            "card Atron Frigate start",
+            "end",
+            "card Hulk Ship start",
+            "end",
+            "visiblestack deck",
+            "setup start",
+                "random Ship -> deck 300",
+                "random Frigate -> deck 300",
+                "random Hulk -> deck 10",
+            "end",
+        "end"
+    };
+
+    Battler::Program p;
+    p.Compile(lines);
+    p.Run(true);
+
+    auto& game = p.game();
+    int ship = game.FindCard(game.symbols.Find("Ship"));
+    int frigate = game.FindCard(game.symbols.Find("Frigate"));
+    int rifter = game.FindCard(game.symbols.Find("Rifter"));
+    int atron = game.FindCard(game.symbols.Find("Atron"));
+    int hulk = game.FindCard(game.symbols.Find("Hulk"));
+    EXPECT_EQ(game.CardsOfClass(ship), (std::vector<int>{rifter, atron, hulk}));
+    EXPECT_EQ(game.CardsOfClass(frigate), (std::vector<int>{rifter, atron}));
+    EXPECT_EQ(game.CardsOfClass(hulk), std::vector<int>{hulk});
+
+    p.RunSetup();
+
+    // new cards go to the end of the stack: 300 of any kind of ship, 300 frigates, then the hulks
+    auto& deck = game.stacks[0].Cards();
+    ASSERT_EQ(deck.size(), 610);
+    std::set<int> ships, frigates;
+    for (int i = 0; i < 300; i++)
+    {
+        ships.insert(deck[i].ID);
+    }
+    for (int i = 300; i < 600; i++)
+    {
+        frigates.insert(deck[i].ID);
+    }
+    for (int i = 600; i < 610; i++)
+    {
+        EXPECT_EQ(deck[i].ID, hulk);
+    }
+    EXPECT_EQ(frigates, (std::set<int>{rifter, atron}));
+    EXPECT_EQ(ships, (std::set<int>{rifter, atron, hulk}));
+
+    // a negative number of cards is an error, drawn at random or not
+    for (std::string transfer : {"random Ship -> deck (0 - 1)", "deck -> deck top (0 - 1)", "choose deck -> deck (0 - 1)"})
+    {
+        Battler::Program negative;
+        negative.Compile({"game test start", "card Ship start end", "visiblestack deck", "setup start", transfer, "end", "end"});
+        negative.Run(true);
+        EXPECT_THROW(negative.RunSetup(), Battler::VMError);
+    }
+}
+
+TEST(VMTest, cardsShareAttributeShapes)
+{
+    auto lines = std::vector<std::string>() =
+    {
+        "game test start",
+            "card Parent start",
+                "int health",
+                "int attack",
+            "end",
+            "card Child Parent start",
+                "health = 5",
+            "end",
+            "card Other Parent start",
+                "int defence",
+            "end",
+        "end"
+    };
+
+    Battler::Program p;
+    p.Compile(lines);
+    p.Run(true);
+
+    auto& symbols = p.game().symbols;
+    Battler::Card& parent = p.game().cards[p.game().FindCard(symbols.Find("Parent"))];
+    Battler::Card& child = p.game().cards[p.game().FindCard(symbols.Find("Child"))];
+    Battler::Card& other = p.game().cards[p.game().FindCard(symbols.Find("Other"))];
+
+    // overriding an inherited attribute keeps the parent's layout, declaring a new one extends it
+    EXPECT_EQ(child.attributes.GetShape(), parent.attributes.GetShape());
+    EXPECT_NE(other.attributes.GetShape(), parent.attributes.GetShape());
+    EXPECT_EQ(other.attributes.GetShape()->Find(symbols.Find("health")), parent.attributes.GetShape()->Find(symbols.Find("health")));
+    EXPECT_EQ(other.attributes.GetShape()->Find(symbols.Find("defence")), 2);
+
+    EXPECT_EQ(child.attributes.Get(symbols.Find("health")).i, 5);
+    EXPECT_EQ(parent.attributes.Get(symbols.Find("health")).i, 0);
+
+    Battler::CardInstance instance = p.game().GenerateCard(child.ID);
+    EXPECT_EQ(&p.game().CardOf(instance), &child);
+    EXPECT_EQ(p.game().Attributes(instance).Get(symbols.Find("health")).i, 5);
+}
+
+TEST(VMTest, cardInstancesCopyAttributesOnWrite)
+{
+    auto lines = std::vector<std::string>() =
+    {
+        "game test start",
+            "visiblestack deck",
+            "card Ship start",
+                "int health",
+                "health = 3",
+            "end",
+            "place Ship -> deck 100",
+        "end"
+    };
+
+    Battler::Program p;
+    p.Compile(lines);
+    p.Run(true);
+
+    Battler::Game& game = p.game();
+    Battler::Symbol health = game.symbols.Find("health");
+    Battler::Card& ship = game.cards[game.FindCard(game.symbols.Find("Ship"))];
+    auto& deck = game.stacks[0].Cards();
+    ASSERT_EQ(deck.size(), 100);
+
+    // instances read their card's attributes until they're written to
+    for (auto& instance : deck)
+    {
+        EXPECT_EQ(instance.ID, ship.ID);
+        EXPECT_FALSE(instance.overrides);
+        EXPECT_EQ(&game.Attributes(instance), &ship.attributes);
+    }
+
+    game.WritableAttributes(game.stacks[0], 0).Get(health).i = 1;
+    EXPECT_EQ(game.Attributes(deck[0]).Get(health).i, 1);
+    EXPECT_EQ(game.Attributes(deck[1]).Get(health).i, 3);
+    EXPECT_EQ(ship.attributes.Get(health).i, 3);
+    EXPECT_FALSE(deck[1].overrides);
+
+    // a copy shares its original's attributes until one of them writes
+    Battler::CardInstance copy = deck[0];
+    EXPECT_EQ(copy.overrides, deck[0].overrides);
+    game.WritableAttributes(copy).Get(health).i = 2;
+    EXPECT_NE(copy.overrides, deck[0].overrides);
+    EXPECT_EQ(game.Attributes(deck[0]).Get(health).i, 1);
+    EXPECT_EQ(game.Attributes(copy).Get(health).i, 2);
+}
+
+TEST(VMTest, bottomMovesKeepStackOrder)
+{
+    auto lines = std::vector<std::string>() =
+    {
+        "game test start",
+            "card C start end",
+            "visiblestack a",
+            "visiblestack b",
+            "place C -> a 5",
+            "setup start end",
+            "turn start",
+                "a ->_ b bottom 2",
+                "a -> b top 2",
+            "end",
+        "end"
+    };
+
+    Battler::Program p;
+    p.Compile(lines);
+    p.Run(true);
+    p.RunSetup();
+
+    std::vector<int> placed;
+    for (auto& c : p.game().stacks[0].Cards())
+    {
+        placed.push_back(c.UUID);
+    }
+    ASSERT_EQ(placed.size(), 5);
+
+    p.RunTurn();
+
+    // cards move one at a time, so each pair lands in the opposite order it was in
+    auto& a = p.game().stacks[0].Cards();
+    auto& b = p.game().stacks[1].Cards();
+    ASSERT_EQ(a.size(), 1);
+    ASSERT_EQ(b.size(), 4);
+    EXPECT_EQ(a[0].UUID, placed[2]);
+    EXPECT_EQ(b[0].UUID, placed[1]);
+    EXPECT_EQ(b[1].UUID, placed[0]);
+    EXPECT_EQ(b[2].UUID, placed[4]);
+    EXPECT_EQ(b[3].UUID, placed[3]);
+}
+
+TEST(VMTest, stackIndexFollowsMoves)
+{
+    Battler::Stack s;
+    auto instances = [](int from, int to) {
+        std::vector<Battler::CardInstance> cards;
+        for (int uuid = from; uuid < to; uuid++)
+        {
+            cards.push_back(Battler::CardInstance(uuid, 0));
+        }
+        return cards;
+    };
+    auto expectIndexed = [&s]() {
+        for (int i = 0; i < (int) s.Cards().size(); i++)
+        {
+            EXPECT_EQ(s.PositionOf(s.Cards()[i].UUID), i);
+        }
+    };
+
+    s.Insert(true, instances(0, 10));
+    s.Insert(false, instances(10, 15));
+    expectIndexed();
+    EXPECT_EQ(s.Cards().front().UUID, 10);
+    EXPECT_EQ(s.Cards().back().UUID, 9);
+
+    EXPECT_TRUE(s.Erase({s.Cards()[3], s.Cards()[7], s.Cards()[12]}));
+    EXPECT_EQ(s.Cards().size(), 12);
+    EXPECT_EQ(s.PositionOf(13), -1);
+    expectIndexed();
+
+    s.EraseTop(2);
+    s.EraseBottom(2);
+    s.Insert(true, instances(20, 22));
+    s.Insert(false, instances(22, 23));
+    expectIndexed();
+
+    // a card that isn't there, or one picked twice, leaves the stack alone
+    EXPECT_FALSE(s.Erase({s.Cards()[0], Battler::CardInstance(100, 0)}));
+    EXPECT_FALSE(s.Erase({s.Cards()[1], s.Cards()[1]}));
+    EXPECT_EQ(s.Cards().size(), 11);
+    expectIndexed();
+
+    // picked cards leave gaps until the stack is read, moves at its ends step over them
+    std::vector<Battler::CardInstance> before(s.Cards().begin(), s.Cards().end());
+    EXPECT_TRUE(s.Erase({before[1], before[8]}));
+    EXPECT_EQ(s.Size(), 9);
+    s.EraseTop(2);
+    s.EraseBottom(1);
+    EXPECT_EQ(s.Size(), 6);
+    EXPECT_TRUE(s.Erase({before[5]}));
+    EXPECT_FALSE(s.Erase({before[5]}));
+    std::vector<int> left;
+    for (auto& card : s.Cards())
+    {
+        left.push_back(card.UUID);
+    }
+    EXPECT_EQ(left, std::vector<int>({before[2].UUID, before[3].UUID, before[4].UUID, before[6].UUID, before[7].UUID}));
+    expectIndexed();
+
+    // erasing the top cards leaves no gaps behind
+    EXPECT_TRUE(s.Erase({before[7], before[6]}));
+    EXPECT_EQ(s.Size(), 3);
+    EXPECT_EQ(s.Cards().back().UUID, before[4].UUID);
+}
@@ -0,0 +1,826 @@
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <unordered_set>
+
+#ifdef _WIN32
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "../Compiler.h"
+
+namespace Battler {
+
+/*
+ * A bytecode image is a header followed by its sections, each starting on an 8 byte boundary:
+ *
+ *   opcodes       Opcode[opcodeCount], exactly as they are in memory, so they can be run in place
+ *   symbols       per symbol a uint32_t length and its characters, in symbol order
+ *   ints          int32_t[intCount]
+ *   bools         uint8_t[boolCount]
+ *   phases        (symbol, opcode index) int32_t pairs
+ *   global slots  (symbol, slot) int32_t pairs
+ *   blocks        (expression type, symbol, begin, end) int32_t quadruples, the game block's
+ *                 expressions and their opcodes, see Program::CompiledBlock
+ *   game          optional, the Game and VM state after Run(true), written field by field by
+ *                 ImageWriter. Symbols interned while loading are in the symbols section
+ *   source        a module's source, only in images of units compiled by Program::include_module,
+ *                 so a module cache hit is checked against the file it was compiled from
+ *
+ * Images are in the byte order of the machine that wrote them, and only load where opcodes have
+ * the same layout and instruction set. Anything else is a BytecodeError, recompile the source.
+ */
+
+static const char BYTECODE_MAGIC[4] = {'B', 'B', 'C', '\0'};
+static const uint32_t BYTECODE_VERSION = 5;
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+struct BytecodeSection {
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct BytecodeHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t opcodeSize;
+    uint32_t opcodeTypeCount;
+    int32_t setupIndex;
+    int32_t turnIndex;
+    uint32_t cardSequenceCount;
+    BytecodeSection opcodes;
+    BytecodeSection symbols; // count is the number of symbols, the section runs up to ints
+    BytecodeSection ints;
+    BytecodeSection bools;
+    BytecodeSection phases;
+    BytecodeSection globalSlots;
+    BytecodeSection blocks;
+    BytecodeSection game; // count is in bytes, 0 if the image wasn't saved after loading
+    BytecodeSection source; // count is in bytes, 0 unless the image is a module's unit
+    uint64_t size;
+};
+
+// Appends the loaded game to an image. Values are written as they are in memory, containers as
+// their size followed by their elements.
+class ImageWriter {
+public:
+    explicit ImageWriter(string& image) : image(image) {}
+
+    template <class T>
+    void Raw(const T& value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values are written as they are");
+        image.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    void Int(int64_t value) {Raw(value);}
+
+    void String(const string& s)
+    {
+        Int((int64_t) s.size());
+        image.append(s);
+    }
+
+    // attributes in slot order, storing them in this order rebuilds the same shape
+    void Attributes(const AttrCont& attributes)
+    {
+        const vector<Symbol>& names = attributes.GetShape()->Names();
+        Int((int64_t) names.size());
+        for (size_t slot = 0; slot < names.size(); slot++)
+        {
+            Int(names[slot]);
+            Raw(attributes.Values()[slot]);
+        }
+    }
+
+    void Instance(const CardInstance& instance)
+    {
+        Int(instance.UUID);
+        Int(instance.ID);
+        Int(instance.overrides ? 1 : 0);
+        if (instance.overrides)
+        {
+            Attributes(*instance.overrides);
+        }
+    }
+
+private:
+    string& image;
+};
+
+// Reads what ImageWriter wrote, throwing a BytecodeError instead of reading past the game section.
+class ImageReader {
+public:
+    ImageReader(const char* begin, const char* end, const string& path) : current(begin), end(end), path(path) {}
+
+    template <class T>
+    T Raw()
+    {
+        if ((size_t) (end - current) < sizeof(T))
+        {
+            Corrupt();
+        }
+        T value;
+        std::memcpy(&value, current, sizeof(T));
+        current += sizeof(T);
+        return value;
+    }
+
+    int Int(int64_t min = INT32_MIN, int64_t max = INT32_MAX)
+    {
+        int64_t value = Raw<int64_t>();
+        if (value < min || value > max)
+        {
+            Corrupt();
+        }
+        return (int) value;
+    }
+
+    // the size of a container, whose elements take up at least elementSize bytes each
+    int Count(size_t elementSize = 1)
+    {
+        return Int(0, (end - current) / elementSize);
+    }
+
+    string String()
+    {
+        int size = Count();
+        string s(current, size);
+        current += size;
+        return s;
+    }
+
+    AttrCont Attributes(const SymbolTable& symbols)
+    {
+        AttrCont attributes;
+        int n = Count(sizeof(int64_t) + sizeof(Attr));
+        for (int i = 0; i < n; i++)
+        {
+            Symbol name = Int(0, (int64_t) symbols.size() - 1);
+            attributes.Store(name, Raw<Attr>());
+        }
+        return attributes;
+    }
+
+    CardInstance Instance(const SymbolTable& symbols, int nCards)
+    {
+        CardInstance instance;
+        instance.UUID = Int();
+        instance.ID = Int(0, nCards - 1);
+        if (Int(0, 1))
+        {
+            instance.overrides = std::make_shared<AttrCont>(Attributes(symbols));
+        }
+        return instance;
+    }
+
+    bool AtEnd() const {return current == end;}
+
+    [[noreturn]] void Corrupt() const
+    {
+        throw BytecodeError(path + " is truncated or corrupt");
+    }
+
+private:
+    const char* current;
+    const char* end;
+    const string& path;
+};
+
+static size_t align8(size_t n)
+{
+	return (n + 7) & ~size_t(7);
+}
+
+template <class T>
+static void append(string& image, const T& value)
+{
+	image.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+static uint64_t start_section(string& image)
+{
+	image.resize(align8(image.size()), '\0');
+	return image.size();
+}
+
+void Program::Save(const string& path) const
+{
+	BytecodeHeader header = {};
+	std::memcpy(header.magic, BYTECODE_MAGIC, sizeof(header.magic));
+	header.version = BYTECODE_VERSION;
+	header.byteOrder = BYTE_ORDER_MARK;
+	header.opcodeSize = sizeof(Opcode);
+	header.opcodeTypeCount = (uint32_t) OPCODE_TYPE_COUNT;
+	header.setupIndex = m_setup_index;
+	header.turnIndex = m_turn_index;
+	header.cardSequenceCount = (uint32_t) m_card_sequences.size();
+
+	string image(sizeof(BytecodeHeader), '\0');
+
+	header.opcodes = {start_section(image), m_opcodes.size()};
+	image.append(reinterpret_cast<const char*>(m_opcodes.begin()), m_opcodes.size() * sizeof(Opcode));
+
+	header.symbols = {start_section(image), m_game.symbols.size()};
+	for (Symbol s = 0; s < (Symbol) m_game.symbols.size(); s++)
+	{
+		const string& name = m_game.symbols.Name(s);
+		append(image, (uint32_t) name.size());
+		image.append(name);
+	}
+
+	header.ints = {start_section(image), m_ints.size()};
+	for (int i : m_ints)
+	{
+		append(image, (int32_t) i);
+	}
+
+	header.bools = {start_section(image), m_bools.size()};
+	for (bool b : m_bools)
+	{
+		append(image, (uint8_t) b);
+	}
+
+	header.phases = {start_section(image), m_phase_indexes.size()};
+	for (auto& phase : m_phase_indexes)
+	{
+		append(image, (int32_t) phase.first);
+		append(image, (int32_t) phase.second);
+	}
+
+	header.globalSlots = {start_section(image), m_global_slots.size()};
+	for (auto& global : m_global_slots)
+	{
+		append(image, (int32_t) global.first);
+		append(image, (int32_t) global.second);
+	}
+
+	header.blocks = {start_section(image), m_blocks.size()};
+	for (const CompiledBlock& block : m_blocks)
+	{
+		append(image, (int32_t) block.type);
+		append(image, (int32_t) block.name);
+		append(image, (int32_t) block.begin);
+		append(image, (int32_t) block.end);
+	}
+
+	if (m_loaded)
+	{
+		header.game.offset = start_section(image);
+		save_game(image);
+		header.game.count = image.size() - header.game.offset;
+	}
+
+	if (m_unit)
+	{
+		header.source = {start_section(image), m_source.size()};
+		image.append(m_source);
+	}
+
+	header.size = image.size();
+	std::memcpy(&image[0], &header, sizeof(header));
+
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	out.write(image.data(), image.size());
+	if (!out)
+	{
+		throw BytecodeError("could not write " + path);
+	}
+}
+
+std::shared_ptr<const void> map_file(const string& path, size_t& size)
+{
+#ifdef _WIN32
+	std::ifstream in(path, std::ios::binary);
+	if (!in.is_open())
+	{
+		return nullptr;
+	}
+	auto contents = std::make_shared<vector<char>>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	size = contents->size();
+	return std::shared_ptr<const void>(contents, contents->data());
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1)
+	{
+		return nullptr;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1)
+	{
+		close(fd);
+		return nullptr;
+	}
+	size = (size_t) st.st_size;
+	if (size == 0)
+	{
+		// there's nothing to map
+		close(fd);
+		static const char empty = 0;
+		return std::shared_ptr<const void>(&empty, [](const void*) {});
+	}
+
+	void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED)
+	{
+		return nullptr;
+	}
+
+	return std::shared_ptr<const void>(mapping, [size](const void* p) { munmap(const_cast<void*>(p), size); });
+#endif
+}
+
+static bool section_fits(const BytecodeSection& section, size_t elementSize, size_t imageSize)
+{
+	return section.offset <= imageSize && section.count <= (imageSize - section.offset) / elementSize;
+}
+
+void Program::Load(const string& path)
+{
+	size_t size = 0;
+	std::shared_ptr<const void> mapping = map_file(path, size);
+	if (!mapping)
+	{
+		throw BytecodeError("could not open " + path);
+	}
+	const char* image = static_cast<const char*>(mapping.get());
+
+	BytecodeHeader header;
+	if (size < sizeof(header))
+	{
+		throw BytecodeError(path + " is not a bytecode image");
+	}
+	std::memcpy(&header, image, sizeof(header));
+
+	if (std::memcmp(header.magic, BYTECODE_MAGIC, sizeof(header.magic)) != 0)
+	{
+		throw BytecodeError(path + " is not a bytecode image");
+	}
+	if (header.version != BYTECODE_VERSION || header.byteOrder != BYTE_ORDER_MARK
+		|| header.opcodeSize != sizeof(Opcode) || header.opcodeTypeCount != OPCODE_TYPE_COUNT)
+	{
+		throw BytecodeError(path + " was written by an incompatible version of Battler");
+	}
+	if (header.size != size
+		|| header.opcodes.offset % alignof(Opcode) != 0
+		|| !section_fits(header.opcodes, sizeof(Opcode), size)
+		|| !section_fits(header.ints, sizeof(int32_t), size)
+		|| !section_fits(header.bools, sizeof(uint8_t), size)
+		|| !section_fits(header.phases, 2 * sizeof(int32_t), size)
+		|| !section_fits(header.globalSlots, 2 * sizeof(int32_t), size)
+		|| !section_fits(header.blocks, 4 * sizeof(int32_t), size)
+		|| !section_fits(header.game, 1, size)
+		|| !section_fits(header.source, 1, size)
+		|| header.symbols.offset > header.ints.offset
+		|| header.setupIndex < -1 || header.setupIndex >= (int64_t) header.opcodes.count
+		|| header.turnIndex < -1 || header.turnIndex >= (int64_t) header.opcodes.count
+		|| header.cardSequenceCount > header.opcodes.count)
+	{
+		throw BytecodeError(path + " is truncated or corrupt");
+	}
+
+	*this = Program();
+
+	const Opcode* opcodes = reinterpret_cast<const Opcode*>(image + header.opcodes.offset);
+	int nOpcodes = (int) header.opcodes.count;
+	for (int i = 0; i < nOpcodes; i++)
+	{
+		const Opcode& code = opcodes[i];
+		// a card takes at least two opcodes to declare, so card IDs are below the opcode count too.
+		// A name's card is its end_index, and a module's cards aren't numbered until it's linked
+		bool cardHeader = code.type == OpcodeType::CARD_BLK_HEADER;
+		if ((size_t) code.type >= OPCODE_TYPE_COUNT
+			|| code.jump_index < -1 || code.jump_index >= nOpcodes
+			|| code.end_index < -1 || code.end_index >= nOpcodes
+			|| (cardHeader && (code.slot < NO_CARD || code.slot >= nOpcodes))
+			|| (!cardHeader && (code.slot < NO_SLOT || code.slot >= (int) header.globalSlots.count)))
+		{
+			throw BytecodeError(path + " is truncated or corrupt");
+		}
+
+		// the index in an opcode's data is into the pool its type code names, see Program::link
+		DATA_IX_T index = (code.data & DATA_IX_T_MASK) >> 32;
+		TYPE_CODE_T typeCode = code.data & TYPE_CODE_T_MASK;
+		bool indexed = true;
+		uint64_t poolSize = 0;
+		if (code.type == OpcodeType::CARD_SEQUENCE_START)
+		{
+			poolSize = header.cardSequenceCount;
+		}
+		else if (code.type == OpcodeType::ATTR_DATA_TYPE)
+		{
+			// an attribute's type is a type code without an index
+			indexed = false;
+			if (s_type_code_to_attribute_type(typeCode) == AttributeType::UNDEFINED)
+			{
+				throw BytecodeError(path + " is truncated or corrupt");
+			}
+		}
+		else if (typeCode == STRING_TC)
+		{
+			poolSize = header.symbols.count;
+		}
+		else if (typeCode == INT_TC)
+		{
+			poolSize = header.ints.count;
+		}
+		else if (typeCode == BOOL_TC)
+		{
+			poolSize = header.bools.count;
+		}
+		else
+		{
+			indexed = false;
+		}
+		if (indexed && index >= poolSize)
+		{
+			throw BytecodeError(path + " is truncated or corrupt");
+		}
+	}
+	m_opcodes.Adopt(mapping, opcodes, nOpcodes);
+
+	// the builtin symbols are interned by every symbol table, so an image's have to agree with them
+	const char* name = image + header.symbols.offset;
+	const char* symbolsEnd = image + header.ints.offset;
+	for (uint64_t s = 0; s < header.symbols.count; s++)
+	{
+		uint32_t length;
+		if (symbolsEnd - name < (ptrdiff_t) sizeof(length))
+		{
+			throw BytecodeError(path + " is truncated or corrupt");
+		}
+		std::memcpy(&length, name, sizeof(length));
+		name += sizeof(length);
+		if ((size_t) (symbolsEnd - name) < length || m_game.symbols.Intern(string(name, length)) != (Symbol) s)
+		{
+			throw BytecodeError(path + " is truncated or corrupt");
+		}
+		name += length;
+	}
+
+	const char* ints = image + header.ints.offset;
+	for (uint64_t i = 0; i < header.ints.count; i++)
+	{
+		int32_t value;
+		std::memcpy(&value, ints + i * sizeof(value), sizeof(value));
+		m_ints.push_back(value);
+	}
+
+	const uint8_t* bools = reinterpret_cast<const uint8_t*>(image + header.bools.offset);
+	m_bools.assign(bools, bools + header.bools.count);
+
+	const char* phases = image + header.phases.offset;
+	for (uint64_t i = 0; i < header.phases.count; i++)
+	{
+		int32_t pair[2];
+		std::memcpy(pair, phases + i * sizeof(pair), sizeof(pair));
+		if (pair[0] < 0 || pair[0] >= (int64_t) header.symbols.count || pair[1] < 0 || pair[1] >= nOpcodes)
+		{
+			throw BytecodeError(path + " is truncated or corrupt");
+		}
+		m_phase_indexes[pair[0]] = pair[1];
+	}
+
+	const char* globals = image + header.globalSlots.offset;
+	for (uint64_t i = 0; i < header.globalSlots.count; i++)
+	{
+		int32_t pair[2];
+		std::memcpy(pair, globals + i * sizeof(pair), sizeof(pair));
+		if (pair[0] < 0 || pair[0] >= (int64_t) header.symbols.count || pair[1] < 0 || pair[1] >= (int64_t) header.globalSlots.count)
+		{
+			throw BytecodeError(path + " is truncated or corrupt");
+		}
+		m_global_slots[pair[0]] = pair[1];
+	}
+	// every slot an opcode may be bound to has a global
+	if (m_global_slots.size() != header.globalSlots.count)
+	{
+		throw BytecodeError(path + " is truncated or corrupt");
+	}
+
+	const char* blocks = image + header.blocks.offset;
+	for (uint64_t i = 0; i < header.blocks.count; i++)
+	{
+		int32_t fields[4];
+		std::memcpy(fields, blocks + i * sizeof(fields), sizeof(fields));
+		if (fields[0] < 0 || fields[0] > (int32_t) ExpressionType::UNKNOWN
+			|| fields[1] < NO_SYMBOL || fields[1] >= (int32_t) header.symbols.count
+			|| fields[2] < 0 || fields[2] > fields[3] || fields[3] > nOpcodes)
+		{
+			throw BytecodeError(path + " is truncated or corrupt");
+		}
+		CompiledBlock block;
+		block.type = (ExpressionType) fields[0];
+		block.name = fields[1];
+		block.begin = fields[2];
+		block.end = fields[3];
+		block.compiled = true;
+		m_blocks.push_back(block);
+	}
+
+	m_setup_index = header.setupIndex;
+	m_turn_index = header.turnIndex;
+	m_globals.assign(m_global_slots.size(), Attr(AttributeType::UNDEFINED));
+	m_card_sequences.assign(header.cardSequenceCount, CardSequence());
+
+	if (header.game.count > 0)
+	{
+		const char* game = image + header.game.offset;
+		ImageReader reader(game, game + header.game.count, path);
+		load_game(reader);
+	}
+
+	if (header.source.count > 0)
+	{
+		m_source_buffer = mapping;
+		m_source = std::string_view(image + header.source.offset, header.source.count);
+	}
+}
+
+void Program::save_game(string& image) const
+{
+	ImageWriter w(image);
+
+	w.Int(m_game.ID);
+	w.String(m_game.name);
+	w.Attributes(m_game.attributeCont);
+	w.Int(m_game.currentPlayerIndex);
+	w.Int(m_game.winner);
+	w.Int(m_game.m_currentCardUUID);
+	w.Raw(m_game.random);
+
+	w.Int((int64_t) m_game.cards.size());
+	for (const Card& card : m_game.cards)
+	{
+		w.Int(card.UUID);
+		w.Int(card.parentID);
+		w.Int(card.name);
+		w.Int(card.parentName);
+		w.Attributes(card.attributes);
+	}
+
+	w.Int((int64_t) m_game.stacks.size());
+	for (const Stack& stack : m_game.stacks)
+	{
+		w.Int((int64_t) stack.t);
+		w.Attributes(stack.attributes);
+		w.Int((int64_t) stack.Cards().size());
+		for (const CardInstance& instance : stack.Cards())
+		{
+			w.Instance(instance);
+		}
+	}
+
+	w.Int((int64_t) m_game.players.size());
+	for (const Player& player : m_game.players)
+	{
+		w.Int(player.ID);
+		w.String(player.name);
+		w.Attributes(player.attributes);
+	}
+
+	w.Int((int64_t) m_game.playerBindings.size());
+	for (auto& binding : m_game.playerBindings)
+	{
+		w.String(binding.first);
+		w.Int(binding.second);
+	}
+
+	w.Int((int64_t) m_game.phases.size());
+	for (auto& phase : m_game.phases)
+	{
+		w.Int(phase.first);
+		w.Int(phase.second.ID);
+		w.String(phase.second.name);
+		w.Attributes(phase.second.attributes);
+	}
+
+	w.Int(m_depth);
+	w.Int(m_depth_store);
+	w.Int(m_current_opcode_index);
+	w.Raw(m_executed_opcodes);
+	for (const Attr& global : m_globals)
+	{
+		w.Raw(global);
+	}
+	w.Int((int64_t) m_locale_stack.size());
+	for (const AttrCont& locale : m_locale_stack)
+	{
+		w.Attributes(locale);
+	}
+	w.Int((int64_t) m_proc_mode_stack.size());
+	for (PROC_MODE mode : m_proc_mode_stack)
+	{
+		w.Int((int64_t) mode);
+	}
+	w.Int((int64_t) m_block_name_stack.size());
+	for (const string& name : m_block_name_stack)
+	{
+		w.String(name);
+	}
+}
+
+// whether a loaded value's payload indexes the table its type refers to
+static bool s_valid_attr(const Attr& a, const Game& game, size_t cardSequences)
+{
+	auto below = [](int value, size_t size) {return value >= 0 && (size_t) value < size;};
+
+	switch (a.type)
+	{
+	case AttributeType::INT:
+	case AttributeType::FLOAT:
+	case AttributeType::UNDEFINED:
+		return true;
+	case AttributeType::BOOL:
+	{
+		// anything but 0 or 1 isn't a bool
+		uint8_t byte;
+		std::memcpy(&byte, &a.b, sizeof(byte));
+		return byte <= 1;
+	}
+	case AttributeType::STRING:
+		return below(a.s, game.symbols.size());
+	case AttributeType::PHASE_REF:
+		return below(a.phaseRef, game.symbols.size());
+	case AttributeType::CARD_REF:
+		return below(a.cardRef, game.cards.size());
+	case AttributeType::STACK_REF:
+		return below(a.stackRef, game.stacks.size());
+	case AttributeType::PLAYER:
+	case AttributeType::PLAYER_REF:
+		// a stack nobody owns has an owner of -1
+		return a.playerRef == -1 || below(a.playerRef, game.players.size());
+	case AttributeType::STACK_POSITION_REF:
+		// a position off its stack is checked when it's used
+		return below(a.stackPositionRef.stack, game.stacks.size());
+	case AttributeType::CARD_SEQUENCE:
+		return below(a.cardSequence, cardSequences);
+	default:
+		return false;
+	}
+}
+
+void Program::load_game(ImageReader& r)
+{
+	const SymbolTable& symbols = m_game.symbols;
+	int lastSymbol = (int) symbols.size() - 1;
+
+	m_game.ID = r.Int();
+	m_game.name = r.String();
+	m_game.attributeCont = r.Attributes(symbols);
+	m_game.currentPlayerIndex = r.Int();
+	m_game.winner = r.Int();
+	m_game.m_currentCardUUID = r.Int();
+	m_game.random = r.Raw<Random>();
+
+	int nCards = r.Count();
+	for (int id = 0; id < nCards; id++)
+	{
+		Card card;
+		card.ID = id;
+		card.UUID = r.Int();
+		// parents are always declared before their children
+		card.parentID = r.Int(-1, id - 1);
+		card.name = r.Int(NO_SYMBOL, lastSymbol);
+		card.parentName = r.Int(NO_SYMBOL, lastSymbol);
+		card.attributes = r.Attributes(symbols);
+		m_game.cardIDs[card.name] = card.ID;
+		m_game.cards.push_back(std::move(card));
+	}
+	m_game.IndexCardClasses();
+
+	std::unordered_set<int> uuids;
+	int nStacks = r.Count();
+	for (int id = 0; id < nStacks; id++)
+	{
+		Stack stack;
+		stack.ID = id;
+		stack.t = (StackType) r.Int((int64_t) StackType::VISIBLE, (int64_t) StackType::FLAT_HIDDEN);
+		stack.attributes = r.Attributes(symbols);
+		vector<CardInstance> cards(r.Count());
+		for (CardInstance& instance : cards)
+		{
+			instance = r.Instance(symbols, nCards);
+			// a card is in one place at a time, and the stack's index can only hold it once
+			if (!uuids.insert(instance.UUID).second)
+			{
+				r.Corrupt();
+			}
+		}
+		stack.Insert(true, cards);
+		m_game.stacks.push_back(std::move(stack));
+	}
+
+	// turns are taken in turn by the players, so there's always at least one
+	int nPlayers = r.Count();
+	if (nPlayers == 0 || m_game.currentPlayerIndex < 0 || m_game.currentPlayerIndex >= nPlayers)
+	{
+		r.Corrupt();
+	}
+	m_game.players.resize(nPlayers);
+	for (Player& player : m_game.players)
+	{
+		player.ID = r.Int();
+		player.name = r.String();
+		player.attributes = r.Attributes(symbols);
+	}
+
+	int nBindings = r.Count();
+	for (int i = 0; i < nBindings; i++)
+	{
+		string name = r.String();
+		m_game.playerBindings[name] = r.Int(0, nPlayers - 1);
+	}
+
+	int nPhases = r.Count();
+	for (int i = 0; i < nPhases; i++)
+	{
+		Phase& phase = m_game.phases[r.Int(0, lastSymbol)];
+		phase.ID = r.Int();
+		phase.name = r.String();
+		phase.attributes = r.Attributes(symbols);
+	}
+
+	m_depth = r.Int();
+	m_depth_store = r.Int();
+	m_current_opcode_index = r.Int(0, m_opcodes.size());
+	m_executed_opcodes = r.Raw<uint64_t>();
+	for (Attr& global : m_globals)
+	{
+		global = r.Raw<Attr>();
+	}
+	m_locale_stack.resize(r.Count());
+	for (AttrCont& locale : m_locale_stack)
+	{
+		locale = r.Attributes(symbols);
+	}
+	m_proc_mode_stack.resize(r.Count());
+	for (PROC_MODE& mode : m_proc_mode_stack)
+	{
+		mode = (PROC_MODE) r.Int((int64_t) PROC_MODE::GAME, (int64_t) PROC_MODE::IF);
+	}
+	m_block_name_stack.resize(r.Count());
+	for (string& name : m_block_name_stack)
+	{
+		name = r.String();
+	}
+
+	if (!r.AtEnd())
+	{
+		r.Corrupt();
+	}
+
+	// values are read as they are, so check them once every table they may refer to is loaded
+	auto check = [&](const vector<Attr>& values) {
+		for (const Attr& value : values)
+		{
+			if (!s_valid_attr(value, m_game, m_card_sequences.size()))
+			{
+				r.Corrupt();
+			}
+		}
+	};
+	check(m_game.attributeCont.Values());
+	for (const Card& card : m_game.cards)
+	{
+		check(card.attributes.Values());
+	}
+	for (const Stack& stack : m_game.stacks)
+	{
+		check(stack.attributes.Values());
+		for (const CardInstance& instance : stack.Cards())
+		{
+			if (instance.overrides)
+			{
+				check(instance.overrides->Values());
+			}
+		}
+	}
+	for (const Player& player : m_game.players)
+	{
+		check(player.attributes.Values());
+	}
+	for (const auto& phase : m_game.phases)
+	{
+		check(phase.second.attributes.Values());
+	}
+	check(m_globals);
+	for (const AttrCont& locale : m_locale_stack)
+	{
+		check(locale.Values());
+	}
+
+	m_loaded = true;
+}
+
+}
@@ -1,4 +1,11 @@
 #include <algorithm>
+#include <array>
+#include <exception>
+#include <filesystem>
+#include <limits>
+#include <random>
+#include <thread>
+#include <unordered_set>
 
 #include "../Compiler.h"
 
@@ -9,48 +16,257 @@ namespace Battler {
 
 vector<Opcode> Program::opcodes()
 {
-	return m_opcodes;
+	return vector<Opcode>(m_opcodes.begin(), m_opcodes.end());
 }
 
-void Program::_Parse(vector<string> lines)
+// the lines of a game as one buffer, the way they'd be read from its file
+static string s_join_lines(const vector<string>& lines)
 {
-    for (std::string line : lines)
-    {
-        auto start = line.begin();
-        auto end = line.end();
+	size_t size = 0;
+	for (const string& line : lines)
+	{
+		size += line.size() + 1;
+	}
 
-        while (start != end) {
+	string source;
+	source.reserve(size);
+	for (const string& line : lines)
+	{
+		source += line;
+		source += '\n';
+	}
+	return source;
+}
 
-            auto resPair = getNextToken(start, end);
-            Token t = resPair.first;
+void Program::_Parse(vector<string> lines)
+{
+	auto source = std::make_shared<const string>(s_join_lines(lines));
+	m_source = *source;
+	m_source_buffer = std::move(source);
+	tokenize();
+}
 
-            if (t.type == TokenType::comment) {
-                break;
-            }
+void Program::tokenize()
+{
+	// most games average a token every few characters, reserving for that skips regrowing the vector
+	m_tokens.reserve(m_tokens.size() + m_source.size() / 4);
+	Lexer lexer(m_source);
+	Token t;
+	while (lexer.Next(t))
+	{
+		m_tokens.push_back(t);
+	}
+}
 
-            if (t.type != TokenType::space) {
+void Program::Compile(vector<string> lines)
+{
+	CompileSource(s_join_lines(lines));
+}
 
-                t.l = (int) lines.size();
-                t.c = (int) std::distance(line.begin(), start);
-                m_tokens.push_back(std::move(t));
-            }
+void Program::CompileSource(string source)
+{
+	auto buffer = std::make_shared<const string>(std::move(source));
+	m_source = *buffer;
+	m_source_buffer = std::move(buffer);
+	compile_source();
+}
 
-            start = resPair.second;
-        }
-    }
+void Program::CompileFile(const string& path)
+{
+	size_t size = 0;
+	m_source_buffer = map_file(path, size);
+	if (!m_source_buffer)
+	{
+		throw CompileError("could not open " + path, Token{});
+	}
+	m_source = std::string_view(static_cast<const char*>(m_source_buffer.get()), size);
+	m_source_dir = std::filesystem::path(path).parent_path().string();
+	compile_source();
 }
 
-void Program::Compile(vector<string> lines)
+void Program::compile_source()
 {
-    _Parse(lines);
-    auto tokens_begin = m_tokens.begin();
-	m_rootExpression = GetExpression(tokens_begin, m_tokens.end());
+	tokenize();
+	auto tokens_begin = m_tokens.begin();
+	m_expressions = std::make_shared<ExpressionArena>();
+	m_rootExpression = GetExpression(*m_expressions, tokens_begin, m_tokens.end());
 	CompileExpression(m_rootExpression);
+	resolve_jump_targets();
+	resolve_names();
+}
+
+/*
+ * Points every block header at the opcodes it may jump to, so the VM never has to walk a block
+ * to skip over it. The headers of an if block (if, elseif..., else) form a chain through
+ * jump_index that ends at the if's BLK_END, and all of them share that BLK_END as end_index.
+ * The end of a foreachplayer block points back at its header, and each 'do' at its phase.
+ */
+void Program::resolve_jump_targets()
+{
+	// the header indexes of every block we are inside of, an if block also collects the
+	// elseif and else headers that belong to it
+	vector<vector<int>> open_blocks;
+
+	for (int i = 0; i < (int) m_opcodes.size(); i++)
+	{
+		Opcode& code = m_opcodes.Edit(i);
+
+		if (s_is_block_start(code.type))
+		{
+			open_blocks.push_back({i});
+		}
+		else if (code.type == OpcodeType::ELSE_IF_BLK_HEADER || code.type == OpcodeType::ELSE_BLK_HEADER)
+		{
+			assert(!open_blocks.empty() && m_opcodes[open_blocks.back()[0]].type == OpcodeType::IF_BLK_HEADER);
+			open_blocks.back().push_back(i);
+		}
+		else if (s_is_block_end(code.type))
+		{
+			assert(!open_blocks.empty());
+			vector<int>& headers = open_blocks.back();
+			for (size_t h = 0; h < headers.size(); h++)
+			{
+				m_opcodes.Edit(headers[h]).jump_index = h + 1 < headers.size() ? headers[h + 1] : i;
+				m_opcodes.Edit(headers[h]).end_index = i;
+			}
+			code.jump_index = headers[0];
+			open_blocks.pop_back();
+		}
+		else if (code.type == OpcodeType::DO_DECL)
+		{
+			DATA_IX_T name_idx = (code.data & DATA_IX_T_MASK) >> 32;
+			auto phase = m_phase_indexes.find((Symbol) name_idx);
+			if (phase != m_phase_indexes.end())
+			{
+				code.jump_index = phase->second;
+			}
+		}
+	}
+
+	assert(open_blocks.empty());
+}
+
+static bool s_is_name(OpcodeType type)
+{
+	return type == OpcodeType::L_VALUE
+		|| type == OpcodeType::R_VALUE_REF
+		|| type == OpcodeType::L_VALUE_DOT_SEPERATED_REF_CHAIN
+		|| type == OpcodeType::R_VALUE_DOT_SEPERATED_REF_CHAIN;
+}
+
+/*
+ * Binds every reference to an attribute declared in the game block to a slot in m_globals, so
+ * the VM reads it by index instead of searching the locale stack by name.
+ * A name is only bound when nothing can shadow it at runtime: it is not a card, and it is never
+ * declared inside another block or pushed as a local (currentPlayer, from, to, loop counters).
+ * Phases run in the frames of whoever calls 'do', so locals are still looked up by name.
+ * Cards get their IDs here too, in the order they're declared in, and every name that names a
+ * card is bound to its ID so the VM never looks a card up by name.
+ */
+void Program::resolve_names()
+{
+	std::unordered_set<Symbol> locals = { CURRENT_PLAYER_SYMBOL, FROM_SYMBOL, TO_SYMBOL, P_SYMBOL };
+	vector<Symbol> globals;
+	vector<OpcodeType> open_blocks;
+
+	for (int i = 0; i < (int) m_opcodes.size(); i++)
+	{
+		Opcode& code = m_opcodes.Edit(i);
+		DATA_IX_T name_idx = (code.data & DATA_IX_T_MASK) >> 32;
+
+		if (s_is_block_start(code.type))
+		{
+			open_blocks.push_back(code.type);
+			if (code.type == OpcodeType::CARD_BLK_HEADER)
+			{
+				// a card keeps its ID when it's declared again, so its instances take on the new card
+				Symbol card = get_card_name(m_game.symbols.Name(name_idx));
+				auto id = m_card_ids.emplace(card, (int) m_card_ids.size()).first;
+				code.slot = id->second;
+			}
+			else if (code.type == OpcodeType::FOREACHPLAYER_BLK_HEADER)
+			{
+				locals.insert((Symbol) name_idx);
+			}
+		}
+		else if (s_is_block_end(code.type))
+		{
+			open_blocks.pop_back();
+		}
+		else if (code.type == OpcodeType::ATTR_DECL && m_opcodes[i + 1].type == OpcodeType::L_VALUE)
+		{
+			Symbol name = (Symbol) ((m_opcodes[i + 1].data & DATA_IX_T_MASK) >> 32);
+			if (open_blocks.back() == OpcodeType::GAME_BLK_HEADER)
+			{
+				globals.push_back(name);
+			}
+			else
+			{
+				locals.insert(name);
+			}
+		}
+	}
+
+	for (Symbol name : globals)
+	{
+		if (locals.count(name) == 0 && m_card_ids.count(name) == 0 && m_global_slots.count(name) == 0)
+		{
+			int slot = (int) m_global_slots.size();
+			m_global_slots[name] = slot;
+		}
+	}
+	m_globals.assign(m_global_slots.size(), Attr(AttributeType::UNDEFINED));
+
+	bool in_card_sequence = false;
+	for (int i = 0; i < (int) m_opcodes.size(); i++)
+	{
+		Opcode& code = m_opcodes.Edit(i);
+		OpcodeType previous = i > 0 ? m_opcodes[i - 1].type : OpcodeType::NO_OP;
+		if (s_is_name(code.type))
+		{
+			code.slot = NO_SLOT;
+			code.card = NO_CARD;
+		}
+
+		if (code.type == OpcodeType::CARD_SEQUENCE_START || code.type == OpcodeType::CARD_SEQUENCE_END)
+		{
+			in_card_sequence = code.type == OpcodeType::CARD_SEQUENCE_START;
+		}
+
+		// only the first name of a reference is looked up in the locale stack. The names that follow
+		// a dynamic resolution are looked up on its result, and card sequences, random and specific
+		// card sources name cards
+		bool chained = previous == code.type
+			&& (code.type == OpcodeType::L_VALUE_DOT_SEPERATED_REF_CHAIN || code.type == OpcodeType::R_VALUE_DOT_SEPERATED_REF_CHAIN);
+
+		if (!s_is_name(code.type) || chained || previous == OpcodeType::DYNAMIC_IDENTIFIER_RESOLTION_NAMES)
+		{
+			continue;
+		}
+
+		Symbol name = (Symbol) ((code.data & DATA_IX_T_MASK) >> 32);
+		auto card = m_card_ids.find(name);
+		if (card != m_card_ids.end())
+		{
+			code.card = card->second;
+		}
+
+		if (in_card_sequence || previous == OpcodeType::RANDOM || previous == OpcodeType::SPECIFIC_CARD)
+		{
+			continue;
+		}
+
+		auto global = m_global_slots.find(name);
+		if (global != m_global_slots.end())
+		{
+			code.slot = global->second;
+		}
+	}
 }
 
 #define NAME_IS_LVALUE true
 #define NAME_IS_RVALUE false
-void Program::compile_name(vector<Token> tokens, bool lvalue)
+void Program::compile_name(ArenaSpan<Token> tokens, bool lvalue)
 {
 	// we're dealing with just a name, no dot seperation
 	if (tokens.size() == 1)
@@ -65,8 +281,7 @@ void Program::compile_name(vector<Token> tokens, bool lvalue)
 			code.type = OpcodeType::R_VALUE_REF;
 		}
 
-		DATA_IX_T string_index = (DATA_IX_T) m_strings.size();
-		m_strings.push_back(tokens[0].text);
+		DATA_IX_T string_index = intern_string(tokens[0].text);
 		code.data |= STRING_TC;
 		code.data |= ((OPCODE_CONV_T)string_index << 32);
 		m_opcodes.push_back(code);
@@ -74,7 +289,7 @@ void Program::compile_name(vector<Token> tokens, bool lvalue)
 	// we're dealing with a dot seperated name
 	else
 	{
-		for (auto token : tokens)
+		for (const Token& token : tokens)
 		{
 			if (token.type == TokenType::name)
 			{
@@ -88,8 +303,7 @@ void Program::compile_name(vector<Token> tokens, bool lvalue)
 					code.type = OpcodeType::R_VALUE_DOT_SEPERATED_REF_CHAIN;
 				}
 
-				DATA_IX_T string_index = (DATA_IX_T) m_strings.size();
-				m_strings.push_back(token.text);
+				DATA_IX_T string_index = intern_string(token.text);
 				code.data |= STRING_TC;
 				code.data |= ((OPCODE_CONV_T)string_index << 32);
 				m_opcodes.push_back(code);
@@ -101,42 +315,206 @@ void Program::compile_name(vector<Token> tokens, bool lvalue)
 	}
 }
 
+static Attr s_int_attr(int i)
+{
+	Attr a(AttributeType::INT);
+	a.i = i;
+	return a;
+}
+
+static Attr s_bool_attr(bool b)
+{
+	Attr a(AttributeType::BOOL);
+	a.b = b;
+	return a;
+}
+
+DATA_IX_T Program::intern_string(std::string_view s)
+{
+	return (DATA_IX_T) m_game.symbols.Intern(s);
+}
+
+DATA_IX_T Program::intern_int(int i)
+{
+	auto interned = m_int_indexes.find(i);
+	if (interned != m_int_indexes.end())
+	{
+		return interned->second;
+	}
+
+	DATA_IX_T index = (DATA_IX_T) m_ints.size();
+	m_ints.push_back(i);
+	m_int_indexes[i] = index;
+	return index;
+}
+
+DATA_IX_T Program::intern_bool(bool b)
+{
+	auto interned = std::find(m_bools.begin(), m_bools.end(), b);
+	if (interned != m_bools.end())
+	{
+		return (DATA_IX_T) std::distance(m_bools.begin(), interned);
+	}
+
+	m_bools.push_back(b);
+	return (DATA_IX_T) m_bools.size() - 1;
+}
+
+void Program::compile_constant(const Attr& constant)
+{
+	Opcode code;
+	code.type = OpcodeType::R_VALUE;
+	if (constant.type == AttributeType::INT)
+	{
+		code.data |= INT_TC;
+		code.data |= ((OPCODE_CONV_T)intern_int(constant.i) << 32);
+	}
+	else
+	{
+		assert(constant.type == AttributeType::BOOL);
+		code.data |= BOOL_TC;
+		code.data |= ((OPCODE_CONV_T)intern_bool(constant.b) << 32);
+	}
+	m_opcodes.push_back(code);
+}
+
 void Program::compile_factor_from_number(int number)
 {
-    Opcode code;
-    code.type = OpcodeType::R_VALUE;
-    DATA_IX_T int_index = (DATA_IX_T) m_ints.size();
-    m_ints.push_back(number);
-    code.data |= INT_TC;
-    code.data |= ((OPCODE_CONV_T)int_index << 32);
-    m_opcodes.push_back(code);
+    compile_constant(s_int_attr(number));
+    m_opcodes.push_back(Opcode(OpcodeType::EXPRESSION_END));
 }
 
-void Program::factor_expression(Expression expr)
+/*
+ * Computes an expression made only of literals, the way the VM would, into constant.
+ * Returns false when any part of it has to be looked up at runtime, or it would divide by zero or
+ * overflow, which are left for the VM to run into.
+ */
+static bool s_fold_constant(const Expression& expr, Attr& constant)
 {
 	if (expr.type == ExpressionType::FACTOR)
 	{
-		if (expr.tokens[0].type == TokenType::number)
+		const Token& token = expr.tokens[0];
+		if (token.type == TokenType::number)
+		{
+			constant = s_int_attr(stoi(string(token.text)));
+			return true;
+		}
+		if (token.type == TokenType::name && (token.text == "true" || token.text == "false"))
+		{
+			constant = s_bool_attr(token.text == "true");
+			return true;
+		}
+		return false;
+	}
+
+	Attr left, right;
+	if (expr.children.size() != 2 || !s_fold_constant(expr.children[0], left) || !s_fold_constant(expr.children[1], right))
+	{
+		return false;
+	}
+
+	if (left.type == AttributeType::INT && right.type == AttributeType::INT)
+	{
+		// computed wider, so a result that doesn't fit an int is left to the VM rather than
+		// overflowing here
+		int64_t a = left.i;
+		int64_t b = right.i;
+		int64_t result;
+		switch (expr.type)
 		{
-			Opcode code;
-			code.type = OpcodeType::R_VALUE;
-			DATA_IX_T int_index = (DATA_IX_T) m_ints.size();
-			m_ints.push_back(stoi(expr.tokens[0].text));
-			code.data |= INT_TC;
-			code.data |= ((OPCODE_CONV_T)int_index << 32);
-			m_opcodes.push_back(code);
+		case ExpressionType::ADDITION:
+			result = a + b;
+			break;
+		case ExpressionType::SUBTRACTION:
+			result = a - b;
+			break;
+		case ExpressionType::MULTIPLICATION:
+			result = a * b;
+			break;
+		case ExpressionType::DIVISION:
+			if (b == 0)
+			{
+				return false;
+			}
+			result = a / b;
+			break;
+		case ExpressionType::EQUALITY_TEST:
+			constant = s_bool_attr(left.i == right.i);
+			return true;
+		case ExpressionType::GREATHERTHAN_TEST:
+			constant = s_bool_attr(left.i > right.i);
+			return true;
+		case ExpressionType::LESSTHAN_TEST:
+			constant = s_bool_attr(left.i < right.i);
+			return true;
+		default:
+			return false;
 		}
-		else if (expr.tokens[0].type == TokenType::name && (expr.tokens[0].text == "true" || expr.tokens[0].text == "false"))
+
+		if (result < std::numeric_limits<int>::min() || result > std::numeric_limits<int>::max())
 		{
-			Opcode code;
-			code.type = OpcodeType::R_VALUE;
-			DATA_IX_T bool_index = (DATA_IX_T) m_bools.size();
-			m_bools.push_back(expr.tokens[0].text == "true");
-			code.data |= BOOL_TC;
-			code.data |= ((OPCODE_CONV_T)bool_index << 32);
-			m_opcodes.push_back(code);
+			return false;
 		}
-		else if (expr.tokens[0].type == TokenType::name)
+		constant = s_int_attr((int) result);
+		return true;
+	}
+
+	if (left.type == AttributeType::BOOL && right.type == AttributeType::BOOL && expr.type == ExpressionType::EQUALITY_TEST)
+	{
+		constant = s_bool_attr(left.b == right.b);
+		return true;
+	}
+
+	return false;
+}
+
+// the number of values an expression needs on the VM's value stack
+static int s_value_stack_depth(const Expression& expr)
+{
+	if (expr.type == ExpressionType::FACTOR || expr.type == ExpressionType::CARD_SEQUENCE)
+	{
+		return 1;
+	}
+	else if (expr.type == ExpressionType::RESOLVED_IDENTIFIER_ATTRIBUTE_ACCESS)
+	{
+		return s_value_stack_depth(expr.children[0]);
+	}
+	else if (expr.children.size() == 2)
+	{
+		// the left value waits on the stack while the right one is computed
+		return std::max(s_value_stack_depth(expr.children[0]), s_value_stack_depth(expr.children[1]) + 1);
+	}
+
+	return 1;
+}
+
+/*
+ * Compiles an expression to postfix form, closed by an EXPRESSION_END, for the VM to evaluate on
+ * its value stack.
+ */
+void Program::factor_expression(const Expression& expr)
+{
+	if (s_value_stack_depth(expr) > VALUE_STACK_SIZE)
+	{
+		throw CompileError("This expression is nested too deeply", expr.tokens.empty() ? Token{} : expr.tokens[0]);
+	}
+
+	factor_postfix(expr);
+	m_opcodes.push_back(Opcode(OpcodeType::EXPRESSION_END));
+}
+
+void Program::factor_postfix(const Expression& expr)
+{
+	Attr constant;
+	if (s_fold_constant(expr, constant))
+	{
+		compile_constant(constant);
+		return;
+	}
+
+	if (expr.type == ExpressionType::FACTOR)
+	{
+		if (expr.tokens[0].type == TokenType::name)
 		{
 			compile_name(expr.tokens, NAME_IS_RVALUE);
 		}
@@ -145,10 +523,7 @@ void Program::factor_expression(Expression expr)
 	}
 	else if (expr.type == ExpressionType::RESOLVED_IDENTIFIER_ATTRIBUTE_ACCESS)
 	{
-		Opcode RIAA_START;
-		RIAA_START.type = OpcodeType::DYNAMIC_IDENTIFIER_RESOLUTION_START;
-		m_opcodes.push_back(RIAA_START);
-		factor_expression(expr.children[0]);
+		factor_postfix(expr.children[0]);
 		Opcode RIAA_NAMES;
 		RIAA_NAMES.type = OpcodeType::DYNAMIC_IDENTIFIER_RESOLTION_NAMES;
 		m_opcodes.push_back(RIAA_NAMES);
@@ -163,11 +538,14 @@ void Program::factor_expression(Expression expr)
 	{
 		Opcode CS_START;
 		CS_START.type = OpcodeType::CARD_SEQUENCE_START;
+		// the sequence is built into its own entry of the card sequence table every time it's evaluated
+		CS_START.data |= ((OPCODE_CONV_T)m_card_sequences.size() << 32);
+		m_card_sequences.emplace_back();
 		Opcode CS_END;
 		CS_END.type = OpcodeType::CARD_SEQUENCE_END;
 
 		m_opcodes.push_back(CS_START);
-		for (auto c : expr.children)
+		for (const Expression& c : expr.children)
 		{
             if (c.type == ExpressionType::CARD_SEQUENCE_MATCH_ANYCARD)
             {
@@ -192,8 +570,8 @@ void Program::factor_expression(Expression expr)
 		return;
 	}
 
-	auto left_expr = expr.children[0];
-	auto right_expr = expr.children[1];
+	const Expression& left_expr = expr.children[0];
+	const Expression& right_expr = expr.children[1];
 
 	Opcode operation_opcode;
 
@@ -235,28 +613,28 @@ void Program::factor_expression(Expression expr)
 		throw CompileError(ss.str(), expr.tokens[0]);
 	}
 
+	factor_postfix(left_expr);
+	factor_postfix(right_expr);
 	m_opcodes.push_back(operation_opcode);
-	factor_expression(left_expr);
-	factor_expression(right_expr);
 }
 
-std::vector<vector<Token>> get_identifiers_from_flat_comma_seperated_tokens_vector(std::vector<Token> tokens)
+// the names in a comma separated list, as spans of the list
+std::vector<ArenaSpan<Token>> get_identifiers_from_flat_comma_seperated_tokens_vector(ArenaSpan<Token> tokens)
 {
     auto currentToken = tokens.begin();
     auto tokensEnd = tokens.end();
 
-    vector<vector<Token> > names;
+    vector<ArenaSpan<Token>> names;
     while (currentToken != tokensEnd)
     {
-        vector<Token> name;
+        auto nameStart = currentToken;
 
         do
         {
-            name.push_back(*currentToken);
             currentToken++;
         } while (currentToken != tokensEnd && currentToken->type != TokenType::comma);
 
-        names.push_back(name);
+        names.push_back(ArenaSpan<Token>(nameStart, currentToken - nameStart));
 
         if (currentToken != tokensEnd && currentToken->type == TokenType::comma)
         {
@@ -271,7 +649,7 @@ std::vector<vector<Token>> get_identifiers_from_flat_comma_seperated_tokens_vect
     return names;
 }
 
-void EnsureValidBooleanExpression(Expression booleanExpression)
+void EnsureValidBooleanExpression(const Expression& booleanExpression)
 {
 	if (booleanExpression.type != ExpressionType::FACTOR
 		&& booleanExpression.type != ExpressionType::EQUALITY_TEST
@@ -287,58 +665,750 @@ void EnsureValidBooleanExpression(Expression booleanExpression)
 	}
 }
 
-void Program::CompileExpression(Expression expr)
+static size_t s_hash_combine(size_t seed, size_t value)
 {
-	if (expr.type == ExpressionType::GAME_DECLARATION)
+	return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+}
+
+static ExpressionType s_block_type(const Token& t)
+{
+	if (t.type != TokenType::name)
+	{
+		return ExpressionType::NONE;
+	}
+	if (t.text == "card")
+	{
+		return ExpressionType::CARD_DECLARATION;
+	}
+	if (t.text == "phase")
+	{
+		return ExpressionType::PHASE_DECLARATION;
+	}
+	if (t.text == "setup")
+	{
+		return ExpressionType::SETUP_DECLARATION;
+	}
+	if (t.text == "turn")
 	{
-		auto nameDecl = expr.children.back();
+		return ExpressionType::TURN_DECLARATION;
+	}
+	return ExpressionType::NONE;
+}
 
-		DATA_IX_T name_index = (DATA_IX_T) m_strings.size();
-		this->m_strings.push_back(nameDecl.tokens[0].text);
+// FNV-1a, which unlike std::hash is the same in every build, so cached modules outlive them
+static uint64_t s_content_hash(std::string_view content)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (char c : content)
+	{
+		hash ^= (unsigned char) c;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
 
-		Opcode start;
-		Opcode end;
-		end.type = OpcodeType::BLK_END;
-		start.type = OpcodeType::GAME_BLK_HEADER;
-		start.data |= STRING_TC;
-		start.data |= ((OPCODE_CONV_T)name_index << 32);
+// an expression of a game block, as the range of tokens it was parsed from
+struct TopLevelSpan
+{
+	ExpressionType type; // NONE unless it's a setup, turn, phase or card block
+	std::string_view name; // of a phase or card
+	vector<Token>::iterator first;
+	vector<Token>::iterator last;
+	size_t hash; // of its tokens
+};
 
-		m_opcodes.push_back(start);
-		expr.children.pop_back();
-		for (auto e : expr.children) {
-			CompileExpression(e);
-		}
-		m_opcodes.push_back(end);
-	}
-	else if (expr.type == ExpressionType::SETUP_DECLARATION)
+/*
+ * Splits a game block into its expressions without parsing its blocks: every 'start' in a block
+ * has a matching 'end', so a block ends at the 'end' that brings the count back to zero. Anything
+ * else is parsed into arena to find where it ends.
+ */
+static vector<TopLevelSpan> s_top_level_spans(vector<Token>& tokens, ExpressionArena& arena)
+{
+	vector<TopLevelSpan> spans;
+	if (tokens.size() < 3)
 	{
-		Opcode start;
-		Opcode end;
-		start.type = OpcodeType::SETUP_BLK_HEADER;
-		end.type = OpcodeType::BLK_END;
+		return spans;
+	}
 
-		m_opcodes.push_back(start);
-		m_setup_index = (int) m_opcodes.size()-1;
-		for (auto e : expr.children)
+	// skip 'game name start'
+	auto current = tokens.begin() + 3;
+	while (current != tokens.end() && current->text != "end")
+	{
+		TopLevelSpan span;
+		span.type = s_block_type(*current);
+		span.first = current;
+		if (span.type == ExpressionType::NONE)
 		{
-			CompileExpression(e);
+			GetExpression(arena, current, tokens.end());
 		}
-		m_opcodes.push_back(end);
-	}
-	else if (expr.type == ExpressionType::TURN_DECLARATION)
-	{
-		Opcode start;
-		Opcode end;
-		start.type = OpcodeType::TURN_BLK_HEADER;
-		end.type = OpcodeType::BLK_END;
+		else
+		{
+			if (span.type == ExpressionType::CARD_DECLARATION || span.type == ExpressionType::PHASE_DECLARATION)
+			{
+				ensureNoEOF(current + 1, tokens.end());
+				span.name = (current + 1)->text;
+			}
+			int depth = 0;
+			for (; current != tokens.end(); current++)
+			{
+				if (current->type != TokenType::name)
+				{
+					continue;
+				}
+				if (current->text == "start")
+				{
+					depth++;
+				}
+				else if (current->text == "end" && --depth == 0)
+				{
+					break;
+				}
+			}
+			ensureNoEOF(current, tokens.end());
+		}
+		span.last = current;
 
-		m_opcodes.push_back(start);
-		m_turn_index = (int) m_opcodes.size()-1;
-		for (auto e : expr.children)
+		span.hash = 0;
+		for (auto t = span.first; t <= span.last; t++)
 		{
-			CompileExpression(e);
+			span.hash = s_hash_combine(span.hash, (size_t) t->type);
+			span.hash = s_hash_combine(span.hash, std::hash<std::string_view>()(t->text));
 		}
-		m_opcodes.push_back(end);
+		spans.push_back(span);
+		current++;
+	}
+	return spans;
+}
+
+// whether two spans have the same tokens. The hashes rule most spans out, the tokens make sure
+static bool s_same_tokens(const TopLevelSpan& a, const TopLevelSpan& b)
+{
+	if (a.hash != b.hash || a.last - a.first != b.last - b.first)
+	{
+		return false;
+	}
+	for (auto t = a.first, u = b.first; t <= a.last; t++, u++)
+	{
+		if (t->type != u->type || t->text != u->text)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Lexes the new source and splits its game block into expressions the same way as this program's,
+ * so a block whose tokens haven't changed has its opcodes copied instead of being parsed and
+ * compiled again. Copies keep their names' data indexes, since the pools are only ever appended
+ * to, and their jump targets and slots are resolved again with the rest.
+ */
+void Program::Reload(vector<string> lines)
+{
+	if (m_waitingForUserInteraction)
+	{
+		throw VMError("can't reload a game while it's waiting for input");
+	}
+	if (m_tokens.empty())
+	{
+		throw VMError("only a game compiled from source can be reloaded");
+	}
+
+	auto buffer = std::make_shared<const string>(s_join_lines(lines));
+	vector<Token> tokens;
+	tokens.reserve(buffer->size() / 4);
+	Lexer lexer(*buffer);
+	Token t;
+	while (lexer.Next(t))
+	{
+		tokens.push_back(t);
+	}
+	if (tokens.size() < 3 || tokens[0].text != "game" || tokens[2].text != "start")
+	{
+		throw CompileError("a reloaded game must be a game block", tokens.empty() ? Token{} : tokens[0]);
+	}
+
+	auto expressions = std::make_shared<ExpressionArena>();
+	vector<TopLevelSpan> spans = s_top_level_spans(tokens, *expressions);
+	ExpressionArena scratch;
+	vector<TopLevelSpan> previous_spans = s_top_level_spans(m_tokens, scratch);
+	if (previous_spans.size() != m_blocks.size())
+	{
+		throw VMError("only a game compiled from source can be reloaded");
+	}
+
+	// only blocks can be patched in, everything else in the game block has already run
+	vector<size_t> statements;
+	vector<size_t> previous_statements;
+	for (size_t i = 0; i < previous_spans.size(); i++)
+	{
+		if (previous_spans[i].type == ExpressionType::NONE)
+		{
+			previous_statements.push_back(i);
+		}
+	}
+	for (size_t i = 0; i < spans.size(); i++)
+	{
+		if (spans[i].type != ExpressionType::NONE)
+		{
+			continue;
+		}
+		size_t n = statements.size();
+		if (n == previous_statements.size() || !s_same_tokens(spans[i], previous_spans[previous_statements[n]]))
+		{
+			throw CompileError("only setup, turn, phase and card blocks can change when reloading a game", *spans[i].first);
+		}
+		// the same include can link modules that have changed since
+		for (const auto& module : m_blocks[previous_statements[n]].modules)
+		{
+			size_t size = 0;
+			std::shared_ptr<const void> content = map_file(module.first, size);
+			if (!content || s_content_hash(std::string_view(static_cast<const char*>(content.get()), size)) != module.second)
+			{
+				throw CompileError(module.first + " has changed, included modules can't change when reloading a game", *spans[i].first);
+			}
+		}
+		statements.push_back(i);
+	}
+	if (tokens[1].text != m_tokens[1].text || statements.size() != previous_statements.size())
+	{
+		throw CompileError("only setup, turn, phase and card blocks can change when reloading a game", tokens[1]);
+	}
+
+	std::unordered_multimap<size_t, size_t> reusable;
+	for (size_t i = 0; i < previous_spans.size(); i++)
+	{
+		if (previous_spans[i].type != ExpressionType::NONE)
+		{
+			reusable.emplace(previous_spans[i].hash, i);
+		}
+	}
+
+	Bytecode opcodes;
+	vector<CompiledBlock> blocks;
+	unordered_map<Symbol, int> phase_indexes;
+	int setup_index = -1;
+	int turn_index = -1;
+	size_t card_sequences = m_card_sequences.size();
+
+	std::swap(opcodes, m_opcodes);
+	std::swap(blocks, m_blocks);
+	std::swap(phase_indexes, m_phase_indexes);
+	std::swap(setup_index, m_setup_index);
+	std::swap(turn_index, m_turn_index);
+	try
+	{
+		m_opcodes.reserve(opcodes.size());
+		m_opcodes.push_back(opcodes[0]);
+		size_t statement = 0;
+		for (const TopLevelSpan& span : spans)
+		{
+			const CompiledBlock* copy = nullptr;
+			if (span.type == ExpressionType::NONE)
+			{
+				copy = &blocks[previous_statements[statement++]];
+			}
+			auto candidates = reusable.equal_range(span.hash);
+			for (auto candidate = candidates.first; !copy && candidate != candidates.second; candidate++)
+			{
+				const TopLevelSpan& previous = previous_spans[candidate->second];
+				if (previous.type == span.type && previous.name == span.name && s_same_tokens(previous, span))
+				{
+					copy = &blocks[candidate->second];
+				}
+			}
+
+			CompiledBlock block;
+			block.begin = (int) m_opcodes.size();
+			if (copy)
+			{
+				block.type = copy->type;
+				block.name = copy->name;
+				block.compiled = false;
+				block.modules = copy->modules;
+				m_opcodes.append(opcodes.begin() + copy->begin, opcodes.begin() + copy->end);
+				if (block.type == ExpressionType::SETUP_DECLARATION)
+				{
+					m_setup_index = block.begin;
+				}
+				else if (block.type == ExpressionType::TURN_DECLARATION)
+				{
+					m_turn_index = block.begin;
+				}
+				else if (block.type == ExpressionType::PHASE_DECLARATION)
+				{
+					m_phase_indexes[block.name] = block.begin;
+				}
+				else if (block.type == ExpressionType::INCLUDE_DECLARATION)
+				{
+					// the modules an include linked have setup, turn and phase blocks of their own.
+					// Phases only ever start at the top level of a module, so any header is one
+					for (int i = block.begin; i < (int) m_opcodes.size(); i++)
+					{
+						const Opcode& code = m_opcodes[i];
+						if (code.type == OpcodeType::SETUP_BLK_HEADER)
+						{
+							m_setup_index = i;
+						}
+						else if (code.type == OpcodeType::TURN_BLK_HEADER)
+						{
+							m_turn_index = i;
+						}
+						else if (code.type == OpcodeType::PHASE_BLK_HEADER)
+						{
+							m_phase_indexes[(Symbol) ((code.data & DATA_IX_T_MASK) >> 32)] = i;
+						}
+					}
+				}
+			}
+			else
+			{
+				auto current = span.first;
+				Expression expr = GetExpression(*expressions, current, tokens.end());
+				block.type = expr.type;
+				block.name = span.name.empty() ? NO_SYMBOL : m_game.symbols.Intern(span.name);
+				block.compiled = true;
+				CompileExpression(expr);
+			}
+			block.end = (int) m_opcodes.size();
+			m_blocks.push_back(block);
+		}
+		m_opcodes.push_back(opcodes[opcodes.size() - 1]);
+	}
+	catch (...)
+	{
+		std::swap(opcodes, m_opcodes);
+		std::swap(blocks, m_blocks);
+		std::swap(phase_indexes, m_phase_indexes);
+		std::swap(setup_index, m_setup_index);
+		std::swap(turn_index, m_turn_index);
+		m_card_sequences.resize(card_sequences);
+		throw;
+	}
+
+	resolve_jump_targets();
+
+	// slots are bound again, since a changed block may shadow a global it didn't before, but the
+	// globals keep their values
+	unordered_map<Symbol, Attr> globals;
+	for (const auto& global : m_global_slots)
+	{
+		globals[global.first] = m_globals[global.second];
+	}
+	m_global_slots.clear();
+	if (!m_loaded)
+	{
+		// no card has been declared yet, so they're all numbered again in their new order
+		m_card_ids.clear();
+	}
+	resolve_names();
+	for (const auto& global : m_global_slots)
+	{
+		auto value = globals.find(global.first);
+		if (value != globals.end())
+		{
+			m_globals[global.second] = value->second;
+		}
+	}
+
+	// the unchanged blocks were never parsed, so there's no tree of the whole game
+	m_source_buffer = buffer;
+	m_source = *buffer;
+	m_tokens = std::move(tokens);
+	m_expressions = std::move(expressions);
+	m_rootExpression = Expression();
+
+	if (!m_loaded)
+	{
+		return;
+	}
+
+	// redeclare the cards that changed, then the ones that inherit from them. Blocks are in the
+	// order they're declared in, and a card's parent is always declared before it
+	std::unordered_set<Symbol> redeclared;
+	int index = m_current_opcode_index;
+	for (const CompiledBlock& block : m_blocks)
+	{
+		if (block.type != ExpressionType::CARD_DECLARATION)
+		{
+			continue;
+		}
+		bool redeclare = block.compiled;
+		if (!redeclare && !redeclared.empty())
+		{
+			DATA_IX_T name_idx = (m_opcodes[block.begin].data & DATA_IX_T_MASK) >> 32;
+			redeclare = redeclared.count(get_card_parent_name(m_game.symbols.Name(name_idx))) > 0;
+		}
+		if (redeclare)
+		{
+			redeclared.insert(block.name);
+			m_current_opcode_index = block.begin;
+			execute(true, m_depth);
+		}
+	}
+	m_current_opcode_index = index;
+	m_game.IndexCardClasses();
+}
+
+// compiles an expression of the game block, and records it for Reload
+void Program::compile_top_level(const Expression& expr)
+{
+	CompiledBlock block;
+	block.type = expr.type;
+	block.name = NO_SYMBOL;
+	block.begin = (int) m_opcodes.size();
+	block.compiled = true;
+	if (expr.type != ExpressionType::INCLUDE_DECLARATION)
+	{
+		CompileExpression(expr);
+	}
+	else if (!m_unit)
+	{
+		m_linked_modules.clear();
+		include_module(m_source_dir, string(expr.tokens[1].text));
+		block.modules = std::move(m_linked_modules);
+	}
+	block.end = (int) m_opcodes.size();
+
+	// interned after the block's own names, the order link() interns them in
+	if (expr.type == ExpressionType::PHASE_DECLARATION)
+	{
+		block.name = m_game.symbols.Intern(expr.tokens[0].text);
+	}
+	else if (expr.type == ExpressionType::CARD_DECLARATION)
+	{
+		block.name = m_game.symbols.Intern(expr.children.back().tokens[0].text);
+	}
+	else if (expr.type == ExpressionType::INCLUDE_DECLARATION && m_unit)
+	{
+		// kept for whoever links the unit, the game never sees it
+		block.name = m_game.symbols.Intern(expr.tokens[1].text);
+	}
+	m_blocks.push_back(block);
+}
+
+// below these, starting threads costs more than it saves
+static const size_t PARALLEL_COMPILE_MIN_EXPRESSIONS = 256;
+static const size_t PARALLEL_COMPILE_MIN_EXPRESSIONS_PER_THREAD = 64;
+
+/*
+ * Compiles the expressions of a game block. A large one is cut into runs of expressions that are
+ * compiled on their own threads, each into a unit: a program of its own, with its own pools.
+ * The units are then linked in order, which gives the same opcodes as compiling them here.
+ */
+void Program::compile_game_body(ArenaSpan<Expression> body)
+{
+	size_t threads = m_compile_threads ? m_compile_threads : std::thread::hardware_concurrency();
+	threads = std::min(threads, body.size() / PARALLEL_COMPILE_MIN_EXPRESSIONS_PER_THREAD);
+	if (threads <= 1 || body.size() < PARALLEL_COMPILE_MIN_EXPRESSIONS)
+	{
+		for (const Expression& e : body)
+		{
+			compile_top_level(e);
+		}
+		return;
+	}
+
+	vector<Program> units(threads);
+	for (Program& unit : units)
+	{
+		unit.m_unit = true;
+		unit.m_source_dir = m_source_dir;
+	}
+	vector<std::exception_ptr> errors(threads);
+	vector<std::thread> workers;
+	for (size_t i = 0; i < threads; i++)
+	{
+		ArenaSpan<Expression> run = body.Slice(i * body.size() / threads, (i + 1) * body.size() / threads);
+		workers.emplace_back([&units, &errors, run, i]() {
+			try
+			{
+				for (const Expression& e : run)
+				{
+					units[i].compile_top_level(e);
+				}
+			}
+			catch (...)
+			{
+				errors[i] = std::current_exception();
+			}
+		});
+	}
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+
+	// the first error in the source is the one compiling it here would have thrown
+	for (const std::exception_ptr& error : errors)
+	{
+		if (error)
+		{
+			std::rethrow_exception(error);
+		}
+	}
+	for (const Program& unit : units)
+	{
+		link(unit, true);
+	}
+}
+
+/*
+ * Appends a unit's opcodes, moving their data indexes from its pools to ours. Its symbols are
+ * interned in the order its opcodes name them, as they would have been compiling them here, and
+ * the modules it includes are linked where it includes them. Jump targets and slots aren't
+ * resolved until the whole game is linked. The unit's expressions are only recorded in m_blocks
+ * if they're expressions of our game block, rather than of a module.
+ */
+void Program::link(const Program& unit, bool record)
+{
+	const DATA_IX_T UNLINKED = (DATA_IX_T) -1;
+	vector<DATA_IX_T> symbols(unit.m_game.symbols.size(), UNLINKED);
+	vector<DATA_IX_T> ints(unit.m_ints.size(), UNLINKED);
+	auto link_symbol = [&](DATA_IX_T symbol) {
+		if (symbols[symbol] == UNLINKED)
+		{
+			symbols[symbol] = intern_string(unit.m_game.symbols.Name((Symbol) symbol));
+		}
+		return symbols[symbol];
+	};
+
+	DATA_IX_T card_sequences = (DATA_IX_T) m_card_sequences.size();
+	m_card_sequences.resize(m_card_sequences.size() + unit.m_card_sequences.size());
+	m_opcodes.reserve(m_opcodes.size() + unit.m_opcodes.size());
+
+	// a unit's opcodes are all compiled by compile_top_level, so its blocks cover them
+	for (const CompiledBlock& block : unit.m_blocks)
+	{
+		CompiledBlock linked = block;
+		linked.begin = (int) m_opcodes.size();
+		m_opcodes.append(unit.m_opcodes.begin() + block.begin, unit.m_opcodes.begin() + block.end);
+
+		for (int i = linked.begin; i < (int) m_opcodes.size(); i++)
+		{
+			Opcode& code = m_opcodes.Edit(i);
+			DATA_IX_T index = (code.data & DATA_IX_T_MASK) >> 32;
+			TYPE_CODE_T type_code = code.data & TYPE_CODE_T_MASK;
+
+			// an attribute's type is a type code without an index
+			if (code.type == OpcodeType::CARD_SEQUENCE_START)
+			{
+				index += card_sequences;
+			}
+			else if (code.type != OpcodeType::ATTR_DATA_TYPE && type_code == STRING_TC)
+			{
+				index = link_symbol(index);
+			}
+			else if (code.type != OpcodeType::ATTR_DATA_TYPE && type_code == INT_TC)
+			{
+				if (ints[index] == UNLINKED)
+				{
+					ints[index] = intern_int(unit.m_ints[index]);
+				}
+				index = ints[index];
+			}
+			else if (code.type != OpcodeType::ATTR_DATA_TYPE && type_code == BOOL_TC)
+			{
+				index = intern_bool(unit.m_bools[index]);
+			}
+			code.data = (code.data & ~DATA_IX_T_MASK) | ((OPCODE_CONV_T)index << 32);
+		}
+
+		if (block.type == ExpressionType::INCLUDE_DECLARATION)
+		{
+			// a unit's own includes are linked into it, so only the top level ones start a new list
+			if (record)
+			{
+				m_linked_modules.clear();
+			}
+			include_module(unit.m_source_dir, unit.m_game.symbols.Name(block.name));
+			if (record)
+			{
+				linked.modules = std::move(m_linked_modules);
+			}
+			linked.name = NO_SYMBOL;
+		}
+		else if (linked.name != NO_SYMBOL)
+		{
+			linked.name = (Symbol) link_symbol(linked.name);
+		}
+		linked.end = (int) m_opcodes.size();
+
+		if (linked.type == ExpressionType::SETUP_DECLARATION)
+		{
+			m_setup_index = linked.begin;
+		}
+		else if (linked.type == ExpressionType::TURN_DECLARATION)
+		{
+			m_turn_index = linked.begin;
+		}
+		else if (linked.type == ExpressionType::PHASE_DECLARATION)
+		{
+			m_phase_indexes[linked.name] = linked.begin;
+		}
+		if (record)
+		{
+			m_blocks.push_back(linked);
+		}
+	}
+}
+
+/*
+ * Links the module at path, relative to dir, where it's included. A module is a run of game block
+ * expressions in a file of its own. It's compiled into a unit, which is cached in the module
+ * cache under its content's hash, so only modules that changed since the last compile are
+ * compiled again. A cached unit keeps the source it was compiled from, and a hit is only used
+ * if that's the module's source byte for byte. Errors in a module name it, their tokens would
+ * point into the wrong source.
+ */
+void Program::include_module(const string& dir, const string& path)
+{
+	std::filesystem::path file = (std::filesystem::path(dir) / path).lexically_normal();
+	if (std::find(m_include_stack.begin(), m_include_stack.end(), file.string()) != m_include_stack.end())
+	{
+		throw CompileError(file.string() + " includes itself", Token{});
+	}
+
+	size_t size = 0;
+	std::shared_ptr<const void> buffer = map_file(file.string(), size);
+	if (!buffer)
+	{
+		throw CompileError("could not open included module " + file.string(), Token{});
+	}
+	std::string_view source(static_cast<const char*>(buffer.get()), size);
+	m_linked_modules.emplace_back(file.string(), s_content_hash(source));
+
+	Program unit;
+	string cached;
+	bool hit = false;
+	if (!m_module_cache.empty())
+	{
+		std::stringstream name;
+		name << std::hex << s_content_hash(source) << "-" << std::dec << size << ".bbc";
+		cached = (std::filesystem::path(m_module_cache) / name.str()).string();
+		try
+		{
+			// a different module whose hash and size collide with this one's is a miss
+			unit.Load(cached);
+			hit = unit.Source() == source;
+		}
+		catch (BytecodeError&)
+		{
+			// not cached yet, or cached by another build of Battler
+		}
+	}
+
+	if (!hit)
+	{
+		unit = Program();
+		unit.m_unit = true;
+		unit.m_source_buffer = buffer;
+		unit.m_source = source;
+		try
+		{
+			vector<Token> tokens;
+			Lexer lexer(source);
+			Token t;
+			while (lexer.Next(t))
+			{
+				tokens.push_back(t);
+			}
+
+			ExpressionArena arena;
+			auto current = tokens.begin();
+			while (current != tokens.end())
+			{
+				if (current->text == "end" || current->text == "elseif" || current->text == "else")
+				{
+					throw UnexpectedTokenException(*current, "Unexpected '" + string(current->text) + "' outside of a block");
+				}
+				unit.compile_top_level(GetExpression(arena, current, tokens.end()));
+				current++;
+			}
+		}
+		catch (UnexpectedTokenException& e)
+		{
+			throw CompileError(file.string() + " line " + std::to_string(e.t.l) + ": " + e.reason, Token{});
+		}
+		catch (CompileError& e)
+		{
+			throw CompileError(file.string() + " line " + std::to_string(e.t.l) + ": " + e.reason, Token{});
+		}
+
+		if (!cached.empty())
+		{
+			// written next to where it goes and renamed, so a compile running alongside this one
+			// never loads half an image. The cache is only an optimisation, failing to write it isn't an error
+			std::error_code error;
+			std::filesystem::create_directories(m_module_cache, error);
+			string partial = cached + "." + std::to_string(std::random_device()());
+			try
+			{
+				unit.Save(partial);
+				std::filesystem::rename(partial, cached, error);
+			}
+			catch (BytecodeError&)
+			{
+			}
+			std::filesystem::remove(partial, error);
+		}
+	}
+
+	unit.m_source_dir = file.parent_path().string();
+	m_include_stack.push_back(file.string());
+	link(unit, false);
+	m_include_stack.pop_back();
+}
+
+void Program::CompileExpression(const Expression& expr)
+{
+	if (expr.type == ExpressionType::GAME_DECLARATION)
+	{
+		const Expression& nameDecl = expr.children.back();
+
+		DATA_IX_T name_index = intern_string(nameDecl.tokens[0].text);
+
+		Opcode start;
+		Opcode end;
+		end.type = OpcodeType::BLK_END;
+		start.type = OpcodeType::GAME_BLK_HEADER;
+		start.data |= STRING_TC;
+		start.data |= ((OPCODE_CONV_T)name_index << 32);
+
+		m_opcodes.push_back(start);
+		m_blocks.clear();
+		compile_game_body(expr.children.DropBack());
+		m_opcodes.push_back(end);
+	}
+	else if (expr.type == ExpressionType::SETUP_DECLARATION)
+	{
+		Opcode start;
+		Opcode end;
+		start.type = OpcodeType::SETUP_BLK_HEADER;
+		end.type = OpcodeType::BLK_END;
+
+		m_opcodes.push_back(start);
+		m_setup_index = (int) m_opcodes.size()-1;
+		for (const Expression& e : expr.children)
+		{
+			CompileExpression(e);
+		}
+		m_opcodes.push_back(end);
+	}
+	else if (expr.type == ExpressionType::TURN_DECLARATION)
+	{
+		Opcode start;
+		Opcode end;
+		start.type = OpcodeType::TURN_BLK_HEADER;
+		end.type = OpcodeType::BLK_END;
+
+		m_opcodes.push_back(start);
+		m_turn_index = (int) m_opcodes.size()-1;
+		for (const Expression& e : expr.children)
+		{
+			CompileExpression(e);
+		}
+		m_opcodes.push_back(end);
 	}
 	else if (expr.type == ExpressionType::PHASE_DECLARATION)
 	{
@@ -347,15 +1417,14 @@ void Program::CompileExpression(Expression expr)
 		start.type = OpcodeType::PHASE_BLK_HEADER;
 		end.type = OpcodeType::BLK_END;
 
-		string phase_name = expr.tokens[0].text;
-		DATA_IX_T phase_name_index = (DATA_IX_T) m_strings.size();
-		m_strings.push_back(phase_name);
+		std::string_view phase_name = expr.tokens[0].text;
+		DATA_IX_T phase_name_index = intern_string(phase_name);
 		start.data |= STRING_TC;
 		start.data |= ((OPCODE_CONV_T)phase_name_index << 32);
 
 		m_opcodes.push_back(start);
-		m_phase_indexes[phase_name] = (int) m_opcodes.size()-1;
-		for (auto e : expr.children)
+		m_phase_indexes[(Symbol) phase_name_index] = (int) m_opcodes.size()-1;
+		for (const Expression& e : expr.children)
 		{
 			CompileExpression(e);
 		}
@@ -366,9 +1435,8 @@ void Program::CompileExpression(Expression expr)
 		Opcode code;
 		code.type = OpcodeType::DO_DECL;
 
-		string phase_name = expr.tokens[1].text;
-		DATA_IX_T phase_name_index = (DATA_IX_T) m_strings.size();
-		m_strings.push_back(phase_name);
+		std::string_view phase_name = expr.tokens[1].text;
+		DATA_IX_T phase_name_index = intern_string(phase_name);
 		code.data |= STRING_TC;
 		code.data |= ((OPCODE_CONV_T)phase_name_index << 32);
 
@@ -391,7 +1459,7 @@ void Program::CompileExpression(Expression expr)
 	}
 	else if (expr.type == ExpressionType::IF_DECLARATION)
 	{
-		auto booleanExpression = expr.children[0];
+		const Expression& booleanExpression = expr.children[0];
 
 		int elseIfIndexesStart = -1;
 		int elseIndex = -1;
@@ -408,19 +1476,19 @@ void Program::CompileExpression(Expression expr)
 			}
 		}
 
-		std::vector<Expression> expressionsInIfBlock;
+		ArenaSpan<Expression> expressionsInIfBlock;
 
 		if (elseIfIndexesStart > -1)
 		{
-			expressionsInIfBlock = std::vector(expr.children.begin() + 1, expr.children.begin() + elseIfIndexesStart);
+			expressionsInIfBlock = expr.children.Slice(1, elseIfIndexesStart);
 		}
 		else if (elseIndex > -1)
 		{
-			expressionsInIfBlock = std::vector(expr.children.begin() + 1, expr.children.begin() + elseIndex);
+			expressionsInIfBlock = expr.children.Slice(1, elseIndex);
 		}
 		else
 		{
-			expressionsInIfBlock = std::vector(expr.children.begin() + 1, expr.children.end());
+			expressionsInIfBlock = expr.children.Slice(1, expr.children.size());
 		}
 
 		Opcode ifHeader;
@@ -432,7 +1500,7 @@ void Program::CompileExpression(Expression expr)
 
 		EnsureValidBooleanExpression(booleanExpression);
 		factor_expression(booleanExpression);
-		for (auto e : expressionsInIfBlock)
+		for (const Expression& e : expressionsInIfBlock)
 		{
 			CompileExpression(e);
 		}
@@ -453,7 +1521,7 @@ void Program::CompileExpression(Expression expr)
 	}
 	else if (expr.type == ExpressionType::ELSEIF_DECLARATION)
 	{
-		auto booleanExpression = expr.children[0];
+		const Expression& booleanExpression = expr.children[0];
 		Opcode elseIfHeader;
 		elseIfHeader.type = OpcodeType::ELSE_IF_BLK_HEADER;
 
@@ -461,43 +1529,40 @@ void Program::CompileExpression(Expression expr)
 
 		EnsureValidBooleanExpression(booleanExpression);
 		factor_expression(booleanExpression);
-		for (auto e : vector(expr.children.begin()+1, expr.children.end()))
+		for (const Expression& e : expr.children.Slice(1, expr.children.size()))
 		{
 			CompileExpression(e);
 		}
 	}
 	else if (expr.type == ExpressionType::ELSE_DECLARATION)
 	{
-		auto booleanExpression = expr.children[0];
 		Opcode elseHeader;
 		elseHeader.type = OpcodeType::ELSE_BLK_HEADER;
 
 		m_opcodes.push_back(elseHeader);
 
-		for (auto e : vector(expr.children.begin(), expr.children.end()))
+		for (const Expression& e : expr.children)
 		{
 			CompileExpression(e);
 		}
 	}
 	else if (expr.type == ExpressionType::FOREACHPLAYER_DECLARATION)
 	{
-		Expression identExpression = expr.children.back();
-		expr.children.pop_back();
+		const Expression& identExpression = expr.children.back();
 
-		string eachPlayerLoopVarName = identExpression.tokens[0].text;
+		std::string_view eachPlayerLoopVarName = identExpression.tokens[0].text;
 
 		Opcode forEachHeaderCode;
 		Opcode end;
 		forEachHeaderCode.type = OpcodeType::FOREACHPLAYER_BLK_HEADER;
 		end.type = OpcodeType::FOREACHPLAYER_BLK_END;
 
-		DATA_IX_T string_index = (DATA_IX_T) m_strings.size();
-		m_strings.push_back(eachPlayerLoopVarName);
+		DATA_IX_T string_index = intern_string(eachPlayerLoopVarName);
 		forEachHeaderCode.data |= STRING_TC;
 		forEachHeaderCode.data |= ((OPCODE_CONV_T)string_index << 32);
 
 		m_opcodes.push_back(forEachHeaderCode);
-		for (auto e : expr.children)
+		for (const Expression& e : expr.children.DropBack())
 		{
 			CompileExpression(e);
 		}
@@ -505,12 +1570,12 @@ void Program::CompileExpression(Expression expr)
 	}
 	else if (expr.type == ExpressionType::STACK_TRANSFER) {
 
-        Expression sourceStackExpr = expr.children[0];
-        Expression operationExpr = expr.children[1];
-        Expression targetStackExpr = expr.children[2];
+        const Expression& sourceStackExpr = expr.children[0];
+        const Expression& operationExpr = expr.children[1];
+        const Expression& targetStackExpr = expr.children[2];
 
-		auto toConstraintExpr = expr.children.back(); // last
-		auto fromConstraintExpr = *(expr.children.end()-2); // second from last
+		const Expression& toConstraintExpr = expr.children.back(); // last
+		const Expression& fromConstraintExpr = *(expr.children.end()-2); // second from last
 
         Opcode stackTransfer; // transfer operation
         Opcode sourceStackOpcode; // Source Stack Identifier "a", "a,b"
@@ -652,8 +1717,8 @@ void Program::CompileExpression(Expression expr)
 	}
 	else if (expr.type == ExpressionType::ATTR_ASSIGNMENT)
 	{
-		auto rightHandSide = expr.children.back();
-		auto assignmentTarget = *(expr.children.end() - 2);
+		const Expression& rightHandSide = expr.children.back();
+		const Expression& assignmentTarget = *(expr.children.end() - 2);
 
 		compile_name(assignmentTarget.tokens, NAME_IS_LVALUE);
 		factor_expression(rightHandSide);
@@ -663,13 +1728,13 @@ void Program::CompileExpression(Expression expr)
 		Opcode code;
 		code.type = OpcodeType::PLAYERS_L_VALUE;
 		m_opcodes.push_back(code);
-		auto numPlayersExpression = expr.children[0];
+		const Expression& numPlayersExpression = expr.children[0];
 		factor_expression(numPlayersExpression);
 	}
 	else if (expr.type == ExpressionType::CARD_DECLARATION)
 	{
 		auto nameTokens = expr.children.back().tokens;
-		string name = nameTokens[0].text;
+		string name(nameTokens[0].text);
 
 		if (nameTokens.size() == 2)
 		{
@@ -678,8 +1743,7 @@ void Program::CompileExpression(Expression expr)
 			name = ss.str();
 		}
 
-		DATA_IX_T name_index = (DATA_IX_T) m_strings.size();
-		m_strings.push_back(name);
+		DATA_IX_T name_index = intern_string(name);
 
 		Opcode code;
 		code.type = OpcodeType::CARD_BLK_HEADER;
@@ -687,9 +1751,7 @@ void Program::CompileExpression(Expression expr)
 		code.data |= ((OPCODE_CONV_T)name_index << 32);
 		m_opcodes.push_back(code);
 
-		expr.children.pop_back();
-
-		for (auto e : expr.children) {
+		for (const Expression& e : expr.children.DropBack()) {
 			CompileExpression(e);
 		}
 
@@ -699,11 +1761,8 @@ void Program::CompileExpression(Expression expr)
 	}
 	else if (expr.type == ExpressionType::ATTR_DECLARATION)
 	{
-		auto nameExpression = expr.children.back();
-		expr.children.pop_back();
-
-		auto typeExpression = expr.children.back();
-		expr.children.pop_back();
+		const Expression& nameExpression = expr.children.back();
+		const Expression& typeExpression = *(expr.children.end() - 2);
 
 		Opcode attrDeclCode;
 		attrDeclCode.type = OpcodeType::ATTR_DECL;
@@ -711,7 +1770,7 @@ void Program::CompileExpression(Expression expr)
 		Opcode typeCode;
 		typeCode.type = OpcodeType::ATTR_DATA_TYPE;
 
-		string type = typeExpression.tokens[0].text;
+		std::string_view type = typeExpression.tokens[0].text;
 		if (type == "int")
 		{
 			typeCode.data |= INT_TC;
@@ -765,6 +1824,10 @@ void Program::CompileExpression(Expression expr)
 		compile_name(nameExpression.tokens, NAME_IS_LVALUE);
 		m_opcodes.push_back(typeCode);
 	}
+	else if (expr.type == ExpressionType::INCLUDE_DECLARATION)
+	{
+		throw CompileError("modules can only be included in the game block", expr.tokens[0]);
+	}
 	else
 	{
 		std::stringstream ss;
@@ -778,56 +1841,42 @@ void Program::CompileExpression(Expression expr)
 
 int Program::Run(bool load)
 {
-
-	while (!m_waitingForUserInteraction && m_game.winner == -1 && m_current_opcode_index < m_opcodes.size())
+	// a program restored from an image saved after loading has nothing left to load
+	if (load && m_loaded)
 	{
-		Opcode code = m_opcodes[m_current_opcode_index];
-		if (run(code, load) == RUN_ERROR)
-		{
-			return RUN_ERROR;
-		}
+		return RUN_FINISHED;
+	}
+	if (execute(load, -1) == RUN_ERROR)
+	{
+		return RUN_ERROR;
+	}
+	if (load)
+	{
+		m_game.IndexCardClasses();
 	}
     if (m_waitingForUserInteraction)
     {
         return RUN_WAITING_FOR_INTERACTION_RETURN;
     }
+	m_loaded = m_loaded || load;
 
 	return RUN_FINISHED;
 }
 
 int Program::RunSetup()
 {
-	bool done = false;
-	int depth_store = m_depth;
-
 	m_current_opcode_index = m_setup_index;
 
-	while (!done)
-	{
-		Opcode code = m_opcodes[m_current_opcode_index];
-
-		if (run(code, false) == -1)
-		{
-			return -1;
-		}
-
-		if (code.type == OpcodeType::BLK_END && m_depth == depth_store)
-		{
-			done = true;
-		}
-	}
-	return 0;
+	return execute(false, m_depth);
 }
 
 int Program::RunTurn(bool resume/*=false*/)
 {
-	bool done = false;
-
     AttrCont currentPlayerAttrCont;
     Attr currentPlayerAttr;
     currentPlayerAttr.type = AttributeType::PLAYER_REF;
     currentPlayerAttr.playerRef = m_game.currentPlayerIndex;
-    currentPlayerAttrCont.Store("currentPlayer", currentPlayerAttr);
+    currentPlayerAttrCont.Store(CURRENT_PLAYER_SYMBOL, currentPlayerAttr);
 
     if (!resume)
     {
@@ -838,26 +1887,12 @@ int Program::RunTurn(bool resume/*=false*/)
         m_current_opcode_index = m_turn_index;
     }
 
-	while (!done)
-	{
-		Opcode code = m_opcodes[m_current_opcode_index];
-
-        int runReturn = run(code, false);
-
-		if (runReturn == RUN_ERROR)
-		{
-			return RUN_ERROR;
-		}
-        else if (runReturn == RUN_WAITING_FOR_INTERACTION_RETURN)
-        {
-            return RUN_WAITING_FOR_INTERACTION_RETURN;
-        }
+    int runReturn = execute(false, m_depth_store);
 
-		if (code.type == OpcodeType::BLK_END && m_depth == m_depth_store)
-		{
-			done = true;
-		}
-	}
+    if (runReturn != RUN_FINISHED)
+    {
+        return runReturn;
+    }
 
 	locale_stack().pop_back();
 	m_game.currentPlayerIndex = (currentPlayerAttr.playerRef + 1) % (m_game.players.size());
@@ -865,88 +1900,88 @@ int Program::RunTurn(bool resume/*=false*/)
 	return 0;
 }
 
-bool Program::CompleteStackTransfer(StackTransferStateTracker state)
+bool Program::CompleteStackTransfer(const StackTransferStateTracker& state)
 {
     if (!m_stackTransferStateTracker.complete)
     {
         return false;
     }
 
-    std::vector<Card> cardsToMove;
+    std::vector<CardInstance> cardsToMove;
 
     Stack* sourceStack = &game().stacks[m_stackTransferStateTracker.srcStackID];
     Stack* destinationStack = &game().stacks[m_stackTransferStateTracker.dstStackID];
 
     if (m_stackTransferStateTracker.randomSource)
     {
-        auto matching_cards = m_game.get_cards_of_type(m_stackTransferStateTracker.randomSourceParentCard);
-		for (int i = 0; i < m_stackTransferStateTracker.nExpected; i++)
-		{
-			cardsToMove.push_back(m_game.GenerateCard(matching_cards[rand() % matching_cards.size()].name));
+        const vector<int>& matching_cards = m_game.CardsOfClass(m_stackTransferStateTracker.randomSourceClassID);
+		// drawn a batch at a time, so a big draw doesn't need its picks as well as its cards
+		uint32_t picks[256];
+		for (int left = m_stackTransferStateTracker.nExpected; left > 0; left -= 256)
+		{
+			size_t n = (size_t) std::min(left, 256);
+			m_game.random.Below((uint32_t) matching_cards.size(), picks, n);
+			for (size_t i = 0; i < n; i++)
+			{
+				cardsToMove.push_back(m_game.GenerateCard(matching_cards[picks[i]]));
+			}
 		}
     }
 	else if (m_stackTransferStateTracker.specificCardGeneration)
 	{
 		for (int i=0; i<m_stackTransferStateTracker.nExpected; i++)
 		{
-			cardsToMove.push_back(m_game.GenerateCard(m_stackTransferStateTracker.specificCardName));
+			cardsToMove.push_back(m_game.GenerateCard(m_stackTransferStateTracker.specificCardID));
 		}
 	}
     else if (m_stackTransferStateTracker.transferType == StackTransferType::MOVE)
     {
-        cardsToMove = m_stackTransferStateTracker.cardsToMove;
-        std::reverse(cardsToMove.begin(), cardsToMove.end());
+        cardsToMove.assign(m_stackTransferStateTracker.cardsToMove.rbegin(), m_stackTransferStateTracker.cardsToMove.rend());
+
+        if (m_stackTransferStateTracker.takenFromEnd)
+        {
+            // the cards are the top or bottom of the source, so they come off it in one go
+            int n = (int) cardsToMove.size();
+            if (m_stackTransferStateTracker.srcTop)
+            {
+                sourceStack->EraseTop(n);
+            }
+            else
+            {
+                sourceStack->EraseBottom(n);
+            }
+        }
+        else if (!sourceStack->Erase(cardsToMove))
+        {
+            throw VMError("Irreconsilable Error. Player has picked a card to move, that isn't available in the source stack.");
+        }
     }
     else if (m_stackTransferStateTracker.transferType == StackTransferType::CUT)
     {
+        int cutPoint = m_stackTransferStateTracker.cutPoint;
+        const std::deque<CardInstance>& source = sourceStack->Cards();
         if (m_stackTransferStateTracker.srcTop)
         {
-            cardsToMove = vector(
-            sourceStack->cards.end()-m_stackTransferStateTracker.cutPoint,
-            sourceStack->cards.end()
-            );
+            cardsToMove.assign(source.end() - cutPoint, source.end());
+            sourceStack->EraseTop(cutPoint);
         }
         else
         {
-            cardsToMove = vector(
-            sourceStack->cards.begin(),
-            sourceStack->cards.end() - m_stackTransferStateTracker.cutPoint
-            );
+            cardsToMove.assign(source.begin(), source.end() - cutPoint);
+            sourceStack->EraseBottom((int) source.size() - cutPoint);
         }
     }
     else
     {
         std::cerr << "Stack transfer is not of any recognised type" << std::endl;
     }
-    if (!m_stackTransferStateTracker.randomSource && !m_stackTransferStateTracker.specificCardGeneration)
-    {
-        for(Card c : cardsToMove)
-        {
-            auto cardIt = std::find_if(
-                    sourceStack->cards.begin(),
-                    sourceStack->cards.end(),
-                    [&c](const Card& b) {return c.UUID == b.UUID;}
-            );
-
-            if (cardIt == sourceStack->cards.end())
-            {
-                throw VMError("Irreconsilable Error. Player has picked a card to move, that isn't available in the source stack.");
-            }
-
-            sourceStack->cards.erase(cardIt);
-        }
-    }
 
-    auto insertPosition = destinationStack->cards.begin();
-    if (m_stackTransferStateTracker.dstTop)
-    {
-        insertPosition = destinationStack->cards.end();
-    }
-    destinationStack->cards.insert(insertPosition, cardsToMove.begin(), cardsToMove.end());
+    destinationStack->Insert(m_stackTransferStateTracker.dstTop, cardsToMove);
 
-    std::vector<int> cardsTakenForCallbackReport(cardsToMove.size());
+    std::vector<int> cardsTakenForCallbackReport;
+    cardsTakenForCallbackReport.reserve(cardsToMove.size());
 
-    for (const Card& c : cardsToMove)
+    for (const CardInstance& c : cardsToMove)
     {
         cardsTakenForCallbackReport.push_back(c.UUID);
     }
@@ -963,467 +1998,559 @@ bool Program::CompleteStackTransfer(StackTransferStateTracker state)
     return true;
 }
 
-int Program::run(Opcode code, bool load)
+// Every opcode that starts an instruction, and the handler that executes it. Opcodes that
+// only ever appear as operands of these (TOP, MOVE, R_VALUE, ...) are read by the handlers
+// themselves, and dispatching one of them directly is an error.
+#define BATTLER_INSTRUCTIONS(X) \
+	X(GAME_BLK_HEADER, op_game_blk_header) \
+	X(BLK_END, op_blk_end) \
+	X(IF_BLK_HEADER, op_if_blk_header) \
+	X(ELSE_IF_BLK_HEADER, op_else_blk_header) \
+	X(ELSE_BLK_HEADER, op_else_blk_header) \
+	X(FOREACHPLAYER_BLK_HEADER, op_foreachplayer_blk_header) \
+	X(FOREACHPLAYER_BLK_END, op_foreachplayer_blk_end) \
+	X(SETUP_BLK_HEADER, op_setup_blk_header) \
+	X(PHASE_BLK_HEADER, op_phase_blk_header) \
+	X(TURN_BLK_HEADER, op_turn_blk_header) \
+	X(CARD_BLK_HEADER, op_card_blk_header) \
+	X(DO_DECL, op_do_decl) \
+	X(STACK_TRANSFER, op_stack_transfer) \
+	X(STACK_SOURCE_LOCATION, op_stack_source_location) \
+	X(DESTINATION_STACK, op_destination_stack) \
+	X(STACK_DESTINATION_LOCATION, op_stack_destination_location) \
+	X(ATTR_DECL, op_attr_decl) \
+	X(PLAYERS_L_VALUE, op_players_l_value) \
+	X(L_VALUE_DOT_SEPERATED_REF_CHAIN, op_assignment) \
+	X(L_VALUE, op_assignment) \
+	X(WINNER_DECL, op_winner_decl) \
+	X(LOOSER_DECL, op_looser_decl)
+
+constexpr Program::OpcodeHandlerTable Program::make_opcode_handler_table()
 {
-	if (code.type == OpcodeType::GAME_BLK_HEADER)
+	OpcodeHandlerTable table{};
+	for (auto& handler : table)
 	{
-		m_depth++;
-		if (!m_proc_mode_stack.empty())
-		{
-			cout << "Error: Cannot define game" << endl;
-			return -1;
-		}
-		m_proc_mode_stack.push_back(PROC_MODE::GAME);
-		m_locale_stack.push_back(AttrCont());
-		DATA_IX_T name_idx = (code.data & uint64_t(0xFFFF0000)) >> 32;
-		m_game.name = m_strings[name_idx];
-		m_block_name_stack.push_back(m_strings[name_idx]);
-		m_current_opcode_index += 1;
+		handler = &Program::op_unknown;
 	}
-	else if (code.type == OpcodeType::BLK_END)
+#define BATTLER_HANDLER_ENTRY(type, handler) table[(size_t)OpcodeType::type] = &Program::handler;
+	BATTLER_INSTRUCTIONS(BATTLER_HANDLER_ENTRY)
+#undef BATTLER_HANDLER_ENTRY
+	return table;
+}
+
+const Program::OpcodeHandlerTable Program::s_opcode_handlers = make_opcode_handler_table();
+
+#ifdef BATTLER_COMPUTED_GOTO
+// Position of each instruction's label in the label table built by Program::execute,
+// label 0 being the unknown opcode label.
+static constexpr std::array<uint8_t, OPCODE_TYPE_COUNT> make_opcode_label_slots()
+{
+	std::array<uint8_t, OPCODE_TYPE_COUNT> slots{};
+	uint8_t slot = 1;
+#define BATTLER_LABEL_SLOT(type, handler) slots[(size_t)OpcodeType::type] = slot++;
+	BATTLER_INSTRUCTIONS(BATTLER_LABEL_SLOT)
+#undef BATTLER_LABEL_SLOT
+	return slots;
+}
+
+static constexpr std::array<uint8_t, OPCODE_TYPE_COUNT> s_opcode_label_slots = make_opcode_label_slots();
+#endif
+
+/*
+ * Executes instructions from m_current_opcode_index until one of them fails or waits for user
+ * input, or the end of the opcodes is reached.
+ * With a stopDepth of -1 it also stops once a winner is declared. Otherwise it stops as soon as a
+ * BLK_END brings m_depth back to stopDepth, which is how a setup block or a turn is run on its own.
+ */
+int Program::execute(bool load, int stopDepth)
+{
+	int ret = RUN_FINISHED;
+	Opcode code;
+
+#ifdef BATTLER_COMPUTED_GOTO
+#define BATTLER_LABEL_ADDRESS(type, handler) &&type,
+	static void* const labels[] = { &&UNKNOWN, BATTLER_INSTRUCTIONS(BATTLER_LABEL_ADDRESS) };
+#undef BATTLER_LABEL_ADDRESS
+#endif
+
+next:
+	if (m_current_opcode_index >= m_opcodes.size())
+	{
+		return ret;
+	}
+	if (stopDepth == -1 && (m_waitingForUserInteraction || m_game.winner != -1))
 	{
+		return ret;
+	}
 
-		if (m_proc_mode_stack.empty())
-		{
-			cout << "'end' without a matching 'start'" << endl;
-			return -1;
-		}
+	code = m_opcodes[m_current_opcode_index];
+	m_executed_opcodes++;
 
-		m_depth--;
+#ifdef BATTLER_COMPUTED_GOTO
+	goto *labels[s_opcode_label_slots[(size_t)code.type]];
 
-		if (m_proc_mode_stack.back() == PROC_MODE::CARD)
-		{
-			Card card;
-			card.attributes = m_locale_stack.back();
-			card.ID = (int) m_game.cards.size();
-			// name sequence is NAME:PARENT_NAME or just NAME
-			string nameSequence = m_block_name_stack.back();
+UNKNOWN:
+	ret = op_unknown(code, load);
+	goto dispatched;
 
-			card.name = get_card_name(nameSequence);
-			card.parentName = get_card_parent_name(nameSequence);
-			if (m_game.cards.find(card.parentName) != m_game.cards.end())
-			{
-				card.parentID = m_game.cards[card.parentName].ID;
-			}
-			else if (card.parentName != "")
-			{
-				std::stringstream ss;
-				ss << "no card with parent " << card.parentName;
-				throw VMError(ss.str());
-			}
-			m_game.cards[card.name] = card;
-			m_current_opcode_index += 1;
+#define BATTLER_LABEL(type, handler) \
+type: \
+	ret = handler(code, load); \
+	goto dispatched;
+	BATTLER_INSTRUCTIONS(BATTLER_LABEL)
+#undef BATTLER_LABEL
+#else
+	ret = (this->*s_opcode_handlers[(size_t)code.type])(code, load);
+	goto dispatched;
+#endif
+
+dispatched:
+	if (ret != RUN_FINISHED)
+	{
+		return ret;
+	}
+	if (stopDepth > -1 && code.type == OpcodeType::BLK_END && m_depth == stopDepth)
+	{
+		return RUN_FINISHED;
+	}
+	goto next;
+}
+
+int Program::op_game_blk_header(const Opcode& code, bool load)
+{
+	m_depth++;
+	if (!m_proc_mode_stack.empty())
+	{
+		cout << "Error: Cannot define game" << endl;
+		return -1;
+	}
+	m_proc_mode_stack.push_back(PROC_MODE::GAME);
+	m_locale_stack.push_back(AttrCont());
+	DATA_IX_T name_idx = (code.data & DATA_IX_T_MASK) >> 32;
+	m_game.name = m_game.symbols.Name(name_idx);
+	m_block_name_stack.push_back(m_game.name);
+	m_current_opcode_index += 1;
+
+	return 0;
+}
+
+int Program::op_blk_end(const Opcode& code, bool load)
+{
+	if (m_proc_mode_stack.empty())
+	{
+		cout << "'end' without a matching 'start'" << endl;
+		return -1;
+	}
+
+	m_depth--;
+
+	if (m_proc_mode_stack.back() == PROC_MODE::CARD)
+	{
+		Card card;
+		card.attributes = m_locale_stack.back();
+		card.ID = m_opcodes[code.jump_index].slot;
+		// name sequence is NAME:PARENT_NAME or just NAME
+		string nameSequence = m_block_name_stack.back();
+
+		card.name = get_card_name(nameSequence);
+		card.parentName = get_card_parent_name(nameSequence);
+		if (m_game.FindCard(card.parentName) != -1)
+		{
+			card.parentID = m_game.FindCard(card.parentName);
+		}
+		else if (card.parentName != NO_SYMBOL)
+		{
+			std::stringstream ss;
+			ss << "no card with parent " << m_game.symbols.Name(card.parentName);
+			throw VMError(ss.str());
+		}
+		// cards are declared in the order resolve_names gave them their IDs in
+		if (card.ID < 0 || card.ID > (int) m_game.cards.size())
+		{
+			throw VMError("card " + m_game.symbols.Name(card.name) + " is declared out of order");
 		}
-		else if (m_proc_mode_stack.back() == PROC_MODE::PHASE)
+		if (card.ID < (int) m_game.cards.size())
 		{
-			m_locale_stack.pop_back();
-			assert(!m_locale_stack.empty());
-			assert(m_locale_stack.back().Contains("__INDEX_STORE"));
-			Attr index_store = m_locale_stack.back().Get("__INDEX_STORE");
-			assert(index_store.type == AttributeType::INT);
-			m_current_opcode_index = index_store.i;
+			// the card's instances refer to it by ID, so they take on its new attributes
+			m_game.cards[card.ID] = card;
 		}
 		else
 		{
-			m_current_opcode_index += 1;
+			m_game.cards.push_back(card);
 		}
+		m_game.cardIDs[card.name] = card.ID;
+		m_current_opcode_index += 1;
+	}
+	else if (m_proc_mode_stack.back() == PROC_MODE::PHASE)
+	{
+		m_locale_stack.pop_back();
+		assert(!m_locale_stack.empty());
+		assert(m_locale_stack.back().Contains(INDEX_STORE_SYMBOL));
+		Attr index_store = m_locale_stack.back().Get(INDEX_STORE_SYMBOL);
+		assert(index_store.type == AttributeType::INT);
+		m_current_opcode_index = index_store.i;
+	}
+	else
+	{
+		m_current_opcode_index += 1;
+	}
+
+	// never pop the root level attributes
+	if (m_proc_mode_stack.back() != PROC_MODE::GAME)
+	{
+		m_locale_stack.pop_back();
+	}
+	m_proc_mode_stack.pop_back();
+	m_block_name_stack.pop_back();
+
+	return 0;
+}
+
+int Program::op_if_blk_header(const Opcode& code, bool load)
+{
+	// follow the if's chain of headers until one of their guards passes, or we reach the end
+	int header_index = m_current_opcode_index;
+	while (m_opcodes[header_index].type != OpcodeType::BLK_END)
+	{
+		const Opcode& header = m_opcodes[header_index];
+		m_current_opcode_index = header_index + 1;
 
-		// never pop the root level attributes
-		if (m_proc_mode_stack.back() != PROC_MODE::GAME)
+		if (header.type == OpcodeType::ELSE_BLK_HEADER || resolve_bool_expression())
 		{
-			m_locale_stack.pop_back();
+			// execute it right away, since no other block matched
+			m_depth++;
+			m_proc_mode_stack.push_back(PROC_MODE::IF);
+			m_block_name_stack.push_back("__IF");
+			AttrCont cont;
+			m_locale_stack.push_back(cont);
+			return 0;
 		}
-		m_proc_mode_stack.pop_back();
-		m_block_name_stack.pop_back();
 
-    }
-	else if (code.type == OpcodeType::IF_BLK_HEADER)
-	{
-		bool foundExecutableBlock = false;
-		int depth = 0;
-		bool firstLoop = true;
-		while (!foundExecutableBlock && !(m_opcodes[m_current_opcode_index].type == OpcodeType::BLK_END && depth == 0))
-		{
-			Opcode currentCode = m_opcodes[m_current_opcode_index];
+		header_index = header.jump_index;
+	}
+
+	m_current_opcode_index = header_index + 1;
+
+	return 0;
+}
+
+int Program::op_else_blk_header(const Opcode& code, bool load)
+{
+	// we're here because we just executed part of an if / else block, and now we need to skip the rest of it
+	m_depth--;
+	m_proc_mode_stack.pop_back();
+	m_block_name_stack.pop_back();
+	m_locale_stack.pop_back();
+	ignore_block();
 
-			if (firstLoop || (currentCode.type == OpcodeType::ELSE_IF_BLK_HEADER && depth == 0))
-			{
-				m_current_opcode_index++;
-				foundExecutableBlock = resolve_bool_expression();
+	return 0;
+}
 
-				if (foundExecutableBlock)
-				{
-					// execute it right away, since no other block matched
-					m_depth++;
-					m_proc_mode_stack.push_back(PROC_MODE::IF);
-					m_block_name_stack.push_back("__IF");
-					AttrCont cont;
-					m_locale_stack.push_back(cont);
-				}
+int Program::op_foreachplayer_blk_header(const Opcode& code, bool load)
+{
+	m_depth++;
+	AttrCont cont;
+	Attr counter;
+	counter.playerRef = 0;
+	counter.type = AttributeType::PLAYER_REF;
+	cont.Store(P_SYMBOL, counter);
+
+	m_proc_mode_stack.push_back(PROC_MODE::FOREACH);
+	m_block_name_stack.push_back("__FOREACHPLAYER");
+	m_locale_stack.push_back(cont);
+	m_current_opcode_index++;
 
-			}
-			else if (currentCode.type == OpcodeType::ELSE_BLK_HEADER && depth == 0)
-			{
-				foundExecutableBlock = true;
-				m_current_opcode_index++;
-				// execute it right away, since no other block matched
-				m_depth++;
-				m_proc_mode_stack.push_back(PROC_MODE::IF);
-				m_block_name_stack.push_back("__IF");
-				AttrCont cont;
-				m_locale_stack.push_back(cont);
-			}
-			else
-			{
-				if (is_block_start())
-				{
-					depth++;
-				}
-				else if (is_block_end())
-				{
-					depth--;
-				}
-				m_current_opcode_index++;
-			}
+	return 0;
+}
 
-			firstLoop = false;
-		}
+int Program::op_foreachplayer_blk_end(const Opcode& code, bool load)
+{
+	auto playerRef = m_locale_stack.back().Get(P_SYMBOL);
+	assert(playerRef.type == AttributeType::PLAYER_REF);
 
-		if (!foundExecutableBlock && m_opcodes[m_current_opcode_index].type == OpcodeType::BLK_END)
-		{
-			m_current_opcode_index++;
-		}
-	}
-	else if (code.type == OpcodeType::ELSE_BLK_HEADER || code.type == OpcodeType::ELSE_IF_BLK_HEADER)
+	if (playerRef.playerRef == m_game.players.size() - 1)
 	{
-		// we're here because we just executed part of an if / else block, and now we need to skip the rest of it
 		m_depth--;
+		m_locale_stack.pop_back();
 		m_proc_mode_stack.pop_back();
 		m_block_name_stack.pop_back();
+		m_current_opcode_index++;
+	}
+	else
+	{
+		Attr newPlayerRef;
+		newPlayerRef.type = AttributeType::PLAYER_REF;
+		newPlayerRef.playerRef = playerRef.playerRef + 1;
+		m_locale_stack.back().Store(P_SYMBOL, newPlayerRef);
+
+		// the end of a foreachplayer block jumps back to its header
+		m_current_opcode_index = code.jump_index + 1;
+	}
+
+	return 0;
+}
+
+int Program::op_setup_blk_header(const Opcode& code, bool load)
+{
+	if (load)
+	{
 		ignore_block();
 	}
-	else if (code.type == OpcodeType::FOREACHPLAYER_BLK_HEADER)
+	else
 	{
 		m_depth++;
-		AttrCont cont;
-		Attr counter;
-		counter.playerRef = 0;
-		counter.type = AttributeType::PLAYER_REF;
-		cont.Store("p", counter);
-
-		Attr loop_start_index;
-		loop_start_index.type = AttributeType::INT;
-		loop_start_index.i = m_current_opcode_index + 1;
-		cont.Store("__LOOP_START_INDEX", loop_start_index);
-
-		m_proc_mode_stack.push_back(PROC_MODE::FOREACH);
-		m_block_name_stack.push_back("__FOREACHPLAYER");
-		m_locale_stack.push_back(cont);
+		m_proc_mode_stack.push_back(PROC_MODE::SETUP);
+		m_block_name_stack.push_back("__SETUP");
+		m_locale_stack.push_back(AttrCont());
 		m_current_opcode_index++;
 	}
-	else if (code.type == OpcodeType::FOREACHPLAYER_BLK_END)
-	{
-		auto playerRef = m_locale_stack.back().Get("p");
-		assert(playerRef.type == AttributeType::PLAYER_REF);
 
-		if (playerRef.playerRef == m_game.players.size() - 1)
-		{
-			m_depth--;
-			m_locale_stack.pop_back();
-			m_proc_mode_stack.pop_back();
-			m_block_name_stack.pop_back();
-			m_current_opcode_index++;
-		}
-		else
-		{
-			Attr newPlayerRef;
-			newPlayerRef.type = AttributeType::PLAYER_REF;
-			newPlayerRef.playerRef = playerRef.playerRef + 1;
-			m_locale_stack.back().Store("p", newPlayerRef);
+	return 0;
+}
 
-			auto loopStartIndex = m_locale_stack.back().Get("__LOOP_START_INDEX");
-			assert(loopStartIndex.type == AttributeType::INT);
-			int jmp_location = loopStartIndex.i;
-			m_current_opcode_index = jmp_location;
-		}
-	}
-	else if (code.type == OpcodeType::SETUP_BLK_HEADER)
+int Program::op_phase_blk_header(const Opcode& code, bool load)
+{
+	if (load)
 	{
-		if (load)
-		{
-			ignore_block();
-		}
-		else
-		{
-			m_depth++;
-			m_proc_mode_stack.push_back(PROC_MODE::SETUP);
-			m_block_name_stack.push_back("__SETUP");
-			m_locale_stack.push_back(AttrCont());
-			m_current_opcode_index++;
-		}
+		ignore_block();
 	}
-	else if (code.type == OpcodeType::PHASE_BLK_HEADER)
+	else
 	{
-		if (load)
-		{
-			ignore_block();
-		}
-		else
-		{
-			m_depth++;
-			m_proc_mode_stack.push_back(PROC_MODE::PHASE);
-			m_block_name_stack.push_back("__PHASE");
-			m_locale_stack.push_back(AttrCont());
-			m_current_opcode_index++;
-		}
+		m_depth++;
+		m_proc_mode_stack.push_back(PROC_MODE::PHASE);
+		m_block_name_stack.push_back("__PHASE");
+		m_locale_stack.push_back(AttrCont());
+		m_current_opcode_index++;
 	}
-	else if (code.type == OpcodeType::TURN_BLK_HEADER)
+
+	return 0;
+}
+
+int Program::op_turn_blk_header(const Opcode& code, bool load)
+{
+	if (load)
 	{
-		if (load)
-		{
-			ignore_block();
-		}
-		else
-		{
-			m_depth++;
-			m_proc_mode_stack.push_back(PROC_MODE::TURN);
-			m_block_name_stack.push_back("__TURN");
-			m_locale_stack.push_back(AttrCont());
-			m_current_opcode_index++;
-		}
+		ignore_block();
 	}
-	else if (code.type == OpcodeType::CARD_BLK_HEADER)
+	else
 	{
 		m_depth++;
-		DATA_IX_T name_idx = (code.data & (OPCODE_CONV_T(0xFF) << 32)) >> 32;
+		m_proc_mode_stack.push_back(PROC_MODE::TURN);
+		m_block_name_stack.push_back("__TURN");
+		m_locale_stack.push_back(AttrCont());
+		m_current_opcode_index++;
+	}
 
+	return 0;
+}
 
-		m_proc_mode_stack.push_back(PROC_MODE::CARD);
-		m_block_name_stack.push_back(m_strings[name_idx]);
+int Program::op_card_blk_header(const Opcode& code, bool load)
+{
+	m_depth++;
+	DATA_IX_T name_idx = (code.data & DATA_IX_T_MASK) >> 32;
 
-		string parentName = get_card_parent_name(m_strings[name_idx]);
 
-		if (parentName.size() > 0 && m_game.cards.find(parentName) != m_game.cards.end())
-		{
-			AttrCont attrs = m_game.cards.find(parentName)->second.attributes;
-			m_locale_stack.push_back(attrs);
-		}
-		else
-		{
-			m_locale_stack.push_back(AttrCont());
-		}
+	m_proc_mode_stack.push_back(PROC_MODE::CARD);
+	m_block_name_stack.push_back(m_game.symbols.Name(name_idx));
 
-		m_current_opcode_index++;
-    }
-	else if (code.type == OpcodeType::DO_DECL)
-	{
-		DATA_IX_T name_idx = (code.data & (OPCODE_CONV_T(0xFF) << 32)) >> 32;
-		string block_name = m_strings[name_idx];
-
-		AttrCont cont;
-		Attr index_store_attr;
-		index_store_attr.type = AttributeType::INT;
-		index_store_attr.i = m_current_opcode_index + 1;
-		cont.Store("__INDEX_STORE", index_store_attr);
-		m_locale_stack.push_back(cont);
-
-		m_current_opcode_index = m_phase_indexes[block_name];
-	}
-    /*
-     * --
-     * STACK_TRANSFER
-     * --
-     * SOURCE CHOOSE | IDENTIFIER
-     * --
-     * IDENTIFIER(S)
-     * --
-     * FROM_CONSTRAINT + FACTOR / NO_FROM_CONSTRAINT
-     * --
-     * STACK_SOURCE_LOCATION
-     * --
-     * source location TOP/BOTTOM/CHOOSE
-     * --
-     * FACTOR (number to take)
-     * --
-     * OPERATION: MOVE/CUT
-     * --
-     * DESTINATION_STACK
-     * --
-     * TARGET IDENTIFIER | CHOOSE
-     * --
-     * IDENTIFIER(S)
-     * --
-     *  TO_CONSTRAINT + FACTOR / NO_TO_CONSTRAINT
-     * --
-     * STACK_DESTINATION_LOCATION
-     * --
-     * TARGET LOCATION: TOP/BOTTOM
-     */
-    else if (code.type == OpcodeType::STACK_TRANSFER)
-    {
-        m_stackTransferStateTracker = StackTransferStateTracker();
-        m_stackTransferStateTracker.complete = false;
-        m_current_opcode_index++;
+	Symbol parentName = get_card_parent_name(m_block_name_stack.back());
 
-        auto sourceOpcode = m_opcodes[m_current_opcode_index];
-        if (sourceOpcode.type == OpcodeType::CHOOSE)
-        {
-            std::vector<int> source_ids_to_select_from;
-            m_current_opcode_index++;
-            while (m_opcodes[m_current_opcode_index].type == OpcodeType::L_VALUE_DOT_SEPERATED_REF_CHAIN
-                || m_opcodes[m_current_opcode_index].type == OpcodeType::L_VALUE)
-            {
-                std::vector<std::string> current_name;
-                read_name(current_name, m_opcodes[m_current_opcode_index].type);
-                Attr* stackName = this->get_attr_ptr(current_name);
-                source_ids_to_select_from.push_back(stackName->stackRef);
-            }
+	if (parentName != NO_SYMBOL && m_game.FindCard(parentName) != -1)
+	{
+		AttrCont attrs = m_game.cards[m_game.FindCard(parentName)].attributes;
+		m_locale_stack.push_back(attrs);
+	}
+	else
+	{
+		m_locale_stack.push_back(AttrCont());
+	}
 
-        	if (m_opcodes[m_current_opcode_index].type == OpcodeType::STACK_FROM_NO_CONSTRAINT)
-        	{
-        		m_current_opcode_index++;
-        	}
-        	else
-        	{
-        		m_current_opcode_index++;
-        		int booleanExpressionIndexStart = m_current_opcode_index;
-				vector<int> new_source_ids_to_select_from;
-        		for (int id : source_ids_to_select_from)
-        		{
-        			m_current_opcode_index = booleanExpressionIndexStart;
-        			AttrCont cont;
-        			Attr fromStackRef;
-        			fromStackRef.type = AttributeType::STACK_REF;
-        			fromStackRef.stackRef = id;
-        			cont.Store("from", fromStackRef);
-        			m_locale_stack.push_back(cont);
-					if(resolve_bool_expression())
-					{
-						new_source_ids_to_select_from.push_back(id);
-					}
+	m_current_opcode_index++;
 
-        			m_locale_stack.pop_back();
-        		}
-        		source_ids_to_select_from = new_source_ids_to_select_from;
-        	}
+	return 0;
+}
 
-            m_stackTransferStateTracker.sourceStackSelectionPool = source_ids_to_select_from;
-            m_stackTransferStateTracker.type = InputOperationType::CHOOSE_SOURCE;
-            m_waitingForUserInteraction = true;
-            return RUN_WAITING_FOR_INTERACTION_RETURN;
-        }
-        else if (sourceOpcode.type == OpcodeType::IDENTIFIER)
-        {
-            m_current_opcode_index++;
-            std::vector<std::string> sourceIdentifier;
-            read_name(sourceIdentifier, m_opcodes[m_current_opcode_index].type);
-            Attr* stackName = this->get_attr_ptr(sourceIdentifier);
-            m_stackTransferStateTracker.srcStackID = stackName->stackRef;
-
-        	if (m_opcodes[m_current_opcode_index].type == OpcodeType::STACK_FROM_NO_CONSTRAINT)
-        	{
-        		m_current_opcode_index++;
-        	}
-        	else {
-        		throw VMError("You can only use from constraints on transfers where you choose from multiple source stacks");
-        	}
-        }
-        else if (sourceOpcode.type == OpcodeType::RANDOM)
-        {
-            m_current_opcode_index++;
-            vector<string> card_type;
-            read_name(card_type, m_opcodes[m_current_opcode_index].type);
+int Program::op_do_decl(const Opcode& code, bool load)
+{
+	if (code.jump_index == -1)
+	{
+		DATA_IX_T name_idx = (code.data & DATA_IX_T_MASK) >> 32;
+		throw VMError("there is no phase called " + m_game.symbols.Name(name_idx));
+	}
 
-            assert(card_type.size() == 1);
-            m_stackTransferStateTracker.randomSource = true;
-            m_stackTransferStateTracker.randomSourceParentCard = card_type[0];
+	AttrCont cont;
+	Attr index_store_attr;
+	index_store_attr.type = AttributeType::INT;
+	index_store_attr.i = m_current_opcode_index + 1;
+	cont.Store(INDEX_STORE_SYMBOL, index_store_attr);
+	m_locale_stack.push_back(cont);
 
-        	if (m_opcodes[m_current_opcode_index].type == OpcodeType::STACK_FROM_NO_CONSTRAINT)
-        	{
-        		m_current_opcode_index++;
-        	}
-        	else {
-        		throw VMError("You can only use from constraints on transfers where you choose from multiple source stacks");
-        	}
-        }
-    	else if (sourceOpcode.type == OpcodeType::SPECIFIC_CARD)
-    	{
-    		m_current_opcode_index++;
-    		vector<string> card_type;
-    		read_name(card_type, m_opcodes[m_current_opcode_index].type);
+	m_current_opcode_index = code.jump_index;
 
-    		assert(card_type.size() == 1);
+	return 0;
+}
+
+/*
+ * --
+ * STACK_TRANSFER
+ * --
+ * SOURCE CHOOSE | IDENTIFIER
+ * --
+ * IDENTIFIER(S)
+ * --
+ * FROM_CONSTRAINT + FACTOR / NO_FROM_CONSTRAINT
+ * --
+ * STACK_SOURCE_LOCATION
+ * --
+ * source location TOP/BOTTOM/CHOOSE
+ * --
+ * FACTOR (number to take)
+ * --
+ * OPERATION: MOVE/CUT
+ * --
+ * DESTINATION_STACK
+ * --
+ * TARGET IDENTIFIER | CHOOSE
+ * --
+ * IDENTIFIER(S)
+ * --
+ *  TO_CONSTRAINT + FACTOR / NO_TO_CONSTRAINT
+ * --
+ * STACK_DESTINATION_LOCATION
+ * --
+ * TARGET LOCATION: TOP/BOTTOM
+ */
+int Program::op_stack_transfer(const Opcode& code, bool load)
+{
+    m_stackTransferStateTracker = StackTransferStateTracker();
+    m_stackTransferStateTracker.complete = false;
+    m_current_opcode_index++;
 
-    		Card c = m_game.GenerateCard(card_type[0]);
-    		m_stackTransferStateTracker.specificCardName = card_type[0];
-    		m_stackTransferStateTracker.specificCardGeneration = true;
+    auto sourceOpcode = m_opcodes[m_current_opcode_index];
+    if (sourceOpcode.type == OpcodeType::CHOOSE)
+    {
+        std::vector<int> source_ids_to_select_from;
+        m_current_opcode_index++;
+        while (m_opcodes[m_current_opcode_index].type == OpcodeType::L_VALUE_DOT_SEPERATED_REF_CHAIN
+            || m_opcodes[m_current_opcode_index].type == OpcodeType::L_VALUE)
+        {
+            std::vector<Symbol> current_name;
+            NameBinding binding = read_name(current_name, m_opcodes[m_current_opcode_index].type);
+            Attr* stackName = this->get_attr_ptr(current_name, binding);
+            source_ids_to_select_from.push_back(stackName->stackRef);
+        }
 
-    		if (m_opcodes[m_current_opcode_index].type == OpcodeType::STACK_FROM_NO_CONSTRAINT)
+    	if (m_opcodes[m_current_opcode_index].type == OpcodeType::STACK_FROM_NO_CONSTRAINT)
+    	{
+    		m_current_opcode_index++;
+    	}
+    	else
+    	{
+    		m_current_opcode_index++;
+    		int booleanExpressionIndexStart = m_current_opcode_index;
+			vector<int> new_source_ids_to_select_from;
+    		for (int id : source_ids_to_select_from)
     		{
-    			m_current_opcode_index++;
-    		}
-    		else {
-    			throw VMError("You can only use from constraints on transfers where you choose from multiple source stacks");
+    			m_current_opcode_index = booleanExpressionIndexStart;
+    			AttrCont cont;
+    			Attr fromStackRef;
+    			fromStackRef.type = AttributeType::STACK_REF;
+    			fromStackRef.stackRef = id;
+    			cont.Store(FROM_SYMBOL, fromStackRef);
+    			m_locale_stack.push_back(cont);
+				if(resolve_bool_expression())
+				{
+					new_source_ids_to_select_from.push_back(id);
+				}
+
+    			m_locale_stack.pop_back();
     		}
+    		source_ids_to_select_from = new_source_ids_to_select_from;
     	}
+
+        m_stackTransferStateTracker.sourceStackSelectionPool = source_ids_to_select_from;
+        m_stackTransferStateTracker.type = InputOperationType::CHOOSE_SOURCE;
+        m_waitingForUserInteraction = true;
+        return RUN_WAITING_FOR_INTERACTION_RETURN;
     }
-    else if (code.type == OpcodeType::STACK_SOURCE_LOCATION) {
-        m_waitingForUserInteraction = false;
+    else if (sourceOpcode.type == OpcodeType::IDENTIFIER)
+    {
         m_current_opcode_index++;
-        if (m_opcodes[m_current_opcode_index].type == OpcodeType::CHOOSE) {
-            m_current_opcode_index++;
-            int numberToTake = resolve_number_expression();
-            // srcTop is true, but it's only set for consistancy.
-            // it doesn't matter when you're choosing cards
-            m_stackTransferStateTracker.srcTop = true;
-            m_stackTransferStateTracker.nExpected = numberToTake;
-            m_stackTransferStateTracker.type = InputOperationType::CHOOSE_CARDS_FROM_SOURCE;
-            if(m_opcodes[m_current_opcode_index].type == OpcodeType::MOVE)
-            {
-                m_stackTransferStateTracker.transferType = StackTransferType::MOVE;
-            }
-            else if (m_opcodes[m_current_opcode_index].type == OpcodeType::CUT)
-            {
-                m_stackTransferStateTracker.transferType = StackTransferType::CUT;
-            }
-            m_current_opcode_index++;
+        std::vector<Symbol> sourceIdentifier;
+        NameBinding binding = read_name(sourceIdentifier, m_opcodes[m_current_opcode_index].type);
+        Attr* stackName = this->get_attr_ptr(sourceIdentifier, binding);
+        m_stackTransferStateTracker.srcStackID = stackName->stackRef;
 
-            if (m_game.stacks[m_stackTransferStateTracker.srcStackID].cards.empty())
-            {
-                return 0;
-            }
+    	if (m_opcodes[m_current_opcode_index].type == OpcodeType::STACK_FROM_NO_CONSTRAINT)
+    	{
+    		m_current_opcode_index++;
+    	}
+    	else {
+    		throw VMError("You can only use from constraints on transfers where you choose from multiple source stacks");
+    	}
+    }
+    else if (sourceOpcode.type == OpcodeType::RANDOM)
+    {
+        m_current_opcode_index++;
+        vector<Symbol> card_type;
+        NameBinding binding = read_name(card_type, m_opcodes[m_current_opcode_index].type);
 
-            m_waitingForUserInteraction = true;
-            return RUN_WAITING_FOR_INTERACTION_RETURN;
-        }
-        if (m_opcodes[m_current_opcode_index].type == OpcodeType::TOP) {
-            m_stackTransferStateTracker.srcTop = true;
-        } else if (m_opcodes[m_current_opcode_index].type == OpcodeType::BOTTOM) {
-            m_stackTransferStateTracker.srcTop = false;
+        assert(card_type.size() == 1);
+        m_stackTransferStateTracker.randomSource = true;
+        m_stackTransferStateTracker.randomSourceClassID = bound_card(binding);
+        if (m_stackTransferStateTracker.randomSourceClassID == -1)
+        {
+            throw VMError("no card named " + m_game.symbols.Name(card_type[0]));
         }
 
-        m_current_opcode_index++;
-        int numberToTake = resolve_number_expression();
+    	if (m_opcodes[m_current_opcode_index].type == OpcodeType::STACK_FROM_NO_CONSTRAINT)
+    	{
+    		m_current_opcode_index++;
+    	}
+    	else {
+    		throw VMError("You can only use from constraints on transfers where you choose from multiple source stacks");
+    	}
+    }
+	else if (sourceOpcode.type == OpcodeType::SPECIFIC_CARD)
+	{
+		m_current_opcode_index++;
+		vector<Symbol> card_type;
+		NameBinding binding = read_name(card_type, m_opcodes[m_current_opcode_index].type);
 
-        auto sourceStack = m_game.stacks[m_stackTransferStateTracker.srcStackID];
-        if (!m_stackTransferStateTracker.randomSource && !m_stackTransferStateTracker.specificCardGeneration)
-        {
-            numberToTake = std::min(numberToTake, (int)sourceStack.cards.size());
-            vector<Card> cardsTaken;
-            if (m_stackTransferStateTracker.srcTop)
-            {
-                cardsTaken = vector(sourceStack.cards.end()-numberToTake, sourceStack.cards.end());
-            }
-            else
-            {
-                cardsTaken = vector(sourceStack.cards.begin(), sourceStack.cards.begin() + numberToTake);
-            }
+		assert(card_type.size() == 1);
 
-            m_stackTransferStateTracker.cardsToMove = cardsTaken;
-        }
+		int cardID = bound_card(binding);
+		if (cardID == NO_CARD)
+		{
+			throw VMError("no card named " + m_game.symbols.Name(card_type[0]));
+		}
+		m_stackTransferStateTracker.specificCardID = cardID;
+		m_stackTransferStateTracker.specificCardGeneration = true;
 
-        m_stackTransferStateTracker.nExpected = numberToTake;
+		if (m_opcodes[m_current_opcode_index].type == OpcodeType::STACK_FROM_NO_CONSTRAINT)
+		{
+			m_current_opcode_index++;
+		}
+		else {
+			throw VMError("You can only use from constraints on transfers where you choose from multiple source stacks");
+		}
+	}
 
+	return 0;
+}
+
+int Program::op_stack_source_location(const Opcode& code, bool load)
+{
+    m_waitingForUserInteraction = false;
+    m_current_opcode_index++;
+    if (m_opcodes[m_current_opcode_index].type == OpcodeType::CHOOSE) {
+        m_current_opcode_index++;
+        int numberToTake = resolve_number_expression();
+        // srcTop is true, but it's only set for consistancy.
+        // it doesn't matter when you're choosing cards
+        m_stackTransferStateTracker.srcTop = true;
+        m_stackTransferStateTracker.nExpected = numberToTake;
+        m_stackTransferStateTracker.type = InputOperationType::CHOOSE_CARDS_FROM_SOURCE;
         if(m_opcodes[m_current_opcode_index].type == OpcodeType::MOVE)
         {
             m_stackTransferStateTracker.transferType = StackTransferType::MOVE;
@@ -1431,264 +2558,342 @@ int Program::run(Opcode code, bool load)
         else if (m_opcodes[m_current_opcode_index].type == OpcodeType::CUT)
         {
             m_stackTransferStateTracker.transferType = StackTransferType::CUT;
-            m_stackTransferStateTracker.cutPoint = numberToTake;
         }
         m_current_opcode_index++;
 
+        // a cut the player chooses has no number of cards, it's compiled as -1
+        if (numberToTake < 0 && m_stackTransferStateTracker.transferType == StackTransferType::MOVE)
+        {
+            throw VMError("Can't move a negative number of cards");
+        }
+
+        if (m_game.stacks[m_stackTransferStateTracker.srcStackID].Empty())
+        {
+            return 0;
+        }
+
+        m_waitingForUserInteraction = true;
+        return RUN_WAITING_FOR_INTERACTION_RETURN;
+    }
+    if (m_opcodes[m_current_opcode_index].type == OpcodeType::TOP) {
+        m_stackTransferStateTracker.srcTop = true;
+    } else if (m_opcodes[m_current_opcode_index].type == OpcodeType::BOTTOM) {
+        m_stackTransferStateTracker.srcTop = false;
+    }
+
+    m_current_opcode_index++;
+    int numberToTake = resolve_number_expression();
+    if (numberToTake < 0)
+    {
+        throw VMError("Can't move a negative number of cards");
     }
-    else if (code.type == OpcodeType::DESTINATION_STACK)
+
+    const std::deque<CardInstance>& source = m_game.stacks[m_stackTransferStateTracker.srcStackID].Cards();
+    if (!m_stackTransferStateTracker.randomSource && !m_stackTransferStateTracker.specificCardGeneration)
     {
-        m_waitingForUserInteraction = false;
+        numberToTake = std::min(numberToTake, (int)source.size());
+        if (m_stackTransferStateTracker.srcTop)
+        {
+            m_stackTransferStateTracker.cardsToMove.assign(source.end() - numberToTake, source.end());
+        }
+        else
+        {
+            m_stackTransferStateTracker.cardsToMove.assign(source.begin(), source.begin() + numberToTake);
+        }
+        m_stackTransferStateTracker.takenFromEnd = true;
+    }
+
+    m_stackTransferStateTracker.nExpected = numberToTake;
+
+    if(m_opcodes[m_current_opcode_index].type == OpcodeType::MOVE)
+    {
+        m_stackTransferStateTracker.transferType = StackTransferType::MOVE;
+    }
+    else if (m_opcodes[m_current_opcode_index].type == OpcodeType::CUT)
+    {
+        m_stackTransferStateTracker.transferType = StackTransferType::CUT;
+        m_stackTransferStateTracker.cutPoint = numberToTake;
+    }
+    m_current_opcode_index++;
+
+	return 0;
+}
+
+int Program::op_destination_stack(const Opcode& code, bool load)
+{
+    m_waitingForUserInteraction = false;
+    m_current_opcode_index++;
+    if (m_opcodes[m_current_opcode_index].type == OpcodeType::CHOOSE)
+    {
+        std::vector<int> dest_ids_to_select_from;
         m_current_opcode_index++;
-        if (m_opcodes[m_current_opcode_index].type == OpcodeType::CHOOSE)
+        while (m_opcodes[m_current_opcode_index].type == OpcodeType::L_VALUE_DOT_SEPERATED_REF_CHAIN
+               || m_opcodes[m_current_opcode_index].type == OpcodeType::L_VALUE)
         {
-            std::vector<int> dest_ids_to_select_from;
-            m_current_opcode_index++;
-            while (m_opcodes[m_current_opcode_index].type == OpcodeType::L_VALUE_DOT_SEPERATED_REF_CHAIN
-                   || m_opcodes[m_current_opcode_index].type == OpcodeType::L_VALUE)
-            {
-                std::vector<std::string> current_name;
-                read_name(current_name, m_opcodes[m_current_opcode_index].type);
-                Attr* stackName = this->get_attr_ptr(current_name);
-                dest_ids_to_select_from.push_back(stackName->stackRef);
-            }
+            std::vector<Symbol> current_name;
+            NameBinding binding = read_name(current_name, m_opcodes[m_current_opcode_index].type);
+            Attr* stackName = this->get_attr_ptr(current_name, binding);
+            dest_ids_to_select_from.push_back(stackName->stackRef);
+        }
+
+    	if (m_opcodes[m_current_opcode_index].type == OpcodeType::STACK_TO_NO_CONSTRAINT)
+    	{
+    		m_current_opcode_index++;
+    	}
+    	else
+    	{
+    		m_current_opcode_index++;
+    		int booleanExpressionIndexStart = m_current_opcode_index;
+    		vector<int> new_dest_ids_to_select_from;
+    		for (int id : dest_ids_to_select_from)
+    		{
+    			m_current_opcode_index = booleanExpressionIndexStart;
+
+    			Attr toStackRef;
+    			toStackRef.type = AttributeType::STACK_REF;
+    			toStackRef.stackRef = id;
+
+				Attr fromStackRef;
+    			fromStackRef.type = AttributeType::STACK_REF;
+    			fromStackRef.stackRef = m_stackTransferStateTracker.srcStackID;
+
+    			AttrCont cont;
+    			cont.Store(TO_SYMBOL, toStackRef);
+    			cont.Store(FROM_SYMBOL, fromStackRef);
+
+    			m_locale_stack.push_back(cont);
+    			if(resolve_bool_expression())
+    			{
+    				new_dest_ids_to_select_from.push_back(id);
+    			}
+
+    			m_locale_stack.pop_back();
+    		}
 
-        	if (m_opcodes[m_current_opcode_index].type == OpcodeType::STACK_TO_NO_CONSTRAINT)
-        	{
-        		m_current_opcode_index++;
-        	}
-        	else
-        	{
-        		m_current_opcode_index++;
-        		int booleanExpressionIndexStart = m_current_opcode_index;
-        		vector<int> new_dest_ids_to_select_from;
-        		for (int id : dest_ids_to_select_from)
-        		{
-        			m_current_opcode_index = booleanExpressionIndexStart;
-
-        			Attr toStackRef;
-        			toStackRef.type = AttributeType::STACK_REF;
-        			toStackRef.stackRef = id;
-
-					Attr fromStackRef;
-        			fromStackRef.type = AttributeType::STACK_REF;
-        			fromStackRef.stackRef = m_stackTransferStateTracker.srcStackID;
-
-        			AttrCont cont;
-        			cont.Store("to", toStackRef);
-        			cont.Store("from", fromStackRef);
-
-        			m_locale_stack.push_back(cont);
-        			if(resolve_bool_expression())
-        			{
-        				new_dest_ids_to_select_from.push_back(id);
-        			}
-
-        			m_locale_stack.pop_back();
-        		}
-
-        		dest_ids_to_select_from = new_dest_ids_to_select_from;
-        	}
+    		dest_ids_to_select_from = new_dest_ids_to_select_from;
+    	}
 
-            m_stackTransferStateTracker.destinationStackSelectionPool = dest_ids_to_select_from;
-            m_stackTransferStateTracker.type = InputOperationType::CHOOSE_DESTINATION;
-            m_waitingForUserInteraction = true;
-            return RUN_WAITING_FOR_INTERACTION_RETURN;
-        }
-        else if (m_opcodes[m_current_opcode_index].type == OpcodeType::IDENTIFIER)
-        {
-            m_current_opcode_index++;
-            std::vector<std::string> destinationIdentifier;
-            read_name(destinationIdentifier, m_opcodes[m_current_opcode_index].type);
-            Attr* stackName = this->get_attr_ptr(destinationIdentifier);
-            m_stackTransferStateTracker.dstStackID = stackName->stackRef;
-
-        	if (m_opcodes[m_current_opcode_index].type == OpcodeType::STACK_TO_NO_CONSTRAINT)
-        	{
-        		m_current_opcode_index++;
-        	}
-        	else
-        	{
-        		throw VMError("You can only use to constraints on transfers where you choose from multiple destination stacks");
-        	}
-        }
+        m_stackTransferStateTracker.destinationStackSelectionPool = dest_ids_to_select_from;
+        m_stackTransferStateTracker.type = InputOperationType::CHOOSE_DESTINATION;
+        m_waitingForUserInteraction = true;
+        return RUN_WAITING_FOR_INTERACTION_RETURN;
     }
-    else if (code.type == OpcodeType::STACK_DESTINATION_LOCATION)
+    else if (m_opcodes[m_current_opcode_index].type == OpcodeType::IDENTIFIER)
     {
-        m_waitingForUserInteraction = false;
-        m_current_opcode_index ++;
-        if (m_opcodes[m_current_opcode_index].type == OpcodeType::TOP)
-        {
-            m_stackTransferStateTracker.dstTop = true;
-        }
-        else if (m_opcodes[m_current_opcode_index].type == OpcodeType::BOTTOM)
-        {
-            m_stackTransferStateTracker.dstTop = false;
-        }
+        m_current_opcode_index++;
+        std::vector<Symbol> destinationIdentifier;
+        NameBinding binding = read_name(destinationIdentifier, m_opcodes[m_current_opcode_index].type);
+        Attr* stackName = this->get_attr_ptr(destinationIdentifier, binding);
+        m_stackTransferStateTracker.dstStackID = stackName->stackRef;
 
-        m_stackTransferStateTracker.complete = true;
-        CompleteStackTransfer(m_stackTransferStateTracker);
-        m_current_opcode_index ++;
+    	if (m_opcodes[m_current_opcode_index].type == OpcodeType::STACK_TO_NO_CONSTRAINT)
+    	{
+    		m_current_opcode_index++;
+    	}
+    	else
+    	{
+    		throw VMError("You can only use to constraints on transfers where you choose from multiple destination stacks");
+    	}
     }
-	else if (code.type == OpcodeType::ATTR_DECL)
-	{
-		m_current_opcode_index++;
-		vector<string> names;
-		read_name(names, m_opcodes[m_current_opcode_index].type);
-
-		auto typeOpcode = m_opcodes[m_current_opcode_index];
-		assert(typeOpcode.type == OpcodeType::ATTR_DATA_TYPE);
-		TYPE_CODE_T typeCode = typeOpcode.data & TYPE_CODE_T_MASK;
-		m_current_opcode_index++;
 
-		Attr a;
-		auto attrType = s_type_code_to_attribute_type(typeCode);
+	return 0;
+}
 
-		if (attrType == AttributeType::UNDEFINED)
-		{
-			cout << "undefined attribute type " << typeCode << endl;
-			return -1;
-		}
+int Program::op_stack_destination_location(const Opcode& code, bool load)
+{
+    m_waitingForUserInteraction = false;
+    m_current_opcode_index ++;
+    if (m_opcodes[m_current_opcode_index].type == OpcodeType::TOP)
+    {
+        m_stackTransferStateTracker.dstTop = true;
+    }
+    else if (m_opcodes[m_current_opcode_index].type == OpcodeType::BOTTOM)
+    {
+        m_stackTransferStateTracker.dstTop = false;
+    }
 
-		a.type = attrType;
+    m_stackTransferStateTracker.complete = true;
+    CompleteStackTransfer(m_stackTransferStateTracker);
+    m_current_opcode_index ++;
 
-		if (attrType == AttributeType::STACK_REF)
-		{
+	return 0;
+}
 
-			Stack newStack;
-			a.stackRef = (int) m_game.stacks.size();
+int Program::op_attr_decl(const Opcode& code, bool load)
+{
+	m_current_opcode_index++;
+	vector<Symbol> names;
+	NameBinding binding = read_name(names, m_opcodes[m_current_opcode_index].type);
 
-			if (typeCode == VISIBLE_STACK_TC)
-			{
-				newStack.t = StackType::VISIBLE;
-			}
-			else if (typeCode == HIDDEN_STACK_TC)
-			{
-				newStack.t = StackType::HIDDEN;
-			}
-			else if (typeCode == PRIVATE_STACK_TC)
-			{
-				newStack.t = StackType::PRIVATE;
-			}
-			else if (typeCode == FLAT_VISIBLE_STACK_TC)
-			{
-				newStack.t = StackType::FLAT_VISIBLE;
-			}
-			else if (typeCode == FLAT_HIDDEN_STACK_TC)
-			{
-				newStack.t = StackType::FLAT_HIDDEN;
-			}
-			else if (typeCode == FLAT_PRIVATE_STACK_TC)
-			{
-				newStack.t = StackType::FLAT_PRIVATE;
-			}
+	auto typeOpcode = m_opcodes[m_current_opcode_index];
+	assert(typeOpcode.type == OpcodeType::ATTR_DATA_TYPE);
+	TYPE_CODE_T typeCode = typeOpcode.data & TYPE_CODE_T_MASK;
+	m_current_opcode_index++;
 
-			newStack.ID = (int) m_game.stacks.size();
-			m_game.stacks[a.stackRef] = newStack;
-		}
+	Attr a;
+	auto attrType = s_type_code_to_attribute_type(typeCode);
 
-		if (names.size() == 1)
-		{
-			m_locale_stack.back().Store(names[0], a);
-		}
-		else
-		{
-			AttrCont* cont = GetObjectAttrContPtrFromIdentifier(names.begin(), names.end() - 1);
-			// TODO: Fix bug where nested stack attrs delcarations such as hiddenstack p.hand
-			//       are overwritten in the game's stack store using their last name
-			cont->Store(names.back(), a);
-		}
-	}
-	else if (code.type == OpcodeType::PLAYERS_L_VALUE)
+	if (attrType == AttributeType::UNDEFINED)
 	{
-		m_current_opcode_index++;
-		int n_players = resolve_number_expression();
-
-		for (int i = 0; i < n_players; i++) {
-			m_game.players.push_back(Player());
-		}
+		cout << "undefined attribute type " << typeCode << endl;
+		return -1;
 	}
-	else if (code.type == OpcodeType::L_VALUE_DOT_SEPERATED_REF_CHAIN || code.type == OpcodeType::L_VALUE)
+
+	a.type = attrType;
+
+	if (attrType == AttributeType::STACK_REF)
 	{
-		vector<string> names;
-		read_name(names, code.type);
 
-		Attr* attrPtr = get_attr_ptr(names);
+		Stack newStack;
+		a.stackRef = (int) m_game.stacks.size();
 
-		if (code.type == OpcodeType::R_VALUE)
+		if (typeCode == VISIBLE_STACK_TC)
 		{
-			throw VMError("Cannot assign from an rvalue reference yet");
+			newStack.t = StackType::VISIBLE;
 		}
-		else if (attrPtr->type == AttributeType::INT)
+		else if (typeCode == HIDDEN_STACK_TC)
 		{
-			int value = resolve_number_expression();
-			attrPtr->i = value;
+			newStack.t = StackType::HIDDEN;
 		}
-		else if (attrPtr->type == AttributeType::BOOL)
+		else if (typeCode == PRIVATE_STACK_TC)
 		{
-			bool value = resolve_bool_expression();
-			attrPtr->b = value;
+			newStack.t = StackType::PRIVATE;
 		}
-		else if (attrPtr->type == AttributeType::STRING)
+		else if (typeCode == FLAT_VISIBLE_STACK_TC)
 		{
-			string value = resolve_string_expression();
-			attrPtr->s = value;
+			newStack.t = StackType::FLAT_VISIBLE;
 		}
-		else if (attrPtr->type == AttributeType::FLOAT)
+		else if (typeCode == FLAT_HIDDEN_STACK_TC)
 		{
-			float value = resolve_float_expression();
-			attrPtr->f = value;
+			newStack.t = StackType::FLAT_HIDDEN;
 		}
-		else if (attrPtr->type == AttributeType::PLAYER_REF)
+		else if (typeCode == FLAT_PRIVATE_STACK_TC)
 		{
-			attrPtr->playerRef = resolve_expression_to_attr().playerRef;
-		}
-		else
-		{
-			throw VMError("Unsupported lvalue type, not sure how we got here.");
+			newStack.t = StackType::FLAT_PRIVATE;
 		}
+
+		newStack.ID = (int) m_game.stacks.size();
+		m_game.stacks.push_back(newStack);
 	}
-	else if (code.type == OpcodeType::WINNER_DECL)
+
+	if (names.size() == 1 && binding.slot != NO_SLOT)
 	{
-		m_current_opcode_index++;
+		m_globals[binding.slot] = a;
+	}
+	else if (names.size() == 1)
+	{
+		m_locale_stack.back().Store(names[0], a);
+	}
+	else
+	{
+		AttrCont* cont = GetObjectAttrContPtrFromIdentifier(names.begin(), names.end() - 1, binding);
+		// TODO: Fix bug where nested stack attrs delcarations such as hiddenstack p.hand
+		//       are overwritten in the game's stack store using their last name
+		cont->Store(names.back(), a);
+	}
 
-		vector<string> names;
-		read_name(names, m_opcodes[m_current_opcode_index].type);
+	return 0;
+}
 
-		Attr attr = get_attr_rvalue(names);
-		if (attr.type != AttributeType::PLAYER_REF)
-		{
-			throw VMError("You must declare a winner with a playerRef");
-		}
-		m_game.winner = attr.playerRef;
+int Program::op_players_l_value(const Opcode& code, bool load)
+{
+	m_current_opcode_index++;
+	int n_players = resolve_number_expression();
+
+	for (int i = 0; i < n_players; i++) {
+		m_game.players.push_back(Player());
 	}
-	else if (code.type == OpcodeType::LOOSER_DECL)
-	{
-		m_current_opcode_index++;
 
-		vector<string> names;
-		read_name(names, m_opcodes[m_current_opcode_index].type);
+	return 0;
+}
 
-		Attr attr = get_attr_rvalue(names);
-		if (attr.type != AttributeType::PLAYER_REF)
-		{
-			throw VMError("You must declare a looser with a playerRef");
-		}
+int Program::op_assignment(const Opcode& code, bool load)
+{
+	vector<Symbol>& names = m_lvalue_names;
+	names.clear();
+	NameBinding binding = read_name(names, code.type);
 
-		m_game.winner = 1000000000; // we probably will never have one billion players . . . right?
+	Attr* attrPtr = get_attr_ptr(names, binding);
+
+	if (code.type == OpcodeType::R_VALUE)
+	{
+		throw VMError("Cannot assign from an rvalue reference yet");
+	}
+	else if (attrPtr->type == AttributeType::INT)
+	{
+		int value = resolve_number_expression();
+		attrPtr->i = value;
+	}
+	else if (attrPtr->type == AttributeType::BOOL)
+	{
+		bool value = resolve_bool_expression();
+		attrPtr->b = value;
+	}
+	else if (attrPtr->type == AttributeType::STRING)
+	{
+		Symbol value = resolve_string_expression();
+		attrPtr->s = value;
+	}
+	else if (attrPtr->type == AttributeType::FLOAT)
+	{
+		float value = resolve_float_expression();
+		attrPtr->f = value;
+	}
+	else if (attrPtr->type == AttributeType::PLAYER_REF)
+	{
+		attrPtr->playerRef = resolve_expression_to_attr().playerRef;
 	}
 	else
 	{
-		cout << "encounterd unknown opcode type " << int(code.type) << endl;
-		return -1;
+		throw VMError("Unsupported lvalue type, not sure how we got here.");
+	}
+
+	return 0;
+}
+
+int Program::op_winner_decl(const Opcode& code, bool load)
+{
+	m_current_opcode_index++;
+
+	vector<Symbol> names;
+	NameBinding binding = read_name(names, m_opcodes[m_current_opcode_index].type);
+
+	Attr attr = get_attr_rvalue(names, binding);
+	if (attr.type != AttributeType::PLAYER_REF)
+	{
+		throw VMError("You must declare a winner with a playerRef");
+	}
+	m_game.winner = attr.playerRef;
+
+	return 0;
+}
+
+int Program::op_looser_decl(const Opcode& code, bool load)
+{
+	m_current_opcode_index++;
+
+	vector<Symbol> names;
+	NameBinding binding = read_name(names, m_opcodes[m_current_opcode_index].type);
+
+	Attr attr = get_attr_rvalue(names, binding);
+	if (attr.type != AttributeType::PLAYER_REF)
+	{
+		throw VMError("You must declare a looser with a playerRef");
 	}
 
+	m_game.winner = 1000000000; // we probably will never have one billion players . . . right?
+
 	return 0;
 }
 
-bool Program::is_block_start()
+int Program::op_unknown(const Opcode& code, bool load)
+{
+	cout << "encounterd unknown opcode type " << int(code.type) << endl;
+	return -1;
+}
+
+bool Program::s_is_block_start(OpcodeType type)
 {
-	auto type = m_opcodes[m_current_opcode_index].type;
 	if (type == OpcodeType::CARD_BLK_HEADER)
 		return true;
 
@@ -1701,12 +2906,6 @@ bool Program::is_block_start()
 	if (type == OpcodeType::IF_BLK_HEADER)
 		return true;
 
-	// if (type == OpcodeType::ELSE_IF_BLK_HEADER)
-	// 	return true;
-	//
-	// if (type == OpcodeType::ELSE_BLK_HEADER)
-	// 	return true;
-
 	if (type == OpcodeType::PHASE_BLK_HEADER)
 		return true;
 
@@ -1719,9 +2918,8 @@ bool Program::is_block_start()
 	return false;
 }
 
-bool Program::is_block_end()
+bool Program::s_is_block_end(OpcodeType type)
 {
-	auto type = m_opcodes[m_current_opcode_index].type;
 	if (type == OpcodeType::BLK_END)
 		return true;
 
@@ -1733,38 +2931,29 @@ bool Program::is_block_end()
 
 void Program::ignore_block()
 {
-	int depth = 1;
-
-	while (depth > 0)
-	{
-		m_current_opcode_index++;
-		if (is_block_start())
-		{
-			depth++;
-		}
-		else if (is_block_end())
-		{
-			depth --;
-		}
-	}
-	m_current_opcode_index++;
+	m_current_opcode_index = m_opcodes[m_current_opcode_index].end_index + 1;
 }
 
 int get_stored_string_index(Opcode stringOpcode)
 {
     TYPE_CODE_T _string_typecode = stringOpcode.data & TYPE_CODE_T_MASK;
     assert(_string_typecode == STRING_TC);
-    DATA_IX_T stringNameIdx = (stringOpcode.data & (OPCODE_CONV_T(0xFF) << 32)) >> 32;
+    DATA_IX_T stringNameIdx = (stringOpcode.data & DATA_IX_T_MASK) >> 32;
     return stringNameIdx;
 }
 
-void Program::read_name(vector<string>& names, OpcodeType nameType)
+/*
+ * Reads the names of the reference at m_current_opcode_index into names, and returns the global
+ * slot and card its first name is bound to.
+ */
+NameBinding Program::read_name(vector<Symbol>& names, OpcodeType nameType)
 {
 	int idx = m_current_opcode_index;
+	NameBinding binding{m_opcodes[idx].slot, m_opcodes[idx].card};
     if (m_opcodes[idx].type == OpcodeType::L_VALUE || m_opcodes[idx].type == OpcodeType::R_VALUE || m_opcodes[idx].type == OpcodeType::R_VALUE_REF)
     {
         int stringNameIdx = get_stored_string_index(m_opcodes[idx]);
-        names.push_back(m_strings[stringNameIdx]);
+        names.push_back((Symbol) stringNameIdx);
         idx++;
     }
     else
@@ -1773,7 +2962,7 @@ void Program::read_name(vector<string>& names, OpcodeType nameType)
         while (m_opcodes[idx].type == nameType)
         {
             int stringNameIdx = get_stored_string_index(m_opcodes[idx]);
-            names.push_back(m_strings[stringNameIdx]);
+            names.push_back((Symbol) stringNameIdx);
             idx++;
         }
 
@@ -1784,154 +2973,278 @@ void Program::read_name(vector<string>& names, OpcodeType nameType)
     }
 
 	m_current_opcode_index = idx;
+
+	return binding;
 }
 
-int Program::resolve_number_expression()
+int Program::bound_card(const NameBinding& binding) const
 {
-	if (m_opcodes[m_current_opcode_index].type == OpcodeType::R_VALUE)
-	{
-		auto int_value_opcode = m_opcodes[m_current_opcode_index];
-
-		TYPE_CODE_T type = (int_value_opcode.data & TYPE_CODE_T_MASK);
+	// cards are declared in ID order, so one at or past the end hasn't been declared yet
+	return binding.card < (int) m_game.cards.size() ? binding.card : NO_CARD;
+}
 
-		assert(type == INT_TC);
+Attr& Program::get_global(int slot)
+{
+	Attr& global = m_globals[slot];
+	if (global.type == AttributeType::UNDEFINED)
+	{
+		throw VMError("variable does not exist");
+	}
 
-		DATA_IX_T data_index = (int_value_opcode.data & (OPCODE_CONV_T(0xFF) << 32)) >> 32;
+	return global;
+}
 
-		m_current_opcode_index++;
-		return m_ints[data_index];
-	}
-	if (m_opcodes[m_current_opcode_index].type == OpcodeType::R_VALUE_DOT_SEPERATED_REF_CHAIN)
+Attr& Program::push_value()
+{
+	// the compiler never emits an expression this deep, but a bytecode image may hold one
+	if (m_value_stack_size == VALUE_STACK_SIZE)
 	{
-		vector<string> names;
-		read_name(names, m_opcodes[m_current_opcode_index].type);
+		throw VMError("This expression is nested too deeply");
+	}
+	return m_value_stack[m_value_stack_size++];
+}
 
-		Attr attrPtr = get_attr_rvalue(names);
+void Program::push_value(const Attr& value)
+{
+	push_value() = value;
+}
 
-		assert(attrPtr.type == AttributeType::INT);
+/*
+ * Evaluates the postfix expression at m_current_opcode_index on the value stack, and leaves
+ * m_current_opcode_index just after its EXPRESSION_END.
+ * The result stays valid until the next expression is evaluated.
+ */
+const Attr& Program::evaluate_expression()
+{
+	const int base = m_value_stack_size;
 
-		return attrPtr.i;
-	}
-	else if (m_opcodes[m_current_opcode_index].type == OpcodeType::MULTIPLY)
+	// drops this expression's values however it exits, so a caught VMError doesn't leak slots
+	struct ValueStackReset
 	{
-		m_current_opcode_index++;
-		Attr left = resolve_expression_to_attr();
-		Attr right = resolve_expression_to_attr();
-
-		if (left.type != AttributeType::INT || right.type != AttributeType::INT)
-		{
-			throw VMError("both sides of addition must be integers");
-		}
+		int& size;
+		const int base;
+		~ValueStackReset() { size = base; }
+	} reset{m_value_stack_size, base};
 
-		return left.i * right.i;
-	}
-	else if (m_opcodes[m_current_opcode_index].type == OpcodeType::ADD)
+	while (true)
 	{
-		m_current_opcode_index++;
-		Attr left = resolve_expression_to_attr();
-		Attr right = resolve_expression_to_attr();
+		const Opcode& code = m_opcodes[m_current_opcode_index];
 
-		if (left.type != AttributeType::INT || right.type != AttributeType::INT)
+		switch (code.type)
 		{
-			throw VMError("both sides of addition must be integers");
-		}
+		case OpcodeType::R_VALUE:
+		{
+			TYPE_CODE_T type = (code.data & TYPE_CODE_T_MASK);
+			DATA_IX_T data_index = (code.data & DATA_IX_T_MASK) >> 32;
 
-		return left.i + right.i;
-	}
-	else if (m_opcodes[m_current_opcode_index].type == OpcodeType::SUBTRACT)
-	{
-		m_current_opcode_index++;
-		Attr left = resolve_expression_to_attr();
-		Attr right = resolve_expression_to_attr();
+			Attr& value = push_value();
+			switch (type)
+			{
+			case INT_TC:
+				value.type = AttributeType::INT;
+				value.i = m_ints[data_index];
+				break;
+			case STRING_TC:
+				value.type = AttributeType::STRING;
+				value.s = (Symbol) data_index;
+				break;
+			case BOOL_TC:
+				value.type = AttributeType::BOOL;
+				value.b = m_bools[data_index];
+				break;
+			default:
+				throw VMError("Unsupported rvalue type");
+			}
 
-		if (left.type != AttributeType::INT || right.type != AttributeType::INT)
-		{
-			throw VMError("both sides of subtraction must be integers");
+			m_current_opcode_index++;
+			break;
 		}
+		case OpcodeType::R_VALUE_REF:
+		case OpcodeType::R_VALUE_DOT_SEPERATED_REF_CHAIN:
+			if (code.type == OpcodeType::R_VALUE_REF && code.slot != NO_SLOT)
+			{
+				push_value(get_global(code.slot));
+				m_current_opcode_index++;
+			}
+			else
+			{
+				m_expression_names.clear();
+				NameBinding binding = read_name(m_expression_names, code.type);
+				push_value(get_attr_rvalue(m_expression_names, binding));
+			}
+			break;
+		case OpcodeType::ADD:
+		case OpcodeType::SUBTRACT:
+		case OpcodeType::MULTIPLY:
+		case OpcodeType::DIVIDE:
+		case OpcodeType::COMPARE:
+		case OpcodeType::COMPARE_GREATERTHAN:
+		case OpcodeType::COMPARE_LESSTHAN:
+		{
+			if (m_value_stack_size - base < 2)
+			{
+				throw VMError("OPCODE ERROR: Expected two values to operate on");
+			}
+			Attr& left = m_value_stack[m_value_stack_size - 2];
+			const Attr& right = m_value_stack[m_value_stack_size - 1];
 
-		return left.i - right.i;
-	}
-	else if (m_opcodes[m_current_opcode_index].type == OpcodeType::DIVIDE)
-	{
-		m_current_opcode_index++;
-		Attr left = resolve_expression_to_attr();
-		Attr right = resolve_expression_to_attr();
+			if (code.type == OpcodeType::ADD)
+			{
+				left = add_attrs(left, right);
+			}
+			else if (code.type == OpcodeType::SUBTRACT)
+			{
+				left = subtract_attrs(left, right);
+			}
+			else if (code.type == OpcodeType::MULTIPLY)
+			{
+				left = multiply_attrs(left, right);
+			}
+			else if (code.type == OpcodeType::DIVIDE)
+			{
+				left = divide_attrs(left, right);
+			}
+			else
+			{
+				bool result;
+				if (code.type == OpcodeType::COMPARE)
+				{
+					result = compare_attrs(left, right);
+				}
+				else if (code.type == OpcodeType::COMPARE_GREATERTHAN)
+				{
+					result = compare_greatherthan_attrs(left, right);
+				}
+				else
+				{
+					result = compare_lessthan_attrs(left, right);
+				}
+				left.type = AttributeType::BOOL;
+				left.b = result;
+			}
 
-		if (left.type != AttributeType::INT || right.type != AttributeType::INT)
-		{
-			throw VMError("both sides of subtraction must be integers");
+			m_value_stack_size--;
+			m_current_opcode_index++;
+			break;
 		}
+		case OpcodeType::DYNAMIC_IDENTIFIER_RESOLTION_NAMES:
+		{
+			// some expression . . .
+			// DYNAMIC_IDENTIFIER_RESOLTION_NAMES
+			// identifier in names
+			// DYNAMIC_IDENTIFIER_RESOLUTION_END
+			if (m_value_stack_size - base < 1)
+			{
+				throw VMError("OPCODE ERROR: Expected a value to resolve the identifier on");
+			}
+			m_current_opcode_index++;
+			m_expression_names.clear();
+			read_name(m_expression_names, m_opcodes[m_current_opcode_index].type);
+			Attr& value = m_value_stack[m_value_stack_size - 1];
+			value = get_attr_rvalue_from_base_attr(value, m_expression_names);
 
-		return left.i / right.i;
-	}
-	else
-	{
-
-		throw VMError("Unable to resolve direct rvalue in any way other than a number entry, like '5'");
-	}
+			if (m_opcodes[m_current_opcode_index].type != OpcodeType::DYNAMIC_IDENTIFIER_RESOLUTION_END)
+			{
+				throw VMError("OPCODE ERROR: Expected DYNAMIC_IDENTIFIER_RESOLUTION_END");
+			}
+			m_current_opcode_index++;
+			break;
+		}
+		case OpcodeType::CARD_SEQUENCE_START:
+		{
+			DATA_IX_T data_index = (code.data & DATA_IX_T_MASK) >> 32;
+			m_current_opcode_index++;
+			Attr& cardSequenceAttr = push_value();
+			cardSequenceAttr.type = AttributeType::CARD_SEQUENCE;
+			cardSequenceAttr.cardSequence = (int) data_index;
+			CardSequence& sequence = m_card_sequences[data_index];
+			if (sequence.Resolved())
+			{
+				while (m_opcodes[m_current_opcode_index].type != OpcodeType::CARD_SEQUENCE_END)
+				{
+					m_current_opcode_index++;
+				}
+				m_current_opcode_index++;
+				break;
+			}
 
-	return 0;
-}
+			vector<CardMatcher> matchers;
+			while (m_opcodes[m_current_opcode_index].type == OpcodeType::L_VALUE
+			|| m_opcodes[m_current_opcode_index].type == OpcodeType::CARD_SEQUENCE_MATCH_ANYCARD
+			|| m_opcodes[m_current_opcode_index].type == OpcodeType::CARD_SEQUENCE_MATCH_REST )
+			{
+				if (m_opcodes[m_current_opcode_index].type == OpcodeType::CARD_SEQUENCE_MATCH_ANYCARD)
+				{
+					CardMatcher m;
+					m.type = CardMatcherType::ANY;
+					matchers.push_back(m);
+					m_current_opcode_index++;
+				}
+				else if (m_opcodes[m_current_opcode_index].type == OpcodeType::CARD_SEQUENCE_MATCH_REST)
+				{
+					CardMatcher m;
+					m.type = CardMatcherType::REST;
+					matchers.push_back(m);
+					m_current_opcode_index++;
+				}
+				else
+				{
+					m_expression_names.clear();
+					NameBinding binding = read_name(m_expression_names, OpcodeType::L_VALUE);
 
-bool Program::resolve_bool_expression()
-{
-	if (m_opcodes[m_current_opcode_index].type == OpcodeType::R_VALUE)
-	{
-		auto bool_value_opcode = m_opcodes[m_current_opcode_index];
+					if (m_expression_names.empty())
+					{
+						throw VMError("Could not read Card name from sequence");
+					}
+					CardMatcher m;
+					m.type = CardMatcherType::ID;
+					m.id = bound_card(binding);
+					matchers.push_back(m);
+				}
+			}
+			sequence = CardSequence(matchers);
 
-		TYPE_CODE_T type = (bool_value_opcode.data & TYPE_CODE_T_MASK);
+			if (m_opcodes[m_current_opcode_index].type != OpcodeType::CARD_SEQUENCE_END)
+			{
+				throw VMError("Encountered wrong opcode, VM expected CARD_SEQUENCE_END");
+			}
 
-		if (type != BOOL_TC)
-		{
-			throw VMError("Type must be a bool to be a boolean expression");
+			m_current_opcode_index++;
+			break;
+		}
+		case OpcodeType::EXPRESSION_END:
+			if (m_value_stack_size != base + 1)
+			{
+				throw VMError("OPCODE ERROR: Expected an expression to leave one value");
+			}
+			m_current_opcode_index++;
+			return m_value_stack[base];
+		default:
+			throw VMError("Expression -> attr conversion is unsupported for this expression type");
 		}
-
-		DATA_IX_T data_index = (bool_value_opcode.data & (OPCODE_CONV_T(0xFF) << 32)) >> 32;
-
-		m_current_opcode_index++;
-		return m_bools[data_index];
 	}
-	else if (m_opcodes[m_current_opcode_index].type == OpcodeType::R_VALUE_DOT_SEPERATED_REF_CHAIN)
-	{
-		vector<string> names;
-		read_name(names, m_opcodes[m_current_opcode_index].type);
-
-		Attr attr = get_attr_rvalue(names);
-		if (attr.type != AttributeType::BOOL)
-		{
-			throw VMError("Attribute must be a bool to be a boolean expression");
-		}
+}
 
-		return attr.b;
-	}
-	else if (m_opcodes[m_current_opcode_index].type == OpcodeType::COMPARE)
+int Program::resolve_number_expression()
+{
+	const Attr& value = evaluate_expression();
+	if (value.type != AttributeType::INT)
 	{
-		m_current_opcode_index++;
-		auto left = resolve_expression_to_attr();
-		auto right = resolve_expression_to_attr();
-
-		return compare_attrs(left, right);
+		throw VMError("Expected a number here");
 	}
-	else if (m_opcodes[m_current_opcode_index].type == OpcodeType::COMPARE_GREATERTHAN)
-	{
-		m_current_opcode_index++;
-		auto left = resolve_expression_to_attr();
-		auto right = resolve_expression_to_attr();
 
-		return compare_greatherthan_attrs(left, right);
-	}
-	else if (m_opcodes[m_current_opcode_index].type == OpcodeType::COMPARE_LESSTHAN)
-	{
-		m_current_opcode_index++;
-		auto left = resolve_expression_to_attr();
-		auto right = resolve_expression_to_attr();
+	return value.i;
+}
 
-		return compare_lessthan_attrs(left, right);
-	}
-	else
+bool Program::resolve_bool_expression()
+{
+	const Attr& value = evaluate_expression();
+	if (value.type != AttributeType::BOOL)
 	{
 		throw VMError("This is somehow not a boolean expression");
 	}
+
+	return value.b;
 }
 
 bool Program::compare_lessthan_attrs(Attr a, Attr b)
@@ -1969,22 +3282,23 @@ bool Program::compare_attrs(Attr a, Attr b) {
     }
 
     if (a.type == AttributeType::STACK_POSITION_REF) {
-        int stackAID = std::get<0>(a.stackPositionRef);
-        int stackAPos = std::get<1>(a.stackPositionRef);
-        auto stackA = m_game.stacks[stackAID];
-        if (stackA.cards.empty()) {
+        int stackAID = a.stackPositionRef.stack;
+        int stackAPos = a.stackPositionRef.index;
+        const std::deque<CardInstance>& stackA = m_game.stacks[stackAID].Cards();
+        // a position past either end of its stack, EG the top of an empty one, holds no card
+        if (stackAPos < 0 || stackAPos >= (int) stackA.size()) {
             return false;
         }
 
-        auto cardFromA = stackA.cards[stackAPos];
+        const CardInstance& cardFromA = stackA[stackAPos];
 
         if (b.type == AttributeType::STACK_POSITION_REF) {
-            int stackBID = std::get<0>(b.stackPositionRef);
-            int stackBPos = std::get<1>(b.stackPositionRef);
+            int stackBID = b.stackPositionRef.stack;
+            int stackBPos = b.stackPositionRef.index;
 
-            auto stackB = m_game.stacks[stackBID];
+            const std::deque<CardInstance>& stackB = m_game.stacks[stackBID].Cards();
 
-            if (stackB.cards.empty()) {
+            if (stackBPos < 0 || stackBPos >= (int) stackB.size()) {
                 return false;
             }
 
@@ -1992,12 +3306,11 @@ bool Program::compare_attrs(Attr a, Attr b) {
                 return true;
             }
 
-
-            auto cardFromB = stackB.cards[stackBPos];
+            const CardInstance& cardFromB = stackB[stackBPos];
 
             return cardFromA.ID == cardFromB.ID;
         } else if (b.type == AttributeType::CARD_REF) {
-            return m_game.cards[b.cardRef].ID == cardFromA.ID;
+            return b.cardRef == cardFromA.ID;
         } else {
             throw VMError(
                     "Stack Posistion References may only be compared to Cards and other Stack Position References");
@@ -2012,7 +3325,7 @@ bool Program::compare_attrs(Attr a, Attr b) {
 
         if (b.type == AttributeType::CARD_SEQUENCE)
         {
-            return m_game.stacks[a.stackRef].MatchesSequence(b.cardSquence);
+            return m_game.stacks[a.stackRef].MatchesSequence(m_card_sequences[b.cardSequence]);
         }
 
         throw VMError("Stack References may only be compared to card sequences or other stack references");
@@ -2067,10 +3380,9 @@ Attr Program::add_attrs(Attr a, Attr b)
 			throw VMError("you can only subtract integers from Stack Position references");
 		}
 
-		tuple<int, int> newStackPositionRef(std::get<0>(a.stackPositionRef), std::get<1>(a.stackPositionRef) - b.i);
 		Attr r;
 		r.type = AttributeType::STACK_POSITION_REF;
-		r.stackPositionRef = newStackPositionRef;
+		r.stackPositionRef = {a.stackPositionRef.stack, a.stackPositionRef.index - b.i};
 		return r;
 	}
 	else if (a.type == AttributeType::PLAYER_REF) {
@@ -2122,14 +3434,31 @@ Attr Program::divide_attrs(Attr a, Attr b)
 			throw VMError("you can only divide Stack Position references by integers");
 		}
 
-		tuple<int, int> newStackPositionRef(std::get<0>(a.stackPositionRef), std::get<1>(a.stackPositionRef) / b.i);
+		if (b.i == 0)
+		{
+			throw VMError("division by zero");
+		}
+
 		Attr r;
 		r.type = AttributeType::STACK_POSITION_REF;
-		r.stackPositionRef = newStackPositionRef;
+		r.stackPositionRef = {a.stackPositionRef.stack, a.stackPositionRef.index / b.i};
 		return r;
 	}
 	else if (a.type == AttributeType::INT)
 	{
+		if (b.type != AttributeType::INT)
+		{
+			throw VMError("you can only divide integers by integers");
+		}
+		if (b.i == 0)
+		{
+			throw VMError("division by zero");
+		}
+		if (a.i == std::numeric_limits<int>::min() && b.i == -1)
+		{
+			throw VMError("this division overflows");
+		}
+
 		Attr r;
 		r.type = AttributeType::INT;
 		r.i = a.i / b.i;
@@ -2191,11 +3520,10 @@ Attr Program::subtract_attrs(Attr a, Attr b)
 		}
 		break;
 	case AttributeType::STACK_POSITION_REF:
-		//return std::get<0>(a.stackPositionRef) == std::get<0>(b.stackPositionRef) && std::get<1>(a.stackPositionRef) == std::get<1>(b.stackPositionRef);
 		r.type = AttributeType::STACK_POSITION_REF;
 		if (b.type == AttributeType::INT)
 		{
-			r.stackPositionRef = std::tuple<int, int>(std::get<0>(a.stackPositionRef), std::get<1>(a.stackPositionRef) - b.i);
+			r.stackPositionRef = {a.stackPositionRef.stack, a.stackPositionRef.index - b.i};
 		}
 		else
 		{
@@ -2211,165 +3539,10 @@ Attr Program::subtract_attrs(Attr a, Attr b)
 
 Attr Program::resolve_expression_to_attr()
 {
-	if (m_opcodes[m_current_opcode_index].type == OpcodeType::R_VALUE)
-	{
-		auto value_opcode = m_opcodes[m_current_opcode_index];
-
-		TYPE_CODE_T type = (value_opcode.data & TYPE_CODE_T_MASK);
-		DATA_IX_T data_index = (value_opcode.data & (OPCODE_CONV_T(0xFF) << 32)) >> 32;
-
-		Attr a;
-		switch (type)
-		{
-		case INT_TC:
-			a.type = AttributeType::INT;
-			a.i = m_ints[data_index];
-			break;
-		case STRING_TC:
-			a.type = AttributeType::STRING;
-			a.s = m_strings[data_index];
-			break;
-		case BOOL_TC:
-			a.type = AttributeType::BOOL;
-			a.b = m_bools[data_index];
-			break;
-		default:
-			throw VMError("Unsupported rvalue type");
-		}
-
-		m_current_opcode_index++;
-		return a;
-	}
-	else if (m_opcodes[m_current_opcode_index].type == OpcodeType::R_VALUE_DOT_SEPERATED_REF_CHAIN || m_opcodes[m_current_opcode_index].type == OpcodeType::R_VALUE_REF)
-	{
-		vector<string> names;
-		read_name(names, m_opcodes[m_current_opcode_index].type);
-
-		Attr attr = get_attr_rvalue(names);
-		return attr;
-	}
-	else if (m_opcodes[m_current_opcode_index].type == OpcodeType::COMPARE)
-	{
-		bool res = resolve_bool_expression();
-
-		Attr a;
-		a.type = AttributeType::BOOL;
-		a.b = res;
-
-		return a;
-	}
-	else if (m_opcodes[m_current_opcode_index].type == OpcodeType::SUBTRACT)
-	{
-		m_current_opcode_index++;
-		Attr left = resolve_expression_to_attr();
-		Attr right = resolve_expression_to_attr();
-
-		return subtract_attrs(left, right);
-	}
-	else if (m_opcodes[m_current_opcode_index].type == OpcodeType::ADD)
-	{
-		m_current_opcode_index++;
-		Attr left = resolve_expression_to_attr();
-		Attr right = resolve_expression_to_attr();
-
-		return add_attrs(left, right);
-	}
-	else if (m_opcodes[m_current_opcode_index].type == OpcodeType::DIVIDE)
-	{
-		m_current_opcode_index++;
-		Attr left = resolve_expression_to_attr();
-		Attr right = resolve_expression_to_attr();
-
-		return divide_attrs(left, right);
-	}
-	else if (m_opcodes[m_current_opcode_index].type == OpcodeType::MULTIPLY)
-	{
-		m_current_opcode_index++;
-		Attr left = resolve_expression_to_attr();
-		Attr right = resolve_expression_to_attr();
-
-		return multiply_attrs(left, right);
-	}
-	else if (m_opcodes[m_current_opcode_index].type == OpcodeType::DYNAMIC_IDENTIFIER_RESOLUTION_START)
-	{
-		// DYNAMIC_IDENTIFIER_RESOLUTION_START
-		// some expression . . .
-		// DYNAMIC_IDENTIFIER_RESOLTION_NAMES
-		// identifier in names
-		// DYNAMIC_IDENTIFIER_RESOLUTION_END
-		m_current_opcode_index++;
-		Attr r = resolve_expression_to_attr();
-		vector<string> names;
-		if (m_opcodes[m_current_opcode_index].type != OpcodeType::DYNAMIC_IDENTIFIER_RESOLTION_NAMES)
-		{
-			throw VMError("OPCODE ERROR: Expected DYNAMIC_IDENTIFIER_RESOLUTION_NAMES");
-		}
-		m_current_opcode_index ++;
-		read_name(names, m_opcodes[m_current_opcode_index].type);
-		Attr dynamicallyResolvedAttribute = get_attr_rvalue_from_base_attr(r, names);
-		m_current_opcode_index ++;
-
-		return dynamicallyResolvedAttribute;
-
-	}
-    else if (m_opcodes[m_current_opcode_index].type == OpcodeType::CARD_SEQUENCE_START)
-    {
-        m_current_opcode_index++;
-        Attr cardSequenceAttr;
-        cardSequenceAttr.type = AttributeType::CARD_SEQUENCE;
-
-        while (m_opcodes[m_current_opcode_index].type == OpcodeType::L_VALUE
-        || m_opcodes[m_current_opcode_index].type == OpcodeType::CARD_SEQUENCE_MATCH_ANYCARD
-        || m_opcodes[m_current_opcode_index].type == OpcodeType::CARD_SEQUENCE_MATCH_REST )
-        {
-            if (m_opcodes[m_current_opcode_index].type == OpcodeType::CARD_SEQUENCE_MATCH_ANYCARD)
-            {
-                CardMatcher m;
-                m.type = CardMatcherType::ANY;
-                cardSequenceAttr.cardSquence.push_back(m);
-                m_current_opcode_index++;
-            }
-            else if (m_opcodes[m_current_opcode_index].type == OpcodeType::CARD_SEQUENCE_MATCH_REST)
-            {
-                CardMatcher m;
-                m.type = CardMatcherType::REST;
-                cardSequenceAttr.cardSquence.push_back(m);
-                m_current_opcode_index++;
-            }
-            else
-            {
-                vector<std::string> name;
-                read_name(name, OpcodeType::L_VALUE);
-
-                if (name.empty())
-                {
-                    VMError("Could not read Card name from sequence");
-                }
-                Card c = m_game.cards[name[0]];
-                CardMatcher m;
-                m.type = CardMatcherType::ID;
-                m.id = c.ID;
-                cardSequenceAttr.cardSquence.push_back(m);
-            }
-
-        }
-
-        if (m_opcodes[m_current_opcode_index].type != OpcodeType::CARD_SEQUENCE_END)
-        {
-            throw VMError("Encountered wrong opcode, VM expected CARD_SEQUENCE_END");
-        }
-
-        m_current_opcode_index++;
-
-        return cardSequenceAttr;
-    }
-	else
-	{
-		throw VMError("Expression -> attr conversion is unsupported for this expression type");
-	}
+	return evaluate_expression();
 }
 
-string Program::resolve_string_expression()
+Symbol Program::resolve_string_expression()
 {
 	throw VMError("Cannot yet resolve string expressions");
 }
@@ -2417,41 +3590,50 @@ AttributeType Program::s_type_code_to_attribute_type(TYPE_CODE_T t)
 	}
 }
 
-AttrCont* Program::GetGlobalObjectAttrContPtr(AttrCont& cont, string name) {
+AttrCont* Program::GetGlobalObjectAttrContPtr(AttrCont& cont, Symbol name) {
 	if (!cont.Contains(name)) {
 		throw VMError("this attribute does not exist ");
 	}
 
-	if (cont.Get(name).type == AttributeType::CARD_REF) {
-		return &m_game.cards[cont.Get(name).cardRef].attributes;
+	return GetObjectAttrContPtr(cont.Get(name));
+}
+
+AttrCont* Program::GetObjectAttrContPtr(const Attr& object) {
+	if (object.type == AttributeType::CARD_REF) {
+		return &m_game.cards[object.cardRef].attributes;
 	}
 
-	if (cont.Get(name).type == AttributeType::PLAYER_REF) {
-		return &m_game.players[cont.Get(name).playerRef].attributes;
+	if (object.type == AttributeType::PLAYER_REF) {
+		return &m_game.players[object.playerRef].attributes;
 	}
 
-	if (cont.Get(name).type == AttributeType::PHASE_REF) {
-		return &m_game.phases[cont.Get(name).phaseRef].attributes;
+	if (object.type == AttributeType::PHASE_REF) {
+		return &m_game.phases[object.phaseRef].attributes;
 	}
 
-	if (cont.Get(name).type == AttributeType::STACK_REF) {
-		return &m_game.stacks[cont.Get(name).stackRef].attributes;
+	if (object.type == AttributeType::STACK_REF) {
+		return &m_game.stacks[object.stackRef].attributes;
 	}
 
 	throw VMError("this type cannot have attributes ");
 }
 
 
-AttrCont* Program::GetObjectAttrContPtrFromIdentifier(vector<string>::iterator namesBegin, vector<string>::iterator namesEnd) {
+AttrCont* Program::GetObjectAttrContPtrFromIdentifier(vector<Symbol>::iterator namesBegin, vector<Symbol>::iterator namesEnd, NameBinding binding) {
 	assert(namesBegin!= namesEnd);
 
 	auto namesItr = namesBegin;
 
-	string firstName = *namesItr;
+	Symbol firstName = *namesItr;
 
 	AttrCont* current;
 	bool found = false;
 
+	if (binding.slot != NO_SLOT) {
+		current = GetObjectAttrContPtr(get_global(binding.slot));
+		found = true;
+	}
+
 	for (int i = m_locale_stack.size() - 1; !found && i >= 0; i--) {
 		if (m_locale_stack[i].Contains(firstName)) {
 			current = GetGlobalObjectAttrContPtr(m_locale_stack[i], *namesBegin);
@@ -2471,7 +3653,7 @@ AttrCont* Program::GetObjectAttrContPtrFromIdentifier(vector<string>::iterator n
 			current = GetGlobalObjectAttrContPtr(*current, *namesItr);
 		}
 		else {
-			throw VMError(*namesItr + " not found in " + firstName);
+			throw VMError(m_game.symbols.Name(*namesItr) + " not found in " + m_game.symbols.Name(firstName));
 		}
 
 		++namesItr;
@@ -2480,356 +3662,216 @@ AttrCont* Program::GetObjectAttrContPtrFromIdentifier(vector<string>::iterator n
 	return current;
 }
 
-Attr Program::get_attr_rvalue_from_base_attr(Attr base, vector<string>& names)
+Attr Program::get_attr_rvalue_from_base_attr(Attr base, vector<Symbol>& names)
 {
 	assert(names.size() > 0);
 
-	bool shallowName = names.size() == 1;
-
-	AttrCont baseAttrCont;
-
-	if (base.type == AttributeType::CARD_REF)
-	{
-		Card c = m_game.cards[base.cardRef];
-		baseAttrCont = c.attributes;
-	}
-	else if (base.type == AttributeType::STACK_POSITION_REF)
-	{
-		Card c = m_game.stacks[std::get<0>(base.stackPositionRef)].cards[std::get<1>(base.stackPositionRef)];
-		baseAttrCont = c.attributes;
-	}
-	else if (base.type == AttributeType::PLAYER_REF)
-	{
-		baseAttrCont = m_game.players[base.playerRef].attributes;
-	}
-	else if (base.type == AttributeType::STACK_REF)
-	{
-		baseAttrCont = m_game.stacks.at(base.stackRef).attributes;
-	}
-	else
-	{
-		std::stringstream ss;
-		ss << "cannot lookup '";
-		for (auto n : names)
-		{
-			ss << "." << n;
-		}
-		ss <<"' on this attribute";
-
-
-		throw VMError(ss.str());
-	}
-
-	Attr nextAttribute = baseAttrCont.Get(names[0]);
-
-	if (shallowName)
-	{
-		return nextAttribute;
-	}
-
-	std::vector restOfNames(names.begin()+1, names.end());
-	return get_attr_rvalue_from_base_attr(nextAttribute, restOfNames);
+	Attr computed;
+	Attr* attr = walk_attr_path(base, names.begin(), names.end(), computed, false);
 
+	return attr == nullptr ? Attr() : *attr;
 }
 
-Attr Program::get_attr_rvalue(vector<string>& names)
+Attr Program::get_attr_rvalue(vector<Symbol>& names, NameBinding binding)
 {
 	assert(names.size() > 0);
 
-	bool shallowName = names.size() == 1;
-
-	Attr currentAttr;
-	bool found = false;
-
-	auto nameItr = names.begin();
-
-
-	if (shallowName && m_game.cards.find(*nameItr) != m_game.cards.end())
+	int card = bound_card(binding);
+	if (names.size() == 1 && card != NO_CARD)
 	{
 		Attr tmp;
 		tmp.type = AttributeType::CARD_REF;
-		tmp.cardRef = *nameItr;
+		tmp.cardRef = card;
 		return tmp;
 	}
-	
-
-	for (auto& locale : m_locale_stack)
-	{
-		if (locale.Contains(*nameItr))
-		{
-			if (shallowName)
-			{
-				return locale.Get(*nameItr);
-			}
 
-			found = true;
-			currentAttr = locale.Get(*nameItr);
-		}
-	}
+	Attr computed;
+	return *get_attr_path(names, binding, computed, false);
+}
 
-	if (shallowName && !found)
-	{
-		throw VMError("variable does not exist");
-	}
+Attr* Program::get_attr_ptr(vector<Symbol>& names, NameBinding binding)
+{
+	assert(names.size() > 0);
 
-	if (!found && m_game.cards.find(*nameItr) != m_game.cards.end())
+	if (names.size() == 1 && bound_card(binding) != NO_CARD)
 	{
-		found = true;
-		currentAttr.type = AttributeType::CARD_REF;
-		currentAttr.cardRef = *nameItr;
+		throw VMError("Cannot create an lvalue reference to a card type");
 	}
 
-	if (!found)
+	Attr computed;
+	Attr* attr = get_attr_path(names, binding, computed, true);
+	if (attr == &computed)
 	{
-		throw VMError("variable does not exist");
+		throw VMError("Cannot create lvalue reference from stack position pointer");
 	}
 
-	nameItr++;
-
-	while (nameItr != names.end())
-	{
-		if (currentAttr.type == AttributeType::CARD_REF)
-		{
-			if (m_game.cards[currentAttr.cardRef].attributes.Contains(*nameItr))
-			{
-				if (nameItr == names.end() - 1)
-				{
-					return m_game.cards[currentAttr.cardRef].attributes.Get(*nameItr);
-				}
-
-				currentAttr = m_game.cards[currentAttr.cardRef].attributes.Get(*nameItr);
-			}
-			else
-			{
-				throw VMError("This card does not contain attribute");
-			}
-		}
-		else if (currentAttr.type == AttributeType::STACK_REF)
-		{
-
-			if (*nameItr == "top" || *nameItr == "bottom") {
-				Attr tmp;
-				tmp.type = AttributeType::STACK_POSITION_REF;
-
-				if (*nameItr == "top")
-				{
-					int topIndex = m_game.stacks[currentAttr.stackRef].cards.size() - 1;
-					tmp.stackPositionRef = std::tuple< int, int>(currentAttr.stackRef, topIndex);
-				}
-				else
-				{
-					int bottomIndex = 0;
-					tmp.stackPositionRef = std::tuple< int, int>(currentAttr.stackRef, bottomIndex);
-				}
-
-				if (nameItr == names.end() - 1)
-				{
-					return tmp;
-				}
-
-				int stackID = std::get<0>(tmp.stackPositionRef);
-				int cardIdx = std::get<1>(tmp.stackPositionRef);
-				Card c = m_game.stacks[stackID].cards[cardIdx];
-				Attr cardRef;
-				cardRef.cardRef = c.name;
-				cardRef.type = AttributeType::CARD_REF;
-				currentAttr = cardRef;
-			}
-			else if (*nameItr == "size")
-			{
-				Attr tmp;
-				tmp.type = AttributeType::INT;
-
-				tmp.i = m_game.stacks[currentAttr.stackRef].cards.size();
-
-				return tmp;
-			}
-			else if (m_game.stacks[currentAttr.stackRef].attributes.Contains(*nameItr))
-			{
-				if (nameItr == names.end() - 1)
-				{
-					return m_game.stacks[currentAttr.stackRef].attributes.Get(*nameItr);
-				}
-
-				currentAttr = m_game.stacks[currentAttr.stackRef].attributes.Get(*nameItr);
-			}
-			else
-			{
-				cout << "This stack does not contain attribute " << *nameItr << endl;
-				throw VMError("This stack does not contain attribute");
-			}
-		}
-		else if (currentAttr.type == AttributeType::PLAYER_REF)
-		{
-			if (m_game.players[currentAttr.playerRef].attributes.Contains(*nameItr))
-			{
-				if (nameItr == names.end() - 1)
-				{
-					return m_game.players[currentAttr.playerRef].attributes.Get(*nameItr);
-				}
-
-				currentAttr = m_game.players[currentAttr.playerRef].attributes.Get(*nameItr);
-			}
-			else
-			{
-				throw VMError("This player does not contain attribute");
-			}
-		}
-
-		nameItr++;
-	}
+	return attr;
 }
 
-Attr* Program::get_attr_ptr(vector<string>& names)
+Attr* Program::get_attr_path(vector<Symbol>& names, NameBinding binding, Attr& computed, bool lvalue)
 {
-
-	assert(names.size() > 0);
-
 	bool shallowName = names.size() == 1;
 
-	Attr currentAttr;
-	bool found = false;
-
-	auto nameItr = names.begin();
-
+	Attr* base = nullptr;
 
-	if (shallowName && m_game.cards.find(*nameItr) != m_game.cards.end())
+	if (binding.slot != NO_SLOT)
 	{
-		throw VMError("Cannot create an lvalue reference to a card type");
+		base = &get_global(binding.slot);
 	}
 
-	for (auto& locale : m_locale_stack)
+	// a shallow name is the outermost frame's, the start of a dot chain the innermost frame's
+	for (int i = 0; binding.slot == NO_SLOT && i < m_locale_stack.size(); i++)
 	{
-		if (locale.Contains(*nameItr))
+		Attr* attr = m_locale_stack[i].Find(names[0]);
+		if (attr != nullptr)
 		{
+			base = attr;
 			if (shallowName)
 			{
-				return &locale.Get(*nameItr);
+				break;
 			}
-			
-			found = true;
-			currentAttr = locale.Get(*nameItr);
 		}
 	}
 
-	if (shallowName && !found)
+	if (base == nullptr && !shallowName && bound_card(binding) != NO_CARD)
+	{
+		computed.type = AttributeType::CARD_REF;
+		computed.cardRef = binding.card;
+		base = &computed;
+	}
+
+	if (base == nullptr)
 	{
 		throw VMError("variable does not exist");
 	}
 
-	if (!found && m_game.cards.find(*nameItr) != m_game.cards.end())
+	if (shallowName)
 	{
-		found = true;
-		currentAttr.type = AttributeType::CARD_REF;
-		currentAttr.cardRef = *nameItr;
+		return base;
 	}
 
-	if (!found)
+	Attr* attr = walk_attr_path(*base, names.begin() + 1, names.end(), computed, lvalue);
+	if (attr == nullptr)
 	{
-		throw VMError("variable does not exist");
+		throw VMError(m_game.symbols.Name(names.back()) + " does not exist");
 	}
 
-	nameItr++;
+	return attr;
+}
+
+Attr* Program::walk_attr_path(Attr current, vector<Symbol>::const_iterator name, vector<Symbol>::const_iterator end, Attr& computed, bool lvalue)
+{
+	assert(name != end);
 
-	while (nameItr != names.end())
+	while (true)
 	{
-		if (currentAttr.type == AttributeType::CARD_REF)
-		{
-			if (m_game.cards[currentAttr.cardRef].attributes.Contains(*nameItr))
-			{
-				if (nameItr == names.end()-1)
-				{
-					return &m_game.cards[currentAttr.cardRef].attributes.Get(*nameItr);
-				}
+		bool last = name + 1 == end;
+		AttrCont* cont = nullptr;
+		Attr* attr = nullptr;
 
-				currentAttr = m_game.cards[currentAttr.cardRef].attributes.Get(*nameItr);
-			}
-			else
+		if (current.type == AttributeType::CARD_REF)
+		{
+			cont = &m_game.cards[current.cardRef].attributes;
+		}
+		else if (current.type == AttributeType::STACK_POSITION_REF)
+		{
+			Stack& stack = m_game.stacks[current.stackPositionRef.stack];
+			int index = current.stackPositionRef.index;
+			if (index < 0 || index >= stack.Size())
 			{
-				throw VMError("This card does not contain attribute");
+				throw VMError("there is no card at this stack position");
 			}
+			// only the container that's written to needs a copy of its card's attributes
+			cont = lvalue && last ? &m_game.WritableAttributes(stack, index) : &m_game.Attributes(stack.Cards()[index]);
+		}
+		else if (current.type == AttributeType::PLAYER_REF)
+		{
+			cont = &m_game.players[current.playerRef].attributes;
 		}
-		else if (currentAttr.type == AttributeType::STACK_REF)
+		else if (current.type == AttributeType::STACK_REF)
 		{
+			Stack& stack = m_game.stacks[current.stackRef];
 
-			if (*nameItr == "top" || *nameItr == "bottom")
+			// positions and sizes aren't stored in the stack, so they're computed into the caller's Attr
+			if (*name == TOP_SYMBOL || *name == BOTTOM_SYMBOL)
 			{
-				throw VMError("Cannot create lvalue reference from stack position pointer");
+				computed.type = AttributeType::STACK_POSITION_REF;
+				computed.stackPositionRef = {current.stackRef, *name == TOP_SYMBOL ? stack.Size() - 1 : 0};
+				attr = &computed;
 			}
-
-			if (m_game.stacks[currentAttr.stackRef].attributes.Contains(*nameItr))
+			else if (*name == SIZE_SYMBOL)
 			{
-				if (nameItr == names.end() - 1)
-				{
-					return &m_game.stacks[currentAttr.stackRef].attributes.Get(*nameItr);
-				}
-
-				currentAttr = m_game.stacks[currentAttr.stackRef].attributes.Get(*nameItr);
+				computed.type = AttributeType::INT;
+				computed.i = stack.Size();
+				attr = &computed;
 			}
 			else
 			{
-				cout << "This stack does not contain attribute " << *nameItr << endl;
-				throw VMError("This stack does not contain attribute");
+				cont = &stack.attributes;
 			}
 		}
-		else if (currentAttr.type == AttributeType::PLAYER_REF)
+		else
 		{
-			if (m_game.players[currentAttr.playerRef].attributes.Contains(*nameItr))
-			{
-				if (nameItr == names.end() - 1)
-				{
-					return &m_game.players[currentAttr.playerRef].attributes.Get(*nameItr);
-				}
+			throw VMError("cannot look up '" + m_game.symbols.Name(*name) + "' on this attribute");
+		}
 
-				currentAttr = m_game.players[currentAttr.playerRef].attributes.Get(*nameItr);
-			}
-			else
-			{
-				throw VMError("This player does not contain attribute");
-			}
+		if (cont != nullptr)
+		{
+			attr = cont->Find(*name);
+		}
+
+		if (last)
+		{
+			return attr;
+		}
+
+		if (attr == nullptr)
+		{
+			throw VMError(m_game.symbols.Name(*name) + " does not exist");
 		}
 
-		nameItr++;
+		current = *attr;
+		++name;
 	}
 }
 
-string Program::get_card_parent_name(string nameSequence)
+Symbol Program::get_card_parent_name(const string& nameSequence)
 {
 
 	auto delimPos = nameSequence.find(":");
 
 	if (delimPos != string::npos)
 	{
-		return nameSequence.substr(delimPos + 1);
+		return m_game.symbols.Intern(nameSequence.substr(delimPos + 1));
 	}
 	
-	return "";
+	return NO_SYMBOL;
 }
 
-string Program::get_card_name(string nameSequence)
+Symbol Program::get_card_name(const string& nameSequence)
 {
 	auto delimPos = nameSequence.find(":");
 
 	if (delimPos != string::npos)
 	{
-		return nameSequence.substr(0, delimPos);
+		return m_game.symbols.Intern(nameSequence.substr(0, delimPos));
 	}
 
-	return nameSequence;
+	return m_game.symbols.Intern(nameSequence);
 }
 
-Stack* Program::get_stack_ptr(vector<string>& stack_identifier)
+Stack* Program::get_stack_ptr(vector<Symbol>& stack_identifier, NameBinding binding)
 {
 	assert(stack_identifier.size() != 0);
 
 	Stack* src = nullptr;
 
-	Attr* stackAttr = get_attr_ptr(stack_identifier);
+	Attr* stackAttr = get_attr_ptr(stack_identifier, binding);
 	assert(stackAttr->type == AttributeType::STACK_REF);
 	auto stackId = stackAttr->stackRef;
-	if (m_game.stacks.find(stackId) == m_game.stacks.end())
+	if (stackId < 0 || stackId >= (int) m_game.stacks.size())
 	{
-		throw VMError("could not find stack with name: " + stack_identifier.back());
+		throw VMError("could not find stack with name: " + m_game.symbols.Name(stack_identifier.back()));
 	}
 	src = &m_game.stacks[stackId];
 
@@ -2859,7 +3901,7 @@ void Program::call_stack_move_callback(int from, int to, bool fromTop, bool toTo
 /*
  Returns false if no more cards are required
  */
-bool Program::AddCardToWaitingInput(Card c)
+bool Program::AddCardToWaitingInput(CardInstance c)
 {
     if (!m_waitingForUserInteraction)
     {
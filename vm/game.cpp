@@ -1,40 +1,107 @@
 #include <algorithm>
+#include <mutex>
 #include "game.h"
 
 #include "../Compiler.h"
 
 namespace Battler {
 
+    SymbolTable::SymbolTable() {
+        for (auto name : {"ownerID", "currentPlayer", "from", "to", "p", "__INDEX_STORE", "top", "bottom", "size"}) {
+            Intern(name);
+        }
+    }
+
+    // names are short enough that the lookup key usually fits in a string's inline buffer
+    Symbol SymbolTable::Intern(std::string_view name) {
+        auto symbol = symbols.find(std::string(name));
+        if (symbol != symbols.end()) {
+            return symbol->second;
+        }
+
+        Symbol newSymbol = (Symbol) names.size();
+        names.emplace_back(name);
+        symbols.emplace(names.back(), newSymbol);
+        return newSymbol;
+    }
+
+    Symbol SymbolTable::Find(std::string_view name) const {
+        auto symbol = symbols.find(std::string(name));
+        if (symbol == symbols.end()) {
+            return NO_SYMBOL;
+        }
+        return symbol->second;
+    }
+
     Stack::Stack() {
         Attr ownerIDAttr = Attr();
         ownerIDAttr.type = AttributeType::PLAYER_REF;
         ownerIDAttr.playerRef = -1;
-        this->attributes.Store("ownerID", ownerIDAttr);
+        this->attributes.Store(OWNER_ID_SYMBOL, ownerIDAttr);
     }
 
-    Card Game::GenerateCard(string name) {
-        Card c = cards[name];
-        c.UUID = m_currentCardUUID;
+    CardInstance Game::GenerateCard(int cardID) {
+        CardInstance c(m_currentCardUUID, cardID);
 
         m_currentCardUUID += 1;
 
         return c;
     }
 
-    vector<Card> Game::get_cards_of_type(string type) {
-        vector<Card> matching_cards;
+    void Game::IndexCardClasses() {
+        vector<bool> hasChildren(cards.size(), false);
+        for (auto& card: cards) {
+            if (card.parentID != -1) {
+                hasChildren[card.parentID] = true;
+            }
+        }
 
-        for (auto card_entry: cards) {
-            Card card = card_entry.second;
-            if (card.parentName == type) {
-                matching_cards.push_back(card);
+        cardClasses.assign(cards.size(), vector<int>());
+        for (auto& card: cards) {
+            if (hasChildren[card.ID]) {
+                continue;
+            }
+            cardClasses[card.ID].push_back(card.ID);
+            // parents are declared before their children, so this always ends at a root card
+            for (int ancestor = card.parentID; ancestor != -1; ancestor = cards[ancestor].parentID) {
+                cardClasses[ancestor].push_back(card.ID);
             }
         }
+    }
+
+    const vector<int>& Game::CardsOfClass(int cardID) {
+        // cards declared after loading finished invalidate the index
+        if (cardClasses.size() != cards.size()) {
+            IndexCardClasses();
+        }
+        return cardClasses[cardID];
+    }
+
+    int Game::FindCard(Symbol name) const {
+        auto card = cardIDs.find(name);
+        if (card == cardIDs.end()) {
+            return -1;
+        }
+        return card->second;
+    }
+
+    AttrCont& Game::Attributes(const CardInstance& instance) {
+        if (instance.overrides) {
+            return *instance.overrides;
+        }
+        return CardOf(instance).attributes;
+    }
 
-        return matching_cards;
+    AttrCont& Game::WritableAttributes(CardInstance& instance) {
+        if (!instance.overrides) {
+            instance.overrides = std::make_shared<AttrCont>(CardOf(instance).attributes);
+        } else if (instance.overrides.use_count() > 1) {
+            instance.overrides = std::make_shared<AttrCont>(*instance.overrides);
+        }
+        return *instance.overrides;
     }
 
-    std::string Attr::ToString() {
+    std::string Attr::ToString(const Game& game) const {
         std::stringstream ss;
 
         if (type == AttributeType::BOOL) {
@@ -44,40 +111,92 @@ namespace Battler {
         } else if (type == AttributeType::FLOAT) {
             ss << f;
         } else if (type == AttributeType::STRING) {
-            ss << s;
+            ss << game.symbols.Name(s);
+        } else if (type == AttributeType::PHASE_REF) {
+            ss << game.symbols.Name(phaseRef);
         }
         if (type == AttributeType::CARD_REF) {
-            ss << cardRef;
+            // cards are referred to by ID, but were declared by name
+            if (cardRef >= 0 && cardRef < (int) game.cards.size()) {
+                ss << game.symbols.Name(game.cards[cardRef].name);
+            } else {
+                ss << cardRef;
+            }
         } else if (type == AttributeType::PLAYER_REF) {
             ss << playerRef;
         } else if (type == AttributeType::STACK_REF) {
             ss << stackRef;
         } else if (type == AttributeType::STACK_POSITION_REF) {
-            ss << std::get<0>(stackPositionRef) << " " << std::get<1>(stackPositionRef);
+            ss << stackPositionRef.stack << " " << stackPositionRef.index;
         }
 
         return ss.str();
     }
 
-    bool AttrCont::Contains(std::string name) {
-        if (attrs.find(name) == attrs.end()) {
-            return false;
+    const Shape* Shape::Empty() {
+        static const Shape empty;
+        return &empty;
+    }
+
+    int Shape::Find(Symbol name) const {
+        if (names.size() <= LINEAR_SEARCH_LIMIT) {
+            for (size_t slot = 0; slot < names.size(); slot++) {
+                if (names[slot] == name) {
+                    return (int) slot;
+                }
+            }
+            return -1;
         }
-        return true;
+
+        auto slot = index.find(name);
+        if (slot == index.end()) {
+            return -1;
+        }
+        return slot->second;
+    }
+
+    const Shape* Shape::With(Symbol name) const {
+        // shapes are shared between programs, and a new transition is only made when a program
+        // declares an attribute no container with this shape had yet
+        static std::mutex transitionsMutex;
+        std::lock_guard<std::mutex> lock(transitionsMutex);
+
+        auto transition = transitions.find(name);
+        if (transition != transitions.end()) {
+            return transition->second.get();
+        }
+
+        Shape* next = new Shape();
+        next->names = names;
+        next->names.push_back(name);
+        if (next->names.size() > LINEAR_SEARCH_LIMIT) {
+            for (size_t slot = 0; slot < next->names.size(); slot++) {
+                next->index[next->names[slot]] = (int) slot;
+            }
+        }
+        transitions[name].reset(next);
+        return next;
     }
 
-    void AttrCont::Store(std::string name, Attr a) {
-        attrs[name] = a;
+    void AttrCont::Store(Symbol name, Attr a) {
+        Get(name) = a;
     }
 
-    Attr &AttrCont::Get(std::string name) {
-        return attrs[name];
+    Attr &AttrCont::Get(Symbol name) {
+        int slot = shape->Find(name);
+        if (slot != -1) {
+            return values[slot];
+        }
+
+        shape = shape->With(name);
+        values.push_back(Attr());
+        return values.back();
     }
 
-    std::string AttrCont::ToString(std::string prefix /* = "" */) {
+    std::string AttrCont::ToString(const Game& game, std::string prefix /* = "" */) const {
         std::stringstream ss;
-        for (auto pair: attrs) {
-            ss << endl << prefix << pair.first << ": " << pair.second.ToString();
+        for (size_t slot = 0; slot < values.size(); slot++) {
+            ss << endl << prefix << game.symbols.Name(shape->Names()[slot]) << ": " << values[slot].ToString(game);
         }
 
         return ss.str();
@@ -86,112 +205,217 @@ namespace Battler {
     void Game::Print() {
         cout << "Cards:" << endl;
 
-        for (auto pair: cards) {
-            cout << pair.first << ":" << pair.second.attributes.ToString("    ") << endl;
+        for (auto& card: cards) {
+            cout << symbols.Name(card.name) << ":" << card.attributes.ToString(*this, "    ") << endl;
         }
 
         cout << "Stacks:" << endl;
 
-        for (auto pair: stacks) {
-            cout << pair.first << ":" << pair.second.attributes.ToString("    ") << endl;
+        for (auto& stack: stacks) {
+            cout << stack.ID << ":" << stack.attributes.ToString(*this, "    ") << endl;
         }
 
         cout << "Players:" << endl;
 
         for (int i = 0; i < players.size(); i++) {
-            cout << i << ":" << players[i].attributes.ToString("    ") << endl;
+            cout << i << ":" << players[i].attributes.ToString(*this, "    ") << endl;
         }
 
         cout << "Game Attributes:" << endl;
 
-        cout << attributeCont.ToString("    ") << endl;
+        cout << attributeCont.ToString(*this, "    ") << endl;
     }
 
-    bool Stack::MatchesSequence(std::vector<CardMatcher> sequence, bool searchBottomUp/*=false*/) {
+    int Stack::PositionOf(int UUID) const {
+        Compact();
+        if (!indexed) {
+            Reindex();
+        }
+        auto key = keys.find(UUID);
+        if (key == keys.end()) {
+            return -1;
+        }
+        return key->second - bottomKey;
+    }
 
-        if (cards.empty() && sequence.empty())
-        {
-            return true;
+    void Stack::Insert(bool top, const std::vector<CardInstance>& newCards) {
+        int firstKey;
+        if (top) {
+            firstKey = bottomKey + (int) cards.size();
+            cards.insert(cards.end(), newCards.begin(), newCards.end());
+        } else {
+            bottomKey -= (int) newCards.size();
+            firstKey = bottomKey;
+            cards.insert(cards.begin(), newCards.begin(), newCards.end());
         }
 
-        // In the sequence [A B C D], A compares to the top of the stack, and D the bottom.
-        // stacks are arranged so the top of the stack is the end of the vector, so we must reverse the
-        // stack before we compare. a searchBottomUp == true here means that we want to compare [D C B A] to the stack
-        // (D being compared to the top card, and A being compared to the bottom card), so we would not reverse the stack
-        // in that case
-        std::vector<Card> cardsToTestAgainst = cards;
-        if (!searchBottomUp) {
-            std::reverse(cardsToTestAgainst.begin(), cardsToTestAgainst.end());
+        if (indexed) {
+            for (auto& card : newCards) {
+                keys[card.UUID] = firstKey++;
+            }
         }
+    }
 
-        auto currentCard = cardsToTestAgainst.begin();
-        auto cardsEnd = cardsToTestAgainst.end();
+    void Stack::EraseTop(int n) {
+        if (tombstones == 0 && !indexed) {
+            cards.erase(cards.end() - n, cards.end());
+            return;
+        }
 
-        auto currentMatcher = sequence.begin();
-        auto matchersEnd = sequence.end();
+        while (n > 0 && !cards.empty()) {
+            if (cards.back().UUID == -1) {
+                tombstones--;
+            } else {
+                keys.erase(cards.back().UUID);
+                n--;
+            }
+            cards.pop_back();
+        }
+        while (!cards.empty() && cards.back().UUID == -1) {
+            tombstones--;
+            cards.pop_back();
+        }
+    }
 
-        while (currentMatcher != matchersEnd)
-        {
-            if (currentMatcher->type == CardMatcherType::ANY)
-            {
-                if (currentCard == cardsEnd)
-                {
-                    return false;
-                }
+    void Stack::EraseBottom(int n) {
+        if (tombstones == 0 && !indexed) {
+            cards.erase(cards.begin(), cards.begin() + n);
+            bottomKey += n;
+            return;
+        }
+
+        while (n > 0 && !cards.empty()) {
+            if (cards.front().UUID == -1) {
+                tombstones--;
+            } else {
+                keys.erase(cards.front().UUID);
+                n--;
             }
-            else if (currentMatcher->type == CardMatcherType::ID)
-            {
-                if (currentCard == cardsEnd)
-                {
-                    return false;
-                }
-                if (currentCard->ID != currentMatcher->id)
-                {
-                    return false;
-                }
+            cards.pop_front();
+            bottomKey++;
+        }
+        while (!cards.empty() && cards.front().UUID == -1) {
+            tombstones--;
+            cards.pop_front();
+            bottomKey++;
+        }
+    }
+
+    bool Stack::Erase(const std::vector<CardInstance>& cardsToErase) {
+        if (!indexed) {
+            Reindex();
+        }
+
+        std::vector<int> positions;
+        positions.reserve(cardsToErase.size());
+        for (auto& card : cardsToErase) {
+            auto key = keys.find(card.UUID);
+            if (key == keys.end()) {
+                return false;
             }
-            else if (currentMatcher->type == CardMatcherType::REST)
-            {
+            positions.push_back(key->second - bottomKey);
+        }
+        std::sort(positions.begin(), positions.end());
+        if (std::adjacent_find(positions.begin(), positions.end()) != positions.end()) {
+            return false;
+        }
 
-                // ending on a match rest, means by definition we are matching whatever is left in the stack
-                if (currentMatcher+1 == matchersEnd)
-                {
-                    return true;
-                }
+        for (int position : positions) {
+            keys.erase(cards[position].UUID);
+            cards[position] = CardInstance();
+        }
+        tombstones += (int) positions.size();
 
-                currentMatcher++;
-                bool foundMatchingCardForNextMatcher = false;
-                while (!foundMatchingCardForNextMatcher && currentCard != cardsEnd)
-                {
-                    if (currentMatcher->type == CardMatcherType::REST)
-                    {
-                        throw VMError("Cannot match sequence. Cannot have two consecutive REST matchers");
-                    }
+        // the ends are never tombstones
+        while (!cards.empty() && cards.back().UUID == -1) {
+            tombstones--;
+            cards.pop_back();
+        }
+        while (!cards.empty() && cards.front().UUID == -1) {
+            tombstones--;
+            cards.pop_front();
+            bottomKey++;
+        }
 
-                    if (currentMatcher->type == CardMatcherType::ANY || currentMatcher->id == currentCard->ID)
-                    {
-                        foundMatchingCardForNextMatcher = true;
-                    }
-                    else
-                    {
-                        currentCard++;
-                    }
-                }
+        // a stack that's mostly tombstones is compacted, which is O(n) once every n erased cards
+        if (tombstones > Size()) {
+            Compact();
+        }
+
+        return true;
+    }
+
+    void Stack::Compact() const {
+        if (tombstones == 0) {
+            return;
+        }
+        cards.erase(std::remove_if(cards.begin(), cards.end(), [](const CardInstance& card) {
+            return card.UUID == -1;
+        }), cards.end());
+        tombstones = 0;
+        // only stacks that are indexed have tombstones
+        Reindex();
+    }
+
+    void Stack::Reindex() const {
+        keys.clear();
+        bottomKey = 0;
+        for (int i = 0; i < (int) cards.size(); i++) {
+            keys[cards[i].UUID] = i;
+        }
+        indexed = true;
+    }
+
+    CardSequence::CardSequence(const std::vector<CardMatcher>& matchers) : resolved(true) {
+        bool gap = false;
+        for (auto& matcher : matchers) {
+            if (matcher.type == CardMatcherType::REST) {
+                gap = true;
+                continue;
+            }
+            if (length == MAX_MATCHERS) {
+                throw VMError("Cannot match sequence. Card sequences can have at most 64 cards");
+            }
+
+            uint64_t bit = uint64_t(1) << length;
+            if (gap) {
+                gapMask |= bit;
+                gap = false;
+            }
 
-                if (!foundMatchingCardForNextMatcher)
-                {
-                    return false;
+            if (matcher.type == CardMatcherType::ANY) {
+                anyMask |= bit;
+            }
+            else if (matcher.type == CardMatcherType::ID) {
+                if (matcher.id < 0) {
+                    resolved = false;
+                }
+                else {
+                    if (matcher.id >= (int) idMasks.size()) {
+                        idMasks.resize(matcher.id + 1, 0);
+                    }
+                    idMasks[matcher.id] |= bit;
                 }
             }
-            else
-            {
+            else {
                 throw VMError("Cannot match sequence. Encountered Unsupported card matcher type");
             }
 
-            currentMatcher++;
-            currentCard++;
+            lastMatcher = bit;
+            length++;
         }
+    }
 
-        return true;
+    bool Stack::MatchesSequence(const CardSequence& sequence, bool searchBottomUp/*=false*/) const {
+        Compact();
+        // the top of the stack is the back of cards
+        if (searchBottomUp) {
+            return sequence.Matches(cards.begin(), cards.end());
+        }
+        return sequence.Matches(cards.rbegin(), cards.rend());
+    }
+
+    bool Stack::MatchesSequence(const std::vector<CardMatcher>& sequence, bool searchBottomUp/*=false*/) const {
+        return MatchesSequence(CardSequence(sequence), searchBottomUp);
     }
 }
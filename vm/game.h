@@ -3,12 +3,16 @@
 
 #pragma once
 
+#include <cstdint>
+#include <deque>
 #include <memory>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
 #include "../expression.h"
+#include "random.h"
 
 
 namespace Battler {
@@ -16,6 +20,7 @@ namespace Battler {
 
 
 class Card;
+class CardInstance;
 class AttributeContainer;
 
 enum class AttributeType {INT, FLOAT, STRING, BOOL, CARD_REF, STACK_REF, PLAYER, PLAYER_REF, PHASE_REF, STACK_POSITION_REF, CARD_SEQUENCE, UNDEFINED};
@@ -26,6 +31,41 @@ using std::endl;
 using std::vector;
 using std::string;
 
+// An interned identifier. Every name the compiler sees is interned once, and the compiler, VM and
+// game model refer to it by its symbol from then on.
+typedef int Symbol;
+const Symbol NO_SYMBOL = -1;
+
+// Names the VM uses itself. Every symbol table starts with them, in this order.
+const Symbol OWNER_ID_SYMBOL = 0;
+const Symbol CURRENT_PLAYER_SYMBOL = 1;
+const Symbol FROM_SYMBOL = 2;
+const Symbol TO_SYMBOL = 3;
+const Symbol P_SYMBOL = 4;
+const Symbol INDEX_STORE_SYMBOL = 5;
+const Symbol TOP_SYMBOL = 6;
+const Symbol BOTTOM_SYMBOL = 7;
+const Symbol SIZE_SYMBOL = 8;
+
+class SymbolTable {
+    public:
+        SymbolTable();
+
+        // returns the symbol of name, interning it first if it's new
+        Symbol Intern(std::string_view name);
+
+        // returns the symbol of name, or NO_SYMBOL if it was never interned
+        Symbol Find(std::string_view name) const;
+
+        const std::string& Name(Symbol symbol) const {return names[symbol];}
+
+        size_t size() const {return names.size();}
+
+    private:
+        std::vector<std::string> names;
+        std::unordered_map<std::string, Symbol> symbols;
+};
+
 class OperationError {
     public:
         std::string reason;
@@ -51,43 +91,150 @@ public:
     int id;
 };
 
+// A card sequence such as [A B : C _], compiled into a bit-parallel automaton. Bit j of a state
+// stands for the j-th card matcher, RESTs aren't matchers of their own but a gap before the next
+// one, so a sequence is read in a single pass over the cards however many RESTs it has.
+class CardSequence {
+public:
+    static const int MAX_MATCHERS = 64;
+
+    CardSequence() {}
+    explicit CardSequence(const std::vector<CardMatcher>& matchers);
+
+    // false until the sequence is compiled from matchers that all name declared cards
+    bool Resolved() const {return resolved;}
+
+    // whether the cards, read from card onwards, start with this sequence
+    template <class Iterator>
+    bool Matches(Iterator card, Iterator end) const {
+        if (length == 0) {
+            return true;
+        }
+
+        uint64_t first = 1; // only the first card can be matched by the first matcher, unless a gap precedes it
+        uint64_t current = 0; // the matchers the last card matched
+        uint64_t waiting = gapMask & 1; // the matchers after a gap, whose previous matchers have all matched
+        for (; card != end; ++card) {
+            uint64_t accepting = anyMask;
+            if (card->ID >= 0 && card->ID < (int) idMasks.size()) {
+                accepting |= idMasks[card->ID];
+            }
+
+            current = ((current << 1) | first | waiting) & accepting;
+            if (current & lastMatcher) {
+                return true;
+            }
+            waiting |= (current << 1) & gapMask;
+            first = 0;
+
+            if (current == 0 && waiting == 0) {
+                return false;
+            }
+        }
+
+        return false;
+    }
+
+private:
+    int length{0};
+    bool resolved{false};
+    uint64_t anyMask{0};
+    uint64_t gapMask{0}; // matchers with a REST before them
+    uint64_t lastMatcher{0};
+    std::vector<uint64_t> idMasks; // card ID -> the matchers that match it
+};
+
+// a card's position in a stack, counted from the bottom
+struct StackPosition {
+    int stack;
+    int index;
+};
+
+class Game;
+
+// A tagged value. Anything bigger than a word lives in a side table and the value holds its
+// handle, so values are cheap to copy around the VM.
 class Attr {
     public:
-        Attr() {}
+        Attr() : type(AttributeType::UNDEFINED) {}
         Attr(AttributeType t) : type(t) {}
         AttributeType type;
-        std::string s;
-        int stackRef;
-        std::tuple<int, int> stackPositionRef;
-        std::string cardRef;
-        std::string phaseRef;
-        std::vector<CardMatcher> cardSquence;
-        
+
         union {
-            int i{0};
+            StackPosition stackPositionRef{0, 0};
+            int i;
             bool b;
             float f;
             int playerRef;
+            int stackRef;
+            int cardRef; // card ID
+            Symbol phaseRef;
+            Symbol s; // strings are interned in the game's symbol table
+            int cardSequence; // index into the program's card sequence table
         };
 
-        std::string ToString();
+        // names, cards and phases are printed by name, the game holds them
+        std::string ToString(const Game& game) const;
+};
+
+static_assert(sizeof(Attr) <= 16, "Attr should fit in two words");
+static_assert(std::is_trivially_copyable<Attr>::value, "Attr should be copyable with memcpy");
+
+// The layout of an attribute container: which names it holds and the slot each one's value is in.
+// Containers that declared the same names in the same order share a shape, so a card's instances
+// and every card that only overrides its parent's attributes share their parent's. Shapes form a
+// tree rooted at the empty shape, and are never freed.
+class Shape {
+    public:
+        static const Shape* Empty();
+
+        // returns the slot of name, or -1 if this shape doesn't have it
+        int Find(Symbol name) const;
+
+        // returns the shape with name appended to this one's names
+        const Shape* With(Symbol name) const;
+
+        const std::vector<Symbol>& Names() const {return names;}
+
+    private:
+        Shape() {}
+
+        // past this many names, Find uses the index instead of scanning names
+        static const size_t LINEAR_SEARCH_LIMIT = 8;
+
+        std::vector<Symbol> names;
+        std::unordered_map<Symbol, int> index;
+        mutable std::unordered_map<Symbol, std::unique_ptr<Shape>> transitions;
 };
 
 class AttrCont {
     public:
+        AttrCont() : shape(Shape::Empty()) {}
+
+        bool Contains(Symbol name) const {return shape->Find(name) != -1;}
+
+        // returns the attribute called name, or nullptr if there isn't one
+        Attr* Find(Symbol name) {
+            int slot = shape->Find(name);
+            return slot == -1 ? nullptr : &values[slot];
+        }
 
-        bool Contains(std::string name);
+        void Store(Symbol name, Attr a);
 
-        void Store(std::string name, Attr a);
+        // returns the attribute called name, adding an undefined one if there isn't one yet
+        Attr& Get(Symbol name);
 
-        Attr& Get(std::string name);
+        const Shape* GetShape() const {return shape;}
 
-        std::unordered_map<std::string, Attr>& GetAttrs() {return attrs;};
+        // values in slot order, see Shape
+        std::vector<Attr>& Values() {return values;}
+        const std::vector<Attr>& Values() const {return values;}
 
-        std::string ToString(std::string prefix = "");
+        std::string ToString(const Game& game, std::string prefix = "") const;
 
     private:
-        std::unordered_map<std::string, Attr> attrs;
+        const Shape* shape;
+        std::vector<Attr> values;
 };
 
 class Stack {
@@ -95,23 +242,82 @@ class Stack {
         Stack();
         int ID;
         StackType t;
-        std::vector<Card>  cards;
         AttrCont attributes;
 
-        bool MatchesSequence(std::vector<CardMatcher> sequence, bool searchBottomUp=false);
+        // the top of the stack is the back. Only the functions below change it, so the UUID index
+        // stays in sync with it
+        const std::deque<CardInstance>& Cards() const {
+            if (tombstones != 0) {
+                Compact();
+            }
+            return cards;
+        }
+
+        // the number of cards, without closing the gaps Erase left like Cards() does
+        int Size() const {return (int) cards.size() - tombstones;}
+        bool Empty() const {return Size() == 0;}
+
+        // In the sequence [A B C D], A compares to the top of the stack, and D the bottom. Searching
+        // bottom up compares [D C B A] instead, with D compared to the top card
+        bool MatchesSequence(const CardSequence& sequence, bool searchBottomUp=false) const;
+        bool MatchesSequence(const std::vector<CardMatcher>& sequence, bool searchBottomUp=false) const;
+
+        // the position of the card with this UUID counted from the bottom, or -1 if it isn't here
+        int PositionOf(int UUID) const;
+
+        // puts newCards on the top or the bottom of the stack, in the order they're in
+        void Insert(bool top, const std::vector<CardInstance>& newCards);
+
+        void EraseTop(int n);
+        void EraseBottom(int n);
+
+        // removes the cards with the same UUIDs as these. Returns false and leaves the stack alone if
+        // any of them isn't here. It's O(k log k) in the number of cards erased, the gaps they leave
+        // are closed the next time something reads Cards(), which is O(n) in the size of the stack
+        bool Erase(const std::vector<CardInstance>& cardsToErase);
+
+    private:
+        friend class Game; // to give the cards their own attributes, see Game::WritableAttributes
+
+        // Cards erased from the middle of the stack leave a tombstone, a card with UUID -1, so the
+        // cards around them don't move. There are never tombstones at either end
+        mutable std::deque<CardInstance> cards;
+        mutable int tombstones{0};
+
+        // UUID -> key, a card's index in cards is its key - bottomKey. The index is only built the
+        // first time a card is looked up, so stacks whose cards only come and go at the ends never
+        // pay for it
+        mutable std::unordered_map<int, int> keys;
+        mutable int bottomKey{0};
+        mutable bool indexed{false};
+
+        // closes the gaps tombstones leave
+        void Compact() const;
+        void Reindex() const;
 };
 
 class Card {
     public:
-        Card() : UUID(-1), parentID(-1) {}
+        Card() : UUID(-1), parentID(-1), name(NO_SYMBOL), parentName(NO_SYMBOL) {}
         int UUID; // unique istance ID
         int ID; // NOT unique per istance, EG, if you have 4x queen of hearts, they will all have the same ID
         int parentID;
-        std::string name;
-        std::string parentName;
+        Symbol name;
+        Symbol parentName;
         AttrCont attributes;
 };
 
+// A card in play. An instance reads its attributes from its card, and only gets attributes of its
+// own once one of them is written, see Game::WritableAttributes.
+class CardInstance {
+    public:
+        CardInstance() : UUID(-1), ID(-1) {}
+        CardInstance(int UUID, int ID) : UUID(UUID), ID(ID) {}
+        int UUID;
+        int ID; // the ID of the card this is an instance of
+        std::shared_ptr<AttrCont> overrides; // shared between copies until one of them writes to it
+};
+
 class Player {
     public:
         int ID;
@@ -133,11 +339,15 @@ class Game {
         int ID;
         std::string name;
         AttrCont attributeCont;
-        std::unordered_map<std::string, Phase> phases;
-        std::unordered_map<std::string, Card> cards;
-        std::unordered_map<int, Stack> stacks;
+        SymbolTable symbols;
+        std::unordered_map<Symbol, Phase> phases;
+        std::vector<Card> cards; // indexed by card ID
+        std::unordered_map<Symbol, int> cardIDs; // card name -> ID, to resolve names
+        std::vector<Stack> stacks; // indexed by stack ID
+        std::vector<vector<int>> cardClasses; // card ID -> IDs of the concrete cards of that class
         std::unordered_map<std::string, int> playerBindings;
         std::vector<Player> players;
+        Random random; // everything random in the game draws from this
         Expression setup; // old tree walk mode
         Expression turn; // old tree walk mode
         int currentPlayerIndex;
@@ -145,11 +355,32 @@ class Game {
 
         void Print();
 
-        vector<Card> get_cards_of_type(string type);
+        // indexes every card's concrete (childless) descendants, through any number of levels of
+        // inheritance. A concrete card is the only member of its own class
+        void IndexCardClasses();
+
+        // the IDs of the concrete cards of the class with this ID
+        const vector<int>& CardsOfClass(int cardID);
 
         int m_currentCardUUID;
 
-        Card GenerateCard(string name);
+        CardInstance GenerateCard(int cardID);
+
+        // returns the ID of the card called name, or -1 if there isn't one
+        int FindCard(Symbol name) const;
+
+        Card& CardOf(const CardInstance& instance) {return cards[instance.ID];}
+
+        // an instance's attributes, for reading
+        AttrCont& Attributes(const CardInstance& instance);
+
+        // an instance's attributes, for writing. This gives the instance its own copy of them if it
+        // was still sharing them
+        AttrCont& WritableAttributes(CardInstance& instance);
+        AttrCont& WritableAttributes(Stack& stack, int position) {
+            stack.Compact();
+            return WritableAttributes(stack.cards[position]);
+        }
 };
 
 }
@@ -0,0 +1,72 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstdint>
+#include <cstddef>
+
+namespace Battler {
+
+// A xoshiro256** generator. Every game owns one, so programs running on different threads don't
+// share any state, and a game replays exactly when it's given the same seed.
+class Random {
+    public:
+        static const uint64_t DEFAULT_SEED = 0x853c49e6748fea9bULL;
+
+        explicit Random(uint64_t seed = DEFAULT_SEED) { Seed(seed); }
+
+        // the state is expanded from the seed with splitmix64, as xoshiro's authors recommend
+        void Seed(uint64_t seed) {
+            for (int i = 0; i < 4; i++) {
+                seed += 0x9e3779b97f4a7c15ULL;
+                uint64_t z = seed;
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+                s[i] = z ^ (z >> 31);
+            }
+        }
+
+        uint64_t Next() {
+            uint64_t result = rotl(s[1] * 5, 7) * 9;
+            uint64_t t = s[1] << 17;
+
+            s[2] ^= s[0];
+            s[3] ^= s[1];
+            s[1] ^= s[2];
+            s[0] ^= s[3];
+            s[2] ^= t;
+            s[3] = rotl(s[3], 45);
+
+            return result;
+        }
+
+        // a uniformly distributed number in [0, bound). Lemire's multiply and reject method, so
+        // there's no modulo bias and usually no division
+        uint32_t Below(uint32_t bound) {
+            uint64_t m = (Next() >> 32) * bound;
+            uint32_t low = (uint32_t) m;
+            if (low < bound) {
+                uint32_t threshold = (0u - bound) % bound;
+                while (low < threshold) {
+                    m = (Next() >> 32) * bound;
+                    low = (uint32_t) m;
+                }
+            }
+            return (uint32_t) (m >> 32);
+        }
+
+        // fills out with n numbers in [0, bound)
+        void Below(uint32_t bound, uint32_t* out, size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                out[i] = Below(bound);
+            }
+        }
+
+    private:
+        static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+        uint64_t s[4];
+};
+
+}
+
+#endif // !RANDOM_H